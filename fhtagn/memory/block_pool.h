@@ -36,6 +36,7 @@
 #include <fhtagn/memory/memory_pool.h>
 #include <fhtagn/memory/common.h>
 #include <fhtagn/threads/lock_policy.h>
+#include <fhtagn/threads/atomic.h>
 
 namespace fhtagn {
 namespace memory {
@@ -52,6 +53,19 @@ namespace memory {
  * Like the fixed_pool class, it allocates from memory handed to it's
  * constructor, and like the fixed_pool class it tries to return only memory
  * aligned at some definable block boundary.
+ *
+ * Allocation state is kept in a bitmap with one bit per block, and a summary
+ * bitmap with one bit per bitmap word that is set if the word is full. Free
+ * blocks are found with a bit scan on the summary and the bitmap word it
+ * points to, starting at the word that was last allocated from or freed to,
+ * so allocation time stays close to constant even for large, mostly full
+ * pools.
+ *
+ * Blocks are laid out back to back, so only the first block is guaranteed to
+ * be aligned unless BLOCK_SIZE is a multiple of the alignment's block size.
+ * Use an alignment that pads objects, such as cache_line_padding (see
+ * utility.h), to align every block and keep blocks handed to different
+ * threads on separate cache lines.
  **/
 template <
   fhtagn::size_t BLOCK_SIZE,
@@ -104,20 +118,183 @@ public:
   inline bool in_use() const;
   inline fhtagn::size_t alloc_size(void * ptr) const;
 
+  /**
+   * Returns true if ptr points into the data part of the memory block, i.e.
+   * if it may have been allocated from this pool. Used e.g. by fallback_pool
+   * (see fallback_pool.h) to route pointers to the pool that owns them.
+   **/
+  inline bool owns(void * ptr) const;
+
+  /**
+   * Bulk API - see memory_pool.h for details. alloc_bulk() claims all free
+   * bits of a bitmap word at once, rather than one bit per call.
+   **/
+  inline fhtagn::size_t alloc_bulk(fhtagn::size_t size, fhtagn::size_t count,
+      void ** ptrs);
+  inline void free_bulk(void ** ptrs, fhtagn::size_t count);
+
+  /**
+   * Returns the mutex guarding this pool, e.g. to read the lock contention
+   * count of a contention_counting_mutex (see statistics.h).
+   **/
+  inline mutex_t & mutex() const;
+
 private:
 
   enum {
     BITS_PER_SIZE_T = sizeof(fhtagn::size_t) * 8,
+
+    /**
+     * Distance between blocks in memory, see object_stride in utility.h.
+     **/
+    BLOCK_STRIDE = object_stride<BLOCK_SIZE, block_alignmentT>::value,
   };
 
+  /**
+   * Returns the index of a m_metadata word with at least one free bit. Must
+   * only be called with the mutex held, and if m_used < m_size.
+   **/
+  inline fhtagn::size_t find_free_word();
+
+  /**
+   * Marks the block ptr points to as free. Must only be called with the mutex
+   * held.
+   **/
+  inline void free_unlocked(void * ptr);
+
+  /**
+   * Returns the number of size_t words needed for a bitmap of count bits.
+   **/
+  static inline fhtagn::size_t words_for(fhtagn::size_t count);
+
+  /**
+   * Returns the size of metadata needed to manage count blocks. If the
+   * summary fits into a single word, it's kept in m_inline_summary instead of
+   * the memory block, so it does not count towards the metadata size.
+   **/
+  static inline fhtagn::size_t metadata_size(fhtagn::size_t count);
+
+  /**
+   * Returns the summary bitmap, one bit per m_metadata word, set if that word
+   * is full.
+   **/
+  inline fhtagn::size_t * summary();
+
   void *            m_memblock;
-  fhtagn::size_t *  m_metadata;
-  fhtagn::size_t    m_size;
+  fhtagn::size_t *  m_metadata;       // One bit per block, set if allocated.
+  fhtagn::size_t *  m_summary;        // Summary in the memory block, or NULL.
+  fhtagn::size_t    m_inline_summary;
+  fhtagn::size_t    m_size;           // Number of blocks.
+  fhtagn::size_t    m_summary_size;   // Number of summary words.
+  fhtagn::size_t    m_hint;           // m_metadata word to try first.
+  fhtagn::size_t    m_used;           // Number of blocks allocated.
 
   mutable mutex_t   m_mutex;
 };
 
 
+
+/**
+ * Lock-free specialization of block_pool, selected by passing
+ * fhtagn::threads::lock_free as the mutexT parameter.
+ *
+ * alloc() and free() are safe to call concurrently from multiple threads,
+ * without acquiring a mutex: allocation state is kept in a bitmap with one bit
+ * per block, which is modified with atomic compare-and-swap operations on
+ * whole bitmap words. A counter of allocated blocks is reserved before the
+ * bitmap is searched, so an allocation from a full pool fails without
+ * scanning, and an allocation that got a reservation is guaranteed to find a
+ * free block.
+ *
+ * Unlike the generic block_pool, there is no summary bitmap; the search for a
+ * free block starts at the bitmap word last allocated from or freed to, and
+ * scans subsequent words from there.
+ **/
+template <
+  fhtagn::size_t BLOCK_SIZE,
+  typename block_alignmentT,
+  template <typename> class adoption_policyT
+>
+class block_pool<BLOCK_SIZE, fhtagn::threads::lock_free, block_alignmentT,
+      adoption_policyT>
+  : public adoption_policyT<char>
+{
+public:
+  /**
+   * Convenience typedefs
+   **/
+  typedef fhtagn::threads::lock_free  mutex_t;
+  typedef block_alignmentT            block_alignment_t;
+
+  /**
+   * Explicit subtypes of this pool type that adopt the memory block handed to
+   * them or not.
+   **/
+  typedef block_pool<
+    BLOCK_SIZE,
+    fhtagn::threads::lock_free,
+    block_alignmentT,
+    fhtagn::memory::ignore_array_policy
+  > with_ignore_policy_t;
+
+  typedef block_pool<
+    BLOCK_SIZE,
+    fhtagn::threads::lock_free,
+    block_alignmentT,
+    fhtagn::memory::adopt_array_policy
+  > with_adopt_policy_t;
+
+
+  /**
+   * See block_pool above.
+   **/
+  inline block_pool(void * memblock, fhtagn::size_t size);
+
+  /**
+   * API - see memory_pool.h for details
+   **/
+  inline void * alloc(fhtagn::size_t size);
+  inline void * realloc(void * ptr, fhtagn::size_t new_size);
+  inline void free(void * ptr);
+  inline bool in_use() const;
+  inline fhtagn::size_t alloc_size(void * ptr) const;
+
+  /**
+   * See block_pool above.
+   **/
+  inline bool owns(void * ptr) const;
+
+  /**
+   * Bulk API - see memory_pool.h for details. alloc_bulk() reserves the whole
+   * batch with a single atomic operation, and claims as many free bits per
+   * compare-and-swap as it still needs.
+   **/
+  inline fhtagn::size_t alloc_bulk(fhtagn::size_t size, fhtagn::size_t count,
+      void ** ptrs);
+  inline void free_bulk(void ** ptrs, fhtagn::size_t count);
+
+private:
+
+  enum {
+    BITS_PER_SIZE_T = sizeof(fhtagn::size_t) * 8,
+
+    /**
+     * Distance between blocks in memory, see object_stride in utility.h.
+     **/
+    BLOCK_STRIDE = object_stride<BLOCK_SIZE, block_alignmentT>::value,
+  };
+
+  void *                      m_memblock;
+  fhtagn::size_t volatile *   m_metadata;   // One bit per block, set if
+                                            // allocated.
+  fhtagn::size_t              m_size;       // Number of blocks.
+  fhtagn::size_t              m_words;      // Number of m_metadata words.
+  fhtagn::size_t volatile     m_hint;       // m_metadata word to try first.
+  fhtagn::size_t volatile     m_used;       // Number of blocks allocated or
+                                            // reserved.
+};
+
+
 }} // namespace fhtagn::memory
 
 #include <fhtagn/memory/detail/block_pool.tcc>
@@ -0,0 +1,244 @@
+/**
+ * $Id$
+ *
+ * This file is part of the Fhtagn! C++ Library.
+ * Copyright (C) 2009 Jens Finkhaeuser <unwesen@users.sourceforge.net>.
+ *
+ * Author: Jens Finkhaeuser <unwesen@users.sourceforge.net>
+ *
+ * This program is licensed as free software for personal, educational or
+ * other non-commerical uses: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation, either version 3 of the License, or (at your
+ * option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Alternatively, licenses for commercial purposes are available as well.
+ * Please send your enquiries to the copyright holder's address above.
+ **/
+#ifndef FHTAGN_MEMORY_DEBUG_POOL_H
+#define FHTAGN_MEMORY_DEBUG_POOL_H
+
+#ifndef __cplusplus
+#error You are trying to include a C++ only header file
+#endif
+
+#include <fhtagn/fhtagn.h>
+
+#include <fhtagn/memory/utility.h>
+#include <fhtagn/memory/memory_pool.h>
+#include <fhtagn/threads/lock_policy.h>
+
+namespace fhtagn {
+namespace memory {
+
+/**
+ * The debug_pool class wraps a MemoryPool, and adds checks that help pin down
+ * heap corruption, at a cost that's proportional to the amount of memory
+ * allocated and freed rather than to the amount of memory accessed:
+ *
+ * - Each allocation is surrounded by GUARD_SIZE bytes of guard pattern on
+ *   either side. The guards are checked when the allocation is freed, which
+ *   detects buffer under- and overruns. The trailing guard starts right after
+ *   the requested size, so even single byte overruns are caught.
+ *
+ * - New allocations are filled with ALLOC_PATTERN, so reads of uninitialized
+ *   memory return recognizable values.
+ *
+ * - Freed allocations are filled with FREE_PATTERN, and held in a FIFO
+ *   quarantine of QUARANTINE_SIZE entries before they're returned to the
+ *   wrapped pool. When an allocation leaves the quarantine, the pattern is
+ *   checked; writes through dangling pointers while the allocation was
+ *   quarantined are detected that way. Freeing a quarantined pointer again is
+ *   detected as a double free.
+ *
+ * - verify() checks the guards of all live allocations, and the pattern of
+ *   all quarantined ones, on demand.
+ *
+ * Any corruption found is reported by throwing std::logic_error with a
+ * description of the problem and the address of the affected allocation.
+ *
+ * realloc() always moves the allocation, so that stale pointers to the old
+ * location end up in the quarantine.
+ *
+ * Each allocation requests an additional header plus 2 * GUARD_SIZE bytes
+ * from the wrapped pool, so pools that only serve a fixed size, such as
+ * block_pool, need to be sized accordingly.
+ *
+ * Like throw_pool, debug_pool does not own the wrapped pool. It does keep
+ * state of it's own - the list of live allocations and the quarantine - which
+ * is protected by mutexT. The destructor releases quarantined memory to the
+ * wrapped pool without checking it; call flush() beforehand for a final check.
+ **/
+template <
+  typename memory_poolT,
+  fhtagn::size_t QUARANTINE_SIZE = 64,
+  fhtagn::size_t GUARD_SIZE = 16,
+  typename mutexT = fhtagn::threads::fake_mutex,
+  typename block_alignmentT = block_alignment<>
+>
+class debug_pool
+{
+public:
+  BOOST_CLASS_REQUIRE(memory_poolT, ::fhtagn::memory::concepts,
+      MemoryPoolConcept);
+
+  /**
+   * Convenience typedefs
+   **/
+  typedef mutexT            mutex_t;
+  typedef block_alignmentT  block_alignment_t;
+
+  enum {
+    GUARD_PATTERN = 0xfd,
+    ALLOC_PATTERN = 0xcd,
+    FREE_PATTERN  = 0xdd,
+  };
+
+  inline debug_pool(memory_poolT & pool);
+  inline ~debug_pool();
+
+  /**
+   * API - see memory_pool.h for details. alloc_size() returns the size that
+   * was requested, as that's all the caller may safely use.
+   **/
+  inline void * alloc(fhtagn::size_t size);
+  inline void * realloc(void * ptr, fhtagn::size_t new_size);
+  inline void free(void * ptr);
+  inline bool in_use() const;
+  inline fhtagn::size_t alloc_size(void * ptr) const;
+
+  /**
+   * Checks the guards of all live allocations and the fill pattern of all
+   * quarantined allocations, and throws std::logic_error on the first
+   * corruption found.
+   **/
+  inline void verify() const;
+
+  /**
+   * Checks all quarantined allocations like verify() does, and returns them
+   * to the wrapped pool.
+   **/
+  inline void flush();
+
+  /**
+   * Number of live allocations, and number of freed allocations currently
+   * held in the quarantine.
+   **/
+  inline fhtagn::size_t live() const;
+  inline fhtagn::size_t quarantined() const;
+
+  /**
+   * Returns the mutex guarding this pool, e.g. to read the lock contention
+   * count of a contention_counting_mutex (see statistics.h).
+   **/
+  inline mutex_t & mutex() const;
+
+private:
+
+  /**
+   * Header in front of each allocation. Live allocations are kept in a
+   * doubly linked list for verify().
+   **/
+  struct header
+  {
+    enum {
+      ALLOCATED = 0xa110ca7e,
+      FREED     = 0xdeadf1ee,
+    };
+
+    header *        prev;
+    header *        next;
+    fhtagn::size_t  size;
+    fhtagn::size_t  state;
+
+    static inline fhtagn::size_t header_size()
+    {
+      return block_alignmentT::adjust_size(sizeof(header))
+        + block_alignmentT::adjust_size(GUARD_SIZE);
+    }
+
+    inline char * data()
+    {
+      return pointer(this).char_ptr + header_size();
+    }
+
+    inline char * front_guard()
+    {
+      return data() - GUARD_SIZE;
+    }
+
+    inline char * back_guard()
+    {
+      return data() + size;
+    }
+
+    inline fhtagn::size_t total_size() const
+    {
+      return header_size() + size + GUARD_SIZE;
+    }
+  };
+
+  /**
+   * Returns the header for a pointer handed out by alloc(), or throws if
+   * there's no valid header.
+   **/
+  inline header * header_for(void * ptr) const;
+
+  /**
+   * Throws if the guards around the allocation are damaged.
+   **/
+  inline void check_guards(header * hdr) const;
+
+  /**
+   * Returns true if a quarantined allocation was not written to since it was
+   * freed.
+   **/
+  inline bool freed_intact(header * hdr) const;
+
+  /**
+   * Throws std::logic_error with the given problem description.
+   **/
+  inline void report(char const * problem, void * ptr) const;
+
+  /**
+   * Returns a quarantined allocation to the wrapped pool, and throws if check
+   * is set and the allocation was written to. release_oldest() does the same
+   * for the oldest allocation in the quarantine, after removing it from
+   * there. Must be called with the mutex held.
+   **/
+  inline void release(header * hdr, bool check);
+  inline void release_oldest(bool check);
+
+  /**
+   * Returns true if the size bytes at ptr all have the given value.
+   **/
+  static inline bool is_filled(char const * ptr, fhtagn::size_t size,
+      int value);
+
+  enum {
+    QUARANTINE_SLOTS = QUARANTINE_SIZE ? QUARANTINE_SIZE : 1,
+  };
+
+  memory_poolT &    m_pool;
+  header *          m_live;
+  fhtagn::size_t    m_live_count;
+  header *          m_quarantine[QUARANTINE_SLOTS];
+  fhtagn::size_t    m_quarantine_head;    // Oldest entry
+  fhtagn::size_t    m_quarantine_count;
+  mutable mutex_t   m_mutex;
+};
+
+
+}} // namespace fhtagn::memory
+
+#include <fhtagn/memory/detail/debug_pool.tcc>
+
+#endif // guard
@@ -132,8 +132,8 @@ inline bool operator==(
     allocator<T, allocation_policyT, object_traitsT> const & rhs)
 {
   return operator==(
-      static_cast<allocation_policyT &>(lhs),
-      static_cast<allocation_policyT &>(rhs));
+      static_cast<allocation_policyT const &>(lhs),
+      static_cast<allocation_policyT const &>(rhs));
 }
 
 
@@ -151,8 +151,8 @@ inline bool operator==(
     allocator<T2, allocation_policyT2, object_traitsT2> const & rhs)
 {
   return operator==(
-      static_cast<allocation_policyT1 &>(lhs),
-      static_cast<allocation_policyT2 &>(rhs));
+      static_cast<allocation_policyT1 const &>(lhs),
+      static_cast<allocation_policyT2 const &>(rhs));
 }
 
 
@@ -166,7 +166,7 @@ inline bool operator==(
     allocator<T, allocation_policyT, object_traitsT> const & lhs,
     other_allocatorT const & rhs)
 {
-  return operator==(static_cast<allocation_policyT &>(lhs), rhs);
+  return operator==(static_cast<allocation_policyT const &>(lhs), rhs);
 }
 
 
@@ -30,9 +30,11 @@
 #error You are trying to include a C++ only header file
 #endif
 
+#include <string.h>
+
+#include <algorithm>
 #include <sstream>
 #include <stdexcept>
-#include <cmath>
 
 namespace fhtagn {
 namespace memory {
@@ -68,40 +70,137 @@ block_pool<BLOCK_SIZE, mutexT, block_alignmentT, adoption_policyT>::block_pool(
   m_memblock = adjusted_start;
 
   // Now that the memory block we're using is aligned and sized, figure out
-  // how much of it we'll be using for metadata. We'll use a fairly primitve
-  // algorithm to figure that out:
-  // 1. Assume all of the block is for data.
-  // 2. Calculate the size of metadata we'd need if we wanted to manage this
-  //    assumed amount of data.
-  // 3. While the sum of metadata size and assumed data size is larger than
-  //    the memory block's size, reduce the assumed data size by one BLOCK_SIZE,
-  //    and repeat at 2.
-
-  // Count the assumed data in units of BLOCK_SIZE.
-  fhtagn::size_t assumed_size = adjusted_size / BLOCK_SIZE;
-  fhtagn::size_t remainder = adjusted_size - (assumed_size * BLOCK_SIZE);
-  fhtagn::size_t metadata_size = block_alignment<sizeof(fhtagn::size_t)>::adjust_size(
-      static_cast<fhtagn::size_t>(
-        std::ceil((assumed_size * 8) / float(BITS_PER_SIZE_T))));
-  do {
-    --assumed_size;
-    remainder = adjusted_size - (assumed_size * BLOCK_SIZE);
-    metadata_size = block_alignment<sizeof(fhtagn::size_t)>::adjust_size(
-        static_cast<fhtagn::size_t>(
-          std::ceil((assumed_size * 8) / float(BITS_PER_SIZE_T))));
-  } while (metadata_size > remainder);
-
-  // Throw bad_alloc if we can't split off enough metadata.
-  if (!metadata_size) {
+  // how much of it we'll be using for metadata. Start by assuming all of the
+  // block is for data, and reduce the number of blocks until data and
+  // metadata fit. The metadata is placed behind the data, aligned to size_t.
+  fhtagn::size_t count = adjusted_size / BLOCK_STRIDE;
+  while (count && (block_alignment<sizeof(fhtagn::size_t)>::adjust_size(
+          count * BLOCK_STRIDE) + metadata_size(count) > adjusted_size))
+  {
+    --count;
+  }
+
+  // Throw bad_alloc if we can't fit a single block and it's metadata.
+  if (!count) {
     throw std::bad_alloc();
   }
 
-  // On the assumption that BLOCK_SIZE is a multiple of fhtagn::size_t, we'll place
-  // the metadata behind the data, because that automatically aligns it properly.
-  m_size = assumed_size;
-  m_metadata = reinterpret_cast<fhtagn::size_t *>(
-      pointer(m_memblock).char_ptr + (m_size * BLOCK_SIZE));
-  ::memset(m_metadata, 0, metadata_size);
+  m_size = count;
+  m_summary_size = words_for(words_for(m_size));
+  m_hint = 0;
+  m_used = 0;
+  m_metadata = reinterpret_cast<fhtagn::size_t *>(pointer(m_memblock).char_ptr
+      + block_alignment<sizeof(fhtagn::size_t)>::adjust_size(
+        m_size * BLOCK_STRIDE));
+  m_summary = NULL;
+  m_inline_summary = 0;
+  if (m_summary_size > 1) {
+    m_summary = m_metadata + words_for(m_size);
+  }
+  ::memset(m_metadata, 0, metadata_size(m_size));
+
+  // Bits in the last metadata word beyond the last block are flagged as
+  // allocated, so they're never found by alloc(). The same goes for the
+  // summary bits beyond the last metadata word.
+  fhtagn::size_t last_word = words_for(m_size) - 1;
+  fhtagn::size_t used_bits = m_size % BITS_PER_SIZE_T;
+  if (used_bits) {
+    m_metadata[last_word] = ~fhtagn::size_t(0) << used_bits;
+  }
+
+  used_bits = words_for(m_size) % BITS_PER_SIZE_T;
+  if (used_bits) {
+    summary()[m_summary_size - 1] = ~fhtagn::size_t(0) << used_bits;
+  }
+}
+
+
+
+template <
+  fhtagn::size_t BLOCK_SIZE,
+  typename mutexT,
+  typename block_alignmentT,
+  template <typename> class adoption_policyT
+>
+fhtagn::size_t
+block_pool<BLOCK_SIZE, mutexT, block_alignmentT, adoption_policyT>::words_for(
+    fhtagn::size_t count)
+{
+  return (count + BITS_PER_SIZE_T - 1) / BITS_PER_SIZE_T;
+}
+
+
+
+template <
+  fhtagn::size_t BLOCK_SIZE,
+  typename mutexT,
+  typename block_alignmentT,
+  template <typename> class adoption_policyT
+>
+fhtagn::size_t
+block_pool<BLOCK_SIZE, mutexT, block_alignmentT,
+    adoption_policyT>::metadata_size(fhtagn::size_t count)
+{
+  fhtagn::size_t words = words_for(count);
+  fhtagn::size_t summary_words = words_for(words);
+  if (summary_words <= 1) {
+    summary_words = 0;
+  }
+  return (words + summary_words) * sizeof(fhtagn::size_t);
+}
+
+
+
+template <
+  fhtagn::size_t BLOCK_SIZE,
+  typename mutexT,
+  typename block_alignmentT,
+  template <typename> class adoption_policyT
+>
+fhtagn::size_t *
+block_pool<BLOCK_SIZE, mutexT, block_alignmentT, adoption_policyT>::summary()
+{
+  if (m_summary) {
+    return m_summary;
+  }
+  return &m_inline_summary;
+}
+
+
+
+template <
+  fhtagn::size_t BLOCK_SIZE,
+  typename mutexT,
+  typename block_alignmentT,
+  template <typename> class adoption_policyT
+>
+fhtagn::size_t
+block_pool<BLOCK_SIZE, mutexT, block_alignmentT,
+    adoption_policyT>::find_free_word()
+{
+  // Try the metadata word we last used first. If that's full, find the first
+  // word that is not full via the summary, starting with the summary word
+  // covering the hint and wrapping around.
+  fhtagn::size_t word = m_hint;
+  if (~m_metadata[word]) {
+    return word;
+  }
+
+  fhtagn::size_t * summary_bits = summary();
+  fhtagn::size_t summary_word = word / BITS_PER_SIZE_T;
+  for (fhtagn::size_t i = 0 ; i < m_summary_size ; ++i) {
+    fhtagn::size_t free_words = ~summary_bits[summary_word];
+    if (free_words) {
+      return (summary_word * BITS_PER_SIZE_T)
+        + count_trailing_zeros(free_words);
+    }
+
+    if (++summary_word >= m_summary_size) {
+      summary_word = 0;
+    }
+  }
+
+  return word;
 }
 
 
@@ -126,50 +225,26 @@ block_pool<BLOCK_SIZE, mutexT, block_alignmentT, adoption_policyT>::alloc(
 
   typename mutex_t::scoped_lock lock(m_mutex);
 
-  // Find the segment (described by how many bits fit into a size_t) for the
-  // first free block of memory.
-  fhtagn::size_t * metadata = m_metadata;
-  fhtagn::size_t segment = 0;
-  do {
-    if (*metadata ^ ~fhtagn::size_t(0)) {
-      // Got a metadata where not all bits are set. We can allocate from here!
-      break;
-    }
-
-    ++metadata;
-    ++segment;
-  } while (segment < (m_size / BITS_PER_SIZE_T));
-
-
-  // Within the segment, search backwards (easier/more portable) for a free bit
-  fhtagn::size_t mask = 1;
-  fhtagn::size_t offs = BITS_PER_SIZE_T;
-  do {
-    if (!(*metadata & mask)) {
-      // Got a zero bit, that's the one we want to allocate.
-      break;
-    }
-
-    mask <<= 1;
-    --offs;
-  } while (offs);
-
-  // Translate to index. The offset is (BITS_PER_SIZE_T - offs) because we
-  // searched backwards above.
-  fhtagn::size_t index = (segment * BITS_PER_SIZE_T) + (BITS_PER_SIZE_T - offs);
-
-  // We *may* have more metadata than data, i.e. if we have a number of entries
-  // not divisible by the number of bits in a size_t. So let's first check whether
-  // the index we found is valid before.
-  if (0 > index || index >= m_size) {
-    // Ok, not a valid index, we're out of memory.
+  if (m_used >= m_size) {
+    // Out of memory.
     return NULL;
   }
 
-  // Flag metadata as allocated
-  *metadata |= mask;
+  // As m_used < m_size, there must be a free bit in the word we find.
+  fhtagn::size_t word = find_free_word();
+  fhtagn::size_t offset = count_trailing_zeros(~m_metadata[word]);
+
+  // Flag metadata as allocated, and the word as full in the summary if need be.
+  m_metadata[word] |= fhtagn::size_t(1) << offset;
+  if (!~m_metadata[word]) {
+    summary()[word / BITS_PER_SIZE_T] |=
+      fhtagn::size_t(1) << (word % BITS_PER_SIZE_T);
+  }
+  m_hint = word;
+  ++m_used;
 
-  return pointer(m_memblock).char_ptr + (BLOCK_SIZE * index);
+  fhtagn::size_t index = (word * BITS_PER_SIZE_T) + offset;
+  return pointer(m_memblock).char_ptr + (BLOCK_STRIDE * index);
 }
 
 
@@ -215,28 +290,45 @@ block_pool<BLOCK_SIZE, mutexT, block_alignmentT, adoption_policyT>::free(
   }
 
   typename mutex_t::scoped_lock lock(m_mutex);
+  free_unlocked(ptr);
+}
+
 
+
+template <
+  fhtagn::size_t BLOCK_SIZE,
+  typename mutexT,
+  typename block_alignmentT,
+  template <typename> class adoption_policyT
+>
+void
+block_pool<BLOCK_SIZE, mutexT, block_alignmentT, adoption_policyT>::free_unlocked(
+    void * ptr)
+{
   if (m_memblock > ptr || ptr >= m_metadata) {
     // Invalid pointer, we don't handle it.
     return;
   }
 
-  // Calculate index of the ptr into m_memblock.
+  // Calculate index of the ptr into m_memblock, and translate that into
+  // metadata word and offset.
   fhtagn::size_t index = (pointer(ptr).char_ptr - pointer(m_memblock).char_ptr)
-    / BLOCK_SIZE;
-
-  // Translate that into segment and offset. Note that the offset should really
-  // be (BITS_PER_SIZE_T - (index % BITS_PER_SIZE_T)), but in order to use it
-  // to shift the mask (below), we'd need to invert it yet again.
-  fhtagn::size_t segment = index / BITS_PER_SIZE_T;
-  fhtagn::size_t offset = index % BITS_PER_SIZE_T;
+    / BLOCK_STRIDE;
+  fhtagn::size_t word = index / BITS_PER_SIZE_T;
+  fhtagn::size_t mask = fhtagn::size_t(1) << (index % BITS_PER_SIZE_T);
 
-  fhtagn::size_t mask = 1;
-  mask <<= offset;
+  if (!(m_metadata[word] & mask)) {
+    // Not allocated, nothing to do.
+    return;
+  }
 
-  // Toggle bit for the pointer to mark it free.
-  fhtagn::size_t * metadata = m_metadata + segment;
-  *metadata ^= mask;
+  // Clear the bit for the pointer to mark it free; the word can't be full any
+  // longer. The next allocation might as well use this word.
+  m_metadata[word] &= ~mask;
+  summary()[word / BITS_PER_SIZE_T] &=
+    ~(fhtagn::size_t(1) << (word % BITS_PER_SIZE_T));
+  m_hint = word;
+  --m_used;
 }
 
 
@@ -248,25 +340,102 @@ template <
   template <typename> class adoption_policyT
 >
 bool
-block_pool<BLOCK_SIZE, mutexT, block_alignmentT, adoption_policyT>::in_use() const
+block_pool<BLOCK_SIZE, mutexT, block_alignmentT, adoption_policyT>::owns(
+    void * ptr) const
+{
+  // The memory block and metadata location never change, so there's no need
+  // to lock.
+  return (m_memblock <= ptr && ptr < m_metadata);
+}
+
+
+
+template <
+  fhtagn::size_t BLOCK_SIZE,
+  typename mutexT,
+  typename block_alignmentT,
+  template <typename> class adoption_policyT
+>
+fhtagn::size_t
+block_pool<BLOCK_SIZE, mutexT, block_alignmentT, adoption_policyT>::alloc_bulk(
+    fhtagn::size_t size, fhtagn::size_t count, void ** ptrs)
+{
+  if (!size || !count) {
+    return 0;
+  }
+
+  if (BLOCK_SIZE != size) {
+    return 0;
+  }
+
+  typename mutex_t::scoped_lock lock(m_mutex);
+
+  fhtagn::size_t allocated = 0;
+  while (allocated < count && m_used < m_size) {
+    // Take as many free bits from the word as we need, then flag them all as
+    // allocated in one go.
+    fhtagn::size_t word = find_free_word();
+    fhtagn::size_t free_bits = ~m_metadata[word];
+    fhtagn::size_t taken = 0;
+    while (free_bits && allocated < count) {
+      fhtagn::size_t offset = count_trailing_zeros(free_bits);
+      free_bits &= free_bits - 1;
+      taken |= fhtagn::size_t(1) << offset;
+
+      fhtagn::size_t index = (word * BITS_PER_SIZE_T) + offset;
+      ptrs[allocated++] = pointer(m_memblock).char_ptr + (BLOCK_STRIDE * index);
+      ++m_used;
+    }
+
+    m_metadata[word] |= taken;
+    if (!~m_metadata[word]) {
+      summary()[word / BITS_PER_SIZE_T] |=
+        fhtagn::size_t(1) << (word % BITS_PER_SIZE_T);
+    }
+    m_hint = word;
+  }
+
+  return allocated;
+}
+
+
+
+template <
+  fhtagn::size_t BLOCK_SIZE,
+  typename mutexT,
+  typename block_alignmentT,
+  template <typename> class adoption_policyT
+>
+void
+block_pool<BLOCK_SIZE, mutexT, block_alignmentT, adoption_policyT>::free_bulk(
+    void ** ptrs, fhtagn::size_t count)
 {
+  if (!count) {
+    return;
+  }
+
   typename mutex_t::scoped_lock lock(m_mutex);
 
-  // The pool is in use if any of the metadata items has any bit set. Simple,
-  // really.
-  fhtagn::size_t * metadata = m_metadata;
-  fhtagn::size_t segment = 0;
-  do {
-    if (*metadata) {
-      return true;
+  for (fhtagn::size_t i = 0 ; i < count ; ++i) {
+    if (ptrs[i]) {
+      free_unlocked(ptrs[i]);
     }
+  }
+}
+
 
-    ++metadata;
-    ++segment;
-  } while (segment < (m_size / BITS_PER_SIZE_T));
 
-  // We survived, the pool must be empty.
-  return false;
+template <
+  fhtagn::size_t BLOCK_SIZE,
+  typename mutexT,
+  typename block_alignmentT,
+  template <typename> class adoption_policyT
+>
+bool
+block_pool<BLOCK_SIZE, mutexT, block_alignmentT, adoption_policyT>::in_use() const
+{
+  typename mutex_t::scoped_lock lock(m_mutex);
+  return m_used > 0;
 }
 
 
@@ -297,6 +466,323 @@ block_pool<BLOCK_SIZE, mutexT, block_alignmentT, adoption_policyT>::alloc_size(
 
 
 
+template <
+  fhtagn::size_t BLOCK_SIZE,
+  typename mutexT,
+  typename block_alignmentT,
+  template <typename> class adoption_policyT
+>
+mutexT &
+block_pool<BLOCK_SIZE, mutexT, block_alignmentT, adoption_policyT>::mutex() const
+{
+  return m_mutex;
+}
+
+
+
+template <
+  fhtagn::size_t BLOCK_SIZE,
+  typename block_alignmentT,
+  template <typename> class adoption_policyT
+>
+block_pool<BLOCK_SIZE, fhtagn::threads::lock_free, block_alignmentT,
+    adoption_policyT>::block_pool(void * memblock, fhtagn::size_t size)
+  : adoption_policyT<char>(static_cast<char *>(memblock))
+  , m_memblock(memblock)
+  , m_hint(0)
+  , m_used(0)
+{
+  // Align the memory block as in the generic block_pool.
+  void * adjusted_start = block_alignment_t::adjust_pointer(m_memblock);
+  fhtagn::size_t size_diff = pointer(adjusted_start).char_ptr
+    - pointer(m_memblock).char_ptr;
+  fhtagn::size_t adjusted_size = size - size_diff;
+
+  size_diff = adjusted_size % block_alignment_t::BLOCK_SIZE;
+  adjusted_size -= size_diff;
+
+  m_memblock = adjusted_start;
+
+  // Reduce the number of blocks until data and metadata fit. The metadata is
+  // placed behind the data, aligned to size_t.
+  fhtagn::size_t count = adjusted_size / BLOCK_STRIDE;
+  while (count && (block_alignment<sizeof(fhtagn::size_t)>::adjust_size(
+          count * BLOCK_STRIDE)
+        + ((count + BITS_PER_SIZE_T - 1) / BITS_PER_SIZE_T)
+          * sizeof(fhtagn::size_t) > adjusted_size))
+  {
+    --count;
+  }
+
+  // Throw bad_alloc if we can't fit a single block and it's metadata.
+  if (!count) {
+    throw std::bad_alloc();
+  }
+
+  m_size = count;
+  m_words = (m_size + BITS_PER_SIZE_T - 1) / BITS_PER_SIZE_T;
+  m_metadata = reinterpret_cast<fhtagn::size_t volatile *>(
+      pointer(m_memblock).char_ptr
+      + block_alignment<sizeof(fhtagn::size_t)>::adjust_size(
+        m_size * BLOCK_STRIDE));
+  for (fhtagn::size_t i = 0 ; i < m_words ; ++i) {
+    m_metadata[i] = 0;
+  }
+
+  // Bits in the last metadata word beyond the last block are flagged as
+  // allocated, so they're never found by alloc().
+  fhtagn::size_t used_bits = m_size % BITS_PER_SIZE_T;
+  if (used_bits) {
+    m_metadata[m_words - 1] = ~fhtagn::size_t(0) << used_bits;
+  }
+}
+
+
+
+template <
+  fhtagn::size_t BLOCK_SIZE,
+  typename block_alignmentT,
+  template <typename> class adoption_policyT
+>
+bool
+block_pool<BLOCK_SIZE, fhtagn::threads::lock_free, block_alignmentT,
+    adoption_policyT>::owns(void * ptr) const
+{
+  return (m_memblock <= ptr
+      && ptr < pointer(m_memblock).char_ptr + (m_size * BLOCK_STRIDE));
+}
+
+
+
+template <
+  fhtagn::size_t BLOCK_SIZE,
+  typename block_alignmentT,
+  template <typename> class adoption_policyT
+>
+void *
+block_pool<BLOCK_SIZE, fhtagn::threads::lock_free, block_alignmentT,
+    adoption_policyT>::alloc(fhtagn::size_t size)
+{
+  namespace threads = fhtagn::threads;
+
+  if (BLOCK_SIZE != size) {
+    return NULL;
+  }
+
+  // Reserve a block first. If that fails, the pool is full.
+  if (threads::atomic_add(m_used, fhtagn::size_t(1)) > m_size) {
+    threads::atomic_add(m_used, ~fhtagn::size_t(0));
+    return NULL;
+  }
+
+  // With the reservation, at most m_size - 1 blocks are allocated by other
+  // threads, so there's always a free bit to be found - but it may move while
+  // we're looking, so we loop until we got one.
+  fhtagn::size_t word = threads::atomic_load(m_hint);
+  while (true) {
+    fhtagn::size_t bits = threads::atomic_load(m_metadata[word]);
+    if (~bits) {
+      fhtagn::size_t offset = count_trailing_zeros(~bits);
+      if (threads::compare_and_swap(m_metadata[word], bits,
+            bits | (fhtagn::size_t(1) << offset)))
+      {
+        threads::atomic_store(m_hint, word);
+
+        fhtagn::size_t index = (word * BITS_PER_SIZE_T) + offset;
+        return pointer(m_memblock).char_ptr + (BLOCK_STRIDE * index);
+      }
+
+      // Another thread modified the word; try it again.
+      continue;
+    }
+
+    if (++word >= m_words) {
+      word = 0;
+    }
+  }
+}
+
+
+
+template <
+  fhtagn::size_t BLOCK_SIZE,
+  typename block_alignmentT,
+  template <typename> class adoption_policyT
+>
+void *
+block_pool<BLOCK_SIZE, fhtagn::threads::lock_free, block_alignmentT,
+    adoption_policyT>::realloc(void * ptr, fhtagn::size_t new_size)
+{
+  if (!owns(ptr)) {
+    // Invalid pointer, we don't handle it.
+    return NULL;
+  }
+
+  if (BLOCK_SIZE == new_size) {
+    // Not really a realloc, the size hasn't changed. We can allow that.
+    return ptr;
+  }
+  return NULL;
+}
+
+
+
+template <
+  fhtagn::size_t BLOCK_SIZE,
+  typename block_alignmentT,
+  template <typename> class adoption_policyT
+>
+void
+block_pool<BLOCK_SIZE, fhtagn::threads::lock_free, block_alignmentT,
+    adoption_policyT>::free(void * ptr)
+{
+  namespace threads = fhtagn::threads;
+
+  if (!owns(ptr)) {
+    // Invalid pointer, we don't handle it.
+    return;
+  }
+
+  fhtagn::size_t index = (pointer(ptr).char_ptr - pointer(m_memblock).char_ptr)
+    / BLOCK_STRIDE;
+  fhtagn::size_t word = index / BITS_PER_SIZE_T;
+  fhtagn::size_t mask = fhtagn::size_t(1) << (index % BITS_PER_SIZE_T);
+
+  // Clear the bit for the pointer to mark it free.
+  while (true) {
+    fhtagn::size_t bits = threads::atomic_load(m_metadata[word]);
+    if (!(bits & mask)) {
+      // Not allocated, nothing to do.
+      return;
+    }
+
+    if (threads::compare_and_swap(m_metadata[word], bits, bits & ~mask)) {
+      break;
+    }
+  }
+
+  // The block is free before the reservation is released, so that
+  // reservations never outnumber free blocks.
+  threads::atomic_store(m_hint, word);
+  threads::atomic_add(m_used, ~fhtagn::size_t(0));
+}
+
+
+
+template <
+  fhtagn::size_t BLOCK_SIZE,
+  typename block_alignmentT,
+  template <typename> class adoption_policyT
+>
+fhtagn::size_t
+block_pool<BLOCK_SIZE, fhtagn::threads::lock_free, block_alignmentT,
+    adoption_policyT>::alloc_bulk(fhtagn::size_t size, fhtagn::size_t count,
+        void ** ptrs)
+{
+  namespace threads = fhtagn::threads;
+
+  if (!count || BLOCK_SIZE != size) {
+    return 0;
+  }
+
+  // Reserve the whole batch first, and give back what the pool can't satisfy.
+  fhtagn::size_t used = threads::atomic_add(m_used, count);
+  if (used > m_size) {
+    fhtagn::size_t excess = std::min(count, used - m_size);
+    threads::atomic_add(m_used, fhtagn::size_t(0) - excess);
+    count -= excess;
+  }
+
+  // As in alloc(), the reservations guarantee that we'll find count free bits
+  // eventually. Claim as many of them per word as we can.
+  fhtagn::size_t allocated = 0;
+  fhtagn::size_t word = threads::atomic_load(m_hint);
+  while (allocated < count) {
+    fhtagn::size_t bits = threads::atomic_load(m_metadata[word]);
+    fhtagn::size_t free_bits = ~bits;
+    if (!free_bits) {
+      if (++word >= m_words) {
+        word = 0;
+      }
+      continue;
+    }
+
+    fhtagn::size_t taken = 0;
+    fhtagn::size_t wanted = count - allocated;
+    for (fhtagn::size_t i = 0 ; free_bits && i < wanted ; ++i) {
+      taken |= free_bits & (fhtagn::size_t(0) - free_bits);
+      free_bits &= free_bits - 1;
+    }
+
+    if (!threads::compare_and_swap(m_metadata[word], bits, bits | taken)) {
+      // Another thread modified the word; try it again.
+      continue;
+    }
+
+    while (taken) {
+      fhtagn::size_t index = (word * BITS_PER_SIZE_T)
+        + count_trailing_zeros(taken);
+      taken &= taken - 1;
+      ptrs[allocated++] = pointer(m_memblock).char_ptr + (BLOCK_STRIDE * index);
+    }
+    threads::atomic_store(m_hint, word);
+  }
+
+  return allocated;
+}
+
+
+
+template <
+  fhtagn::size_t BLOCK_SIZE,
+  typename block_alignmentT,
+  template <typename> class adoption_policyT
+>
+void
+block_pool<BLOCK_SIZE, fhtagn::threads::lock_free, block_alignmentT,
+    adoption_policyT>::free_bulk(void ** ptrs, fhtagn::size_t count)
+{
+  // There's no lock to amortize; each free() is a single compare-and-swap.
+  for (fhtagn::size_t i = 0 ; i < count ; ++i) {
+    free(ptrs[i]);
+  }
+}
+
+
+
+template <
+  fhtagn::size_t BLOCK_SIZE,
+  typename block_alignmentT,
+  template <typename> class adoption_policyT
+>
+bool
+block_pool<BLOCK_SIZE, fhtagn::threads::lock_free, block_alignmentT,
+    adoption_policyT>::in_use() const
+{
+  return fhtagn::threads::atomic_load(m_used) > 0;
+}
+
+
+
+template <
+  fhtagn::size_t BLOCK_SIZE,
+  typename block_alignmentT,
+  template <typename> class adoption_policyT
+>
+fhtagn::size_t
+block_pool<BLOCK_SIZE, fhtagn::threads::lock_free, block_alignmentT,
+    adoption_policyT>::alloc_size(void * ptr) const
+{
+  if (!owns(ptr)) {
+    // Invalid pointer, we don't handle it.
+    return 0;
+  }
+
+  return BLOCK_SIZE;
+}
+
+
+
 }} // namespace fhtagn::memory
 
 
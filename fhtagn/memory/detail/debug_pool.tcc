@@ -0,0 +1,517 @@
+/**
+ * $Id$
+ *
+ * This file is part of the Fhtagn! C++ Library.
+ * Copyright (C) 2009 Jens Finkhaeuser <unwesen@users.sourceforge.net>.
+ *
+ * Author: Jens Finkhaeuser <unwesen@users.sourceforge.net>
+ *
+ * This program is licensed as free software for personal, educational or
+ * other non-commerical uses: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation, either version 3 of the License, or (at your
+ * option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Alternatively, licenses for commercial purposes are available as well.
+ * Please send your enquiries to the copyright holder's address above.
+ **/
+#ifndef FHTAGN_MEMORY_DETAIL_DEBUG_POOL_TCC
+#define FHTAGN_MEMORY_DETAIL_DEBUG_POOL_TCC
+
+#ifndef __cplusplus
+#error You are trying to include a C++ only header file
+#endif
+
+#include <string.h>
+
+#include <algorithm>
+#include <sstream>
+#include <stdexcept>
+
+namespace fhtagn {
+namespace memory {
+
+template <
+  typename memory_poolT,
+  fhtagn::size_t QUARANTINE_SIZE,
+  fhtagn::size_t GUARD_SIZE,
+  typename mutexT,
+  typename block_alignmentT
+>
+debug_pool<memory_poolT, QUARANTINE_SIZE, GUARD_SIZE, mutexT,
+    block_alignmentT>::debug_pool(memory_poolT & pool)
+  : m_pool(pool)
+  , m_live(NULL)
+  , m_live_count(0)
+  , m_quarantine_head(0)
+  , m_quarantine_count(0)
+{
+}
+
+
+
+template <
+  typename memory_poolT,
+  fhtagn::size_t QUARANTINE_SIZE,
+  fhtagn::size_t GUARD_SIZE,
+  typename mutexT,
+  typename block_alignmentT
+>
+debug_pool<memory_poolT, QUARANTINE_SIZE, GUARD_SIZE, mutexT,
+    block_alignmentT>::~debug_pool()
+{
+  typename mutex_t::scoped_lock lock(m_mutex);
+  while (m_quarantine_count) {
+    release_oldest(false);
+  }
+}
+
+
+
+template <
+  typename memory_poolT,
+  fhtagn::size_t QUARANTINE_SIZE,
+  fhtagn::size_t GUARD_SIZE,
+  typename mutexT,
+  typename block_alignmentT
+>
+bool
+debug_pool<memory_poolT, QUARANTINE_SIZE, GUARD_SIZE, mutexT,
+    block_alignmentT>::is_filled(char const * ptr,
+        fhtagn::size_t size, int value)
+{
+  for (fhtagn::size_t i = 0 ; i < size ; ++i) {
+    if (static_cast<unsigned char>(ptr[i]) != value) {
+      return false;
+    }
+  }
+  return true;
+}
+
+
+
+template <
+  typename memory_poolT,
+  fhtagn::size_t QUARANTINE_SIZE,
+  fhtagn::size_t GUARD_SIZE,
+  typename mutexT,
+  typename block_alignmentT
+>
+void
+debug_pool<memory_poolT, QUARANTINE_SIZE, GUARD_SIZE, mutexT,
+    block_alignmentT>::report(char const * problem,
+        void * ptr) const
+{
+  std::stringstream s;
+  s << "debug_pool: " << problem << " at " << std::hex << ptr << ".";
+  throw std::logic_error(s.str());
+}
+
+
+
+template <
+  typename memory_poolT,
+  fhtagn::size_t QUARANTINE_SIZE,
+  fhtagn::size_t GUARD_SIZE,
+  typename mutexT,
+  typename block_alignmentT
+>
+typename debug_pool<memory_poolT, QUARANTINE_SIZE, GUARD_SIZE, mutexT,
+    block_alignmentT>::header *
+debug_pool<memory_poolT, QUARANTINE_SIZE, GUARD_SIZE, mutexT,
+    block_alignmentT>::header_for(void * ptr) const
+{
+  header * hdr = reinterpret_cast<header *>(pointer(ptr).char_ptr
+      - header::header_size());
+
+  if (static_cast<fhtagn::size_t>(header::FREED) == hdr->state) {
+    report("double free or use of freed pointer", ptr);
+  }
+  if (static_cast<fhtagn::size_t>(header::ALLOCATED) != hdr->state) {
+    report("unknown pointer or corrupted allocation header", ptr);
+  }
+  return hdr;
+}
+
+
+
+template <
+  typename memory_poolT,
+  fhtagn::size_t QUARANTINE_SIZE,
+  fhtagn::size_t GUARD_SIZE,
+  typename mutexT,
+  typename block_alignmentT
+>
+void
+debug_pool<memory_poolT, QUARANTINE_SIZE, GUARD_SIZE, mutexT,
+    block_alignmentT>::check_guards(header * hdr) const
+{
+  if (!is_filled(hdr->front_guard(), GUARD_SIZE, GUARD_PATTERN)) {
+    report("buffer underrun", hdr->data());
+  }
+  if (!is_filled(hdr->back_guard(), GUARD_SIZE, GUARD_PATTERN)) {
+    report("buffer overrun", hdr->data());
+  }
+}
+
+
+
+template <
+  typename memory_poolT,
+  fhtagn::size_t QUARANTINE_SIZE,
+  fhtagn::size_t GUARD_SIZE,
+  typename mutexT,
+  typename block_alignmentT
+>
+bool
+debug_pool<memory_poolT, QUARANTINE_SIZE, GUARD_SIZE, mutexT,
+    block_alignmentT>::freed_intact(header * hdr) const
+{
+  return (static_cast<fhtagn::size_t>(header::FREED) == hdr->state
+      && is_filled(hdr->front_guard(), GUARD_SIZE + hdr->size + GUARD_SIZE,
+        FREE_PATTERN));
+}
+
+
+
+template <
+  typename memory_poolT,
+  fhtagn::size_t QUARANTINE_SIZE,
+  fhtagn::size_t GUARD_SIZE,
+  typename mutexT,
+  typename block_alignmentT
+>
+void
+debug_pool<memory_poolT, QUARANTINE_SIZE, GUARD_SIZE, mutexT,
+    block_alignmentT>::release(header * hdr, bool check)
+{
+  // Memory that was written to after it was freed is still returned to the
+  // wrapped pool, as long as the header is intact; the damage is reported
+  // after that.
+  void * data = hdr->data();
+  bool intact = !check || freed_intact(hdr);
+  if (static_cast<fhtagn::size_t>(header::FREED) == hdr->state) {
+    m_pool.free(hdr);
+  }
+
+  if (!intact) {
+    report("write to freed memory", data);
+  }
+}
+
+
+
+template <
+  typename memory_poolT,
+  fhtagn::size_t QUARANTINE_SIZE,
+  fhtagn::size_t GUARD_SIZE,
+  typename mutexT,
+  typename block_alignmentT
+>
+void
+debug_pool<memory_poolT, QUARANTINE_SIZE, GUARD_SIZE, mutexT,
+    block_alignmentT>::release_oldest(bool check)
+{
+  header * hdr = m_quarantine[m_quarantine_head];
+  m_quarantine_head = (m_quarantine_head + 1) % QUARANTINE_SLOTS;
+  --m_quarantine_count;
+
+  release(hdr, check);
+}
+
+
+
+template <
+  typename memory_poolT,
+  fhtagn::size_t QUARANTINE_SIZE,
+  fhtagn::size_t GUARD_SIZE,
+  typename mutexT,
+  typename block_alignmentT
+>
+void *
+debug_pool<memory_poolT, QUARANTINE_SIZE, GUARD_SIZE, mutexT,
+    block_alignmentT>::alloc(fhtagn::size_t size)
+{
+  if (!size) {
+    return NULL;
+  }
+
+  if (size > ~fhtagn::size_t(0) - header::header_size() - GUARD_SIZE) {
+    return NULL;
+  }
+
+  void * block = m_pool.alloc(header::header_size() + size + GUARD_SIZE);
+  if (!block) {
+    return NULL;
+  }
+
+  header * hdr = static_cast<header *>(block);
+  hdr->size = size;
+  hdr->state = header::ALLOCATED;
+  ::memset(hdr->front_guard(), GUARD_PATTERN, GUARD_SIZE);
+  ::memset(hdr->data(), ALLOC_PATTERN, size);
+  ::memset(hdr->back_guard(), GUARD_PATTERN, GUARD_SIZE);
+
+  typename mutex_t::scoped_lock lock(m_mutex);
+
+  hdr->prev = NULL;
+  hdr->next = m_live;
+  if (m_live) {
+    m_live->prev = hdr;
+  }
+  m_live = hdr;
+  ++m_live_count;
+
+  return hdr->data();
+}
+
+
+
+template <
+  typename memory_poolT,
+  fhtagn::size_t QUARANTINE_SIZE,
+  fhtagn::size_t GUARD_SIZE,
+  typename mutexT,
+  typename block_alignmentT
+>
+void *
+debug_pool<memory_poolT, QUARANTINE_SIZE, GUARD_SIZE, mutexT,
+    block_alignmentT>::realloc(void * ptr,
+        fhtagn::size_t new_size)
+{
+  if (!ptr) {
+    return alloc(new_size);
+  }
+
+  if (!new_size) {
+    return NULL;
+  }
+
+  fhtagn::size_t old_size = 0;
+  {
+    typename mutex_t::scoped_lock lock(m_mutex);
+    header * hdr = header_for(ptr);
+    check_guards(hdr);
+    old_size = hdr->size;
+  }
+
+  // Always move the allocation, so that stale pointers to the old one end up
+  // in the quarantine.
+  void * new_ptr = alloc(new_size);
+  if (!new_ptr) {
+    return NULL;
+  }
+
+  ::memcpy(new_ptr, ptr, std::min(old_size, new_size));
+  free(ptr);
+
+  return new_ptr;
+}
+
+
+
+template <
+  typename memory_poolT,
+  fhtagn::size_t QUARANTINE_SIZE,
+  fhtagn::size_t GUARD_SIZE,
+  typename mutexT,
+  typename block_alignmentT
+>
+void
+debug_pool<memory_poolT, QUARANTINE_SIZE, GUARD_SIZE, mutexT,
+    block_alignmentT>::free(void * ptr)
+{
+  if (!ptr) {
+    return;
+  }
+
+  typename mutex_t::scoped_lock lock(m_mutex);
+
+  header * hdr = header_for(ptr);
+  check_guards(hdr);
+
+  // Unlink from the live allocations.
+  if (hdr->prev) {
+    hdr->prev->next = hdr->next;
+  }
+  else {
+    m_live = hdr->next;
+  }
+  if (hdr->next) {
+    hdr->next->prev = hdr->prev;
+  }
+  --m_live_count;
+
+  hdr->state = header::FREED;
+  ::memset(hdr->front_guard(), FREE_PATTERN,
+      GUARD_SIZE + hdr->size + GUARD_SIZE);
+
+  if (!QUARANTINE_SIZE) {
+    m_pool.free(hdr);
+    return;
+  }
+
+  // Make room in the quarantine, and add the allocation at the end. The
+  // oldest allocation is only checked once the new one is safely queued.
+  header * oldest = NULL;
+  if (m_quarantine_count >= QUARANTINE_SIZE) {
+    oldest = m_quarantine[m_quarantine_head];
+    m_quarantine_head = (m_quarantine_head + 1) % QUARANTINE_SLOTS;
+    --m_quarantine_count;
+  }
+  m_quarantine[(m_quarantine_head + m_quarantine_count) % QUARANTINE_SLOTS]
+    = hdr;
+  ++m_quarantine_count;
+
+  if (oldest) {
+    release(oldest, true);
+  }
+}
+
+
+
+template <
+  typename memory_poolT,
+  fhtagn::size_t QUARANTINE_SIZE,
+  fhtagn::size_t GUARD_SIZE,
+  typename mutexT,
+  typename block_alignmentT
+>
+bool
+debug_pool<memory_poolT, QUARANTINE_SIZE, GUARD_SIZE, mutexT,
+    block_alignmentT>::in_use() const
+{
+  typename mutex_t::scoped_lock lock(m_mutex);
+  return m_live_count > 0;
+}
+
+
+
+template <
+  typename memory_poolT,
+  fhtagn::size_t QUARANTINE_SIZE,
+  fhtagn::size_t GUARD_SIZE,
+  typename mutexT,
+  typename block_alignmentT
+>
+fhtagn::size_t
+debug_pool<memory_poolT, QUARANTINE_SIZE, GUARD_SIZE, mutexT,
+    block_alignmentT>::alloc_size(void * ptr) const
+{
+  if (!ptr) {
+    return 0;
+  }
+
+  typename mutex_t::scoped_lock lock(m_mutex);
+  return header_for(ptr)->size;
+}
+
+
+
+template <
+  typename memory_poolT,
+  fhtagn::size_t QUARANTINE_SIZE,
+  fhtagn::size_t GUARD_SIZE,
+  typename mutexT,
+  typename block_alignmentT
+>
+mutexT &
+debug_pool<memory_poolT, QUARANTINE_SIZE, GUARD_SIZE, mutexT,
+    block_alignmentT>::mutex() const
+{
+  return m_mutex;
+}
+
+
+
+template <
+  typename memory_poolT,
+  fhtagn::size_t QUARANTINE_SIZE,
+  fhtagn::size_t GUARD_SIZE,
+  typename mutexT,
+  typename block_alignmentT
+>
+void
+debug_pool<memory_poolT, QUARANTINE_SIZE, GUARD_SIZE, mutexT,
+    block_alignmentT>::verify() const
+{
+  typename mutex_t::scoped_lock lock(m_mutex);
+
+  for (header * hdr = m_live ; hdr ; hdr = hdr->next) {
+    check_guards(hdr);
+  }
+
+  for (fhtagn::size_t i = 0 ; i < m_quarantine_count ; ++i) {
+    header * hdr = m_quarantine[(m_quarantine_head + i) % QUARANTINE_SLOTS];
+    if (!freed_intact(hdr)) {
+      report("write to freed memory", hdr->data());
+    }
+  }
+}
+
+
+
+template <
+  typename memory_poolT,
+  fhtagn::size_t QUARANTINE_SIZE,
+  fhtagn::size_t GUARD_SIZE,
+  typename mutexT,
+  typename block_alignmentT
+>
+void
+debug_pool<memory_poolT, QUARANTINE_SIZE, GUARD_SIZE, mutexT,
+    block_alignmentT>::flush()
+{
+  typename mutex_t::scoped_lock lock(m_mutex);
+  while (m_quarantine_count) {
+    release_oldest(true);
+  }
+}
+
+
+
+template <
+  typename memory_poolT,
+  fhtagn::size_t QUARANTINE_SIZE,
+  fhtagn::size_t GUARD_SIZE,
+  typename mutexT,
+  typename block_alignmentT
+>
+fhtagn::size_t
+debug_pool<memory_poolT, QUARANTINE_SIZE, GUARD_SIZE, mutexT,
+    block_alignmentT>::live() const
+{
+  typename mutex_t::scoped_lock lock(m_mutex);
+  return m_live_count;
+}
+
+
+
+template <
+  typename memory_poolT,
+  fhtagn::size_t QUARANTINE_SIZE,
+  fhtagn::size_t GUARD_SIZE,
+  typename mutexT,
+  typename block_alignmentT
+>
+fhtagn::size_t
+debug_pool<memory_poolT, QUARANTINE_SIZE, GUARD_SIZE, mutexT,
+    block_alignmentT>::quarantined() const
+{
+  typename mutex_t::scoped_lock lock(m_mutex);
+  return m_quarantine_count;
+}
+
+
+}} // namespace fhtagn::memory
+
+
+#endif // guard
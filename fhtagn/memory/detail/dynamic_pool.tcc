@@ -39,10 +39,43 @@ namespace memory {
 template <
   typename poolT,
   int MEMORY_BLOCK_SIZE,
-  typename mutexT
+  typename mutexT,
+  typename retentionT
+>
+dynamic_pool<poolT, MEMORY_BLOCK_SIZE, mutexT, retentionT>::dynamic_pool()
+  : m_free_list(NULL)
+  , m_free_blocks(0)
+  , m_empty_blocks(0)
+{
+}
+
+
+
+template <
+  typename poolT,
+  int MEMORY_BLOCK_SIZE,
+  typename mutexT,
+  typename retentionT
+>
+dynamic_pool<poolT, MEMORY_BLOCK_SIZE, mutexT, retentionT>::~dynamic_pool()
+{
+  // Release all blocks, whether they're in use or not.
+  while (!m_pool_map.empty()) {
+    release_pool(m_pool_map.begin());
+  }
+}
+
+
+
+template <
+  typename poolT,
+  int MEMORY_BLOCK_SIZE,
+  typename mutexT,
+  typename retentionT
 >
 void *
-dynamic_pool<poolT, MEMORY_BLOCK_SIZE, mutexT>::alloc(fhtagn::size_t size)
+dynamic_pool<poolT, MEMORY_BLOCK_SIZE, mutexT, retentionT>::alloc(
+    fhtagn::size_t size)
 {
   typename mutex_t::scoped_lock lock(m_mutex);
   return lockfree_alloc(size);
@@ -53,20 +86,38 @@ dynamic_pool<poolT, MEMORY_BLOCK_SIZE, mutexT>::alloc(fhtagn::size_t size)
 template <
   typename poolT,
   int MEMORY_BLOCK_SIZE,
-  typename mutexT
+  typename mutexT,
+  typename retentionT
 >
 void *
-dynamic_pool<poolT, MEMORY_BLOCK_SIZE, mutexT>::lockfree_alloc(
+dynamic_pool<poolT, MEMORY_BLOCK_SIZE, mutexT, retentionT>::lockfree_alloc(
     fhtagn::size_t size)
 {
+  if (!size) {
+    return NULL;
+  }
 
-  // Iterate over all pools and try to allocate from each of them. If one
-  // succeeds, then we're done.
-  typename pool_map_t::const_iterator map_end = m_pool_map.end();
-  for (typename pool_map_t::const_iterator map_iter = m_pool_map.begin()
-      ; map_iter != map_end ; ++map_iter)
-  {
-    void * ptr = map_iter->second->alloc(size);
+  // Try the pools with free space first. Each of them either satisfies the
+  // request, or moves to the index of failed pools, so the list only ever
+  // holds pools that are worth trying.
+  pool_entry * entry = m_free_list;
+  while (entry) {
+    pool_entry * next = entry->free_next;
+    void * ptr = try_alloc(*entry, size);
+    if (ptr) {
+      return ptr;
+    }
+    entry = next;
+  }
+
+  // Failed pools may still satisfy requests smaller than the one they failed.
+  // Those that fail again are re-indexed by this request's size, i.e. before
+  // the range we're iterating over.
+  typename failed_map_t::iterator failed = m_failed.upper_bound(size);
+  while (failed != m_failed.end()) {
+    pool_entry & candidate = *failed->second;
+    ++failed;
+    void * ptr = try_alloc(candidate, size);
     if (ptr) {
       return ptr;
     }
@@ -74,12 +125,14 @@ dynamic_pool<poolT, MEMORY_BLOCK_SIZE, mutexT>::lockfree_alloc(
 
   // Uh-oh, existing pools don't have enough memory. Seems like we have to
   // create a new one.
-  char * memblock = new char[MEMORY_BLOCK_SIZE];
+  char * memblock = static_cast<char *>(
+      retention_policy_t::allocate_block(MEMORY_BLOCK_SIZE));
   if (!memblock) {
     return NULL;
   }
   pool_ptr new_pool = pool_ptr(new pool_t(memblock, MEMORY_BLOCK_SIZE));
   if (!new_pool) {
+    retention_policy_t::release_block(memblock, MEMORY_BLOCK_SIZE);
     return NULL;
   }
 
@@ -89,11 +142,68 @@ dynamic_pool<poolT, MEMORY_BLOCK_SIZE, mutexT>::lockfree_alloc(
   // insert below failing.
   pool_key_t key = std::make_pair(pointer(memblock).void_ptr,
       pointer(memblock + MEMORY_BLOCK_SIZE).void_ptr);
-  m_pool_map.insert(std::make_pair(key, new_pool));
+  typename pool_map_t::iterator iter = m_pool_map.insert(
+      std::make_pair(key, pool_entry(new_pool))).first;
+  mark_has_space(iter->second);
 
   // Now we have a new pool, return memory from there. It hardly can fail, but
   // if it does, we can't really help it any longer.
-  return new_pool->alloc(size);
+  void * ptr = new_pool->alloc(size);
+  if (!ptr) {
+    release_pool(iter);
+  }
+  return ptr;
+}
+
+
+
+template <
+  typename poolT,
+  int MEMORY_BLOCK_SIZE,
+  typename mutexT,
+  typename retentionT
+>
+void *
+dynamic_pool<poolT, MEMORY_BLOCK_SIZE, mutexT, retentionT>::try_alloc(
+    pool_entry & entry, fhtagn::size_t size)
+{
+  void * ptr = entry.pool->alloc(size);
+  if (!ptr) {
+    mark_failed(entry, size);
+    return NULL;
+  }
+
+  if (entry.empty) {
+    entry.empty = false;
+    --m_empty_blocks;
+  }
+  return ptr;
+}
+
+
+
+template <
+  typename poolT,
+  int MEMORY_BLOCK_SIZE,
+  typename mutexT,
+  typename retentionT
+>
+fhtagn::size_t
+dynamic_pool<poolT, MEMORY_BLOCK_SIZE, mutexT, retentionT>::try_alloc_bulk(
+    pool_entry & entry, fhtagn::size_t size, fhtagn::size_t count,
+    void ** ptrs)
+{
+  fhtagn::size_t got = fhtagn::memory::alloc_bulk(*entry.pool, size, count,
+      ptrs);
+  if (got < count) {
+    mark_failed(entry, size);
+  }
+
+  if (got && entry.empty) {
+    entry.empty = false;
+    --m_empty_blocks;
+  }
+  return got;
 }
 
 
@@ -101,24 +211,53 @@ dynamic_pool<poolT, MEMORY_BLOCK_SIZE, mutexT>::lockfree_alloc(
 template <
   typename poolT,
   int MEMORY_BLOCK_SIZE,
-  typename mutexT
+  typename mutexT,
+  typename retentionT
 >
-typename dynamic_pool<poolT, MEMORY_BLOCK_SIZE, mutexT>::pool_map_t::iterator
-dynamic_pool<poolT, MEMORY_BLOCK_SIZE, mutexT>::find_pool(void * ptr)
+void
+dynamic_pool<poolT, MEMORY_BLOCK_SIZE, mutexT, retentionT>::mark_has_space(
+    pool_entry & entry)
 {
-  typename pool_map_t::iterator map_end = m_pool_map.end();
-  for (typename pool_map_t::iterator map_iter = m_pool_map.begin()
-      ; map_iter != map_end ; ++map_iter)
-  {
-    void * range_start = map_iter->first.first;
-    void * range_end = map_iter->first.second;
-    if (range_start <= ptr && ptr < range_end) {
-      // Found the pool.
-      return map_iter;
-    }
+  if (entry.has_space) {
+    return;
   }
+  unlink(entry);
+
+  // Pools that just had memory freed go to the front; they're likely to be
+  // able to satisfy the next allocation.
+  entry.free_prev = NULL;
+  entry.free_next = m_free_list;
+  if (m_free_list) {
+    m_free_list->free_prev = &entry;
+  }
+  m_free_list = &entry;
+  entry.has_space = true;
+  ++m_free_blocks;
+}
+
+
 
-  return map_end;
+template <
+  typename poolT,
+  int MEMORY_BLOCK_SIZE,
+  typename mutexT,
+  typename retentionT
+>
+void
+dynamic_pool<poolT, MEMORY_BLOCK_SIZE, mutexT, retentionT>::mark_failed(
+    pool_entry & entry, fhtagn::size_t size)
+{
+  if (entry.fail_size && entry.fail_size < size) {
+    size = entry.fail_size;
+  }
+  unlink(entry);
+
+  // A pool that can't satisfy the smallest possible request will only be
+  // useful again once memory is returned to it.
+  entry.fail_size = size;
+  if (size > 1) {
+    entry.failed = m_failed.insert(std::make_pair(size, &entry));
+  }
 }
 
 
@@ -126,24 +265,144 @@ dynamic_pool<poolT, MEMORY_BLOCK_SIZE, mutexT>::find_pool(void * ptr)
 template <
   typename poolT,
   int MEMORY_BLOCK_SIZE,
-  typename mutexT
+  typename mutexT,
+  typename retentionT
 >
-typename dynamic_pool<poolT, MEMORY_BLOCK_SIZE, mutexT>::pool_map_t::const_iterator
-dynamic_pool<poolT, MEMORY_BLOCK_SIZE, mutexT>::find_pool(void * ptr) const
+void
+dynamic_pool<poolT, MEMORY_BLOCK_SIZE, mutexT, retentionT>::unlink(
+    pool_entry & entry)
 {
-  typename pool_map_t::const_iterator map_end = m_pool_map.end();
-  for (typename pool_map_t::const_iterator map_iter = m_pool_map.begin()
-      ; map_iter != map_end ; ++map_iter)
-  {
-    void * range_start = map_iter->first.first;
-    void * range_end = map_iter->first.second;
-    if (range_start <= ptr && ptr < range_end) {
-      // Found the pool.
-      return map_iter;
+  if (entry.has_space) {
+    if (entry.free_prev) {
+      entry.free_prev->free_next = entry.free_next;
+    }
+    else {
+      m_free_list = entry.free_next;
     }
+    if (entry.free_next) {
+      entry.free_next->free_prev = entry.free_prev;
+    }
+    entry.free_prev = entry.free_next = NULL;
+    entry.has_space = false;
+    --m_free_blocks;
+  }
+  else if (entry.fail_size > 1) {
+    m_failed.erase(entry.failed);
+  }
+  entry.fail_size = 0;
+}
+
+
+
+template <
+  typename poolT,
+  int MEMORY_BLOCK_SIZE,
+  typename mutexT,
+  typename retentionT
+>
+void
+dynamic_pool<poolT, MEMORY_BLOCK_SIZE, mutexT, retentionT>::pool_freed(
+    typename pool_map_t::iterator iter)
+{
+  pool_entry & entry = iter->second;
+  if (entry.pool->in_use()) {
+    mark_has_space(entry);
+    return;
+  }
+
+  // The pool is empty. Release it, unless the retention policy wants us to
+  // keep it around.
+  if (m_empty_blocks >= retention_policy_t::KEEP_EMPTY_BLOCKS) {
+    release_pool(iter);
+    return;
+  }
+
+  // The retention policy may discard the block's contents, including the
+  // pool's bookkeeping data, so the pool gets re-created on top of it.
+  retention_policy_t::retain_block(iter->first.first, MEMORY_BLOCK_SIZE);
+  entry.pool = pool_ptr(new pool_t(iter->first.first, MEMORY_BLOCK_SIZE));
+  entry.empty = true;
+  ++m_empty_blocks;
+  mark_has_space(entry);
+}
+
+
+
+template <
+  typename poolT,
+  int MEMORY_BLOCK_SIZE,
+  typename mutexT,
+  typename retentionT
+>
+void
+dynamic_pool<poolT, MEMORY_BLOCK_SIZE, mutexT, retentionT>::release_pool(
+    typename pool_map_t::iterator iter)
+{
+  void * memblock = iter->first.first;
+
+  unlink(iter->second);
+  if (iter->second.empty) {
+    --m_empty_blocks;
+  }
+  m_pool_map.erase(iter);
+
+  retention_policy_t::release_block(memblock, MEMORY_BLOCK_SIZE);
+}
+
+
+
+template <
+  typename poolT,
+  int MEMORY_BLOCK_SIZE,
+  typename mutexT,
+  typename retentionT
+>
+typename dynamic_pool<poolT, MEMORY_BLOCK_SIZE, mutexT,
+    retentionT>::pool_map_t::iterator
+dynamic_pool<poolT, MEMORY_BLOCK_SIZE, mutexT, retentionT>::find_pool(
+    void * ptr)
+{
+  // Find the first pool starting after ptr; the pool before it is the only
+  // one that can contain ptr.
+  typename pool_map_t::iterator map_iter = m_pool_map.upper_bound(
+      std::make_pair(ptr, reinterpret_cast<void *>(~fhtagn::size_t(0))));
+  if (map_iter == m_pool_map.begin()) {
+    return m_pool_map.end();
+  }
+  --map_iter;
+
+  if (ptr < map_iter->first.second) {
+    // Found the pool.
+    return map_iter;
+  }
+  return m_pool_map.end();
+}
+
+
+
+template <
+  typename poolT,
+  int MEMORY_BLOCK_SIZE,
+  typename mutexT,
+  typename retentionT
+>
+typename dynamic_pool<poolT, MEMORY_BLOCK_SIZE, mutexT,
+    retentionT>::pool_map_t::const_iterator
+dynamic_pool<poolT, MEMORY_BLOCK_SIZE, mutexT, retentionT>::find_pool(
+    void * ptr) const
+{
+  typename pool_map_t::const_iterator map_iter = m_pool_map.upper_bound(
+      std::make_pair(ptr, reinterpret_cast<void *>(~fhtagn::size_t(0))));
+  if (map_iter == m_pool_map.begin()) {
+    return m_pool_map.end();
   }
+  --map_iter;
 
-  return map_end;
+  if (ptr < map_iter->first.second) {
+    // Found the pool.
+    return map_iter;
+  }
+  return m_pool_map.end();
 }
 
 
@@ -151,10 +410,11 @@ dynamic_pool<poolT, MEMORY_BLOCK_SIZE, mutexT>::find_pool(void * ptr) const
 template <
   typename poolT,
   int MEMORY_BLOCK_SIZE,
-  typename mutexT
+  typename mutexT,
+  typename retentionT
 >
 void *
-dynamic_pool<poolT, MEMORY_BLOCK_SIZE, mutexT>::realloc(void * ptr,
+dynamic_pool<poolT, MEMORY_BLOCK_SIZE, mutexT, retentionT>::realloc(void * ptr,
     fhtagn::size_t new_size)
 {
   if (!ptr) {
@@ -167,19 +427,21 @@ dynamic_pool<poolT, MEMORY_BLOCK_SIZE, mutexT>::realloc(void * ptr,
 
   typename mutex_t::scoped_lock lock(m_mutex);
 
-  // First, try to find the pool this pointer is from. There's no helping it,
-  // we have to iterate over the map.
+  // First, try to find the pool this pointer is from.
   typename pool_map_t::iterator iter = find_pool(ptr);
 
   // If we didn't find a pool above, the pointer isn't managed by us.
   if (iter == m_pool_map.end()) {
     return NULL;
   }
-  pool_ptr current_pool = iter->second;
+  pool_t * current_pool = iter->second.pool.get();
 
   // See if the current pool can handle the reallocation. If so, we're done.
+  // The reallocation may have shrunk the object, so the pool might have space
+  // again.
   void * new_ptr = current_pool->realloc(ptr, new_size);
   if (new_ptr) {
+    mark_has_space(iter->second);
     return new_ptr;
   }
 
@@ -195,6 +457,7 @@ dynamic_pool<poolT, MEMORY_BLOCK_SIZE, mutexT>::realloc(void * ptr,
   // free the old pointer.
   ::memcpy(new_ptr, ptr, std::min(current_pool->alloc_size(ptr), new_size));
   current_pool->free(ptr);
+  pool_freed(iter);
 
   return new_ptr;
 }
@@ -204,10 +467,11 @@ dynamic_pool<poolT, MEMORY_BLOCK_SIZE, mutexT>::realloc(void * ptr,
 template <
   typename poolT,
   int MEMORY_BLOCK_SIZE,
-  typename mutexT
+  typename mutexT,
+  typename retentionT
 >
 void
-dynamic_pool<poolT, MEMORY_BLOCK_SIZE, mutexT>::free(void * ptr)
+dynamic_pool<poolT, MEMORY_BLOCK_SIZE, mutexT, retentionT>::free(void * ptr)
 {
   if (!ptr) {
     return;
@@ -220,13 +484,113 @@ dynamic_pool<poolT, MEMORY_BLOCK_SIZE, mutexT>::free(void * ptr)
     // That's odd, apparently we weren't responsible.
     return;
   }
-  pool_ptr current_pool = iter->second;
 
-  current_pool->free(ptr);
+  iter->second.pool->free(ptr);
+
+  // Finally, if the pool is now empty, retain or remove it.
+  pool_freed(iter);
+}
+
+
+
+template <
+  typename poolT,
+  int MEMORY_BLOCK_SIZE,
+  typename mutexT,
+  typename retentionT
+>
+bool
+dynamic_pool<poolT, MEMORY_BLOCK_SIZE, mutexT, retentionT>::owns(
+    void * ptr) const
+{
+  typename mutex_t::scoped_lock lock(m_mutex);
+  return find_pool(ptr) != m_pool_map.end();
+}
+
+
+
+template <
+  typename poolT,
+  int MEMORY_BLOCK_SIZE,
+  typename mutexT,
+  typename retentionT
+>
+fhtagn::size_t
+dynamic_pool<poolT, MEMORY_BLOCK_SIZE, mutexT, retentionT>::alloc_bulk(
+    fhtagn::size_t size, fhtagn::size_t count, void ** ptrs)
+{
+  if (!size || !count) {
+    return 0;
+  }
+
+  typename mutex_t::scoped_lock lock(m_mutex);
+
+  fhtagn::size_t allocated = 0;
+  while (allocated < count) {
+    // Fill the batch from pools with free space first, then from failed pools
+    // that may still fit, as in lockfree_alloc().
+    pool_entry * entry = m_free_list;
+    while (allocated < count && entry) {
+      pool_entry * next = entry->free_next;
+      allocated += try_alloc_bulk(*entry, size, count - allocated,
+          ptrs + allocated);
+      entry = next;
+    }
+
+    typename failed_map_t::iterator failed = m_failed.upper_bound(size);
+    while (allocated < count && failed != m_failed.end()) {
+      pool_entry & candidate = *failed->second;
+      ++failed;
+      allocated += try_alloc_bulk(candidate, size, count - allocated,
+          ptrs + allocated);
+    }
+
+    if (allocated >= count) {
+      break;
+    }
+
+    // All pools are full; lockfree_alloc() creates a new one, which the next
+    // iteration fills further.
+    void * ptr = lockfree_alloc(size);
+    if (!ptr) {
+      break;
+    }
+    ptrs[allocated++] = ptr;
+  }
+
+  return allocated;
+}
+
+
+
+template <
+  typename poolT,
+  int MEMORY_BLOCK_SIZE,
+  typename mutexT,
+  typename retentionT
+>
+void
+dynamic_pool<poolT, MEMORY_BLOCK_SIZE, mutexT, retentionT>::free_bulk(
+    void ** ptrs, fhtagn::size_t count)
+{
+  if (!count) {
+    return;
+  }
+
+  typename mutex_t::scoped_lock lock(m_mutex);
 
-  // Finally, if the pool is now empty, remove it.
-  if (!current_pool->in_use()) {
-    m_pool_map.erase(iter);
+  for (fhtagn::size_t i = 0 ; i < count ; ++i) {
+    if (!ptrs[i]) {
+      continue;
+    }
+
+    typename pool_map_t::iterator iter = find_pool(ptrs[i]);
+    if (iter == m_pool_map.end()) {
+      continue;
+    }
+
+    iter->second.pool->free(ptrs[i]);
+    pool_freed(iter);
   }
 }
 
@@ -235,14 +599,15 @@ dynamic_pool<poolT, MEMORY_BLOCK_SIZE, mutexT>::free(void * ptr)
 template <
   typename poolT,
   int MEMORY_BLOCK_SIZE,
-  typename mutexT
+  typename mutexT,
+  typename retentionT
 >
 bool
-dynamic_pool<poolT, MEMORY_BLOCK_SIZE, mutexT>::in_use() const
+dynamic_pool<poolT, MEMORY_BLOCK_SIZE, mutexT, retentionT>::in_use() const
 {
   typename mutex_t::scoped_lock lock(m_mutex);
 
-  return !m_pool_map.empty();
+  return m_pool_map.size() > m_empty_blocks;
 }
 
 
@@ -250,10 +615,12 @@ dynamic_pool<poolT, MEMORY_BLOCK_SIZE, mutexT>::in_use() const
 template <
   typename poolT,
   int MEMORY_BLOCK_SIZE,
-  typename mutexT
+  typename mutexT,
+  typename retentionT
 >
 fhtagn::size_t
-dynamic_pool<poolT, MEMORY_BLOCK_SIZE, mutexT>::alloc_size(void * ptr) const
+dynamic_pool<poolT, MEMORY_BLOCK_SIZE, mutexT, retentionT>::alloc_size(
+    void * ptr) const
 {
   if (!ptr) {
     return 0;
@@ -266,12 +633,98 @@ dynamic_pool<poolT, MEMORY_BLOCK_SIZE, mutexT>::alloc_size(void * ptr) const
     // That's odd, apparently we weren't responsible.
     return 0;
   }
-  pool_ptr pool = iter->second;
+  pool_ptr pool = iter->second.pool;
 
   return pool->alloc_size(ptr);
 }
 
 
+
+template <
+  typename poolT,
+  int MEMORY_BLOCK_SIZE,
+  typename mutexT,
+  typename retentionT
+>
+mutexT &
+dynamic_pool<poolT, MEMORY_BLOCK_SIZE, mutexT, retentionT>::mutex() const
+{
+  return m_mutex;
+}
+
+
+
+template <
+  typename poolT,
+  int MEMORY_BLOCK_SIZE,
+  typename mutexT,
+  typename retentionT
+>
+fhtagn::size_t
+dynamic_pool<poolT, MEMORY_BLOCK_SIZE, mutexT, retentionT>::trim()
+{
+  typename mutex_t::scoped_lock lock(m_mutex);
+
+  fhtagn::size_t released = 0;
+  typename pool_map_t::iterator iter = m_pool_map.begin();
+  while (m_empty_blocks && iter != m_pool_map.end()) {
+    typename pool_map_t::iterator current = iter++;
+    if (current->second.empty) {
+      release_pool(current);
+      ++released;
+    }
+  }
+  return released;
+}
+
+
+
+template <
+  typename poolT,
+  int MEMORY_BLOCK_SIZE,
+  typename mutexT,
+  typename retentionT
+>
+fhtagn::size_t
+dynamic_pool<poolT, MEMORY_BLOCK_SIZE, mutexT, retentionT>::blocks_held() const
+{
+  typename mutex_t::scoped_lock lock(m_mutex);
+  return m_pool_map.size();
+}
+
+
+
+template <
+  typename poolT,
+  int MEMORY_BLOCK_SIZE,
+  typename mutexT,
+  typename retentionT
+>
+fhtagn::size_t
+dynamic_pool<poolT, MEMORY_BLOCK_SIZE, mutexT, retentionT>::blocks_in_use()
+  const
+{
+  typename mutex_t::scoped_lock lock(m_mutex);
+  return m_pool_map.size() - m_empty_blocks;
+}
+
+
+
+template <
+  typename poolT,
+  int MEMORY_BLOCK_SIZE,
+  typename mutexT,
+  typename retentionT
+>
+fhtagn::size_t
+dynamic_pool<poolT, MEMORY_BLOCK_SIZE, mutexT, retentionT>::blocks_with_space()
+  const
+{
+  typename mutex_t::scoped_lock lock(m_mutex);
+  return m_free_blocks;
+}
+
+
 }} // namespace fhtagn::memory
 
 
@@ -0,0 +1,252 @@
+/**
+ * $Id$
+ *
+ * This file is part of the Fhtagn! C++ Library.
+ * Copyright (C) 2009 Jens Finkhaeuser <unwesen@users.sourceforge.net>.
+ *
+ * Author: Jens Finkhaeuser <unwesen@users.sourceforge.net>
+ *
+ * This program is licensed as free software for personal, educational or
+ * other non-commerical uses: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation, either version 3 of the License, or (at your
+ * option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Alternatively, licenses for commercial purposes are available as well.
+ * Please send your enquiries to the copyright holder's address above.
+ **/
+#ifndef FHTAGN_MEMORY_DETAIL_FALLBACK_POOL_TCC
+#define FHTAGN_MEMORY_DETAIL_FALLBACK_POOL_TCC
+
+#ifndef __cplusplus
+#error You are trying to include a C++ only header file
+#endif
+
+#include <string.h>
+
+#include <algorithm>
+
+#include <fhtagn/threads/atomic.h>
+
+namespace fhtagn {
+namespace memory {
+
+template <
+  typename primaryT,
+  typename secondaryT
+>
+fallback_pool<primaryT, secondaryT>::fallback_pool(primaryT & primary,
+    secondaryT & secondary)
+  : m_primary(primary)
+  , m_secondary(secondary)
+  , m_spills(0)
+{
+}
+
+
+
+template <
+  typename primaryT,
+  typename secondaryT
+>
+void *
+fallback_pool<primaryT, secondaryT>::alloc(fhtagn::size_t size)
+{
+  if (!size) {
+    return NULL;
+  }
+
+  void * ptr = m_primary.alloc(size);
+  if (ptr) {
+    return ptr;
+  }
+
+  ptr = m_secondary.alloc(size);
+  if (ptr) {
+    fhtagn::threads::atomic_add(m_spills, fhtagn::size_t(1));
+  }
+  return ptr;
+}
+
+
+
+template <
+  typename primaryT,
+  typename secondaryT
+>
+void *
+fallback_pool<primaryT, secondaryT>::realloc(void * ptr, fhtagn::size_t new_size)
+{
+  if (!ptr) {
+    return alloc(new_size);
+  }
+
+  if (!new_size) {
+    return NULL;
+  }
+
+  if (!m_primary.owns(ptr)) {
+    return m_secondary.realloc(ptr, new_size);
+  }
+
+  void * new_ptr = m_primary.realloc(ptr, new_size);
+  if (new_ptr) {
+    return new_ptr;
+  }
+
+  // The primary pool can't resize the pointer; move it to the secondary pool.
+  new_ptr = m_secondary.alloc(new_size);
+  if (!new_ptr) {
+    return NULL;
+  }
+  fhtagn::threads::atomic_add(m_spills, fhtagn::size_t(1));
+
+  ::memcpy(new_ptr, ptr, std::min(m_primary.alloc_size(ptr), new_size));
+  m_primary.free(ptr);
+
+  return new_ptr;
+}
+
+
+
+template <
+  typename primaryT,
+  typename secondaryT
+>
+void
+fallback_pool<primaryT, secondaryT>::free(void * ptr)
+{
+  if (!ptr) {
+    return;
+  }
+
+  if (m_primary.owns(ptr)) {
+    m_primary.free(ptr);
+  }
+  else {
+    m_secondary.free(ptr);
+  }
+}
+
+
+
+template <
+  typename primaryT,
+  typename secondaryT
+>
+bool
+fallback_pool<primaryT, secondaryT>::in_use() const
+{
+  return m_primary.in_use() || m_secondary.in_use();
+}
+
+
+
+template <
+  typename primaryT,
+  typename secondaryT
+>
+fhtagn::size_t
+fallback_pool<primaryT, secondaryT>::alloc_size(void * ptr) const
+{
+  if (!ptr) {
+    return 0;
+  }
+
+  if (m_primary.owns(ptr)) {
+    return m_primary.alloc_size(ptr);
+  }
+  return m_secondary.alloc_size(ptr);
+}
+
+
+
+template <
+  typename primaryT,
+  typename secondaryT
+>
+fhtagn::size_t
+fallback_pool<primaryT, secondaryT>::alloc_bulk(fhtagn::size_t size,
+    fhtagn::size_t count, void ** ptrs)
+{
+  if (!size || !count) {
+    return 0;
+  }
+
+  fhtagn::size_t allocated = fhtagn::memory::alloc_bulk(m_primary, size,
+      count, ptrs);
+  if (allocated < count) {
+    fhtagn::size_t spilled = fhtagn::memory::alloc_bulk(m_secondary, size,
+        count - allocated, ptrs + allocated);
+    fhtagn::threads::atomic_add(m_spills, spilled);
+    allocated += spilled;
+  }
+  return allocated;
+}
+
+
+
+template <
+  typename primaryT,
+  typename secondaryT
+>
+void
+fallback_pool<primaryT, secondaryT>::free_bulk(void ** ptrs,
+    fhtagn::size_t count)
+{
+  // Pointers from both pools may be mixed in any order, so they're routed
+  // individually.
+  for (fhtagn::size_t i = 0 ; i < count ; ++i) {
+    free(ptrs[i]);
+  }
+}
+
+
+
+template <
+  typename primaryT,
+  typename secondaryT
+>
+fhtagn::size_t
+fallback_pool<primaryT, secondaryT>::spills() const
+{
+  return fhtagn::threads::atomic_load(m_spills);
+}
+
+
+
+template <
+  typename primaryT,
+  typename secondaryT
+>
+primaryT &
+fallback_pool<primaryT, secondaryT>::primary()
+{
+  return m_primary;
+}
+
+
+
+template <
+  typename primaryT,
+  typename secondaryT
+>
+secondaryT &
+fallback_pool<primaryT, secondaryT>::secondary()
+{
+  return m_secondary;
+}
+
+
+}} // namespace fhtagn::memory
+
+
+#endif // guard
@@ -0,0 +1,168 @@
+/**
+ * $Id$
+ *
+ * This file is part of the Fhtagn! C++ Library.
+ * Copyright (C) 2009 Jens Finkhaeuser <unwesen@users.sourceforge.net>.
+ *
+ * Author: Jens Finkhaeuser <unwesen@users.sourceforge.net>
+ *
+ * This program is licensed as free software for personal, educational or
+ * other non-commerical uses: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation, either version 3 of the License, or (at your
+ * option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Alternatively, licenses for commercial purposes are available as well.
+ * Please send your enquiries to the copyright holder's address above.
+ **/
+#ifndef FHTAGN_MEMORY_DETAIL_FILE_POOL_TCC
+#define FHTAGN_MEMORY_DETAIL_FILE_POOL_TCC
+
+#ifndef __cplusplus
+#error You are trying to include a C++ only header file
+#endif
+
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include <sstream>
+#include <stdexcept>
+
+namespace fhtagn {
+namespace memory {
+
+namespace detail {
+
+mapped_file::mapped_file(char const * path, fhtagn::size_t size)
+  : m_map(NULL)
+  , m_map_size(0)
+  , m_created(false)
+  , m_fd(-1)
+{
+  m_fd = ::open(path, O_RDWR | O_CREAT, 0644);
+  if (-1 == m_fd) {
+    fail("open", path);
+  }
+
+  if (-1 == ::flock(m_fd, LOCK_EX | LOCK_NB)) {
+    fail("lock", path);
+  }
+
+  struct stat buf;
+  if (-1 == ::fstat(m_fd, &buf)) {
+    fail("stat", path);
+  }
+
+  m_map_size = buf.st_size;
+  if (!m_map_size) {
+    if (-1 == ::ftruncate(m_fd, size)) {
+      fail("resize", path);
+    }
+    m_map_size = size;
+    m_created = true;
+  }
+
+  m_map = ::mmap(NULL, m_map_size, PROT_READ | PROT_WRITE, MAP_SHARED, m_fd,
+      0);
+  if (MAP_FAILED == m_map) {
+    m_map = NULL;
+    fail("map", path);
+  }
+}
+
+
+
+mapped_file::~mapped_file()
+{
+  if (m_map) {
+    ::munmap(m_map, m_map_size);
+  }
+  if (-1 != m_fd) {
+    ::close(m_fd);
+  }
+}
+
+
+
+void
+mapped_file::fail(char const * what, char const * path)
+{
+  std::stringstream s;
+  s << "file_pool: could not " << what << " file \"" << path << "\": "
+    << ::strerror(errno);
+
+  // The destructor won't run if we throw from the constructor.
+  if (-1 != m_fd) {
+    ::close(m_fd);
+    m_fd = -1;
+  }
+  throw std::runtime_error(s.str());
+}
+
+} // namespace detail
+
+
+
+template <
+  typename block_alignmentT
+>
+file_pool<block_alignmentT>::file_pool(char const * path, fhtagn::size_t size)
+  : detail::mapped_file(path, size)
+  , shared_pool_t(m_map, m_map_size,
+      m_created ? shared_pool_t::CREATE : shared_pool_t::REOPEN)
+{
+}
+
+
+
+template <
+  typename block_alignmentT
+>
+file_pool<block_alignmentT>::~file_pool()
+{
+  try {
+    shared_pool_t::sync();
+  } catch (...) {
+    // The pool stays marked dirty, and is rebuilt on the next open.
+  }
+}
+
+
+
+template <
+  typename block_alignmentT
+>
+bool
+file_pool<block_alignmentT>::created() const
+{
+  return m_created;
+}
+
+
+
+template <
+  typename block_alignmentT
+>
+fhtagn::size_t
+file_pool<block_alignmentT>::file_size() const
+{
+  return m_map_size;
+}
+
+}} // namespace fhtagn::memory
+
+
+#endif // guard
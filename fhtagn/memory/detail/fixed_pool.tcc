@@ -32,6 +32,7 @@
 
 #include <string.h>
 
+#include <algorithm>
 #include <sstream>
 #include <stdexcept>
 
@@ -69,92 +70,13 @@ fixed_pool<mutexT, block_alignmentT, adoption_policyT>::fixed_pool(
   m_memblock = adjusted_start;
   m_size = adjusted_size;
 
-  // Initialize the memblock with one free list entry spanning the whole block.
-  m_start = new (m_memblock) segment(m_size);
+  // Initialize the memblock with one free segment spanning the whole block,
+  // if the block is large enough to hold one.
+  m_heap.create(m_state, m_memblock, pointer(m_memblock).char_ptr + m_size);
 }
 
 
 
-template <
-  typename mutexT,
-  typename block_alignmentT,
-  template <typename> class adoption_policyT
->
-typename fixed_pool<mutexT, block_alignmentT, adoption_policyT>::segment *
-fixed_pool<mutexT, block_alignmentT, adoption_policyT>::allocate_segment(
-    fhtagn::size_t size)
-{
-  // We search for a suitable segment in two passes. In the first pass, we try
-  // to find segments with exactly the requested size, so that we don't need to
-  // fragment our free memory further.
-  segment * seg = m_start;
-  while (static_cast<char>(segment::ALLOCATED) == seg->status
-      || seg->size != size)
-  {
-    if (segment::LAST_SEGMENT == seg->marker) {
-      // Reached the end of the list, end now.
-      break;
-    }
-    seg = seg->next;
-  }
-
-  // If the segment we've ended up with is the exact size we want, let's use
-  // it!
-  if (static_cast<char>(segment::FREE) == seg->status && seg->size == size) {
-    seg->status = segment::ALLOCATED;
-    return seg;
-  }
-
-  // If the segment isn't exactly the size we need, we'll try and find one that's
-  // larger, that we can then split in two.
-  //
-  // The size segment we're looking for is larger than the required size plus
-  // a header for the split off part.
-  // XXX There's a bit of an edge case here; if the segment we find is exactly
-  // full_size below, then on the one hand it'd make no sense to split off a
-  // zero-sized segment. On the other hand, doing so
-  //   a) keeps the free list accurate (even if it includes zero-sized
-  //      segments), and
-  //   b) avoids a third pass where we'd choose such a segment anyway because
-  //      it's our last chance for finding enough space.
-  // For the time being, we'll consider creating zero-sized segments the
-  // lesser evil.
-  fhtagn::size_t full_size = size + segment::header_size();
-
-  seg = m_start;
-  while (static_cast<char>(segment::ALLOCATED) == seg->status
-      || seg->size < full_size)
-  {
-    if (segment::LAST_SEGMENT == seg->marker) {
-      break;
-    }
-    seg = seg->next;
-  }
-
-  if (static_cast<char>(segment::ALLOCATED) == seg->status
-      || seg->size < full_size)
-  {
-    // If this is still the case, we didn't find a suitably sized segment and
-    // need to give up.
-    return NULL;
-  }
-
-  // Create a new segment header for the part we split off.
-  void * new_seg_addr = pointer(seg).char_ptr + full_size;
-  segment * new_seg = new (new_seg_addr) segment(seg->size - size);
-
-  new_seg->next = seg->next;
-  seg->next = new_seg;
-
-  seg->status = segment::ALLOCATED;
-  seg->size = size;
-
-  return seg;
-}
-
-
-
-
 template <
   typename mutexT,
   typename block_alignmentT,
@@ -168,16 +90,17 @@ fixed_pool<mutexT, block_alignmentT, adoption_policyT>::alloc(
     return NULL;
   }
 
-  size = block_alignmentT::adjust_size(size);
+  size = block_alignmentT::adjust_size(std::max(size,
+        heap_t::min_data_size()));
 
   typename mutex_t::scoped_lock lock(m_mutex);
 
-  segment * seg = allocate_segment(size);
+  segment * seg = m_heap.allocate_segment(size);
   if (!seg) {
     return NULL;
   }
 
-  return pointer(seg).char_ptr + segment::header_size();
+  return seg->data();
 }
 
 
@@ -195,109 +118,53 @@ fixed_pool<mutexT, block_alignmentT, adoption_policyT>::realloc(
     return NULL;
   }
 
-  new_size = block_alignmentT::adjust_size(new_size);
+  new_size = block_alignmentT::adjust_size(std::max(new_size,
+        heap_t::min_data_size()));
 
   typename mutex_t::scoped_lock lock(m_mutex);
 
   if (!ptr) {
-    segment * seg = allocate_segment(new_size);
+    segment * seg = m_heap.allocate_segment(new_size);
     if (!seg) {
       return NULL;
     }
 
-    return pointer(seg).char_ptr + segment::header_size();
+    return seg->data();
   }
 
   // Find segment for this pointer.
   segment * seg = find_segment_for(ptr);
 
   // If the new size is smaller than the segment size, that'll mean we can
-  // serve the request from the segment itself.
+  // serve the request from the segment itself, splitting off the unused part
+  // if it's large enough.
   if (new_size <= seg->size) {
-    // If the segment's use shrinks by a segment header size or more, we'll
-    // split the segment.
-    if (new_size <= seg->size - segment::header_size()) {
-
-      fhtagn::size_t new_seg_size = seg->size - new_size;
-      seg->size = new_size;
-
-      void * new_seg_addr = pointer(seg).char_ptr + seg->full_size();
-      segment * new_seg = new (new_seg_addr) segment(new_seg_size);
-
-      new_seg->next = seg->next;
-      seg->next = new_seg;
-
-      defragment_free_list();
-    }
-    return pointer(seg).char_ptr + segment::header_size();
+    m_heap.split_segment(seg, new_size);
+    return seg->data();
   }
 
   // The best case would be if ptr's segment was followed by a free segment
-  // large enough to hold the new size. Given that free segments get
-  // defragmented, we only need to check the following segment.
-  if (segment::LAST_SEGMENT != seg->marker
-      && static_cast<char>(segment::FREE) == seg->next->status)
-  {
-    // The next segment may be a candidate. Calculate the combined size for
-    // both, and check whether that'd be enough.
-    fhtagn::size_t combined_size = seg->size + seg->next->full_size();
-    if (combined_size >= new_size) {
-      // This is awesome, the new size would fit. There are however a few cases
-      // here, that need careful handling.
-      //
-      // a) The combined size is exactly the new size. That's the easiest one.
-      if (combined_size == new_size) {
-        seg->size = new_size;
-        seg->next = seg->next->next;
-        return pointer(seg).char_ptr + segment::header_size();
-      }
-
-      // b) The combined size is large enough to fit the new_size and a new
-      //    segment header, so we can split off unused memory.
-      if (combined_size - new_size > segment::header_size()) {
-        seg->size = new_size;
-
-        void * new_seg_addr = pointer(seg).char_ptr + seg->full_size();
-        segment * new_seg = new (new_seg_addr) segment(combined_size - seg->size);
-
-        new_seg->next = seg->next;
-        seg->next = new_seg;
-
-        defragment_free_list();
-        return pointer(seg).char_ptr + segment::header_size();
-      }
-
-      // c) The combined size is large enough to fit new_size, but not large
-      //    enough to also fit a segment header. Given that we can't allocate
-      //    *anything* in memory blocks this small, we might as well merge that
-      //    as unused memory onto the current segment.
-      seg->size = combined_size;
-      seg->next = seg->next->next;
-      return pointer(seg).char_ptr + segment::header_size();
-    }
+  // large enough to hold the new size.
+  if (m_heap.grow_segment(seg, new_size)) {
+    return seg->data();
   }
 
   // Apparently we could not merge the currently used segment with it's
   // neighbouring one. So let's find some new space for this pointer to point
   // to.
-  segment * new_seg = allocate_segment(new_size);
+  segment * new_seg = m_heap.allocate_segment(new_size);
   if (!new_seg) {
     return NULL;
   }
 
   // If alloc returned a new segment, we'll move over the old data and free the
-  // old segment. Since freeing also defragments, there's no need to defragment
-  // manually here.
-  void * old_data = pointer(seg).char_ptr + segment::header_size();
-  void * new_data = pointer(new_seg).char_ptr + segment::header_size();
-
-  ::memcpy(new_data, old_data, std::min(seg->size, new_size));
+  // old segment.
+  ::memcpy(new_seg->data(), seg->data(), std::min(seg->size, new_size));
 
   // Same as free(), but without an additional lock.
-  seg->status = segment::FREE;
-  defragment_free_list();
+  m_heap.release_segment(seg);
 
-  return new_data;
+  return new_seg->data();
 }
 
 
@@ -311,8 +178,9 @@ typename fixed_pool<mutexT, block_alignmentT, adoption_policyT>::segment *
 fixed_pool<mutexT, block_alignmentT, adoption_policyT>::find_segment_for(
     void * ptr) const
 {
+  char * start = pointer(m_memblock).char_ptr + segment::header_size();
   void * end = pointer(m_memblock).char_ptr + m_size;
-  if (ptr < m_memblock || ptr >= end) {
+  if (ptr < start || ptr >= end) {
     std::stringstream s;
     s << "fixed_pool: can't free pointer " << std::hex << ptr
       << ", it's not in pool " << m_memblock << " of size " << std::dec
@@ -320,19 +188,8 @@ fixed_pool<mutexT, block_alignmentT, adoption_policyT>::find_segment_for(
     throw std::logic_error(s.str());
   }
 
-  // We'll traverse the whole segment list for safety reasons: this lets us
-  // detect whether ptr is pointing to the start of a segment's data, as it
-  // always should.
-  segment * seg = m_start;
-
-  while (ptr != pointer(seg).char_ptr + segment::header_size()) {
-    if (segment::LAST_SEGMENT == seg->marker) {
-      break;
-    }
-    seg = seg->next;
-  }
-
-  if (ptr != pointer(seg).char_ptr + segment::header_size()) {
+  segment * seg = m_heap.find_segment_for(ptr);
+  if (!seg) {
     std::stringstream s;
     s << "fixed_pool: can't free pointer " << std::hex << ptr
       << "; it's in pool " << m_memblock << " of size " << std::dec << m_size
@@ -359,12 +216,8 @@ fixed_pool<mutexT, block_alignmentT, adoption_policyT>::free(void * ptr)
 
   typename mutex_t::scoped_lock lock(m_mutex);
 
-  // Find segment for pointer, and mark the memory freed.
-  segment * seg = find_segment_for(ptr);
-  seg->status = segment::FREE;
-
-  // Lastly, defragment the free list.
-  defragment_free_list();
+  // Find segment for pointer, and release it.
+  m_heap.release_segment(find_segment_for(ptr));
 }
 
 
@@ -375,11 +228,10 @@ template <
   template <typename> class adoption_policyT
 >
 bool
-fixed_pool<mutexT, block_alignmentT, adoption_policyT>::in_use() const
+fixed_pool<mutexT, block_alignmentT, adoption_policyT>::owns(void * ptr) const
 {
-  typename mutex_t::scoped_lock lock(m_mutex);
-
-  return (segment::LAST_SEGMENT != m_start->marker);
+  // The memory block never changes, so there's no need to lock.
+  return (m_memblock <= ptr && ptr < pointer(m_memblock).char_ptr + m_size);
 }
 
 
@@ -389,64 +241,87 @@ template <
   typename block_alignmentT,
   template <typename> class adoption_policyT
 >
-void
-fixed_pool<mutexT, block_alignmentT, adoption_policyT>::defragment_free_list()
+fhtagn::size_t
+fixed_pool<mutexT, block_alignmentT, adoption_policyT>::alloc_bulk(
+    fhtagn::size_t size, fhtagn::size_t count, void ** ptrs)
 {
-  // Since all fragments are in sequence, all we need to do is find two or more
-  // free segments in a row, and merge them.
-  segment * contiguous = NULL;
-
-  segment * seg = m_start;
-  do {
-
-    if (static_cast<char>(segment::FREE) == seg->status) {
-      // If there's no current contiguous segment, start one now. That's all
-      // we need to do at this point.
-      if (!contiguous) {
-        contiguous = seg;
+  if (!size || !count) {
+    return 0;
+  }
+
+  size = block_alignmentT::adjust_size(std::max(size,
+        heap_t::min_data_size()));
+
+  typename mutex_t::scoped_lock lock(m_mutex);
+
+  // Try to allocate one segment that can hold all objects including their
+  // headers; the last object's header is the segment's own.
+  fhtagn::size_t stride = segment::header_size() + size;
+  segment * seg = NULL;
+  if (size <= m_size && count <= (m_size - size) / stride + 1) {
+    seg = m_heap.allocate_segment((count - 1) * stride + size);
+  }
+
+  if (!seg) {
+    fhtagn::size_t allocated = 0;
+    for ( ; allocated < count ; ++allocated) {
+      segment * item = m_heap.allocate_segment(size);
+      if (!item) {
+        break;
       }
-      // All other free segments are part of the current contiguous segment
+      ptrs[allocated] = item->data();
     }
+    return allocated;
+  }
 
-    else if (static_cast<char>(segment::ALLOCATED) == seg->status) {
-      // If there's a contiguous segment, then this current segments signals
-      // the end of it.
-      if (contiguous) {
-        if (contiguous->next == seg) {
-          // Found a single free segment, no merging necessary or possible.
-          contiguous = NULL;
-        }
-        else {
-          // Since the segments are contiguous, all merging is is adjusting
-          // the size and next members of the first segment in the list.
-          contiguous->next = seg;
-          contiguous->size = (pointer(seg).char_ptr
-              - pointer(contiguous).char_ptr) - segment::header_size();
-
-          contiguous = NULL;
-        }
-      }
+  // Carve the segment up; the last object keeps whatever slack
+  // allocate_segment() left.
+  m_heap.carve_segment(seg, size, count, ptrs);
 
-    }
+  return count;
+}
+
+
+
+template <
+  typename mutexT,
+  typename block_alignmentT,
+  template <typename> class adoption_policyT
+>
+void
+fixed_pool<mutexT, block_alignmentT, adoption_policyT>::free_bulk(
+    void ** ptrs, fhtagn::size_t count)
+{
+  if (!count) {
+    return;
+  }
 
-    // Break after last segment.
-    if (segment::LAST_SEGMENT == seg->marker) {
-      break;
+  typename mutex_t::scoped_lock lock(m_mutex);
+
+  for (fhtagn::size_t i = 0 ; i < count ; ++i) {
+    if (ptrs[i]) {
+      m_heap.release_segment(find_segment_for(ptrs[i]));
     }
-    seg = seg->next;
-  } while (true);
-
-  // If the contiguous segment is set here, that means the segment reaches
-  // up to the end of the memory block. Let's merge stuff, then.
-  if (contiguous) {
-    contiguous->marker = segment::LAST_SEGMENT;
-    contiguous->size = ((pointer(m_memblock).char_ptr + m_size)
-        - pointer(contiguous).char_ptr) - segment::header_size();
   }
 }
 
 
 
+template <
+  typename mutexT,
+  typename block_alignmentT,
+  template <typename> class adoption_policyT
+>
+bool
+fixed_pool<mutexT, block_alignmentT, adoption_policyT>::in_use() const
+{
+  typename mutex_t::scoped_lock lock(m_mutex);
+
+  return m_heap.used() > 0;
+}
+
+
+
 template <
   typename mutexT,
   typename block_alignmentT,
@@ -465,6 +340,19 @@ fixed_pool<mutexT, block_alignmentT, adoption_policyT>::alloc_size(
   return seg->size;
 }
 
+
+
+template <
+  typename mutexT,
+  typename block_alignmentT,
+  template <typename> class adoption_policyT
+>
+mutexT &
+fixed_pool<mutexT, block_alignmentT, adoption_policyT>::mutex() const
+{
+  return m_mutex;
+}
+
 }} // namespace fhtagn::memory
 
 
@@ -0,0 +1,340 @@
+/**
+ * $Id$
+ *
+ * This file is part of the Fhtagn! C++ Library.
+ * Copyright (C) 2009 Jens Finkhaeuser <unwesen@users.sourceforge.net>.
+ *
+ * Author: Jens Finkhaeuser <unwesen@users.sourceforge.net>
+ *
+ * This program is licensed as free software for personal, educational or
+ * other non-commerical uses: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation, either version 3 of the License, or (at your
+ * option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Alternatively, licenses for commercial purposes are available as well.
+ * Please send your enquiries to the copyright holder's address above.
+ **/
+#ifndef FHTAGN_MEMORY_DETAIL_GLOBAL_NEW_TCC
+#define FHTAGN_MEMORY_DETAIL_GLOBAL_NEW_TCC
+
+#ifndef __cplusplus
+#error You are trying to include a C++ only header file
+#endif
+
+#include <stdlib.h>
+
+namespace fhtagn {
+namespace memory {
+
+namespace detail {
+
+/**
+ * Number of global_new::reentry_guard instances alive in the calling thread.
+ **/
+inline int & global_new_depth()
+{
+  static FHTAGN_GLOBAL_NEW_THREAD_LOCAL int depth = 0;
+  return depth;
+}
+
+} // namespace detail
+
+
+
+template <
+  typename poolT,
+  typename sourceT,
+  fhtagn::size_t MAX_OBJECT_SIZE
+>
+typename global_new<poolT, sourceT, MAX_OBJECT_SIZE>::storage
+global_new<poolT, sourceT, MAX_OBJECT_SIZE>::s_storage;
+
+template <
+  typename poolT,
+  typename sourceT,
+  fhtagn::size_t MAX_OBJECT_SIZE
+>
+int volatile global_new<poolT, sourceT, MAX_OBJECT_SIZE>::s_state
+  = global_new<poolT, sourceT, MAX_OBJECT_SIZE>::UNINITIALIZED;
+
+
+
+template <
+  typename poolT,
+  typename sourceT,
+  fhtagn::size_t MAX_OBJECT_SIZE
+>
+global_new<poolT, sourceT, MAX_OBJECT_SIZE>::reentry_guard::reentry_guard()
+{
+  ++detail::global_new_depth();
+}
+
+
+
+template <
+  typename poolT,
+  typename sourceT,
+  fhtagn::size_t MAX_OBJECT_SIZE
+>
+global_new<poolT, sourceT, MAX_OBJECT_SIZE>::reentry_guard::~reentry_guard()
+{
+  --detail::global_new_depth();
+}
+
+
+
+template <
+  typename poolT,
+  typename sourceT,
+  fhtagn::size_t MAX_OBJECT_SIZE
+>
+bool
+global_new<poolT, sourceT, MAX_OBJECT_SIZE>::reentry_guard::active()
+{
+  return detail::global_new_depth() > 0;
+}
+
+
+
+template <
+  typename poolT,
+  typename sourceT,
+  fhtagn::size_t MAX_OBJECT_SIZE
+>
+typename global_new<poolT, sourceT, MAX_OBJECT_SIZE>::pool_t *
+global_new<poolT, sourceT, MAX_OBJECT_SIZE>::pool()
+{
+  if (READY != fhtagn::threads::atomic_load(s_state)) {
+    return NULL;
+  }
+  return reinterpret_cast<pool_t *>(s_storage.bytes);
+}
+
+
+
+template <
+  typename poolT,
+  typename sourceT,
+  fhtagn::size_t MAX_OBJECT_SIZE
+>
+typename global_new<poolT, sourceT, MAX_OBJECT_SIZE>::pool_t *
+global_new<poolT, sourceT, MAX_OBJECT_SIZE>::acquire_pool()
+{
+  pool_t * result = pool();
+  if (result) {
+    return result;
+  }
+
+  // Only one thread gets to construct the pool; others fall back to malloc()
+  // in the meantime rather than wait, so that there's no way to deadlock
+  // here.
+  if (!fhtagn::threads::compare_and_swap(s_state, int(UNINITIALIZED),
+        int(INITIALIZING)))
+  {
+    return NULL;
+  }
+
+  try {
+    reentry_guard guard;
+    result = new (s_storage.bytes) pool_t();
+  } catch (...) {
+    fhtagn::threads::atomic_store(s_state, int(FAILED));
+    return NULL;
+  }
+
+  fhtagn::threads::atomic_store(s_state, int(READY));
+  return result;
+}
+
+
+
+template <
+  typename poolT,
+  typename sourceT,
+  fhtagn::size_t MAX_OBJECT_SIZE
+>
+void *
+global_new<poolT, sourceT, MAX_OBJECT_SIZE>::alloc(fhtagn::size_t size)
+{
+  if (!size) {
+    size = 1;
+  }
+
+  if (size <= MAX_OBJECT_SIZE && !reentry_guard::active()) {
+    pool_t * p = acquire_pool();
+    if (p) {
+      reentry_guard guard;
+      void * ptr = p->alloc(size);
+      if (ptr) {
+        return ptr;
+      }
+    }
+  }
+
+  return ::malloc(size);
+}
+
+
+
+template <
+  typename poolT,
+  typename sourceT,
+  fhtagn::size_t MAX_OBJECT_SIZE
+>
+void *
+global_new<poolT, sourceT, MAX_OBJECT_SIZE>::alloc_aligned(fhtagn::size_t size,
+    fhtagn::size_t alignment)
+{
+  if (alignment <= POOL_ALIGNMENT) {
+    return alloc(size);
+  }
+
+  if (!size) {
+    size = 1;
+  }
+  if (alignment < sizeof(void *)) {
+    alignment = sizeof(void *);
+  }
+  return allocate_aligned(size, alignment);
+}
+
+
+
+template <
+  typename poolT,
+  typename sourceT,
+  fhtagn::size_t MAX_OBJECT_SIZE
+>
+void
+global_new<poolT, sourceT, MAX_OBJECT_SIZE>::free(void * ptr)
+{
+  if (!ptr) {
+    return;
+  }
+
+  // Only pointers allocated from the pool can lie in the source's blocks, and
+  // the pool must have been constructed for that to happen.
+  if (sourceT::owns(ptr)) {
+    reentry_guard guard;
+    pool()->free(ptr);
+    return;
+  }
+
+  ::free(ptr);
+}
+
+
+
+template <
+  typename poolT,
+  typename sourceT,
+  fhtagn::size_t MAX_OBJECT_SIZE
+>
+void
+global_new<poolT, sourceT, MAX_OBJECT_SIZE>::free(void * ptr,
+    fhtagn::size_t size)
+{
+  // Large objects never come from the pool, so we can skip the lookup.
+  if (size > MAX_OBJECT_SIZE) {
+    ::free(ptr);
+    return;
+  }
+  free(ptr);
+}
+
+
+
+template <
+  typename poolT,
+  typename sourceT,
+  fhtagn::size_t MAX_OBJECT_SIZE
+>
+void
+global_new<poolT, sourceT, MAX_OBJECT_SIZE>::free_aligned(void * ptr,
+    fhtagn::size_t alignment)
+{
+  if (alignment <= POOL_ALIGNMENT) {
+    free(ptr);
+    return;
+  }
+
+  ::fhtagn::memory::free_aligned(ptr);
+}
+
+
+
+template <
+  typename poolT,
+  typename sourceT,
+  fhtagn::size_t MAX_OBJECT_SIZE
+>
+void
+global_new<poolT, sourceT, MAX_OBJECT_SIZE>::call_new_handler()
+{
+#if __cplusplus >= 201103L
+  std::new_handler handler = std::get_new_handler();
+#else
+  // Not thread-safe, but the only way to find the current new handler before
+  // C++11.
+  std::new_handler handler = std::set_new_handler(0);
+  std::set_new_handler(handler);
+#endif
+
+  if (!handler) {
+    throw std::bad_alloc();
+  }
+  handler();
+}
+
+
+
+template <
+  typename poolT,
+  typename sourceT,
+  fhtagn::size_t MAX_OBJECT_SIZE
+>
+void *
+global_new<poolT, sourceT, MAX_OBJECT_SIZE>::new_object(fhtagn::size_t size)
+{
+  while (true) {
+    void * ptr = alloc(size);
+    if (ptr) {
+      return ptr;
+    }
+    call_new_handler();
+  }
+}
+
+
+
+template <
+  typename poolT,
+  typename sourceT,
+  fhtagn::size_t MAX_OBJECT_SIZE
+>
+void *
+global_new<poolT, sourceT, MAX_OBJECT_SIZE>::new_aligned_object(
+    fhtagn::size_t size, fhtagn::size_t alignment)
+{
+  while (true) {
+    void * ptr = alloc_aligned(size, alignment);
+    if (ptr) {
+      return ptr;
+    }
+    call_new_handler();
+  }
+}
+
+}} // namespace fhtagn::memory
+
+
+#endif // guard
@@ -32,10 +32,134 @@
 
 #if defined(HAVE_MALLOC_SIZE)
 #include <malloc/malloc.h>
+#elif defined(__GLIBC__)
+#include <malloc.h>
 #endif
 
 namespace fhtagn {
 namespace memory {
+namespace detail {
+
+/**
+ * Detects whether poolT has alloc_bulk() and free_bulk() members with the
+ * signatures described in memory_pool.h.
+ **/
+template <
+  typename poolT
+>
+struct has_bulk_api
+{
+  typedef char yes_t;
+  typedef char (&no_t)[2];
+
+  template <
+    typename T,
+    fhtagn::size_t (T::*)(fhtagn::size_t, fhtagn::size_t, void **),
+    void (T::*)(void **, fhtagn::size_t)
+  >
+  struct check;
+
+  template <typename T>
+  static yes_t test(check<T, &T::alloc_bulk, &T::free_bulk> *);
+
+  template <typename T>
+  static no_t test(...);
+
+  enum {
+    value = (sizeof(test<poolT>(0)) == sizeof(yes_t)),
+  };
+};
+
+
+
+template <
+  bool NATIVE
+>
+struct bulk_dispatch
+{
+  template <
+    typename poolT
+  >
+  static inline fhtagn::size_t alloc_bulk(poolT & pool, fhtagn::size_t size,
+      fhtagn::size_t count, void ** ptrs)
+  {
+    return pool.alloc_bulk(size, count, ptrs);
+  }
+
+  template <
+    typename poolT
+  >
+  static inline void free_bulk(poolT & pool, void ** ptrs,
+      fhtagn::size_t count)
+  {
+    pool.free_bulk(ptrs, count);
+  }
+};
+
+
+
+template <>
+struct bulk_dispatch<false>
+{
+  template <
+    typename poolT
+  >
+  static inline fhtagn::size_t alloc_bulk(poolT & pool, fhtagn::size_t size,
+      fhtagn::size_t count, void ** ptrs)
+  {
+    fhtagn::size_t allocated = 0;
+    for ( ; allocated < count ; ++allocated) {
+      void * ptr = pool.alloc(size);
+      if (!ptr) {
+        break;
+      }
+      ptrs[allocated] = ptr;
+    }
+    return allocated;
+  }
+
+  template <
+    typename poolT
+  >
+  static inline void free_bulk(poolT & pool, void ** ptrs,
+      fhtagn::size_t count)
+  {
+    for (fhtagn::size_t i = 0 ; i < count ; ++i) {
+      pool.free(ptrs[i]);
+    }
+  }
+};
+
+} // namespace detail
+
+
+
+template <
+  typename poolT
+>
+fhtagn::size_t
+alloc_bulk(poolT & pool, fhtagn::size_t size, fhtagn::size_t count,
+    void ** ptrs)
+{
+  return detail::bulk_dispatch<
+      detail::has_bulk_api<poolT>::value
+    >::alloc_bulk(pool, size, count, ptrs);
+}
+
+
+
+template <
+  typename poolT
+>
+void
+free_bulk(poolT & pool, void ** ptrs, fhtagn::size_t count)
+{
+  detail::bulk_dispatch<
+      detail::has_bulk_api<poolT>::value
+    >::free_bulk(pool, ptrs, count);
+}
+
+
 
 void *
 heap_pool::alloc(fhtagn::size_t size)
@@ -91,6 +215,8 @@ heap_pool::alloc_size(void * ptr) const
 
 #if defined(HAVE_MALLOC_SIZE)
   return malloc_size(ptr);
+#elif defined(__GLIBC__)
+  return malloc_usable_size(ptr);
 #else
   return 0;
 #endif
@@ -0,0 +1,497 @@
+/**
+ * $Id$
+ *
+ * This file is part of the Fhtagn! C++ Library.
+ * Copyright (C) 2009 Jens Finkhaeuser <unwesen@users.sourceforge.net>.
+ *
+ * Author: Jens Finkhaeuser <unwesen@users.sourceforge.net>
+ *
+ * This program is licensed as free software for personal, educational or
+ * other non-commerical uses: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation, either version 3 of the License, or (at your
+ * option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Alternatively, licenses for commercial purposes are available as well.
+ * Please send your enquiries to the copyright holder's address above.
+ **/
+#ifndef FHTAGN_MEMORY_DETAIL_MONOTONIC_POOL_TCC
+#define FHTAGN_MEMORY_DETAIL_MONOTONIC_POOL_TCC
+
+#ifndef __cplusplus
+#error You are trying to include a C++ only header file
+#endif
+
+#include <string.h>
+
+#include <algorithm>
+
+namespace fhtagn {
+namespace memory {
+
+template <
+  fhtagn::size_t MEMORY_BLOCK_SIZE,
+  typename mutexT,
+  typename block_alignmentT,
+  typename sourceT
+>
+monotonic_pool<MEMORY_BLOCK_SIZE, mutexT, block_alignmentT, sourceT>::monotonic_pool()
+  : m_current(NULL)
+  , m_pos(NULL)
+  , m_last(NULL)
+{
+}
+
+
+
+template <
+  fhtagn::size_t MEMORY_BLOCK_SIZE,
+  typename mutexT,
+  typename block_alignmentT,
+  typename sourceT
+>
+monotonic_pool<MEMORY_BLOCK_SIZE, mutexT, block_alignmentT, sourceT>::monotonic_pool(
+    void * memblock, fhtagn::size_t size)
+  : m_current(NULL)
+  , m_pos(NULL)
+  , m_last(NULL)
+{
+  m_current = init_block(memblock, size, NULL, NULL, 0);
+  if (m_current) {
+    m_pos = m_current->begin();
+  }
+}
+
+
+
+template <
+  fhtagn::size_t MEMORY_BLOCK_SIZE,
+  typename mutexT,
+  typename block_alignmentT,
+  typename sourceT
+>
+monotonic_pool<MEMORY_BLOCK_SIZE, mutexT, block_alignmentT, sourceT>::~monotonic_pool()
+{
+  while (m_current) {
+    block * prev = m_current->prev;
+    if (m_current->raw) {
+      sourceT::release(m_current->raw, m_current->raw_size);
+    }
+    m_current = prev;
+  }
+}
+
+
+
+template <
+  fhtagn::size_t MEMORY_BLOCK_SIZE,
+  typename mutexT,
+  typename block_alignmentT,
+  typename sourceT
+>
+fhtagn::size_t
+monotonic_pool<MEMORY_BLOCK_SIZE, mutexT, block_alignmentT, sourceT>::alloc_header_size()
+{
+  return block_alignmentT::adjust_size(sizeof(fhtagn::size_t));
+}
+
+
+
+template <
+  fhtagn::size_t MEMORY_BLOCK_SIZE,
+  typename mutexT,
+  typename block_alignmentT,
+  typename sourceT
+>
+fhtagn::size_t &
+monotonic_pool<MEMORY_BLOCK_SIZE, mutexT, block_alignmentT, sourceT>::size_of(
+    void * ptr)
+{
+  return *reinterpret_cast<fhtagn::size_t *>(pointer(ptr).char_ptr
+      - sizeof(fhtagn::size_t));
+}
+
+
+
+template <
+  fhtagn::size_t MEMORY_BLOCK_SIZE,
+  typename mutexT,
+  typename block_alignmentT,
+  typename sourceT
+>
+fhtagn::size_t
+monotonic_pool<MEMORY_BLOCK_SIZE, mutexT, block_alignmentT, sourceT>::max_request_size()
+{
+  // adjust_size() may add up to one BLOCK_SIZE, and grow() adds another one
+  // for aligning the block's start.
+  return ~fhtagn::size_t(0) - block::header_size() - alloc_header_size()
+    - 2 * block_alignmentT::BLOCK_SIZE;
+}
+
+
+
+template <
+  fhtagn::size_t MEMORY_BLOCK_SIZE,
+  typename mutexT,
+  typename block_alignmentT,
+  typename sourceT
+>
+typename monotonic_pool<MEMORY_BLOCK_SIZE, mutexT, block_alignmentT, sourceT>::block *
+monotonic_pool<MEMORY_BLOCK_SIZE, mutexT, block_alignmentT, sourceT>::init_block(
+    void * memblock, fhtagn::size_t size, block * prev, void * raw,
+    fhtagn::size_t raw_size)
+{
+  // Same as in fixed_pool: align the start of the block, and only use whole
+  // multiples of the alignment.
+  void * adjusted_start = block_alignmentT::adjust_pointer(memblock);
+  fhtagn::size_t size_diff = pointer(adjusted_start).char_ptr
+    - pointer(memblock).char_ptr;
+  if (size_diff + block::header_size() > size) {
+    return NULL;
+  }
+  fhtagn::size_t adjusted_size = size - size_diff;
+  adjusted_size -= adjusted_size % block_alignmentT::BLOCK_SIZE;
+
+  block * b = static_cast<block *>(adjusted_start);
+  b->prev = prev;
+  b->size = adjusted_size;
+  b->raw = raw;
+  b->raw_size = raw_size;
+  return b;
+}
+
+
+
+template <
+  fhtagn::size_t MEMORY_BLOCK_SIZE,
+  typename mutexT,
+  typename block_alignmentT,
+  typename sourceT
+>
+bool
+monotonic_pool<MEMORY_BLOCK_SIZE, mutexT, block_alignmentT, sourceT>::grow(
+    fhtagn::size_t size)
+{
+  // Blocks are allocated with enough slack to align their start. Requests
+  // that don't fit into a regular block get a block of their own.
+  fhtagn::size_t block_size = std::max(MEMORY_BLOCK_SIZE,
+      block::header_size() + size + block_alignmentT::BLOCK_SIZE);
+
+  void * raw = sourceT::allocate(block_size, sizeof(void *));
+  if (!raw) {
+    return false;
+  }
+
+  m_current = init_block(raw, block_size, m_current, raw, block_size);
+  m_pos = m_current->begin();
+  return true;
+}
+
+
+
+template <
+  fhtagn::size_t MEMORY_BLOCK_SIZE,
+  typename mutexT,
+  typename block_alignmentT,
+  typename sourceT
+>
+void
+monotonic_pool<MEMORY_BLOCK_SIZE, mutexT, block_alignmentT, sourceT>::release_until(
+    block * keep)
+{
+  while (m_current && m_current != keep) {
+    block * prev = m_current->prev;
+    if (m_current->raw) {
+      sourceT::release(m_current->raw, m_current->raw_size);
+    }
+    m_current = prev;
+  }
+  m_last = NULL;
+}
+
+
+
+template <
+  fhtagn::size_t MEMORY_BLOCK_SIZE,
+  typename mutexT,
+  typename block_alignmentT,
+  typename sourceT
+>
+void *
+monotonic_pool<MEMORY_BLOCK_SIZE, mutexT, block_alignmentT, sourceT>::alloc_unlocked(
+    fhtagn::size_t size)
+{
+  if (size > max_request_size()) {
+    return NULL;
+  }
+
+  size = block_alignmentT::adjust_size(size);
+  fhtagn::size_t required = alloc_header_size() + size;
+
+  if (!m_current
+      || static_cast<fhtagn::size_t>(m_current->end() - m_pos) < required)
+  {
+    if (!grow(required)
+        || static_cast<fhtagn::size_t>(m_current->end() - m_pos) < required)
+    {
+      return NULL;
+    }
+  }
+
+  void * result = m_pos + alloc_header_size();
+  size_of(result) = size;
+  m_pos += required;
+  m_last = pointer(result).char_ptr;
+  return result;
+}
+
+
+
+template <
+  fhtagn::size_t MEMORY_BLOCK_SIZE,
+  typename mutexT,
+  typename block_alignmentT,
+  typename sourceT
+>
+void *
+monotonic_pool<MEMORY_BLOCK_SIZE, mutexT, block_alignmentT, sourceT>::alloc(
+    fhtagn::size_t size)
+{
+  if (!size) {
+    return NULL;
+  }
+
+  typename mutex_t::scoped_lock lock(m_mutex);
+  return alloc_unlocked(size);
+}
+
+
+
+template <
+  fhtagn::size_t MEMORY_BLOCK_SIZE,
+  typename mutexT,
+  typename block_alignmentT,
+  typename sourceT
+>
+void *
+monotonic_pool<MEMORY_BLOCK_SIZE, mutexT, block_alignmentT, sourceT>::realloc(
+    void * ptr, fhtagn::size_t new_size)
+{
+  if (!new_size || new_size > max_request_size()) {
+    return NULL;
+  }
+
+  typename mutex_t::scoped_lock lock(m_mutex);
+
+  if (!ptr) {
+    return alloc_unlocked(new_size);
+  }
+
+  fhtagn::size_t old_size = size_of(ptr);
+
+  // The most recent allocation can grow or shrink in place, as long as it
+  // fits into the current block.
+  if (ptr == m_last) {
+    fhtagn::size_t adjusted = block_alignmentT::adjust_size(new_size);
+    if (static_cast<fhtagn::size_t>(m_current->end() - m_last) >= adjusted) {
+      size_of(ptr) = adjusted;
+      m_pos = m_last + adjusted;
+      return ptr;
+    }
+  }
+
+  // Otherwise we need new space; the old allocation stays where it is until
+  // the pool is reset.
+  void * result = alloc_unlocked(new_size);
+  if (!result) {
+    return NULL;
+  }
+  ::memcpy(result, ptr, std::min(old_size, size_of(result)));
+  return result;
+}
+
+
+
+template <
+  fhtagn::size_t MEMORY_BLOCK_SIZE,
+  typename mutexT,
+  typename block_alignmentT,
+  typename sourceT
+>
+void
+monotonic_pool<MEMORY_BLOCK_SIZE, mutexT, block_alignmentT, sourceT>::free(void *)
+{
+  // Memory is only ever released by reset() or rewind().
+}
+
+
+
+template <
+  fhtagn::size_t MEMORY_BLOCK_SIZE,
+  typename mutexT,
+  typename block_alignmentT,
+  typename sourceT
+>
+fhtagn::size_t
+monotonic_pool<MEMORY_BLOCK_SIZE, mutexT, block_alignmentT, sourceT>::alloc_bulk(
+    fhtagn::size_t size, fhtagn::size_t count, void ** ptrs)
+{
+  if (!size || !count) {
+    return 0;
+  }
+
+  typename mutex_t::scoped_lock lock(m_mutex);
+
+  fhtagn::size_t allocated = 0;
+  for ( ; allocated < count ; ++allocated) {
+    void * ptr = alloc_unlocked(size);
+    if (!ptr) {
+      break;
+    }
+    ptrs[allocated] = ptr;
+  }
+  return allocated;
+}
+
+
+
+template <
+  fhtagn::size_t MEMORY_BLOCK_SIZE,
+  typename mutexT,
+  typename block_alignmentT,
+  typename sourceT
+>
+void
+monotonic_pool<MEMORY_BLOCK_SIZE, mutexT, block_alignmentT, sourceT>::free_bulk(
+    void **, fhtagn::size_t)
+{
+  // Memory is only ever released by reset() or rewind().
+}
+
+
+
+template <
+  fhtagn::size_t MEMORY_BLOCK_SIZE,
+  typename mutexT,
+  typename block_alignmentT,
+  typename sourceT
+>
+bool
+monotonic_pool<MEMORY_BLOCK_SIZE, mutexT, block_alignmentT, sourceT>::in_use() const
+{
+  typename mutex_t::scoped_lock lock(m_mutex);
+
+  if (!m_current) {
+    return false;
+  }
+  return m_current->prev || m_pos != m_current->begin();
+}
+
+
+
+template <
+  fhtagn::size_t MEMORY_BLOCK_SIZE,
+  typename mutexT,
+  typename block_alignmentT,
+  typename sourceT
+>
+fhtagn::size_t
+monotonic_pool<MEMORY_BLOCK_SIZE, mutexT, block_alignmentT, sourceT>::alloc_size(
+    void * ptr) const
+{
+  if (!ptr) {
+    return 0;
+  }
+  return size_of(ptr);
+}
+
+
+
+template <
+  fhtagn::size_t MEMORY_BLOCK_SIZE,
+  typename mutexT,
+  typename block_alignmentT,
+  typename sourceT
+>
+mutexT &
+monotonic_pool<MEMORY_BLOCK_SIZE, mutexT, block_alignmentT, sourceT>::mutex() const
+{
+  return m_mutex;
+}
+
+
+
+template <
+  fhtagn::size_t MEMORY_BLOCK_SIZE,
+  typename mutexT,
+  typename block_alignmentT,
+  typename sourceT
+>
+void
+monotonic_pool<MEMORY_BLOCK_SIZE, mutexT, block_alignmentT, sourceT>::reset()
+{
+  typename mutex_t::scoped_lock lock(m_mutex);
+
+  if (!m_current) {
+    return;
+  }
+
+  // Keep the oldest block around for re-use.
+  block * first = m_current;
+  while (first->prev) {
+    first = first->prev;
+  }
+  release_until(first);
+  m_pos = m_current->begin();
+}
+
+
+
+template <
+  fhtagn::size_t MEMORY_BLOCK_SIZE,
+  typename mutexT,
+  typename block_alignmentT,
+  typename sourceT
+>
+typename monotonic_pool<MEMORY_BLOCK_SIZE, mutexT, block_alignmentT, sourceT>::marker
+monotonic_pool<MEMORY_BLOCK_SIZE, mutexT, block_alignmentT, sourceT>::mark() const
+{
+  typename mutex_t::scoped_lock lock(m_mutex);
+  return marker(m_current, m_pos);
+}
+
+
+
+template <
+  fhtagn::size_t MEMORY_BLOCK_SIZE,
+  typename mutexT,
+  typename block_alignmentT,
+  typename sourceT
+>
+void
+monotonic_pool<MEMORY_BLOCK_SIZE, mutexT, block_alignmentT, sourceT>::rewind(
+    marker const & m)
+{
+  if (!m.m_block) {
+    reset();
+    return;
+  }
+
+  typename mutex_t::scoped_lock lock(m_mutex);
+
+  release_until(static_cast<block *>(m.m_block));
+  m_pos = m.m_pos;
+}
+
+
+}} // namespace fhtagn::memory
+
+#endif // guard
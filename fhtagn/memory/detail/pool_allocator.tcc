@@ -30,11 +30,74 @@
 #error You are trying to include a C++ only header file
 #endif
 
+#include <algorithm>
 #include <limits>
 #include <stdexcept>
 
 namespace fhtagn {
 namespace memory {
+namespace detail {
+
+/**
+ * Helpers for the allocation policies' bulk functions. The pool's bulk API
+ * deals in void pointers, so the batch is passed through a buffer of those
+ * rather than reinterpreting the caller's array of T pointers; batches larger
+ * than the buffer take the pool's lock once per BULK_BUFFER_SIZE objects.
+ **/
+enum {
+  BULK_BUFFER_SIZE = 256,
+};
+
+template <
+  typename T,
+  typename memory_poolT
+>
+inline fhtagn::size_t
+allocate_bulk(memory_poolT & pool, fhtagn::size_t count, T ** ptrs)
+{
+  void * buffer[BULK_BUFFER_SIZE];
+
+  fhtagn::size_t allocated = 0;
+  while (allocated < count) {
+    fhtagn::size_t batch = std::min(count - allocated,
+        fhtagn::size_t(BULK_BUFFER_SIZE));
+    fhtagn::size_t got = alloc_bulk(pool, sizeof(T), batch, buffer);
+    for (fhtagn::size_t i = 0 ; i < got ; ++i) {
+      ptrs[allocated++] = static_cast<T *>(buffer[i]);
+    }
+
+    if (got < batch) {
+      break;
+    }
+  }
+  return allocated;
+}
+
+
+
+template <
+  typename T,
+  typename memory_poolT
+>
+inline void
+deallocate_bulk(memory_poolT & pool, T ** ptrs, fhtagn::size_t count)
+{
+  void * buffer[BULK_BUFFER_SIZE];
+
+  fhtagn::size_t done = 0;
+  while (done < count) {
+    fhtagn::size_t batch = std::min(count - done,
+        fhtagn::size_t(BULK_BUFFER_SIZE));
+    for (fhtagn::size_t i = 0 ; i < batch ; ++i) {
+      buffer[i] = ptrs[done + i];
+    }
+    free_bulk(pool, buffer, batch);
+    done += batch;
+  }
+}
+
+} // namespace detail
+
 
 
 /*****************************************************************************
@@ -195,6 +258,34 @@ pool_allocation_policy<T, memory_poolT, tagT>::deallocate(pointer p, size_type)
 }
 
 
+
+template <
+  typename T,
+  typename memory_poolT,
+  typename tagT
+>
+typename pool_allocation_policy<T, memory_poolT, tagT>::size_type
+pool_allocation_policy<T, memory_poolT, tagT>::allocate_bulk(size_type count,
+    pointer * ptrs)
+{
+  return detail::allocate_bulk(*m_pool, count, ptrs);
+}
+
+
+
+template <
+  typename T,
+  typename memory_poolT,
+  typename tagT
+>
+void
+pool_allocation_policy<T, memory_poolT, tagT>::deallocate_bulk(pointer * ptrs,
+    size_type count)
+{
+  detail::deallocate_bulk(*m_pool, ptrs, count);
+}
+
+
 template <
   typename T,
   typename memory_poolT,
@@ -256,6 +347,234 @@ inline bool operator==(
 
 
 
+/*****************************************************************************
+ * raw_pool_allocation_policy
+ **/
+template <
+  typename T,
+  typename memory_poolT,
+  typename tagT
+>
+raw_pool_allocation_policy<T, memory_poolT, tagT>::raw_pool_allocation_policy()
+  : m_pool(NULL)
+{
+  initialize_pool();
+}
+
+
+
+template <
+  typename T,
+  typename memory_poolT,
+  typename tagT
+>
+raw_pool_allocation_policy<T, memory_poolT, tagT>::~raw_pool_allocation_policy()
+{
+}
+
+
+
+template <
+  typename T,
+  typename memory_poolT,
+  typename tagT
+>
+raw_pool_allocation_policy<T, memory_poolT, tagT>::raw_pool_allocation_policy(
+    raw_pool_allocation_policy<T, memory_poolT, tagT> const & other)
+  : m_pool(other.get_memory_pool())
+{
+}
+
+
+
+template <
+  typename T,
+  typename memory_poolT,
+  typename tagT
+>
+template <
+  typename U
+>
+raw_pool_allocation_policy<T, memory_poolT, tagT>::raw_pool_allocation_policy(
+    raw_pool_allocation_policy<U, memory_poolT, tagT> const & other)
+  : m_pool(other.get_memory_pool())
+{
+}
+
+
+
+template <
+  typename T,
+  typename memory_poolT,
+  typename tagT
+>
+template <
+  typename U,
+  typename other_poolT,
+  typename other_tagT
+>
+raw_pool_allocation_policy<T, memory_poolT, tagT>::raw_pool_allocation_policy(
+    raw_pool_allocation_policy<U, other_poolT, other_tagT> const &)
+  : m_pool(NULL)
+{
+  initialize_pool();
+}
+
+
+
+template <
+  typename T,
+  typename memory_poolT,
+  typename tagT
+>
+void
+raw_pool_allocation_policy<T, memory_poolT, tagT>::initialize_pool()
+{
+  if (per_type_memory_pool) {
+    m_pool = per_type_memory_pool;
+    return;
+  }
+
+  if (!raw_pool_allocation_policy_base<memory_poolT, tagT>::global_memory_pool) {
+    throw std::logic_error("Constructing a raw_pool_allocation_policy<T> "
+        "without either a global pool or per-type pool set.");
+  }
+
+  m_pool = raw_pool_allocation_policy_base<memory_poolT, tagT>::global_memory_pool;
+}
+
+
+
+template <
+  typename T,
+  typename memory_poolT,
+  typename tagT
+>
+typename raw_pool_allocation_policy<T, memory_poolT, tagT>::memory_pool_ptr
+raw_pool_allocation_policy<T, memory_poolT, tagT>::get_memory_pool() const
+{
+  return m_pool;
+}
+
+
+
+template <
+  typename T,
+  typename memory_poolT,
+  typename tagT
+>
+bool
+raw_pool_allocation_policy<T, memory_poolT, tagT>::set_memory_pool(
+    typename raw_pool_allocation_policy<T, memory_poolT, tagT>::memory_pool_ptr new_pool)
+{
+  if (m_pool && m_pool->in_use()) {
+    return false;
+  }
+
+  m_pool = new_pool;
+  return true;
+}
+
+
+
+template <
+  typename T,
+  typename memory_poolT,
+  typename tagT
+>
+typename raw_pool_allocation_policy<T, memory_poolT, tagT>::pointer
+raw_pool_allocation_policy<T, memory_poolT, tagT>::allocate(size_type count,
+    typename std::allocator<void>::const_pointer /* = 0 */)
+{
+  return static_cast<T *>(m_pool->alloc(count * sizeof(T)));
+}
+
+
+
+template <
+  typename T,
+  typename memory_poolT,
+  typename tagT
+>
+void
+raw_pool_allocation_policy<T, memory_poolT, tagT>::deallocate(pointer p, size_type)
+{
+  m_pool->free(p);
+}
+
+
+
+template <
+  typename T,
+  typename memory_poolT,
+  typename tagT
+>
+typename raw_pool_allocation_policy<T, memory_poolT, tagT>::size_type
+raw_pool_allocation_policy<T, memory_poolT, tagT>::allocate_bulk(size_type count,
+    pointer * ptrs)
+{
+  return detail::allocate_bulk(*m_pool, count, ptrs);
+}
+
+
+
+template <
+  typename T,
+  typename memory_poolT,
+  typename tagT
+>
+void
+raw_pool_allocation_policy<T, memory_poolT, tagT>::deallocate_bulk(pointer * ptrs,
+    size_type count)
+{
+  detail::deallocate_bulk(*m_pool, ptrs, count);
+}
+
+
+
+template <
+  typename T,
+  typename memory_poolT,
+  typename tagT
+>
+typename raw_pool_allocation_policy<T, memory_poolT, tagT>::size_type
+raw_pool_allocation_policy<T, memory_poolT, tagT>::max_size() const
+{
+  return std::numeric_limits<size_type>::max();
+}
+
+
+
+template <
+  typename T1,
+  typename T2,
+  typename memory_poolT,
+  typename tagT
+>
+inline bool operator==(
+    raw_pool_allocation_policy<T1, memory_poolT, tagT> const & rhs,
+    raw_pool_allocation_policy<T2, memory_poolT, tagT> const & lhs)
+{
+  return (rhs.get_memory_pool() == lhs.get_memory_pool());
+}
+
+
+
+template <
+  typename T,
+  typename memory_poolT,
+  typename tagT,
+  typename other_allocatorT
+>
+inline bool operator==(
+    raw_pool_allocation_policy<T, memory_poolT, tagT> const &,
+    other_allocatorT const &)
+{
+  return false;
+}
+
+
+
 }} // namespace fhtagn::memory
 
 #endif // guard
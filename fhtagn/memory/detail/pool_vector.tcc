@@ -0,0 +1,630 @@
+/**
+ * $Id$
+ *
+ * This file is part of the Fhtagn! C++ Library.
+ * Copyright (C) 2009 Jens Finkhaeuser <unwesen@users.sourceforge.net>.
+ *
+ * Author: Jens Finkhaeuser <unwesen@users.sourceforge.net>
+ *
+ * This program is licensed as free software for personal, educational or
+ * other non-commerical uses: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation, either version 3 of the License, or (at your
+ * option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Alternatively, licenses for commercial purposes are available as well.
+ * Please send your enquiries to the copyright holder's address above.
+ **/
+#ifndef FHTAGN_MEMORY_DETAIL_POOL_VECTOR_TCC
+#define FHTAGN_MEMORY_DETAIL_POOL_VECTOR_TCC
+
+#ifndef __cplusplus
+#error You are trying to include a C++ only header file
+#endif
+
+#include <algorithm>
+#include <limits>
+#include <memory>
+#include <new>
+#include <stdexcept>
+
+namespace fhtagn {
+namespace memory {
+
+template <
+  typename T,
+  typename memory_poolT
+>
+pool_vector<T, memory_poolT>::pool_vector(memory_poolT & pool)
+  : m_pool(&pool)
+  , m_data(NULL)
+  , m_size(0)
+  , m_capacity(0)
+{
+}
+
+
+
+template <
+  typename T,
+  typename memory_poolT
+>
+pool_vector<T, memory_poolT>::pool_vector(memory_poolT & pool, size_type count,
+    value_type const & value /* = value_type() */)
+  : m_pool(&pool)
+  , m_data(NULL)
+  , m_size(0)
+  , m_capacity(0)
+{
+  // resize() leaves no elements behind if it fails, but the destructor won't
+  // run to release the memory it allocated.
+  try {
+    resize(count, value);
+  } catch (...) {
+    if (m_data) {
+      m_pool->free(m_data);
+    }
+    throw;
+  }
+}
+
+
+
+template <
+  typename T,
+  typename memory_poolT
+>
+pool_vector<T, memory_poolT>::pool_vector(pool_vector const & other)
+  : m_pool(other.m_pool)
+  , m_data(NULL)
+  , m_size(0)
+  , m_capacity(0)
+{
+  reserve(other.m_size);
+
+  // If copying fails, the destructor won't run, so clean up here.
+  try {
+    for ( ; m_size < other.m_size ; ++m_size) {
+      new (m_data + m_size) value_type(other.m_data[m_size]);
+    }
+  } catch (...) {
+    destroy(m_data, m_data + m_size);
+    if (m_data) {
+      m_pool->free(m_data);
+    }
+    throw;
+  }
+}
+
+
+
+template <
+  typename T,
+  typename memory_poolT
+>
+pool_vector<T, memory_poolT>::~pool_vector()
+{
+  clear();
+  if (m_data) {
+    m_pool->free(m_data);
+  }
+}
+
+
+
+template <
+  typename T,
+  typename memory_poolT
+>
+pool_vector<T, memory_poolT> &
+pool_vector<T, memory_poolT>::operator=(pool_vector const & other)
+{
+  if (this != &other) {
+    pool_vector copy(other);
+    swap(copy);
+  }
+  return *this;
+}
+
+
+
+template <
+  typename T,
+  typename memory_poolT
+>
+typename pool_vector<T, memory_poolT>::iterator
+pool_vector<T, memory_poolT>::begin()
+{
+  return m_data;
+}
+
+
+
+template <
+  typename T,
+  typename memory_poolT
+>
+typename pool_vector<T, memory_poolT>::const_iterator
+pool_vector<T, memory_poolT>::begin() const
+{
+  return m_data;
+}
+
+
+
+template <
+  typename T,
+  typename memory_poolT
+>
+typename pool_vector<T, memory_poolT>::iterator
+pool_vector<T, memory_poolT>::end()
+{
+  return m_data + m_size;
+}
+
+
+
+template <
+  typename T,
+  typename memory_poolT
+>
+typename pool_vector<T, memory_poolT>::const_iterator
+pool_vector<T, memory_poolT>::end() const
+{
+  return m_data + m_size;
+}
+
+
+
+template <
+  typename T,
+  typename memory_poolT
+>
+typename pool_vector<T, memory_poolT>::size_type
+pool_vector<T, memory_poolT>::size() const
+{
+  return m_size;
+}
+
+
+
+template <
+  typename T,
+  typename memory_poolT
+>
+typename pool_vector<T, memory_poolT>::size_type
+pool_vector<T, memory_poolT>::capacity() const
+{
+  return m_capacity;
+}
+
+
+
+template <
+  typename T,
+  typename memory_poolT
+>
+bool
+pool_vector<T, memory_poolT>::empty() const
+{
+  return !m_size;
+}
+
+
+
+template <
+  typename T,
+  typename memory_poolT
+>
+typename pool_vector<T, memory_poolT>::size_type
+pool_vector<T, memory_poolT>::max_size() const
+{
+  return std::numeric_limits<size_type>::max() / sizeof(value_type);
+}
+
+
+
+template <
+  typename T,
+  typename memory_poolT
+>
+typename pool_vector<T, memory_poolT>::reference
+pool_vector<T, memory_poolT>::operator[](size_type index)
+{
+  return m_data[index];
+}
+
+
+
+template <
+  typename T,
+  typename memory_poolT
+>
+typename pool_vector<T, memory_poolT>::const_reference
+pool_vector<T, memory_poolT>::operator[](size_type index) const
+{
+  return m_data[index];
+}
+
+
+
+template <
+  typename T,
+  typename memory_poolT
+>
+typename pool_vector<T, memory_poolT>::reference
+pool_vector<T, memory_poolT>::at(size_type index)
+{
+  if (index >= m_size) {
+    throw std::out_of_range("pool_vector: index out of range.");
+  }
+  return m_data[index];
+}
+
+
+
+template <
+  typename T,
+  typename memory_poolT
+>
+typename pool_vector<T, memory_poolT>::const_reference
+pool_vector<T, memory_poolT>::at(size_type index) const
+{
+  if (index >= m_size) {
+    throw std::out_of_range("pool_vector: index out of range.");
+  }
+  return m_data[index];
+}
+
+
+
+template <
+  typename T,
+  typename memory_poolT
+>
+typename pool_vector<T, memory_poolT>::reference
+pool_vector<T, memory_poolT>::front()
+{
+  return m_data[0];
+}
+
+
+
+template <
+  typename T,
+  typename memory_poolT
+>
+typename pool_vector<T, memory_poolT>::const_reference
+pool_vector<T, memory_poolT>::front() const
+{
+  return m_data[0];
+}
+
+
+
+template <
+  typename T,
+  typename memory_poolT
+>
+typename pool_vector<T, memory_poolT>::reference
+pool_vector<T, memory_poolT>::back()
+{
+  return m_data[m_size - 1];
+}
+
+
+
+template <
+  typename T,
+  typename memory_poolT
+>
+typename pool_vector<T, memory_poolT>::const_reference
+pool_vector<T, memory_poolT>::back() const
+{
+  return m_data[m_size - 1];
+}
+
+
+
+template <
+  typename T,
+  typename memory_poolT
+>
+typename pool_vector<T, memory_poolT>::pointer
+pool_vector<T, memory_poolT>::data()
+{
+  return m_data;
+}
+
+
+
+template <
+  typename T,
+  typename memory_poolT
+>
+typename pool_vector<T, memory_poolT>::const_pointer
+pool_vector<T, memory_poolT>::data() const
+{
+  return m_data;
+}
+
+
+
+template <
+  typename T,
+  typename memory_poolT
+>
+void
+pool_vector<T, memory_poolT>::reserve(size_type new_capacity)
+{
+  if (new_capacity <= m_capacity) {
+    return;
+  }
+  if (new_capacity > max_size()) {
+    throw std::length_error("pool_vector: requested capacity too large.");
+  }
+  reallocate(new_capacity, is_trivially_relocatable<value_type>());
+}
+
+
+
+template <
+  typename T,
+  typename memory_poolT
+>
+void
+pool_vector<T, memory_poolT>::resize(size_type new_size,
+    value_type const & value /* = value_type() */)
+{
+  if (new_size <= m_size) {
+    destroy(m_data + new_size, m_data + m_size);
+    m_size = new_size;
+    return;
+  }
+
+  if (new_size > m_capacity) {
+    // value might refer to an element of this vector, which growing would
+    // invalidate.
+    value_type copy(value);
+    grow(new_size);
+    std::uninitialized_fill(m_data + m_size, m_data + new_size, copy);
+  }
+  else {
+    std::uninitialized_fill(m_data + m_size, m_data + new_size, value);
+  }
+  m_size = new_size;
+}
+
+
+
+template <
+  typename T,
+  typename memory_poolT
+>
+void
+pool_vector<T, memory_poolT>::push_back(value_type const & value)
+{
+  if (m_size < m_capacity) {
+    new (m_data + m_size) value_type(value);
+    ++m_size;
+    return;
+  }
+
+  // See resize()
+  value_type copy(value);
+  grow(m_size + 1);
+  new (m_data + m_size) value_type(copy);
+  ++m_size;
+}
+
+
+
+template <
+  typename T,
+  typename memory_poolT
+>
+void
+pool_vector<T, memory_poolT>::pop_back()
+{
+  --m_size;
+  m_data[m_size].~value_type();
+}
+
+
+
+template <
+  typename T,
+  typename memory_poolT
+>
+typename pool_vector<T, memory_poolT>::iterator
+pool_vector<T, memory_poolT>::erase(iterator pos)
+{
+  return erase(pos, pos + 1);
+}
+
+
+
+template <
+  typename T,
+  typename memory_poolT
+>
+typename pool_vector<T, memory_poolT>::iterator
+pool_vector<T, memory_poolT>::erase(iterator first, iterator last)
+{
+  if (first == last) {
+    return first;
+  }
+
+  iterator new_end = std::copy(last, end(), first);
+  destroy(new_end, end());
+  m_size = new_end - m_data;
+  return first;
+}
+
+
+
+template <
+  typename T,
+  typename memory_poolT
+>
+void
+pool_vector<T, memory_poolT>::clear()
+{
+  destroy(m_data, m_data + m_size);
+  m_size = 0;
+}
+
+
+
+template <
+  typename T,
+  typename memory_poolT
+>
+void
+pool_vector<T, memory_poolT>::swap(pool_vector & other)
+{
+  std::swap(m_pool, other.m_pool);
+  std::swap(m_data, other.m_data);
+  std::swap(m_size, other.m_size);
+  std::swap(m_capacity, other.m_capacity);
+}
+
+
+
+template <
+  typename T,
+  typename memory_poolT
+>
+memory_poolT &
+pool_vector<T, memory_poolT>::get_memory_pool() const
+{
+  return *m_pool;
+}
+
+
+
+template <
+  typename T,
+  typename memory_poolT
+>
+void
+pool_vector<T, memory_poolT>::grow(size_type min_capacity)
+{
+  if (min_capacity <= m_capacity) {
+    return;
+  }
+
+  size_type new_capacity = m_capacity * 2;
+  if (new_capacity < m_capacity || new_capacity > max_size()) {
+    new_capacity = max_size();
+  }
+  reserve(std::max(new_capacity, min_capacity));
+}
+
+
+
+template <
+  typename T,
+  typename memory_poolT
+>
+void
+pool_vector<T, memory_poolT>::reallocate(size_type new_capacity, boost::true_type)
+{
+  // The elements can be moved around bytewise, so let the pool decide
+  // whether to grow the allocation in place or to move it.
+  size_type bytes = new_capacity * sizeof(value_type);
+  void * ptr = m_data ? m_pool->realloc(m_data, bytes) : m_pool->alloc(bytes);
+  if (!ptr) {
+    throw std::bad_alloc();
+  }
+
+  m_data = static_cast<pointer>(ptr);
+  m_capacity = usable_capacity(ptr, new_capacity);
+}
+
+
+
+template <
+  typename T,
+  typename memory_poolT
+>
+void
+pool_vector<T, memory_poolT>::reallocate(size_type new_capacity, boost::false_type)
+{
+  void * ptr = m_pool->alloc(new_capacity * sizeof(value_type));
+  if (!ptr) {
+    throw std::bad_alloc();
+  }
+  pointer new_data = static_cast<pointer>(ptr);
+
+  // Copy the elements over; if that fails, leave the vector unchanged.
+  size_type copied = 0;
+  try {
+    for ( ; copied < m_size ; ++copied) {
+      new (new_data + copied) value_type(m_data[copied]);
+    }
+  } catch (...) {
+    destroy(new_data, new_data + copied);
+    m_pool->free(new_data);
+    throw;
+  }
+
+  destroy(m_data, m_data + m_size);
+  if (m_data) {
+    m_pool->free(m_data);
+  }
+
+  m_data = new_data;
+  m_capacity = usable_capacity(ptr, new_capacity);
+}
+
+
+
+template <
+  typename T,
+  typename memory_poolT
+>
+typename pool_vector<T, memory_poolT>::size_type
+pool_vector<T, memory_poolT>::usable_capacity(void * ptr, size_type requested) const
+{
+  return std::max(requested, m_pool->alloc_size(ptr) / sizeof(value_type));
+}
+
+
+
+template <
+  typename T,
+  typename memory_poolT
+>
+void
+pool_vector<T, memory_poolT>::destroy(pointer first, pointer last)
+{
+  for ( ; first != last ; ++first) {
+    first->~value_type();
+  }
+}
+
+
+
+template <
+  typename T,
+  typename memory_poolT
+>
+inline void swap(pool_vector<T, memory_poolT> & first,
+    pool_vector<T, memory_poolT> & second)
+{
+  first.swap(second);
+}
+
+
+}} // namespace fhtagn::memory
+
+#endif // guard
@@ -0,0 +1,287 @@
+/**
+ * $Id$
+ *
+ * This file is part of the Fhtagn! C++ Library.
+ * Copyright (C) 2009 Jens Finkhaeuser <unwesen@users.sourceforge.net>.
+ *
+ * Author: Jens Finkhaeuser <unwesen@users.sourceforge.net>
+ *
+ * This program is licensed as free software for personal, educational or
+ * other non-commerical uses: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation, either version 3 of the License, or (at your
+ * option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Alternatively, licenses for commercial purposes are available as well.
+ * Please send your enquiries to the copyright holder's address above.
+ **/
+#ifndef FHTAGN_MEMORY_DETAIL_SEGMENT_HEAP_H
+#define FHTAGN_MEMORY_DETAIL_SEGMENT_HEAP_H
+
+#ifndef __cplusplus
+#error You are trying to include a C++ only header file
+#endif
+
+#include <fhtagn/fhtagn.h>
+
+#include <fhtagn/memory/utility.h>
+
+namespace fhtagn {
+namespace memory {
+namespace detail {
+
+/**
+ * Link representations for segment_heap. Segments refer to their neighbours
+ * in memory and in the free lists via links; pointer_links uses plain
+ * pointers, while offset_links uses offsets from a base address, so that the
+ * segments stay valid wherever the memory block is mapped. Either way, a link
+ * of zero means there's no segment.
+ **/
+struct pointer_links
+{
+  typedef void * link_t;
+
+  inline void * resolve(link_t link) const
+  {
+    return link;
+  }
+
+  inline link_t link_to(void * ptr) const
+  {
+    return ptr;
+  }
+};
+
+
+class offset_links
+{
+public:
+  typedef fhtagn::size_t link_t;
+
+  explicit offset_links(void * base)
+    : m_base(pointer(base).char_ptr)
+  {
+  }
+
+  inline void * resolve(link_t link) const
+  {
+    if (!link) {
+      return NULL;
+    }
+    return m_base + link;
+  }
+
+  inline link_t link_to(void * ptr) const
+  {
+    if (!ptr) {
+      return 0;
+    }
+    return pointer(ptr).char_ptr - m_base;
+  }
+
+private:
+  char * m_base;
+};
+
+
+
+/**
+ * The segment_heap class implements the segment and free list management
+ * shared by fixed_pool and shared_pool.
+ *
+ * The memory handed to it is split into segments, each starting with a header
+ * that records it's size and the segment preceding it in memory. Free
+ * segments are kept in size-binned free lists, one per power of two, with a
+ * bitmap of non-empty bins. Allocation takes the first segment in the bin the
+ * requested size falls into if that's large enough, and otherwise the first
+ * segment from the smallest non-empty bin that only holds large enough
+ * segments, found with a single bitmap scan. Freed segments are merged with
+ * free neighbours via their headers in constant time.
+ *
+ * The free lists and allocation count live in a separate state structure, so
+ * that the pool decides where to keep them; shared_pool keeps them in the
+ * memory block itself. segment_heap does no locking, and reports errors by
+ * return value so that each pool can describe them in it's own terms.
+ **/
+template <
+  typename block_alignmentT,
+  typename linksT
+>
+class segment_heap
+{
+public:
+  typedef typename linksT::link_t link_t;
+
+  enum {
+    BITS_PER_SIZE_T = sizeof(fhtagn::size_t) * 8,
+  };
+
+  /**
+   * Helper structure, that is the header of each free or allocated segment.
+   * The size is the size of the segment's data, excluding the header; the
+   * segment following this one in memory starts right behind the data.
+   **/
+  struct segment
+  {
+    enum {
+      FREE      = 0,
+      ALLOCATED = ~char(0)
+    };
+
+    segment(fhtagn::size_t _size, link_t _prev)
+      : size(_size)
+      , prev(_prev)
+      , status(FREE)
+    {
+    }
+
+    static inline fhtagn::size_t header_size()
+    {
+      return block_alignmentT::adjust_size(sizeof(segment));
+    }
+
+    inline char * data()
+    {
+      return pointer(this).char_ptr + header_size();
+    }
+
+    fhtagn::size_t  size;
+    link_t          prev;
+    char            status;
+  };
+
+  /**
+   * Free segments store links to their neighbours in the free list in their
+   * data, which means no segment can be smaller than min_data_size().
+   **/
+  struct free_links
+  {
+    link_t next;
+    link_t prev;
+  };
+
+  /**
+   * The heap's state.
+   **/
+  struct state
+  {
+    link_t          bins[BITS_PER_SIZE_T];  // Free lists by highest_set_bit()
+                                            // of the segment size.
+    fhtagn::size_t  bin_bitmap;             // Bit set for each non-empty bin.
+    fhtagn::size_t  used;                   // Number of allocated segments.
+  };
+
+  inline explicit segment_heap(linksT const & links = linksT());
+
+  /**
+   * Uses the state and the block-aligned memory between start and end. With
+   * attach(), both are expected to contain a heap already. create() resets the
+   * state, and adds a single free segment spanning the memory, if it's large
+   * enough to hold one.
+   **/
+  inline void attach(state & st, void * start, void * end);
+  inline void create(state & st, void * start, void * end);
+
+  static inline fhtagn::size_t min_data_size();
+
+  /**
+   * Returns the number of allocated segments.
+   **/
+  inline fhtagn::size_t used() const;
+
+  /**
+   * Returns the first segment in memory, or the segment following seg in
+   * memory, or NULL if there is none.
+   **/
+  inline segment * first_segment() const;
+  inline segment * next_segment(segment * seg) const;
+
+  /**
+   * Finds and allocates a free segment of the given size, splitting larger
+   * segments if necessary. Returns NULL if there's no large enough segment.
+   **/
+  inline segment * allocate_segment(fhtagn::size_t size);
+
+  /**
+   * Shrinks the segment to size, and releases the remainder as a new free
+   * segment if it's large enough.
+   **/
+  inline void split_segment(segment * seg, fhtagn::size_t size);
+
+  /**
+   * Grows the segment to size by merging it with the following segment, if
+   * that's free and large enough. Returns false if it isn't.
+   **/
+  inline bool grow_segment(segment * seg, fhtagn::size_t size);
+
+  /**
+   * Splits an allocated segment into count adjacent allocated segments of the
+   * given size each, and stores their data pointers in ptrs. The segment must
+   * be large enough to hold them including their headers; the last one keeps
+   * any slack.
+   **/
+  inline void carve_segment(segment * seg, fhtagn::size_t size,
+      fhtagn::size_t count, void ** ptrs);
+
+  /**
+   * Marks the segment free, merges it with free neighbours, and adds the
+   * result to the free lists.
+   **/
+  inline void release_segment(segment * seg);
+
+  /**
+   * Finds the allocated segment whose data ptr points to, or returns NULL if
+   * there is none.
+   **/
+  inline segment * find_segment_for(void * ptr) const;
+
+  /**
+   * Reconstructs the free lists, the links between neighbouring segments and
+   * the count of allocated segments from the segment sizes and status, merging
+   * free neighbours on the way.
+   *
+   * validate() checks that the segment chain adds up to the memory, that the
+   * segments' links to their predecessors are correct, and that the free
+   * lists and the count of allocated segments match the segments.
+   *
+   * Both return a description of the problem if the segment chain is
+   * corrupted, and NULL otherwise.
+   **/
+  inline char const * rebuild();
+  inline char const * validate() const;
+
+private:
+  /**
+   * Translates between links and segments.
+   **/
+  inline segment * segment_at(link_t link) const;
+  inline link_t link_to(segment * seg) const;
+
+  static inline free_links * links(segment * seg);
+
+  /**
+   * Adds free segments to or removes them from the free list for their size.
+   **/
+  inline void insert_free(segment * seg);
+  inline void remove_free(segment * seg);
+
+  linksT  m_links;
+  state * m_state;
+  char *  m_start;
+  char *  m_end;
+};
+
+
+}}} // namespace fhtagn::memory::detail
+
+#include <fhtagn/memory/detail/segment_heap.tcc>
+
+#endif // guard
@@ -0,0 +1,599 @@
+/**
+ * $Id$
+ *
+ * This file is part of the Fhtagn! C++ Library.
+ * Copyright (C) 2009 Jens Finkhaeuser <unwesen@users.sourceforge.net>.
+ *
+ * Author: Jens Finkhaeuser <unwesen@users.sourceforge.net>
+ *
+ * This program is licensed as free software for personal, educational or
+ * other non-commerical uses: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation, either version 3 of the License, or (at your
+ * option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Alternatively, licenses for commercial purposes are available as well.
+ * Please send your enquiries to the copyright holder's address above.
+ **/
+#ifndef FHTAGN_MEMORY_DETAIL_SEGMENT_HEAP_TCC
+#define FHTAGN_MEMORY_DETAIL_SEGMENT_HEAP_TCC
+
+#ifndef __cplusplus
+#error You are trying to include a C++ only header file
+#endif
+
+#include <new>
+
+namespace fhtagn {
+namespace memory {
+namespace detail {
+
+template <
+  typename block_alignmentT,
+  typename linksT
+>
+segment_heap<block_alignmentT, linksT>::segment_heap(linksT const & links)
+  : m_links(links)
+  , m_state(NULL)
+  , m_start(NULL)
+  , m_end(NULL)
+{
+}
+
+
+
+template <
+  typename block_alignmentT,
+  typename linksT
+>
+void
+segment_heap<block_alignmentT, linksT>::attach(state & st, void * start,
+    void * end)
+{
+  m_state = &st;
+  m_start = pointer(start).char_ptr;
+  m_end = pointer(end).char_ptr;
+}
+
+
+
+template <
+  typename block_alignmentT,
+  typename linksT
+>
+void
+segment_heap<block_alignmentT, linksT>::create(state & st, void * start,
+    void * end)
+{
+  attach(st, start, end);
+
+  for (fhtagn::size_t i = 0 ; i < BITS_PER_SIZE_T ; ++i) {
+    m_state->bins[i] = link_to(NULL);
+  }
+  m_state->bin_bitmap = 0;
+  m_state->used = 0;
+
+  if (m_start > m_end || fhtagn::size_t(m_end - m_start)
+      < segment::header_size() + min_data_size())
+  {
+    return;
+  }
+  insert_free(new (m_start) segment(m_end - m_start - segment::header_size(),
+        link_to(NULL)));
+}
+
+
+
+template <
+  typename block_alignmentT,
+  typename linksT
+>
+fhtagn::size_t
+segment_heap<block_alignmentT, linksT>::min_data_size()
+{
+  return block_alignmentT::adjust_size(sizeof(free_links));
+}
+
+
+
+template <
+  typename block_alignmentT,
+  typename linksT
+>
+fhtagn::size_t
+segment_heap<block_alignmentT, linksT>::used() const
+{
+  return m_state->used;
+}
+
+
+
+template <
+  typename block_alignmentT,
+  typename linksT
+>
+typename segment_heap<block_alignmentT, linksT>::segment *
+segment_heap<block_alignmentT, linksT>::segment_at(link_t link) const
+{
+  return static_cast<segment *>(m_links.resolve(link));
+}
+
+
+
+template <
+  typename block_alignmentT,
+  typename linksT
+>
+typename segment_heap<block_alignmentT, linksT>::link_t
+segment_heap<block_alignmentT, linksT>::link_to(segment * seg) const
+{
+  return m_links.link_to(seg);
+}
+
+
+
+template <
+  typename block_alignmentT,
+  typename linksT
+>
+typename segment_heap<block_alignmentT, linksT>::free_links *
+segment_heap<block_alignmentT, linksT>::links(segment * seg)
+{
+  return reinterpret_cast<free_links *>(seg->data());
+}
+
+
+
+template <
+  typename block_alignmentT,
+  typename linksT
+>
+typename segment_heap<block_alignmentT, linksT>::segment *
+segment_heap<block_alignmentT, linksT>::first_segment() const
+{
+  if (m_start >= m_end) {
+    return NULL;
+  }
+  return reinterpret_cast<segment *>(m_start);
+}
+
+
+
+template <
+  typename block_alignmentT,
+  typename linksT
+>
+typename segment_heap<block_alignmentT, linksT>::segment *
+segment_heap<block_alignmentT, linksT>::next_segment(segment * seg) const
+{
+  char * next = seg->data() + seg->size;
+  if (next >= m_end) {
+    return NULL;
+  }
+  return reinterpret_cast<segment *>(next);
+}
+
+
+
+template <
+  typename block_alignmentT,
+  typename linksT
+>
+void
+segment_heap<block_alignmentT, linksT>::insert_free(segment * seg)
+{
+  fhtagn::size_t bin = highest_set_bit(seg->size);
+
+  free_links * seg_links = links(seg);
+  segment * head = segment_at(m_state->bins[bin]);
+  seg_links->prev = link_to(NULL);
+  seg_links->next = m_state->bins[bin];
+  if (head) {
+    links(head)->prev = link_to(seg);
+  }
+
+  m_state->bins[bin] = link_to(seg);
+  m_state->bin_bitmap |= fhtagn::size_t(1) << bin;
+}
+
+
+
+template <
+  typename block_alignmentT,
+  typename linksT
+>
+void
+segment_heap<block_alignmentT, linksT>::remove_free(segment * seg)
+{
+  fhtagn::size_t bin = highest_set_bit(seg->size);
+
+  free_links * seg_links = links(seg);
+  segment * prev = segment_at(seg_links->prev);
+  segment * next = segment_at(seg_links->next);
+  if (prev) {
+    links(prev)->next = seg_links->next;
+  }
+  else {
+    m_state->bins[bin] = seg_links->next;
+    if (!next) {
+      m_state->bin_bitmap &= ~(fhtagn::size_t(1) << bin);
+    }
+  }
+
+  if (next) {
+    links(next)->prev = seg_links->prev;
+  }
+}
+
+
+
+template <
+  typename block_alignmentT,
+  typename linksT
+>
+typename segment_heap<block_alignmentT, linksT>::segment *
+segment_heap<block_alignmentT, linksT>::allocate_segment(fhtagn::size_t size)
+{
+  // Segments in the bin the size falls into may or may not be large enough,
+  // so only the first one is considered; that means a segment just freed is
+  // reused by an allocation of the same size. All segments in larger bins are
+  // large enough, so otherwise round the size up to the next bin, unless it's
+  // the smallest in it's bin, and take the first segment from the smallest
+  // non-empty bin from there. That's a single bitmap scan, however many free
+  // segments there are.
+  fhtagn::size_t bin = highest_set_bit(size);
+
+  segment * seg = segment_at(m_state->bins[bin]);
+  if (seg && seg->size < size) {
+    seg = NULL;
+  }
+
+  if (!seg) {
+    fhtagn::size_t first_bin = bin;
+    if (size != fhtagn::size_t(1) << bin) {
+      ++first_bin;
+    }
+
+    if (first_bin < BITS_PER_SIZE_T) {
+      fhtagn::size_t candidates = m_state->bin_bitmap
+        & (~fhtagn::size_t(0) << first_bin);
+      if (candidates) {
+        seg = segment_at(m_state->bins[count_trailing_zeros(candidates)]);
+      }
+    }
+  }
+
+  if (!seg) {
+    // We didn't find a suitably sized segment and need to give up.
+    return NULL;
+  }
+
+  remove_free(seg);
+  seg->status = segment::ALLOCATED;
+  ++m_state->used;
+
+  split_segment(seg, size);
+
+  return seg;
+}
+
+
+
+template <
+  typename block_alignmentT,
+  typename linksT
+>
+void
+segment_heap<block_alignmentT, linksT>::split_segment(segment * seg,
+    fhtagn::size_t size)
+{
+  // Only split if the remainder can hold a free segment; otherwise we might as
+  // well leave that as unused memory on the current segment.
+  if (seg->size < size + segment::header_size() + min_data_size()) {
+    return;
+  }
+
+  // The new segment's header is written before seg is shrunk, so that the
+  // chain of segment sizes stays intact for rebuild() at all times.
+  fhtagn::size_t remainder = seg->size - size - segment::header_size();
+  segment * new_seg = new (seg->data() + size) segment(remainder,
+      link_to(seg));
+  new_seg->status = segment::ALLOCATED;
+
+  segment * next = next_segment(seg);
+  if (next) {
+    next->prev = link_to(new_seg);
+  }
+  seg->size = size;
+
+  // The remainder may have a free neighbour after it, so let release_segment
+  // merge it.
+  ++m_state->used;
+  release_segment(new_seg);
+}
+
+
+
+template <
+  typename block_alignmentT,
+  typename linksT
+>
+bool
+segment_heap<block_alignmentT, linksT>::grow_segment(segment * seg,
+    fhtagn::size_t size)
+{
+  // Given that free segments are always merged, we only need to check the
+  // following segment.
+  segment * next = next_segment(seg);
+  if (!next || static_cast<char>(segment::FREE) != next->status
+      || seg->size + segment::header_size() + next->size < size)
+  {
+    return false;
+  }
+
+  // Merge both segments, and split off what we don't need.
+  remove_free(next);
+  seg->size += segment::header_size() + next->size;
+
+  next = next_segment(seg);
+  if (next) {
+    next->prev = link_to(seg);
+  }
+
+  split_segment(seg, size);
+  return true;
+}
+
+
+
+template <
+  typename block_alignmentT,
+  typename linksT
+>
+void
+segment_heap<block_alignmentT, linksT>::carve_segment(segment * seg,
+    fhtagn::size_t size, fhtagn::size_t count, void ** ptrs)
+{
+  // Each new segment takes the remainder of the one before it.
+  fhtagn::size_t stride = segment::header_size() + size;
+  segment * next = next_segment(seg);
+  for (fhtagn::size_t i = 0 ; i < count - 1 ; ++i) {
+    segment * new_seg = new (seg->data() + size) segment(seg->size - stride,
+        link_to(seg));
+    new_seg->status = segment::ALLOCATED;
+    seg->size = size;
+    ++m_state->used;
+
+    ptrs[i] = seg->data();
+    seg = new_seg;
+  }
+  ptrs[count - 1] = seg->data();
+
+  if (next) {
+    next->prev = link_to(seg);
+  }
+}
+
+
+
+template <
+  typename block_alignmentT,
+  typename linksT
+>
+void
+segment_heap<block_alignmentT, linksT>::release_segment(segment * seg)
+{
+  seg->status = segment::FREE;
+  --m_state->used;
+
+  // Merge with the following segment, if that's free.
+  segment * next = next_segment(seg);
+  if (next && static_cast<char>(segment::FREE) == next->status) {
+    remove_free(next);
+    seg->size += segment::header_size() + next->size;
+    next = next_segment(seg);
+  }
+
+  // Merge with the preceding segment, if that's free.
+  segment * prev = segment_at(seg->prev);
+  if (prev && static_cast<char>(segment::FREE) == prev->status) {
+    remove_free(prev);
+    prev->size += segment::header_size() + seg->size;
+    seg = prev;
+  }
+
+  if (next) {
+    next->prev = link_to(seg);
+  }
+
+  insert_free(seg);
+}
+
+
+
+template <
+  typename block_alignmentT,
+  typename linksT
+>
+typename segment_heap<block_alignmentT, linksT>::segment *
+segment_heap<block_alignmentT, linksT>::find_segment_for(void * ptr) const
+{
+  if (ptr < m_start + segment::header_size() || ptr >= m_end) {
+    return NULL;
+  }
+
+  // For safety reasons, check that ptr points to the start of an allocated
+  // segment's data, as it always should: the segment's neighbours in memory
+  // must agree with it about their location.
+  segment * seg = reinterpret_cast<segment *>(pointer(ptr).char_ptr
+      - segment::header_size());
+  if (static_cast<char>(segment::ALLOCATED) != seg->status
+      || seg->size >= fhtagn::size_t(m_end - m_start))
+  {
+    return NULL;
+  }
+
+  segment * prev = segment_at(seg->prev);
+  if (prev) {
+    if (pointer(prev).char_ptr < m_start || prev >= seg
+        || next_segment(prev) != seg)
+    {
+      return NULL;
+    }
+  }
+  else if (pointer(seg).char_ptr != m_start) {
+    return NULL;
+  }
+
+  segment * next = next_segment(seg);
+  if (next && segment_at(next->prev) != seg) {
+    return NULL;
+  }
+
+  return seg;
+}
+
+
+
+template <
+  typename block_alignmentT,
+  typename linksT
+>
+char const *
+segment_heap<block_alignmentT, linksT>::rebuild()
+{
+  for (fhtagn::size_t i = 0 ; i < BITS_PER_SIZE_T ; ++i) {
+    m_state->bins[i] = link_to(NULL);
+  }
+  m_state->bin_bitmap = 0;
+  m_state->used = 0;
+
+  segment * prev = NULL;
+  segment * seg = first_segment();
+  while (seg) {
+    if (seg->data() > m_end
+        || seg->size > fhtagn::size_t(m_end - seg->data()))
+    {
+      return "segment sizes exceed the memory block";
+    }
+
+    seg->prev = link_to(prev);
+    if (static_cast<char>(segment::FREE) != seg->status) {
+      seg->status = segment::ALLOCATED;
+      ++m_state->used;
+    }
+    else if (prev && static_cast<char>(segment::FREE) == prev->status) {
+      // Merge free neighbours; the merged segment is added to the free lists
+      // once it's complete.
+      prev->size += segment::header_size() + seg->size;
+      seg = prev;
+      prev = segment_at(seg->prev);
+    }
+
+    segment * next = next_segment(seg);
+    if (static_cast<char>(segment::FREE) == seg->status
+        && (!next || static_cast<char>(segment::FREE) != next->status))
+    {
+      insert_free(seg);
+    }
+
+    prev = seg;
+    seg = next;
+  }
+
+  return NULL;
+}
+
+
+
+template <
+  typename block_alignmentT,
+  typename linksT
+>
+char const *
+segment_heap<block_alignmentT, linksT>::validate() const
+{
+  fhtagn::size_t used = 0;
+  fhtagn::size_t free_count = 0;
+
+  segment * prev = NULL;
+  segment * seg = first_segment();
+  while (seg) {
+    if (seg->data() > m_end
+        || seg->size > fhtagn::size_t(m_end - seg->data()))
+    {
+      return "segment sizes exceed the memory block";
+    }
+    if (segment_at(seg->prev) != prev) {
+      return "segment links are inconsistent";
+    }
+
+    if (static_cast<char>(segment::FREE) == seg->status) {
+      ++free_count;
+    }
+    else if (static_cast<char>(segment::ALLOCATED) == seg->status) {
+      ++used;
+    }
+    else {
+      return "segment status is invalid";
+    }
+
+    prev = seg;
+    seg = next_segment(seg);
+  }
+
+  if (used != m_state->used) {
+    return "allocation count does not match segments";
+  }
+
+  // Every segment in the free lists must be a free segment of the right
+  // size, and all free segments must be in the free lists. Counting them
+  // stops at the number of free segments, so cycles are detected, too.
+  fhtagn::size_t listed = 0;
+  for (fhtagn::size_t bin = 0 ; bin < BITS_PER_SIZE_T ; ++bin) {
+    segment * entry = segment_at(m_state->bins[bin]);
+    bool has_entries = (NULL != entry);
+    if (has_entries != bool(m_state->bin_bitmap & (fhtagn::size_t(1) << bin)))
+    {
+      return "free list bitmap does not match free lists";
+    }
+
+    segment * entry_prev = NULL;
+    while (entry) {
+      if (pointer(entry).char_ptr < m_start
+          || pointer(entry).char_ptr >= m_end || ++listed > free_count)
+      {
+        return "free lists are inconsistent";
+      }
+
+      if (static_cast<char>(segment::FREE) != entry->status
+          || highest_set_bit(entry->size) != bin
+          || segment_at(links(entry)->prev) != entry_prev)
+      {
+        return "free lists are inconsistent";
+      }
+
+      entry_prev = entry;
+      entry = segment_at(links(entry)->next);
+    }
+  }
+
+  if (listed != free_count) {
+    return "free lists are inconsistent";
+  }
+
+  return NULL;
+}
+
+}}} // namespace fhtagn::memory::detail
+
+
+#endif // guard
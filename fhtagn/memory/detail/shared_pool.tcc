@@ -0,0 +1,524 @@
+/**
+ * $Id$
+ *
+ * This file is part of the Fhtagn! C++ Library.
+ * Copyright (C) 2009 Jens Finkhaeuser <unwesen@users.sourceforge.net>.
+ *
+ * Author: Jens Finkhaeuser <unwesen@users.sourceforge.net>
+ *
+ * This program is licensed as free software for personal, educational or
+ * other non-commerical uses: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation, either version 3 of the License, or (at your
+ * option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Alternatively, licenses for commercial purposes are available as well.
+ * Please send your enquiries to the copyright holder's address above.
+ **/
+#ifndef FHTAGN_MEMORY_DETAIL_SHARED_POOL_TCC
+#define FHTAGN_MEMORY_DETAIL_SHARED_POOL_TCC
+
+#ifndef __cplusplus
+#error You are trying to include a C++ only header file
+#endif
+
+#include <errno.h>
+#include <string.h>
+#include <sys/mman.h>
+
+#include <algorithm>
+#include <new>
+#include <sstream>
+#include <stdexcept>
+
+#include <fhtagn/threads/atomic.h>
+
+namespace fhtagn {
+namespace memory {
+
+template <
+  typename block_alignmentT
+>
+shared_pool<block_alignmentT>::scoped_lock::scoped_lock(
+    shared_pool const & pool)
+  : m_pool(const_cast<shared_pool &>(pool))
+{
+  int err = ::pthread_mutex_lock(&m_pool.m_control->mutex);
+#if defined(__linux__)
+  if (EOWNERDEAD == err) {
+    // The previous owner died, possibly in the middle of modifying the free
+    // lists. Rebuild them before anyone else gets to use the pool.
+    ::pthread_mutex_consistent(&m_pool.m_control->mutex);
+    try {
+      m_pool.rebuild();
+    } catch (...) {
+      ::pthread_mutex_unlock(&m_pool.m_control->mutex);
+      throw;
+    }
+    err = 0;
+  }
+#endif
+  if (err) {
+    std::stringstream s;
+    s << "shared_pool: could not lock mutex: " << ::strerror(err);
+    throw std::runtime_error(s.str());
+  }
+}
+
+
+
+template <
+  typename block_alignmentT
+>
+shared_pool<block_alignmentT>::scoped_lock::~scoped_lock()
+{
+  ::pthread_mutex_unlock(&m_pool.m_control->mutex);
+}
+
+
+
+template <
+  typename block_alignmentT
+>
+shared_pool<block_alignmentT>::shared_pool(void * memblock,
+    fhtagn::size_t size, open_mode mode)
+  : m_memblock(memblock)
+  , m_control(static_cast<control *>(memblock))
+  , m_heap(detail::offset_links(memblock))
+{
+  // Unlike fixed_pool, we can't adjust the start of the memory block, as
+  // processes mapping the block at different addresses might adjust it
+  // differently.
+  if (block_alignment_t::adjust_pointer(m_memblock) != m_memblock) {
+    std::stringstream s;
+    s << "shared_pool: memory block " << std::hex << m_memblock
+      << " is not aligned at " << std::dec << block_alignment_t::BLOCK_SIZE
+      << " bytes.";
+    throw std::logic_error(s.str());
+  }
+  size -= size % block_alignment_t::BLOCK_SIZE;
+
+  if (CREATE != mode) {
+    if (size < control::control_size()
+        || MAGIC != fhtagn::threads::atomic_load(m_control->magic))
+    {
+      throw std::runtime_error("shared_pool: memory block does not contain "
+          "a pool.");
+    }
+
+    if (VERSION != m_control->version
+        || block_alignment_t::BLOCK_SIZE != m_control->block_size
+        || segment::header_size() != m_control->header_size
+        || size < m_control->size)
+    {
+      std::stringstream s;
+      s << "shared_pool: pool of size " << m_control->size << " and block size "
+        << m_control->block_size << " is incompatible with this process' "
+        << "view of size " << size << " and block size "
+        << block_alignment_t::BLOCK_SIZE << ".";
+      throw std::runtime_error(s.str());
+    }
+
+    m_heap.attach(m_control->heap,
+        pointer(m_memblock).char_ptr + control::control_size(),
+        pointer(m_memblock).char_ptr + m_control->size);
+
+    if (REOPEN == mode) {
+      // Nobody else is using the pool, so we can take the mutex without
+      // locking it.
+      init_mutex();
+      if (m_control->dirty) {
+        rebuild();
+      }
+      else {
+        validate();
+      }
+    }
+    return;
+  }
+
+  // Throw bad_alloc if we can't fit the control structure and one segment.
+  if (size < control::control_size() + segment::header_size()
+      + heap_t::min_data_size())
+  {
+    throw std::bad_alloc();
+  }
+
+  m_control->magic = 0;
+  m_control->version = VERSION;
+  m_control->size = size;
+  m_control->block_size = block_alignment_t::BLOCK_SIZE;
+  m_control->header_size = segment::header_size();
+  m_control->root = 0;
+  m_control->dirty = 1;
+  init_mutex();
+
+  m_heap.create(m_control->heap,
+      pointer(m_memblock).char_ptr + control::control_size(),
+      pointer(m_memblock).char_ptr + size);
+
+  // Publish the pool to attaching processes.
+  fhtagn::threads::atomic_store(m_control->magic, fhtagn::size_t(MAGIC));
+}
+
+
+
+template <
+  typename block_alignmentT
+>
+void
+shared_pool<block_alignmentT>::init_mutex()
+{
+  pthread_mutexattr_t attr;
+  ::pthread_mutexattr_init(&attr);
+  ::pthread_mutexattr_setpshared(&attr, PTHREAD_PROCESS_SHARED);
+#if defined(__linux__)
+  ::pthread_mutexattr_setrobust(&attr, PTHREAD_MUTEX_ROBUST);
+#endif
+  int err = ::pthread_mutex_init(&m_control->mutex, &attr);
+  ::pthread_mutexattr_destroy(&attr);
+  if (err) {
+    std::stringstream s;
+    s << "shared_pool: could not create mutex: " << ::strerror(err);
+    throw std::runtime_error(s.str());
+  }
+}
+
+
+
+template <
+  typename block_alignmentT
+>
+void
+shared_pool<block_alignmentT>::corrupted(char const * problem) const
+{
+  std::stringstream s;
+  s << "shared_pool: pool at " << std::hex << m_memblock << " is corrupted: "
+    << problem << ".";
+  throw std::runtime_error(s.str());
+}
+
+
+
+template <
+  typename block_alignmentT
+>
+void
+shared_pool<block_alignmentT>::destroy()
+{
+  fhtagn::threads::atomic_store(m_control->magic, fhtagn::size_t(0));
+  ::pthread_mutex_destroy(&m_control->mutex);
+}
+
+
+
+template <
+  typename block_alignmentT
+>
+void
+shared_pool<block_alignmentT>::rebuild()
+{
+  char const * problem = m_heap.rebuild();
+  if (problem) {
+    corrupted(problem);
+  }
+
+  if (m_control->root && m_control->root >= m_control->size) {
+    corrupted("root lies outside the memory block");
+  }
+}
+
+
+
+template <
+  typename block_alignmentT
+>
+void
+shared_pool<block_alignmentT>::validate() const
+{
+  char const * problem = m_heap.validate();
+  if (problem) {
+    corrupted(problem);
+  }
+
+  if (m_control->root && m_control->root >= m_control->size) {
+    corrupted("root lies outside the memory block");
+  }
+}
+
+
+
+template <
+  typename block_alignmentT
+>
+void *
+shared_pool<block_alignmentT>::alloc(fhtagn::size_t size)
+{
+  if (!size) {
+    return NULL;
+  }
+
+  size = block_alignmentT::adjust_size(std::max(size,
+        heap_t::min_data_size()));
+
+  scoped_lock lock(*this);
+  m_control->dirty = 1;
+
+  segment * seg = m_heap.allocate_segment(size);
+  if (!seg) {
+    return NULL;
+  }
+
+  return seg->data();
+}
+
+
+
+template <
+  typename block_alignmentT
+>
+void *
+shared_pool<block_alignmentT>::realloc(void * ptr, fhtagn::size_t new_size)
+{
+  if (!new_size) {
+    return NULL;
+  }
+
+  new_size = block_alignmentT::adjust_size(std::max(new_size,
+        heap_t::min_data_size()));
+
+  scoped_lock lock(*this);
+  m_control->dirty = 1;
+
+  if (!ptr) {
+    segment * seg = m_heap.allocate_segment(new_size);
+    if (!seg) {
+      return NULL;
+    }
+
+    return seg->data();
+  }
+
+  segment * seg = find_segment_for(ptr);
+
+  // See fixed_pool: shrink in place, or grow into a free following segment,
+  // or move.
+  if (new_size <= seg->size) {
+    m_heap.split_segment(seg, new_size);
+    return seg->data();
+  }
+
+  if (m_heap.grow_segment(seg, new_size)) {
+    return seg->data();
+  }
+
+  segment * new_seg = m_heap.allocate_segment(new_size);
+  if (!new_seg) {
+    return NULL;
+  }
+
+  ::memcpy(new_seg->data(), seg->data(), std::min(seg->size, new_size));
+  m_heap.release_segment(seg);
+
+  return new_seg->data();
+}
+
+
+
+template <
+  typename block_alignmentT
+>
+typename shared_pool<block_alignmentT>::segment *
+shared_pool<block_alignmentT>::find_segment_for(void * ptr) const
+{
+  char * start = pointer(m_memblock).char_ptr + control::control_size()
+    + segment::header_size();
+  void * end = pointer(m_memblock).char_ptr + m_control->size;
+  if (ptr < start || ptr >= end) {
+    std::stringstream s;
+    s << "shared_pool: can't free pointer " << std::hex << ptr
+      << ", it's not in pool " << m_memblock << " of size " << std::dec
+      << m_control->size;
+    throw std::logic_error(s.str());
+  }
+
+  segment * seg = m_heap.find_segment_for(ptr);
+  if (!seg) {
+    std::stringstream s;
+    s << "shared_pool: can't free pointer " << std::hex << ptr
+      << "; it's in pool " << m_memblock << " of size " << std::dec
+      << m_control->size << " but not in any known segment.";
+    throw std::logic_error(s.str());
+  }
+
+  return seg;
+}
+
+
+
+template <
+  typename block_alignmentT
+>
+void
+shared_pool<block_alignmentT>::free(void * ptr)
+{
+  if (!ptr) {
+    return;
+  }
+
+  scoped_lock lock(*this);
+  m_control->dirty = 1;
+  m_heap.release_segment(find_segment_for(ptr));
+}
+
+
+
+template <
+  typename block_alignmentT
+>
+bool
+shared_pool<block_alignmentT>::in_use() const
+{
+  scoped_lock lock(*this);
+  return m_heap.used() > 0;
+}
+
+
+
+template <
+  typename block_alignmentT
+>
+fhtagn::size_t
+shared_pool<block_alignmentT>::alloc_size(void * ptr) const
+{
+  if (!ptr) {
+    return 0;
+  }
+
+  scoped_lock lock(*this);
+  return find_segment_for(ptr)->size;
+}
+
+
+
+template <
+  typename block_alignmentT
+>
+bool
+shared_pool<block_alignmentT>::owns(void * ptr) const
+{
+  // The memory block never changes, so there's no need to lock.
+  return (m_memblock <= ptr
+      && ptr < pointer(m_memblock).char_ptr + m_control->size);
+}
+
+
+
+template <
+  typename block_alignmentT
+>
+fhtagn::size_t
+shared_pool<block_alignmentT>::offset_of(void * ptr) const
+{
+  if (!ptr) {
+    return 0;
+  }
+  return pointer(ptr).char_ptr - pointer(m_memblock).char_ptr;
+}
+
+
+
+template <
+  typename block_alignmentT
+>
+void *
+shared_pool<block_alignmentT>::pointer_to(fhtagn::size_t offset) const
+{
+  if (!offset) {
+    return NULL;
+  }
+  return pointer(m_memblock).char_ptr + offset;
+}
+
+
+
+template <
+  typename block_alignmentT
+>
+void
+shared_pool<block_alignmentT>::set_root(void * ptr)
+{
+  if (ptr && !owns(ptr)) {
+    std::stringstream s;
+    s << "shared_pool: root " << std::hex << ptr << " is not in pool "
+      << m_memblock << ".";
+    throw std::logic_error(s.str());
+  }
+
+  scoped_lock lock(*this);
+  m_control->dirty = 1;
+  m_control->root = offset_of(ptr);
+}
+
+
+
+template <
+  typename block_alignmentT
+>
+void *
+shared_pool<block_alignmentT>::root() const
+{
+  scoped_lock lock(*this);
+  return pointer_to(m_control->root);
+}
+
+
+
+template <
+  typename block_alignmentT
+>
+void
+shared_pool<block_alignmentT>::sync()
+{
+  scoped_lock lock(*this);
+
+  // Everything but the dirty flag needs to be on disk before the flag is
+  // cleared, so that a crash in between leaves the pool marked dirty.
+  int err = ::msync(m_memblock, m_control->size, MS_SYNC);
+  if (!err) {
+    m_control->dirty = 0;
+    err = ::msync(m_memblock, control::control_size(), MS_SYNC);
+  }
+
+  if (err) {
+    std::stringstream s;
+    s << "shared_pool: could not sync pool at " << std::hex << m_memblock
+      << ": " << ::strerror(errno);
+    throw std::runtime_error(s.str());
+  }
+}
+
+
+
+template <
+  typename block_alignmentT
+>
+bool
+shared_pool<block_alignmentT>::dirty() const
+{
+  scoped_lock lock(*this);
+  return m_control->dirty;
+}
+
+}} // namespace fhtagn::memory
+
+
+#endif // guard
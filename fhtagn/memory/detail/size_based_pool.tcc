@@ -30,6 +30,10 @@
 #error You are trying to include a C++ only header file
 #endif
 
+#include <string.h>
+
+#include <algorithm>
+
 namespace fhtagn {
 namespace memory {
 
@@ -40,14 +44,30 @@ template <
   fhtagn::size_t MIN_OBJECT_SIZE,
   fhtagn::size_t MAX_OBJECT_SIZE,
   template <int> class incrementorT,
-  typename mutexT
+  typename mutexT,
+  typename sourceT,
+  typename block_alignmentT
 >
 size_based_pool<OBJECTS_PER_POOL, MIN_OBJECT_SIZE, MAX_OBJECT_SIZE,
-    incrementorT, mutexT>::size_based_pool()
+    incrementorT, mutexT, sourceT, block_alignmentT>::size_based_pool()
+  : m_live(0)
 {
-  // Multiplied with 2 because static_for iterates over [begin, end)
-  ::fhtagn::meta::static_for<MIN_OBJECT_SIZE, MAX_OBJECT_SIZE * 2, incrementorT,
-    pool_creator>(m_pool_map);
+  // Create one pool per size class. Added 1 because static_for iterates over
+  // [begin, end)
+  ::fhtagn::meta::static_for<MIN_OBJECT_SIZE, MAX_OBJECT_SIZE + 1, incrementorT,
+    pool_creator>(*this);
+
+  // Build the size class lookup table. Entry i holds the index of the smallest
+  // size class that fits objects of i * SIZE_GRANULARITY bytes; as all class
+  // sizes are multiples of SIZE_GRANULARITY, that's also the size class for
+  // all sizes in ((i - 1) * SIZE_GRANULARITY, i * SIZE_GRANULARITY].
+  fhtagn::size_t index = 0;
+  for (fhtagn::size_t i = 0 ; i < LOOKUP_TABLE_SIZE ; ++i) {
+    while (m_class_sizes[index] < i * SIZE_GRANULARITY) {
+      ++index;
+    }
+    m_class_lookup[i] = index;
+  }
 }
 
 
@@ -57,19 +77,150 @@ template <
   fhtagn::size_t MIN_OBJECT_SIZE,
   fhtagn::size_t MAX_OBJECT_SIZE,
   template <int> class incrementorT,
-  typename mutexT
+  typename mutexT,
+  typename sourceT,
+  typename block_alignmentT
+>
+size_based_pool<OBJECTS_PER_POOL, MIN_OBJECT_SIZE, MAX_OBJECT_SIZE,
+    incrementorT, mutexT, sourceT, block_alignmentT>::~size_based_pool()
+{
+  // Large objects are not tracked, so we can't release them here. Size class
+  // pools release their chunks themselves.
+}
+
+
+
+template <
+  fhtagn::size_t OBJECTS_PER_POOL,
+  fhtagn::size_t MIN_OBJECT_SIZE,
+  fhtagn::size_t MAX_OBJECT_SIZE,
+  template <int> class incrementorT,
+  typename mutexT,
+  typename sourceT,
+  typename block_alignmentT
+>
+typename size_based_pool<OBJECTS_PER_POOL, MIN_OBJECT_SIZE, MAX_OBJECT_SIZE,
+    incrementorT, mutexT, sourceT, block_alignmentT>::chunk_header *
+size_based_pool<OBJECTS_PER_POOL, MIN_OBJECT_SIZE, MAX_OBJECT_SIZE,
+    incrementorT, mutexT, sourceT, block_alignmentT>::chunk_for(void * ptr)
+{
+  if (!chunk_source_t::owns(ptr)) {
+    return NULL;
+  }
+  return reinterpret_cast<chunk_header *>(
+      reinterpret_cast<fhtagn::size_t>(ptr) & ~(fhtagn::size_t(CHUNK_SIZE) - 1));
+}
+
+
+
+template <
+  fhtagn::size_t OBJECTS_PER_POOL,
+  fhtagn::size_t MIN_OBJECT_SIZE,
+  fhtagn::size_t MAX_OBJECT_SIZE,
+  template <int> class incrementorT,
+  typename mutexT,
+  typename sourceT,
+  typename block_alignmentT
+>
+typename size_based_pool<OBJECTS_PER_POOL, MIN_OBJECT_SIZE, MAX_OBJECT_SIZE,
+    incrementorT, mutexT, sourceT, block_alignmentT>::large_header *
+size_based_pool<OBJECTS_PER_POOL, MIN_OBJECT_SIZE, MAX_OBJECT_SIZE,
+    incrementorT, mutexT, sourceT, block_alignmentT>::large_for(void * ptr)
+{
+  return reinterpret_cast<large_header *>(pointer(ptr).char_ptr
+      - large_header::header_size());
+}
+
+
+
+template <
+  fhtagn::size_t OBJECTS_PER_POOL,
+  fhtagn::size_t MIN_OBJECT_SIZE,
+  fhtagn::size_t MAX_OBJECT_SIZE,
+  template <int> class incrementorT,
+  typename mutexT,
+  typename sourceT,
+  typename block_alignmentT
 >
 fhtagn::size_t
 size_based_pool<OBJECTS_PER_POOL, MIN_OBJECT_SIZE, MAX_OBJECT_SIZE,
-    incrementorT, mutexT>::pool_size(fhtagn::size_t in_size) const
+    incrementorT, mutexT, sourceT, block_alignmentT>::size_classes() const
 {
-  fhtagn::size_t s = MIN_OBJECT_SIZE;
-  for ( ; s < (MAX_OBJECT_SIZE * 2) ; s *= 2) {
-    if (s >= in_size) {
-      break;
-    }
+  return SIZE_CLASSES;
+}
+
+
+
+template <
+  fhtagn::size_t OBJECTS_PER_POOL,
+  fhtagn::size_t MIN_OBJECT_SIZE,
+  fhtagn::size_t MAX_OBJECT_SIZE,
+  template <int> class incrementorT,
+  typename mutexT,
+  typename sourceT,
+  typename block_alignmentT
+>
+fhtagn::size_t
+size_based_pool<OBJECTS_PER_POOL, MIN_OBJECT_SIZE, MAX_OBJECT_SIZE,
+    incrementorT, mutexT, sourceT, block_alignmentT>::size_class(
+        fhtagn::size_t size) const
+{
+  if (size > MAX_OBJECT_SIZE) {
+    return SIZE_CLASSES;
+  }
+  return m_class_lookup[(size + SIZE_GRANULARITY - 1) / SIZE_GRANULARITY];
+}
+
+
+
+template <
+  fhtagn::size_t OBJECTS_PER_POOL,
+  fhtagn::size_t MIN_OBJECT_SIZE,
+  fhtagn::size_t MAX_OBJECT_SIZE,
+  template <int> class incrementorT,
+  typename mutexT,
+  typename sourceT,
+  typename block_alignmentT
+>
+fhtagn::size_t
+size_based_pool<OBJECTS_PER_POOL, MIN_OBJECT_SIZE, MAX_OBJECT_SIZE,
+    incrementorT, mutexT, sourceT, block_alignmentT>::class_size(
+        fhtagn::size_t index) const
+{
+  if (index >= SIZE_CLASSES) {
+    return 0;
+  }
+  return m_class_sizes[index];
+}
+
+
+
+template <
+  fhtagn::size_t OBJECTS_PER_POOL,
+  fhtagn::size_t MIN_OBJECT_SIZE,
+  fhtagn::size_t MAX_OBJECT_SIZE,
+  template <int> class incrementorT,
+  typename mutexT,
+  typename sourceT,
+  typename block_alignmentT
+>
+fhtagn::size_t
+size_based_pool<OBJECTS_PER_POOL, MIN_OBJECT_SIZE, MAX_OBJECT_SIZE,
+    incrementorT, mutexT, sourceT, block_alignmentT>::size_class_of(
+        void * ptr) const
+{
+  if (!ptr) {
+    return SIZE_CLASSES;
+  }
+
+  // The chunk header is written before any pointer from the chunk is handed
+  // out, and stays unchanged while pointers from the chunk are in use, so
+  // there's no need to lock here.
+  chunk_header * chunk = chunk_for(ptr);
+  if (!chunk || chunk->owner != this) {
+    return SIZE_CLASSES;
   }
-  return s > MAX_OBJECT_SIZE ? 0 : s;
+  return chunk->size_class;
 }
 
 
@@ -79,34 +230,102 @@ template <
   fhtagn::size_t MIN_OBJECT_SIZE,
   fhtagn::size_t MAX_OBJECT_SIZE,
   template <int> class incrementorT,
-  typename mutexT
+  typename mutexT,
+  typename sourceT,
+  typename block_alignmentT
 >
 void *
 size_based_pool<OBJECTS_PER_POOL, MIN_OBJECT_SIZE, MAX_OBJECT_SIZE,
-    incrementorT, mutexT>::alloc(fhtagn::size_t size)
+    incrementorT, mutexT, sourceT, block_alignmentT>::alloc(fhtagn::size_t size)
 {
   if (!size) {
     return NULL;
   }
 
-
   typename mutexT::scoped_lock lock(m_mutex);
+  return lockfree_alloc(size);
+}
 
-  fhtagn::size_t adjusted_size = pool_size(size);
 
-  if (adjusted_size) {
-    void * result = m_pool_map[adjusted_size]->alloc(adjusted_size);
+
+template <
+  fhtagn::size_t OBJECTS_PER_POOL,
+  fhtagn::size_t MIN_OBJECT_SIZE,
+  fhtagn::size_t MAX_OBJECT_SIZE,
+  template <int> class incrementorT,
+  typename mutexT,
+  typename sourceT,
+  typename block_alignmentT
+>
+void *
+size_based_pool<OBJECTS_PER_POOL, MIN_OBJECT_SIZE, MAX_OBJECT_SIZE,
+    incrementorT, mutexT, sourceT, block_alignmentT>::lockfree_alloc(
+        fhtagn::size_t size)
+{
+  fhtagn::size_t index = size_class(size);
+
+  if (index < SIZE_CLASSES) {
+    void * result = m_pools[index]->alloc();
     if (result) {
-      m_pointer_size_map[result] = adjusted_size;
+      ++m_live;
     }
     return result;
   }
 
-  void * result = m_heap.alloc(size);
-  if (result) {
-    m_pointer_size_map[result] = size;
+  // Too large for any size class; the object is allocated on it's own, with
+  // a header in front of it.
+  fhtagn::size_t header_size = large_header::header_size();
+  if (size > ~fhtagn::size_t(0) - header_size) {
+    return NULL;
+  }
+
+  void * memblock = sourceT::allocate(header_size + size,
+      std::max(fhtagn::size_t(block_alignmentT::BLOCK_SIZE),
+        2 * sizeof(fhtagn::size_t)));
+  if (!memblock) {
+    return NULL;
+  }
+
+  large_header * large = new (memblock) large_header();
+  large->owner = this;
+  large->size = size;
+
+  ++m_live;
+  return pointer(memblock).char_ptr + header_size;
+}
+
+
+
+template <
+  fhtagn::size_t OBJECTS_PER_POOL,
+  fhtagn::size_t MIN_OBJECT_SIZE,
+  fhtagn::size_t MAX_OBJECT_SIZE,
+  template <int> class incrementorT,
+  typename mutexT,
+  typename sourceT,
+  typename block_alignmentT
+>
+fhtagn::size_t
+size_based_pool<OBJECTS_PER_POOL, MIN_OBJECT_SIZE, MAX_OBJECT_SIZE,
+    incrementorT, mutexT, sourceT, block_alignmentT>::alloc_bulk(
+        fhtagn::size_t size, fhtagn::size_t count,
+        void ** ptrs)
+{
+  if (!size || !count) {
+    return 0;
+  }
+
+  typename mutexT::scoped_lock lock(m_mutex);
+
+  fhtagn::size_t allocated = 0;
+  for ( ; allocated < count ; ++allocated) {
+    void * ptr = lockfree_alloc(size);
+    if (!ptr) {
+      break;
+    }
+    ptrs[allocated] = ptr;
   }
-  return result;
+  return allocated;
 }
 
 
@@ -116,11 +335,14 @@ template <
   fhtagn::size_t MIN_OBJECT_SIZE,
   fhtagn::size_t MAX_OBJECT_SIZE,
   template <int> class incrementorT,
-  typename mutexT
+  typename mutexT,
+  typename sourceT,
+  typename block_alignmentT
 >
 void *
 size_based_pool<OBJECTS_PER_POOL, MIN_OBJECT_SIZE, MAX_OBJECT_SIZE,
-    incrementorT, mutexT>::realloc(void * ptr, fhtagn::size_t new_size)
+    incrementorT, mutexT, sourceT, block_alignmentT>::realloc(
+        void * ptr, fhtagn::size_t new_size)
 {
   if (!ptr) {
     return alloc(new_size);
@@ -130,57 +352,30 @@ size_based_pool<OBJECTS_PER_POOL, MIN_OBJECT_SIZE, MAX_OBJECT_SIZE,
     return NULL;
   }
 
-  fhtagn::size_t adjusted_size = pool_size(new_size);
-
-  typename mutexT::scoped_lock lock(m_mutex);
-
-  pointer_size_map_t::iterator iter = m_pointer_size_map.find(ptr);
-  if (iter == m_pointer_size_map.end()) {
+  fhtagn::size_t old_size = alloc_size(ptr);
+  if (!old_size) {
     return NULL;
   }
 
-  if (iter->second == adjusted_size) {
+  fhtagn::size_t index = size_class(new_size);
+  if (index < SIZE_CLASSES && index == size_class_of(ptr)) {
     // No reallocation required, the backing store is the same size as before.
     return ptr;
   }
 
+  typename mutexT::scoped_lock lock(m_mutex);
+
   // If we've reached here, there's not much helping it: we'll need to allocate
   // new memory and memcpy.
-  void * new_ptr = NULL;
-  if (adjusted_size) {
-    // Allocate
-    new_ptr = m_pool_map[adjusted_size]->alloc(adjusted_size);
-    if (!new_ptr) {
-      return NULL;
-    }
-    m_pointer_size_map[new_ptr] = adjusted_size;
-
-    // Memcopy
-    ::memcpy(new_ptr, ptr, std::min(iter->second, adjusted_size));
+  void * new_ptr = lockfree_alloc(new_size);
+  if (!new_ptr) {
+    return NULL;
   }
-  else {
-    // Allocate
-    new_ptr = m_heap.alloc(new_size);
-    if (!new_ptr) {
-      return NULL;
-    }
-    m_pointer_size_map[new_ptr] = new_size;
 
-    // Memcopy
-    ::memcpy(new_ptr, ptr, std::min(iter->second, new_size));
-  }
+  ::memcpy(new_ptr, ptr, std::min(old_size, new_size));
 
   // Now release the old pointer.
-  fhtagn::size_t old_size = iter->second;
-  m_pointer_size_map.erase(iter);
-
-  fhtagn::size_t old_adjusted_size = pool_size(old_size);
-  if (old_size == old_adjusted_size) {
-    m_pool_map[old_size]->free(ptr);
-  }
-  else {
-    m_heap.free(ptr);
-  }
+  lockfree_free(ptr);
 
   return new_ptr;
 }
@@ -192,33 +387,87 @@ template <
   fhtagn::size_t MIN_OBJECT_SIZE,
   fhtagn::size_t MAX_OBJECT_SIZE,
   template <int> class incrementorT,
-  typename mutexT
+  typename mutexT,
+  typename sourceT,
+  typename block_alignmentT
 >
 void
 size_based_pool<OBJECTS_PER_POOL, MIN_OBJECT_SIZE, MAX_OBJECT_SIZE,
-    incrementorT, mutexT>::free(void * ptr)
+    incrementorT, mutexT, sourceT, block_alignmentT>::free(void * ptr)
 {
   if (!ptr) {
     return;
   }
 
   typename mutexT::scoped_lock lock(m_mutex);
+  lockfree_free(ptr);
+}
+
+
 
-  pointer_size_map_t::const_iterator iter = m_pointer_size_map.find(ptr);
-  if (iter == m_pointer_size_map.end()) {
-    // Not managed by us
+template <
+  fhtagn::size_t OBJECTS_PER_POOL,
+  fhtagn::size_t MIN_OBJECT_SIZE,
+  fhtagn::size_t MAX_OBJECT_SIZE,
+  template <int> class incrementorT,
+  typename mutexT,
+  typename sourceT,
+  typename block_alignmentT
+>
+void
+size_based_pool<OBJECTS_PER_POOL, MIN_OBJECT_SIZE, MAX_OBJECT_SIZE,
+    incrementorT, mutexT, sourceT, block_alignmentT>::lockfree_free(void * ptr)
+{
+  chunk_header * chunk = chunk_for(ptr);
+  if (chunk) {
+    if (chunk->owner != this) {
+      // Not managed by us
+      return;
+    }
+
+    --m_live;
+    m_pools[chunk->size_class]->free(chunk, ptr);
     return;
   }
 
-  fhtagn::size_t adjusted_size = pool_size(iter->second);
-  if (iter->second == adjusted_size) {
-    m_pool_map[iter->second]->free(ptr);
+  large_header * large = large_for(ptr);
+  if (large->owner != this) {
+    return;
   }
-  else {
-    m_heap.free(ptr);
+
+  --m_live;
+  fhtagn::size_t size = large_header::header_size() + large->size;
+  large->~large_header();
+  sourceT::release(large, size);
+}
+
+
+
+template <
+  fhtagn::size_t OBJECTS_PER_POOL,
+  fhtagn::size_t MIN_OBJECT_SIZE,
+  fhtagn::size_t MAX_OBJECT_SIZE,
+  template <int> class incrementorT,
+  typename mutexT,
+  typename sourceT,
+  typename block_alignmentT
+>
+void
+size_based_pool<OBJECTS_PER_POOL, MIN_OBJECT_SIZE, MAX_OBJECT_SIZE,
+    incrementorT, mutexT, sourceT, block_alignmentT>::free_bulk(
+        void ** ptrs, fhtagn::size_t count)
+{
+  if (!count) {
+    return;
   }
 
-  m_pointer_size_map.erase(ptr);
+  typename mutexT::scoped_lock lock(m_mutex);
+
+  for (fhtagn::size_t i = 0 ; i < count ; ++i) {
+    if (ptrs[i]) {
+      lockfree_free(ptrs[i]);
+    }
+  }
 }
 
 
@@ -228,14 +477,16 @@ template <
   fhtagn::size_t MIN_OBJECT_SIZE,
   fhtagn::size_t MAX_OBJECT_SIZE,
   template <int> class incrementorT,
-  typename mutexT
+  typename mutexT,
+  typename sourceT,
+  typename block_alignmentT
 >
 bool
 size_based_pool<OBJECTS_PER_POOL, MIN_OBJECT_SIZE, MAX_OBJECT_SIZE,
-    incrementorT, mutexT>::in_use() const
+    incrementorT, mutexT, sourceT, block_alignmentT>::in_use() const
 {
   typename mutexT::scoped_lock lock(m_mutex);
-  return !m_pointer_size_map.empty();
+  return m_live > 0;
 }
 
 
@@ -245,34 +496,51 @@ template <
   fhtagn::size_t MIN_OBJECT_SIZE,
   fhtagn::size_t MAX_OBJECT_SIZE,
   template <int> class incrementorT,
-  typename mutexT
+  typename mutexT,
+  typename sourceT,
+  typename block_alignmentT
 >
 fhtagn::size_t
 size_based_pool<OBJECTS_PER_POOL, MIN_OBJECT_SIZE, MAX_OBJECT_SIZE,
-    incrementorT, mutexT>::alloc_size(void * ptr) const
+    incrementorT, mutexT, sourceT, block_alignmentT>::alloc_size(
+        void * ptr) const
 {
-  typename mutexT::scoped_lock lock(m_mutex);
-
-  pointer_size_map_t::const_iterator iter = m_pointer_size_map.find(ptr);
-  if (iter == m_pointer_size_map.end()) {
-    // Pointer not managed here.
+  if (!ptr) {
     return 0;
   }
 
-  fhtagn::size_t adjusted_size = pool_size(iter->second);
-  if (iter->second != adjusted_size) {
-    return m_heap.alloc_size(ptr);
+  chunk_header * chunk = chunk_for(ptr);
+  if (chunk) {
+    if (chunk->owner != this) {
+      // Pointer not managed here.
+      return 0;
+    }
+    return chunk->size;
   }
 
-  // Can return 0 if the pool does not manage the ptr - that'd be a bug, though.
-  typename pool_map_t::const_iterator pool_iter = m_pool_map.find(iter->second);
-  if (pool_iter == m_pool_map.end()) {
-    // Pretty much impossible.
-    throw std::bad_alloc();
+  large_header * large = large_for(ptr);
+  if (large->owner != this) {
+    return 0;
   }
-  fhtagn::size_t ret = pool_iter->second->alloc_size(ptr);
-  assert(ret);
-  return ret;
+  return large->size;
+}
+
+
+
+template <
+  fhtagn::size_t OBJECTS_PER_POOL,
+  fhtagn::size_t MIN_OBJECT_SIZE,
+  fhtagn::size_t MAX_OBJECT_SIZE,
+  template <int> class incrementorT,
+  typename mutexT,
+  typename sourceT,
+  typename block_alignmentT
+>
+mutexT &
+size_based_pool<OBJECTS_PER_POOL, MIN_OBJECT_SIZE, MAX_OBJECT_SIZE,
+    incrementorT, mutexT, sourceT, block_alignmentT>::mutex() const
+{
+  return m_mutex;
 }
 
 }} // namespace fhtagn::memory
@@ -0,0 +1,393 @@
+/**
+ * $Id$
+ *
+ * This file is part of the Fhtagn! C++ Library.
+ * Copyright (C) 2009 Jens Finkhaeuser <unwesen@users.sourceforge.net>.
+ *
+ * Author: Jens Finkhaeuser <unwesen@users.sourceforge.net>
+ *
+ * This program is licensed as free software for personal, educational or
+ * other non-commerical uses: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation, either version 3 of the License, or (at your
+ * option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Alternatively, licenses for commercial purposes are available as well.
+ * Please send your enquiries to the copyright holder's address above.
+ **/
+#ifndef FHTAGN_MEMORY_DETAIL_STATISTICS_TCC
+#define FHTAGN_MEMORY_DETAIL_STATISTICS_TCC
+
+#ifndef __cplusplus
+#error You are trying to include a C++ only header file
+#endif
+
+namespace fhtagn {
+namespace memory {
+
+namespace detail {
+
+/**
+ * Reads the contention count from a pool's mutex, if the pool uses a
+ * contention_counting_mutex, and returns zero otherwise.
+ **/
+BOOST_MPL_HAS_XXX_TRAIT_DEF(mutex_t)
+
+template <
+  typename memory_poolT,
+  typename mutexT
+>
+struct mutex_contention
+{
+  static inline fhtagn::size_t count(memory_poolT const &)
+  {
+    return 0;
+  }
+};
+
+template <
+  typename memory_poolT,
+  typename mutexT
+>
+struct mutex_contention<memory_poolT, contention_counting_mutex<mutexT> >
+{
+  static inline fhtagn::size_t count(memory_poolT const & pool)
+  {
+    return pool.mutex().contended();
+  }
+};
+
+template <
+  typename memory_poolT,
+  bool HAS_MUTEX = has_mutex_t<memory_poolT>::value
+>
+struct pool_contention
+{
+  static inline fhtagn::size_t count(memory_poolT const & pool)
+  {
+    return mutex_contention<memory_poolT,
+           typename memory_poolT::mutex_t>::count(pool);
+  }
+};
+
+template <
+  typename memory_poolT
+>
+struct pool_contention<memory_poolT, false>
+{
+  static inline fhtagn::size_t count(memory_poolT const &)
+  {
+    return 0;
+  }
+};
+
+} // namespace detail
+
+
+
+pool_statistics::pool_statistics()
+  : allocs(0)
+  , frees(0)
+  , reallocs(0)
+  , failed_allocs(0)
+  , bytes_live(0)
+  , bytes_high_water(0)
+  , contended_locks(0)
+{
+  for (fhtagn::size_t i = 0 ; i < HISTOGRAM_BUCKETS ; ++i) {
+    size_histogram[i] = 0;
+  }
+}
+
+
+
+void
+pool_statistics::write_text(std::ostream & os) const
+{
+  os << "allocs:           " << allocs << std::endl
+     << "frees:            " << frees << std::endl
+     << "reallocs:         " << reallocs << std::endl
+     << "failed allocs:    " << failed_allocs << std::endl
+     << "bytes live:       " << bytes_live << std::endl
+     << "bytes high water: " << bytes_high_water << std::endl
+     << "contended locks:  " << contended_locks << std::endl
+     << "size histogram:" << std::endl;
+
+  for (fhtagn::size_t i = 0 ; i < HISTOGRAM_BUCKETS ; ++i) {
+    if (!size_histogram[i]) {
+      continue;
+    }
+    os << "  >= " << (fhtagn::size_t(1) << i) << ": " << size_histogram[i]
+       << std::endl;
+  }
+}
+
+
+
+void
+pool_statistics::write_json(std::ostream & os) const
+{
+  os << "{\"allocs\":" << allocs
+     << ",\"frees\":" << frees
+     << ",\"reallocs\":" << reallocs
+     << ",\"failed_allocs\":" << failed_allocs
+     << ",\"bytes_live\":" << bytes_live
+     << ",\"bytes_high_water\":" << bytes_high_water
+     << ",\"contended_locks\":" << contended_locks
+     << ",\"size_histogram\":[";
+
+  for (fhtagn::size_t i = 0 ; i < HISTOGRAM_BUCKETS ; ++i) {
+    if (i) {
+      os << ",";
+    }
+    os << size_histogram[i];
+  }
+  os << "]}";
+}
+
+
+
+atomic_statistics::atomic_statistics()
+  : m_allocs(0)
+  , m_frees(0)
+  , m_reallocs(0)
+  , m_failed_allocs(0)
+  , m_bytes_live(0)
+  , m_bytes_high_water(0)
+{
+  for (fhtagn::size_t i = 0 ; i < pool_statistics::HISTOGRAM_BUCKETS ; ++i) {
+    m_size_histogram[i] = 0;
+  }
+}
+
+
+
+void
+atomic_statistics::on_alloc(fhtagn::size_t requested, fhtagn::size_t bytes)
+{
+  fhtagn::threads::atomic_add(m_allocs, fhtagn::size_t(1));
+  count_size(requested);
+  add_bytes(bytes);
+}
+
+
+
+void
+atomic_statistics::on_realloc(fhtagn::size_t requested,
+    fhtagn::size_t old_bytes, fhtagn::size_t new_bytes)
+{
+  fhtagn::threads::atomic_add(m_reallocs, fhtagn::size_t(1));
+  count_size(requested);
+  // Unsigned arithmetic wraps around, so this works for shrinking, too.
+  add_bytes(new_bytes - old_bytes);
+}
+
+
+
+void
+atomic_statistics::on_free(fhtagn::size_t bytes)
+{
+  fhtagn::threads::atomic_add(m_frees, fhtagn::size_t(1));
+  fhtagn::threads::atomic_add(m_bytes_live, fhtagn::size_t(0) - bytes);
+}
+
+
+
+void
+atomic_statistics::on_failure(fhtagn::size_t)
+{
+  fhtagn::threads::atomic_add(m_failed_allocs, fhtagn::size_t(1));
+}
+
+
+
+void
+atomic_statistics::snapshot(pool_statistics & stats) const
+{
+  using fhtagn::threads::atomic_load;
+
+  stats.allocs = atomic_load(m_allocs);
+  stats.frees = atomic_load(m_frees);
+  stats.reallocs = atomic_load(m_reallocs);
+  stats.failed_allocs = atomic_load(m_failed_allocs);
+  stats.bytes_live = atomic_load(m_bytes_live);
+  stats.bytes_high_water = atomic_load(m_bytes_high_water);
+  for (fhtagn::size_t i = 0 ; i < pool_statistics::HISTOGRAM_BUCKETS ; ++i) {
+    stats.size_histogram[i] = atomic_load(m_size_histogram[i]);
+  }
+}
+
+
+
+void
+atomic_statistics::add_bytes(fhtagn::size_t bytes)
+{
+  fhtagn::size_t live = fhtagn::threads::atomic_add(m_bytes_live, bytes);
+
+  // Raise the high water mark, unless another thread raised it further in the
+  // meantime.
+  fhtagn::size_t high = fhtagn::threads::atomic_load(m_bytes_high_water);
+  while (live > high) {
+    if (fhtagn::threads::compare_and_swap(m_bytes_high_water, high, live)) {
+      break;
+    }
+    high = fhtagn::threads::atomic_load(m_bytes_high_water);
+  }
+}
+
+
+
+void
+atomic_statistics::count_size(fhtagn::size_t requested)
+{
+  fhtagn::size_t bucket = requested ? highest_set_bit(requested) : 0;
+  if (bucket >= pool_statistics::HISTOGRAM_BUCKETS) {
+    bucket = pool_statistics::HISTOGRAM_BUCKETS - 1;
+  }
+  fhtagn::threads::atomic_add(m_size_histogram[bucket], fhtagn::size_t(1));
+}
+
+
+
+template <
+  typename memory_poolT,
+  typename statisticsT
+>
+statistics_pool<memory_poolT, statisticsT>::statistics_pool(
+    memory_poolT & pool)
+  : m_pool(pool)
+{
+}
+
+
+
+template <
+  typename memory_poolT,
+  typename statisticsT
+>
+void *
+statistics_pool<memory_poolT, statisticsT>::alloc(fhtagn::size_t size)
+{
+  void * ret = m_pool.alloc(size);
+  if (statisticsT::ENABLED) {
+    if (ret) {
+      m_statistics.on_alloc(size, m_pool.alloc_size(ret));
+    }
+    else {
+      m_statistics.on_failure(size);
+    }
+  }
+  return ret;
+}
+
+
+
+template <
+  typename memory_poolT,
+  typename statisticsT
+>
+void *
+statistics_pool<memory_poolT, statisticsT>::realloc(void * ptr,
+    fhtagn::size_t new_size)
+{
+  if (!statisticsT::ENABLED) {
+    return m_pool.realloc(ptr, new_size);
+  }
+
+  if (!ptr) {
+    return alloc(new_size);
+  }
+
+  fhtagn::size_t old_bytes = m_pool.alloc_size(ptr);
+  void * ret = m_pool.realloc(ptr, new_size);
+  if (ret) {
+    m_statistics.on_realloc(new_size, old_bytes, m_pool.alloc_size(ret));
+  }
+  else {
+    m_statistics.on_failure(new_size);
+  }
+  return ret;
+}
+
+
+
+template <
+  typename memory_poolT,
+  typename statisticsT
+>
+void
+statistics_pool<memory_poolT, statisticsT>::free(void * ptr)
+{
+  if (!statisticsT::ENABLED || !ptr) {
+    m_pool.free(ptr);
+    return;
+  }
+
+  fhtagn::size_t bytes = m_pool.alloc_size(ptr);
+  m_pool.free(ptr);
+  m_statistics.on_free(bytes);
+}
+
+
+
+template <
+  typename memory_poolT,
+  typename statisticsT
+>
+bool
+statistics_pool<memory_poolT, statisticsT>::in_use() const
+{
+  return m_pool.in_use();
+}
+
+
+
+template <
+  typename memory_poolT,
+  typename statisticsT
+>
+fhtagn::size_t
+statistics_pool<memory_poolT, statisticsT>::alloc_size(void * ptr) const
+{
+  return m_pool.alloc_size(ptr);
+}
+
+
+
+template <
+  typename memory_poolT,
+  typename statisticsT
+>
+pool_statistics
+statistics_pool<memory_poolT, statisticsT>::snapshot() const
+{
+  pool_statistics stats;
+  m_statistics.snapshot(stats);
+  stats.contended_locks = detail::pool_contention<memory_poolT>::count(m_pool);
+  return stats;
+}
+
+
+
+template <
+  typename memory_poolT,
+  typename statisticsT
+>
+statisticsT &
+statistics_pool<memory_poolT, statisticsT>::statistics()
+{
+  return m_statistics;
+}
+
+
+}} // namespace fhtagn::memory
+
+#endif // guard
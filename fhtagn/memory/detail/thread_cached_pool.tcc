@@ -0,0 +1,265 @@
+/**
+ * $Id$
+ *
+ * This file is part of the Fhtagn! C++ Library.
+ * Copyright (C) 2011 Jens Finkhaeuser <unwesen@users.sourceforge.net>.
+ *
+ * Author: Jens Finkhaeuser <unwesen@users.sourceforge.net>
+ *
+ * This program is licensed as free software for personal, educational or
+ * other non-commerical uses: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation, either version 3 of the License, or (at your
+ * option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Alternatively, licenses for commercial purposes are available as well.
+ * Please send your enquiries to the copyright holder's address above.
+ **/
+#ifndef FHTAGN_MEMORY_DETAIL_THREAD_CACHED_POOL_TCC
+#define FHTAGN_MEMORY_DETAIL_THREAD_CACHED_POOL_TCC
+
+#ifndef __cplusplus
+#error You are trying to include a C++ only header file
+#endif
+
+#include <string.h>
+
+#include <algorithm>
+
+namespace fhtagn {
+namespace memory {
+
+template <
+  typename poolT,
+  fhtagn::size_t MAGAZINE_SIZE
+>
+thread_cached_pool<poolT, MAGAZINE_SIZE>::thread_cached_pool()
+  : m_cache(&thread_cached_pool::release_cache)
+{
+}
+
+
+
+template <
+  typename poolT,
+  fhtagn::size_t MAGAZINE_SIZE
+>
+thread_cached_pool<poolT, MAGAZINE_SIZE>::~thread_cached_pool()
+{
+  // Release the calling thread's cache before m_pool gets destroyed.
+  m_cache.reset();
+}
+
+
+
+template <
+  typename poolT,
+  fhtagn::size_t MAGAZINE_SIZE
+>
+typename thread_cached_pool<poolT, MAGAZINE_SIZE>::thread_cache &
+thread_cached_pool<poolT, MAGAZINE_SIZE>::get_cache()
+{
+  thread_cache * cache = m_cache.get();
+  if (!cache) {
+    cache = new thread_cache(this, m_pool.size_classes());
+    m_cache.reset(cache);
+  }
+  return *cache;
+}
+
+
+
+template <
+  typename poolT,
+  fhtagn::size_t MAGAZINE_SIZE
+>
+void
+thread_cached_pool<poolT, MAGAZINE_SIZE>::release_cache(thread_cache * cache)
+{
+  if (!cache) {
+    return;
+  }
+
+  cache->owner->drain(*cache);
+  delete cache;
+}
+
+
+
+template <
+  typename poolT,
+  fhtagn::size_t MAGAZINE_SIZE
+>
+void *
+thread_cached_pool<poolT, MAGAZINE_SIZE>::alloc(fhtagn::size_t size)
+{
+  if (!size) {
+    return NULL;
+  }
+
+  fhtagn::size_t index = m_pool.size_class(size);
+  if (index >= m_pool.size_classes()) {
+    // Too large to be cached.
+    return m_pool.alloc(size);
+  }
+
+  thread_cache & cache = get_cache();
+  magazine & mag = cache.magazines[index];
+
+  // If the magazine is empty, refill it from the pool. We only refill half the
+  // magazine, so that subsequent frees have some space left.
+  if (!mag.count) {
+    mag.count = m_pool.alloc_bulk(m_pool.class_size(index),
+        std::max(fhtagn::size_t(1), MAGAZINE_SIZE / 2), mag.ptrs);
+    if (!mag.count) {
+      return NULL;
+    }
+  }
+
+  return mag.ptrs[--mag.count];
+}
+
+
+
+template <
+  typename poolT,
+  fhtagn::size_t MAGAZINE_SIZE
+>
+void *
+thread_cached_pool<poolT, MAGAZINE_SIZE>::realloc(void * ptr,
+    fhtagn::size_t new_size)
+{
+  if (!ptr) {
+    return alloc(new_size);
+  }
+
+  if (!new_size) {
+    return NULL;
+  }
+
+  fhtagn::size_t old_size = m_pool.alloc_size(ptr);
+  if (!old_size) {
+    return NULL;
+  }
+
+  fhtagn::size_t index = m_pool.size_class(new_size);
+  if (index < m_pool.size_classes() && old_size == m_pool.class_size(index)) {
+    // No reallocation required, the backing store is the same size as before.
+    return ptr;
+  }
+
+  void * new_ptr = alloc(new_size);
+  if (!new_ptr) {
+    return NULL;
+  }
+
+  ::memcpy(new_ptr, ptr, std::min(old_size, new_size));
+  free(ptr);
+
+  return new_ptr;
+}
+
+
+
+template <
+  typename poolT,
+  fhtagn::size_t MAGAZINE_SIZE
+>
+void
+thread_cached_pool<poolT, MAGAZINE_SIZE>::free(void * ptr)
+{
+  if (!ptr) {
+    return;
+  }
+
+  fhtagn::size_t index = m_pool.size_class_of(ptr);
+  if (index >= m_pool.size_classes()) {
+    // Large object, or not managed by the pool; let the pool deal with it.
+    m_pool.free(ptr);
+    return;
+  }
+
+  thread_cache & cache = get_cache();
+  magazine & mag = cache.magazines[index];
+
+  // If the magazine is full, return the older half of it to the pool, so that
+  // alternating allocs and frees don't hit the pool's mutex every time.
+  if (mag.count >= MAGAZINE_SIZE) {
+    fhtagn::size_t release = std::max(fhtagn::size_t(1), MAGAZINE_SIZE / 2);
+    m_pool.free_bulk(mag.ptrs, release);
+    mag.count -= release;
+    ::memmove(mag.ptrs, mag.ptrs + release, mag.count * sizeof(void *));
+  }
+
+  mag.ptrs[mag.count++] = ptr;
+}
+
+
+
+template <
+  typename poolT,
+  fhtagn::size_t MAGAZINE_SIZE
+>
+void
+thread_cached_pool<poolT, MAGAZINE_SIZE>::drain(thread_cache & cache)
+{
+  for (typename std::vector<magazine>::iterator iter = cache.magazines.begin()
+      ; iter != cache.magazines.end() ; ++iter)
+  {
+    m_pool.free_bulk(iter->ptrs, iter->count);
+    iter->count = 0;
+  }
+}
+
+
+
+template <
+  typename poolT,
+  fhtagn::size_t MAGAZINE_SIZE
+>
+void
+thread_cached_pool<poolT, MAGAZINE_SIZE>::flush()
+{
+  thread_cache * cache = m_cache.get();
+  if (!cache) {
+    return;
+  }
+  drain(*cache);
+}
+
+
+
+template <
+  typename poolT,
+  fhtagn::size_t MAGAZINE_SIZE
+>
+bool
+thread_cached_pool<poolT, MAGAZINE_SIZE>::in_use() const
+{
+  return m_pool.in_use();
+}
+
+
+
+template <
+  typename poolT,
+  fhtagn::size_t MAGAZINE_SIZE
+>
+fhtagn::size_t
+thread_cached_pool<poolT, MAGAZINE_SIZE>::alloc_size(void * ptr) const
+{
+  return m_pool.alloc_size(ptr);
+}
+
+}} // namespace fhtagn::memory
+
+
+#endif // guard
@@ -37,6 +37,7 @@
 #include <fhtagn/shared_ptr.h>
 #include <fhtagn/memory/memory_pool.h>
 #include <fhtagn/memory/utility.h>
+#include <fhtagn/memory/retention_policy.h>
 #include <fhtagn/threads/lock_policy.h>
 
 namespace fhtagn {
@@ -46,18 +47,31 @@ namespace memory {
  * The dynamic_pool class is a thin wrapper around such MemoryPool objects that
  * manage memory blocks of a fixed size, such as fixed_pool or block_pool.
  *
- * Note that as dynamic_pool allocates memory from the heap, the underlying pool
- * type must adopt the pointer handed to it. For that purpose, block_pool and
- * fixed_pool both define nested types which explicitly use the adopt or ignore
- * policy from common.h. The former nested type is what dynamic_pool uses and
- * expects any poolT to supply.
+ * Note that as dynamic_pool allocates and releases the memory blocks handed to
+ * the underlying pool itself, the underlying pool type must not adopt them.
+ * For that purpose, block_pool and fixed_pool both define nested types which
+ * explicitly use the adopt or ignore policy from common.h. The latter nested
+ * type is what dynamic_pool uses and expects any poolT to supply.
  *
  * It maintains a defers to a list of such pools. If allocation from one of them
  * fails, an additional such pool is created, and memory is allocated from there
  * instead.
  *
  * If after freeing a pointer, the pool it was from becomes empty, the pool
- * is destroyed again.
+ * is destroyed again - unless the retention policy (see retention_policy.h)
+ * asks for empty pools to be kept around. Memory blocks are obtained from and
+ * released via the retention policy. The default heap_retention_policy<>
+ * allocates blocks with new[] and retains no empty blocks.
+ *
+ * Pools are kept in a map ordered by their address range, so finding the pool
+ * a pointer belongs to is logarithmic in the number of pools. Allocations are
+ * tried on the list of pools that have not failed a request since memory was
+ * last returned to them. A pool that fails a request is taken off that list,
+ * and indexed by the size of the smallest request it failed instead; later
+ * requests only try the pools indexed by a larger size. Freeing or
+ * reallocating a pointer puts it's pool back onto the list. As a result, pools
+ * that filled up are not visited again by requests they can't satisfy, no
+ * matter how many there are.
  *
  * Pools are created with a fixed size, passed to dynamic_pool as a template
  * parameter. One obvious result of that is that dynamic_pool can never allocate
@@ -73,7 +87,8 @@ namespace memory {
 template <
   typename poolT,
   int MEMORY_BLOCK_SIZE,
-  typename mutexT = fhtagn::threads::fake_mutex
+  typename mutexT = fhtagn::threads::fake_mutex,
+  typename retentionT = fhtagn::memory::heap_retention_policy<>
 >
 class dynamic_pool
 {
@@ -81,8 +96,12 @@ public:
   /**
    * Convenience typedefs
    **/
-  typedef mutexT                              mutex_t;
-  typedef typename poolT::with_adopt_policy_t pool_t;
+  typedef mutexT                                mutex_t;
+  typedef retentionT                            retention_policy_t;
+  typedef typename poolT::with_ignore_policy_t  pool_t;
+
+  inline dynamic_pool();
+  inline ~dynamic_pool();
 
   /**
    * API - see memory_pool.h for details
@@ -93,11 +112,85 @@ public:
   inline bool in_use() const;
   inline fhtagn::size_t alloc_size(void * ptr) const;
 
+  /**
+   * Returns true if ptr points into one of the memory blocks currently held
+   * by this pool.
+   **/
+  inline bool owns(void * ptr) const;
+
+  /**
+   * Bulk API - see memory_pool.h for details. The batch is passed on to the
+   * underlying pools' own bulk functions, so it is satisfied from as few
+   * memory blocks as possible.
+   **/
+  inline fhtagn::size_t alloc_bulk(fhtagn::size_t size, fhtagn::size_t count,
+      void ** ptrs);
+  inline void free_bulk(void ** ptrs, fhtagn::size_t count);
+
+  /**
+   * Releases all empty memory blocks, including those the retention policy
+   * would otherwise keep around. Returns the number of blocks released.
+   **/
+  inline fhtagn::size_t trim();
+
+  /**
+   * Number of memory blocks currently held by the pool, and the number of
+   * those that hold at least one allocation. The difference is the number of
+   * empty blocks retained.
+   **/
+  inline fhtagn::size_t blocks_held() const;
+  inline fhtagn::size_t blocks_in_use() const;
+
+  /**
+   * Number of memory blocks on the list of pools with free space, i.e. those
+   * that have not failed a request since memory was last returned to them.
+   **/
+  inline fhtagn::size_t blocks_with_space() const;
+
+  /**
+   * Returns the mutex guarding this pool, e.g. to read the lock contention
+   * count of a contention_counting_mutex (see statistics.h).
+   **/
+  inline mutex_t & mutex() const;
+
 private:
 
   typedef fhtagn::shared_ptr<pool_t>      pool_ptr;
   typedef std::pair<void *, void *>       pool_key_t;
-  typedef std::map<pool_key_t, pool_ptr>  pool_map_t;
+
+  struct pool_entry;
+  typedef std::multimap<fhtagn::size_t, pool_entry *> failed_map_t;
+
+  /**
+   * Map entry for each pool. If has_space is set, the entry is linked into
+   * the list of pools with free space via free_prev and free_next. Otherwise,
+   * fail_size is the smallest request size the pool failed to satisfy since
+   * memory was last returned to it, and if that's larger than one, failed
+   * points to the pool's entry in the index of failed pools. If empty is set,
+   * the pool is retained without holding any allocations.
+   **/
+  struct pool_entry
+  {
+    pool_entry(pool_ptr const & _pool)
+      : pool(_pool)
+      , has_space(false)
+      , empty(false)
+      , fail_size(0)
+      , free_prev(NULL)
+      , free_next(NULL)
+    {
+    }
+
+    pool_ptr                        pool;
+    bool                            has_space;
+    bool                            empty;
+    fhtagn::size_t                  fail_size;
+    pool_entry *                    free_prev;
+    pool_entry *                    free_next;
+    typename failed_map_t::iterator failed;
+  };
+
+  typedef std::map<pool_key_t, pool_entry>  pool_map_t;
 
   /**
    * For a given pointer, returns the pool that should contain it.
@@ -105,12 +198,45 @@ private:
   inline typename pool_map_t::iterator find_pool(void * ptr);
   inline typename pool_map_t::const_iterator find_pool(void * ptr) const;
 
+  /**
+   * mark_has_space() puts the pool entry onto the list of pools with free
+   * space, and clears it's fail_size. mark_failed() records that a request of
+   * the given size failed, and moves the entry from the list into the index
+   * of failed pools. Pools that failed even the smallest possible request are
+   * not indexed at all. unlink() removes the entry from either.
+   **/
+  inline void mark_has_space(pool_entry & entry);
+  inline void mark_failed(pool_entry & entry, fhtagn::size_t size);
+  inline void unlink(pool_entry & entry);
+
+  /**
+   * Allocate from the given pool, and record whether that failed.
+   **/
+  inline void * try_alloc(pool_entry & entry, fhtagn::size_t size);
+  inline fhtagn::size_t try_alloc_bulk(pool_entry & entry, fhtagn::size_t size,
+      fhtagn::size_t count, void ** ptrs);
+
+  /**
+   * Called after a pointer from the given pool was freed; retains or releases
+   * the pool if it became empty.
+   **/
+  inline void pool_freed(typename pool_map_t::iterator iter);
+
+  /**
+   * Destroys the pool and releases it's memory block.
+   **/
+  inline void release_pool(typename pool_map_t::iterator iter);
+
   /**
    * Lock-free version of alloc, used internally.
    **/
   inline void * lockfree_alloc(fhtagn::size_t size);
 
   pool_map_t      m_pool_map;
+  pool_entry *    m_free_list;    // Head of the list of pools with free space.
+  fhtagn::size_t  m_free_blocks;  // Length of that list.
+  failed_map_t    m_failed;       // Failed pools, by smallest failed size.
+  fhtagn::size_t  m_empty_blocks;
   mutable mutex_t m_mutex;
 };
 
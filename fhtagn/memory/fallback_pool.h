@@ -0,0 +1,125 @@
+/**
+ * $Id$
+ *
+ * This file is part of the Fhtagn! C++ Library.
+ * Copyright (C) 2009 Jens Finkhaeuser <unwesen@users.sourceforge.net>.
+ *
+ * Author: Jens Finkhaeuser <unwesen@users.sourceforge.net>
+ *
+ * This program is licensed as free software for personal, educational or
+ * other non-commerical uses: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation, either version 3 of the License, or (at your
+ * option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Alternatively, licenses for commercial purposes are available as well.
+ * Please send your enquiries to the copyright holder's address above.
+ **/
+#ifndef FHTAGN_MEMORY_FALLBACK_POOL_H
+#define FHTAGN_MEMORY_FALLBACK_POOL_H
+
+#ifndef __cplusplus
+#error You are trying to include a C++ only header file
+#endif
+
+#include <fhtagn/fhtagn.h>
+
+#include <fhtagn/memory/memory_pool.h>
+
+namespace fhtagn {
+namespace memory {
+
+/**
+ * The fallback_pool class combines a primary and a secondary MemoryPool.
+ * Allocations are served from the primary pool while it can satisfy them, and
+ * spill over to the secondary pool when it can't. Where throw_pool turns a
+ * full pool into an exception, fallback_pool keeps going.
+ *
+ * The typical use is a fast, bounded primary pool such as a fixed_pool or
+ * block_pool over a preallocated region, with a dynamic_pool or heap_pool as
+ * the secondary.
+ *
+ * Pointers are routed back to the pool that allocated them by asking the
+ * primary pool whether it owns them, so primaryT must provide
+ *
+ *   bool owns(void * ptr) const;
+ *
+ * which fixed_pool, block_pool and dynamic_pool do. Any pointer the primary
+ * pool doesn't own is assumed to come from the secondary pool.
+ *
+ * realloc() of a pointer from the primary pool that the primary pool can't
+ * satisfy moves the data to the secondary pool. Pointers never move back
+ * from the secondary to the primary pool.
+ *
+ * Like throw_pool, fallback_pool owns neither pool, and adds no locking of
+ * it's own; it's as thread-safe as the pools it combines.
+ **/
+template <
+  typename primaryT,
+  typename secondaryT
+>
+class fallback_pool
+{
+public:
+  BOOST_CLASS_REQUIRE(primaryT, ::fhtagn::memory::concepts,
+      MemoryPoolConcept);
+  BOOST_CLASS_REQUIRE(secondaryT, ::fhtagn::memory::concepts,
+      MemoryPoolConcept);
+
+  typedef primaryT    primary_pool_t;
+  typedef secondaryT  secondary_pool_t;
+
+  inline fallback_pool(primaryT & primary, secondaryT & secondary);
+
+  /**
+   * API - see memory_pool.h for details
+   *
+   * in_use() returns true if either pool is in use.
+   **/
+  inline void * alloc(fhtagn::size_t size);
+  inline void * realloc(void * ptr, fhtagn::size_t new_size);
+  inline void free(void * ptr);
+  inline bool in_use() const;
+  inline fhtagn::size_t alloc_size(void * ptr) const;
+
+  /**
+   * Bulk API - see memory_pool.h for details. The batch is allocated from the
+   * primary pool as far as possible, and completed from the secondary pool.
+   **/
+  inline fhtagn::size_t alloc_bulk(fhtagn::size_t size, fhtagn::size_t count,
+      void ** ptrs);
+  inline void free_bulk(void ** ptrs, fhtagn::size_t count);
+
+  /**
+   * Returns the number of allocations the primary pool could not satisfy,
+   * and that were served from the secondary pool instead. Reallocations that
+   * moved data from the primary to the secondary pool are included.
+   **/
+  inline fhtagn::size_t spills() const;
+
+  /**
+   * Access to the combined pools.
+   **/
+  inline primaryT & primary();
+  inline secondaryT & secondary();
+
+private:
+  primaryT &                m_primary;
+  secondaryT &              m_secondary;
+  fhtagn::size_t volatile   m_spills;
+};
+
+
+}} // namespace fhtagn::memory
+
+#include <fhtagn/memory/detail/fallback_pool.tcc>
+
+#endif // guard
@@ -0,0 +1,137 @@
+/**
+ * $Id$
+ *
+ * This file is part of the Fhtagn! C++ Library.
+ * Copyright (C) 2009 Jens Finkhaeuser <unwesen@users.sourceforge.net>.
+ *
+ * Author: Jens Finkhaeuser <unwesen@users.sourceforge.net>
+ *
+ * This program is licensed as free software for personal, educational or
+ * other non-commerical uses: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation, either version 3 of the License, or (at your
+ * option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Alternatively, licenses for commercial purposes are available as well.
+ * Please send your enquiries to the copyright holder's address above.
+ **/
+#ifndef FHTAGN_MEMORY_FILE_POOL_H
+#define FHTAGN_MEMORY_FILE_POOL_H
+
+#ifndef __cplusplus
+#error You are trying to include a C++ only header file
+#endif
+
+#include <fhtagn/fhtagn.h>
+
+#include <boost/noncopyable.hpp>
+
+#include <fhtagn/memory/shared_pool.h>
+
+namespace fhtagn {
+namespace memory {
+
+namespace detail {
+
+/**
+ * Opens a file exclusively and maps it into memory. It's a base class of
+ * file_pool, so that the mapping exists before the pool is constructed in it.
+ **/
+class mapped_file
+  : private boost::noncopyable
+{
+protected:
+  /**
+   * Opens or creates the file at path. Empty files are resized to size bytes;
+   * otherwise the file's size is kept. Throws std::runtime_error if the file
+   * can't be opened, mapped, or is already opened by another mapped_file.
+   **/
+  inline mapped_file(char const * path, fhtagn::size_t size);
+  inline ~mapped_file();
+
+  void *          m_map;
+  fhtagn::size_t  m_map_size;
+  bool            m_created;    // True if the file was empty.
+
+private:
+  inline void fail(char const * what, char const * path);
+
+  int             m_fd;
+};
+
+} // namespace detail
+
+
+/**
+ * The file_pool class is a shared_pool in a memory mapped file, which lets
+ * data structures allocated from it survive restarts of the program without
+ * having to be rebuilt: reopening the file only maps it, and pages are read
+ * back from the file as they're accessed.
+ *
+ * If the file is empty or does not exist, it's resized to the given size and
+ * a new pool is created in it. Otherwise the pool in the file is reopened and
+ * validated, and the file's size is used; see the REOPEN mode of shared_pool
+ * for details. Use set_root() to store the pointer to your data structure's
+ * entry point in the pool, and root() to retrieve it after reopening.
+ *
+ * The file is mapped wherever the operating system chooses, so it may end up
+ * at a different address each time it's opened. root() takes care of that for
+ * the entry point, but pointers your data structure stores in allocated memory
+ * are invalid after reopening. Store links between objects in the pool as
+ * offsets instead: offset_of() turns a pointer into an offset before it's
+ * stored, and pointer_to() turns it back into a pointer when it's followed.
+ *
+ * Changes reach the file at the operating system's discretion. sync() writes
+ * them to the file right away, and marks the pool as clean; it's also called
+ * when the file_pool is destroyed. If the program terminates without that,
+ * the next open rebuilds the pool's free lists from the segment headers, and
+ * fails if those are inconsistent. Note that this covers the pool's own state
+ * only; data written to allocated memory after the last sync() may or may not
+ * be in the file.
+ *
+ * The file is locked while it's open, so only one process can use it at a
+ * time.
+ **/
+template <
+  typename block_alignmentT = block_alignment<>
+>
+class file_pool
+  : private detail::mapped_file
+  , public shared_pool<block_alignmentT>
+{
+public:
+  /**
+   * Convenience typedefs
+   **/
+  typedef shared_pool<block_alignmentT> shared_pool_t;
+
+  inline file_pool(char const * path, fhtagn::size_t size);
+  inline ~file_pool();
+
+  /**
+   * Returns true if a new pool was created in the file, false if an existing
+   * pool was reopened.
+   **/
+  inline bool created() const;
+
+  /**
+   * Returns the size of the file, which may differ from the size passed to
+   * the constructor if the file existed.
+   **/
+  inline fhtagn::size_t file_size() const;
+};
+
+
+}} // namespace fhtagn::memory
+
+#include <fhtagn/memory/detail/file_pool.tcc>
+
+#endif // guard
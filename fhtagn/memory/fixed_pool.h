@@ -35,6 +35,7 @@
 #include <fhtagn/memory/utility.h>
 #include <fhtagn/memory/memory_pool.h>
 #include <fhtagn/memory/common.h>
+#include <fhtagn/memory/detail/segment_heap.h>
 #include <fhtagn/threads/lock_policy.h>
 
 namespace fhtagn {
@@ -62,6 +63,16 @@ namespace memory {
  *
  * In most cases, you don't need to change the block alignment, but if you feel
  * the need to squeeze the last bytes out of things, feel free to do so.
+ *
+ * Internally, the memory block is split into segments, each starting with a
+ * header that records it's size and the segment preceding it in memory. Free
+ * segments are kept in size-binned free lists, one per power of two, with a
+ * bitmap of non-empty bins. Allocation takes the first segment in the bin the
+ * requested size falls into if that's large enough, and otherwise the first
+ * segment from the smallest non-empty bin that only holds large enough
+ * segments, found with a single bitmap scan. It therefore does not depend on
+ * the number of segments in the pool. Freed segments are merged with free
+ * neighbours via their headers in constant time.
  **/
 template <
   typename mutexT = fhtagn::threads::fake_mutex,
@@ -111,69 +122,47 @@ public:
   inline bool in_use() const;
   inline fhtagn::size_t alloc_size(void * ptr) const;
 
-private:
-
   /**
-   * Helper structure, that is the header of each free or allocated segment in
-   * the fixed_pool.
+   * Returns true if ptr points into the memory block managed by this pool,
+   * i.e. if it may have been allocated from it. Used e.g. by fallback_pool
+   * (see fallback_pool.h) to route pointers to the pool that owns them.
    **/
-  struct segment
-  {
-    enum {
-      FREE      = 0,
-      ALLOCATED = ~char(0)
-    };
-
-    enum {
-      LAST_SEGMENT = fhtagn::size_t(0)
-    };
-
-    segment(fhtagn::size_t _size)
-      : size(_size - sizeof(segment))
-      , status(FREE)
-    {
-      marker = LAST_SEGMENT;
-    }
-
-    inline fhtagn::size_t full_size() const
-    {
-      return size + sizeof(segment);
-    }
-
-    static inline fhtagn::size_t header_size()
-    {
-      return block_alignmentT::adjust_size(sizeof(segment));
-    }
-
-    fhtagn::size_t  size;
-    char            status;
-    union {
-      segment *       next;
-      fhtagn::size_t  marker;
-    };
-  };
+  inline bool owns(void * ptr) const;
 
   /**
-   * Finds and allocates a free segment of the given size, splitting larger
-   * segments if necessary.
+   * Bulk API - see memory_pool.h for details. alloc_bulk() tries to find a
+   * single free segment large enough for the whole batch, and carves it up
+   * into adjacent segments; only if there's no such segment does it fall back
+   * to searching the free lists for each object.
    **/
-  inline segment * allocate_segment(fhtagn::size_t size);
+  inline fhtagn::size_t alloc_bulk(fhtagn::size_t size, fhtagn::size_t count,
+      void ** ptrs);
+  inline void free_bulk(void ** ptrs, fhtagn::size_t count);
 
   /**
-   * Finds the segment in which ptr resides, or throws if the ptr can't be
-   * found.
+   * Returns the mutex guarding this pool, e.g. to read the lock contention
+   * count of a contention_counting_mutex (see statistics.h).
    **/
-  inline segment * find_segment_for(void * ptr) const;
+  inline mutex_t & mutex() const;
+
+private:
+  typedef detail::segment_heap<
+    block_alignmentT,
+    detail::pointer_links
+  > heap_t;
+  typedef typename heap_t::segment segment;
 
   /**
-   * Merges contiguous free segments.
+   * Finds the segment in which ptr resides, or throws if the ptr does not
+   * point to an allocated segment's data.
    **/
-  inline void defragment_free_list();
+  inline segment * find_segment_for(void * ptr) const;
 
-  void *          m_memblock;
-  fhtagn::size_t  m_size;
+  void *                  m_memblock;
+  fhtagn::size_t          m_size;
 
-  segment *       m_start;
+  typename heap_t::state  m_state;
+  heap_t                  m_heap;
 
   mutable mutex_t m_mutex;
 };
@@ -0,0 +1,67 @@
+/**
+ * $Id$
+ *
+ * This file is part of the Fhtagn! C++ Library.
+ * Copyright (C) 2009 Jens Finkhaeuser <unwesen@users.sourceforge.net>.
+ *
+ * Author: Jens Finkhaeuser <unwesen@users.sourceforge.net>
+ *
+ * This program is licensed as free software for personal, educational or
+ * other non-commerical uses: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation, either version 3 of the License, or (at your
+ * option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Alternatively, licenses for commercial purposes are available as well.
+ * Please send your enquiries to the copyright holder's address above.
+ **/
+
+/**
+ * The fhtagn_new library replaces the global operator new and operator delete
+ * with versions that allocate objects of up to 1 KiB from a thread_cached_pool
+ * in front of a size_based_pool, and larger objects with malloc(). Link
+ * against it to use the pool as the process-wide allocator; see global_new.h
+ * for details, and for how to use a different pool instead.
+ **/
+
+#include <fhtagn/memory/global_new.h>
+#include <fhtagn/memory/size_based_pool.h>
+#include <fhtagn/memory/thread_cached_pool.h>
+
+#include <boost/thread/mutex.hpp>
+
+namespace {
+
+namespace mem = fhtagn::memory;
+
+enum {
+  MAX_OBJECT_SIZE = 1024,
+};
+
+typedef mem::registry_source<>  source_t;
+
+typedef mem::size_based_pool<
+  256,
+  8,
+  MAX_OBJECT_SIZE,
+  fhtagn::meta::multi_double,
+  boost::mutex,
+  source_t,
+  mem::block_alignment<2 * sizeof(void *)>
+> size_based_pool_t;
+
+typedef mem::thread_cached_pool<size_based_pool_t>  pool_t;
+
+typedef mem::global_new<pool_t, source_t, MAX_OBJECT_SIZE> global_new_t;
+
+} // anonymous namespace
+
+FHTAGN_GLOBAL_NEW_DEFINE(global_new_t)
@@ -0,0 +1,336 @@
+/**
+ * $Id$
+ *
+ * This file is part of the Fhtagn! C++ Library.
+ * Copyright (C) 2009 Jens Finkhaeuser <unwesen@users.sourceforge.net>.
+ *
+ * Author: Jens Finkhaeuser <unwesen@users.sourceforge.net>
+ *
+ * This program is licensed as free software for personal, educational or
+ * other non-commerical uses: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation, either version 3 of the License, or (at your
+ * option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Alternatively, licenses for commercial purposes are available as well.
+ * Please send your enquiries to the copyright holder's address above.
+ **/
+#ifndef FHTAGN_MEMORY_GLOBAL_NEW_H
+#define FHTAGN_MEMORY_GLOBAL_NEW_H
+
+#ifndef __cplusplus
+#error You are trying to include a C++ only header file
+#endif
+
+#include <fhtagn/fhtagn.h>
+
+#include <new>
+
+#include <fhtagn/memory/utility.h>
+#include <fhtagn/memory/memory_source.h>
+#include <fhtagn/threads/atomic.h>
+
+/**
+ * Thread-local storage class specifier; global_new can't use e.g.
+ * boost::thread_specific_ptr, as that allocates memory itself.
+ **/
+#if defined(_MSC_VER)
+#define FHTAGN_GLOBAL_NEW_THREAD_LOCAL __declspec(thread)
+#else
+#define FHTAGN_GLOBAL_NEW_THREAD_LOCAL __thread
+#endif
+
+/**
+ * Exception specifications of the global operator new and operator delete
+ * changed with C++11.
+ **/
+#if __cplusplus >= 201103L
+#define FHTAGN_GLOBAL_NEW_THROW
+#define FHTAGN_GLOBAL_NEW_NOTHROW noexcept
+#else
+#define FHTAGN_GLOBAL_NEW_THROW throw(std::bad_alloc)
+#define FHTAGN_GLOBAL_NEW_NOTHROW throw()
+#endif
+
+namespace fhtagn {
+namespace memory {
+
+/**
+ * The global_new class routes the global operator new and operator delete
+ * through a MemoryPool, e.g. a size_based_pool or a thread_cached_pool, making
+ * that pool the process-wide allocator. Use FHTAGN_GLOBAL_NEW_DEFINE (see
+ * below) in a single translation unit of your program to replace the global
+ * operators, or link against the fhtagn_new library, which does so with a
+ * thread_cached_pool in front of a size_based_pool for objects of 8 Bytes to
+ * 1 KiB.
+ *
+ * - poolT is the pool type. It must be thread-safe, and return memory
+ *   aligned as operator new must, e.g. by using block_alignment<16> on most
+ *   64 bit platforms.
+ * - sourceT is the registry_source (see memory_source.h) the pool obtains
+ *   it's memory from. It's used to tell pointers allocated from the pool
+ *   apart from others in operator delete.
+ * - Allocations of more than MAX_OBJECT_SIZE bytes, i.e. the largest size
+ *   class of the pool, are passed to malloc() instead.
+ *
+ * The pool is constructed in static storage on the first allocation, so
+ * operator new may be called before static initialization has finished. It
+ * is never destroyed, so operator delete may be called during static
+ * destruction as well.
+ *
+ * Allocations made while the pool is being constructed, and allocations the
+ * pool makes itself - e.g. for it's bookkeeping - are passed to malloc(), as
+ * are allocations the pool fails to satisfy. Aligned allocations with an
+ * alignment larger than the pool guarantees are passed to allocate_aligned()
+ * (see utility.h).
+ **/
+template <
+  typename poolT,
+  typename sourceT,
+  fhtagn::size_t MAX_OBJECT_SIZE
+>
+class global_new
+{
+public:
+  /**
+   * Convenience typedefs
+   **/
+  typedef poolT   pool_t;
+  typedef sourceT source_t;
+
+  enum {
+    /**
+     * Alignment the pool must guarantee, and the largest alignment for which
+     * aligned allocations are made from the pool.
+     **/
+    POOL_ALIGNMENT = 2 * sizeof(void *),
+  };
+
+  /**
+   * Allocate memory, or return NULL if that fails. Allocations of zero bytes
+   * return a unique pointer.
+   **/
+  static inline void * alloc(fhtagn::size_t size);
+  static inline void * alloc_aligned(fhtagn::size_t size,
+      fhtagn::size_t alignment);
+
+  /**
+   * Release memory obtained from alloc() or alloc_aligned(). The sized
+   * version may only be used if size is the size passed to alloc().
+   **/
+  static inline void free(void * ptr);
+  static inline void free(void * ptr, fhtagn::size_t size);
+  static inline void free_aligned(void * ptr, fhtagn::size_t alignment);
+
+  /**
+   * Like alloc() and alloc_aligned(), but call the new handler and retry if
+   * the allocation fails, and throw std::bad_alloc if there is no new
+   * handler - as operator new must.
+   **/
+  static inline void * new_object(fhtagn::size_t size);
+  static inline void * new_aligned_object(fhtagn::size_t size,
+      fhtagn::size_t alignment);
+
+  /**
+   * Returns the pool, or NULL if it's not been constructed yet, or if
+   * construction failed.
+   **/
+  static inline pool_t * pool();
+
+private:
+
+  enum state
+  {
+    UNINITIALIZED = 0,
+    INITIALIZING,
+    READY,
+    FAILED,
+  };
+
+  /**
+   * Marks the calling thread as being inside the pool for the guard's
+   * lifetime; allocations made by the pool itself are then passed to
+   * malloc(), rather than back into the pool.
+   **/
+  struct reentry_guard
+  {
+    inline reentry_guard();
+    inline ~reentry_guard();
+
+    static inline bool active();
+  };
+
+  /**
+   * Constructs the pool if no other thread is doing so, and returns it.
+   * Returns NULL while the pool is not ready.
+   **/
+  static inline pool_t * acquire_pool();
+
+  static inline void call_new_handler();
+
+  /**
+   * Static storage for the pool; the union aligns it suitably.
+   **/
+  union storage
+  {
+    char            bytes[sizeof(pool_t)];
+    double          align_double;
+    void *          align_ptr;
+    boost::int64_t  align_int;
+  };
+
+  static storage      s_storage;
+  static int volatile s_state;
+};
+
+
+}} // namespace fhtagn::memory
+
+
+/**
+ * Defines replacements for all variants of the global operator new and
+ * operator delete that route through the given global_new type, including
+ * the sized and aligned variants if the compiler supports them. Use in
+ * exactly one translation unit, outside of any namespace.
+ **/
+#if defined(__cpp_sized_deallocation)
+#define FHTAGN_GLOBAL_NEW_DEFINE_SIZED(GLOBAL_NEW_T)                          \
+  void operator delete(void * ptr, std::size_t size) FHTAGN_GLOBAL_NEW_NOTHROW\
+  {                                                                           \
+    GLOBAL_NEW_T::free(ptr, size);                                            \
+  }                                                                           \
+  void operator delete[](void * ptr, std::size_t size)                        \
+      FHTAGN_GLOBAL_NEW_NOTHROW                                               \
+  {                                                                           \
+    GLOBAL_NEW_T::free(ptr, size);                                            \
+  }
+#else
+#define FHTAGN_GLOBAL_NEW_DEFINE_SIZED(GLOBAL_NEW_T)
+#endif
+
+#if defined(__cpp_aligned_new)
+#define FHTAGN_GLOBAL_NEW_DEFINE_ALIGNED(GLOBAL_NEW_T)                        \
+  void * operator new(std::size_t size, std::align_val_t alignment)           \
+  {                                                                           \
+    return GLOBAL_NEW_T::new_aligned_object(size,                             \
+        static_cast<std::size_t>(alignment));                                 \
+  }                                                                           \
+  void * operator new[](std::size_t size, std::align_val_t alignment)         \
+  {                                                                           \
+    return GLOBAL_NEW_T::new_aligned_object(size,                             \
+        static_cast<std::size_t>(alignment));                                 \
+  }                                                                           \
+  void * operator new(std::size_t size, std::align_val_t alignment,           \
+      std::nothrow_t const &) FHTAGN_GLOBAL_NEW_NOTHROW                       \
+  {                                                                           \
+    try {                                                                     \
+      return GLOBAL_NEW_T::new_aligned_object(size,                           \
+          static_cast<std::size_t>(alignment));                               \
+    } catch (...) {                                                           \
+      return NULL;                                                            \
+    }                                                                         \
+  }                                                                           \
+  void * operator new[](std::size_t size, std::align_val_t alignment,         \
+      std::nothrow_t const &) FHTAGN_GLOBAL_NEW_NOTHROW                       \
+  {                                                                           \
+    try {                                                                     \
+      return GLOBAL_NEW_T::new_aligned_object(size,                           \
+          static_cast<std::size_t>(alignment));                               \
+    } catch (...) {                                                           \
+      return NULL;                                                            \
+    }                                                                         \
+  }                                                                           \
+  void operator delete(void * ptr, std::align_val_t alignment)                \
+      FHTAGN_GLOBAL_NEW_NOTHROW                                               \
+  {                                                                           \
+    GLOBAL_NEW_T::free_aligned(ptr, static_cast<std::size_t>(alignment));     \
+  }                                                                           \
+  void operator delete[](void * ptr, std::align_val_t alignment)              \
+      FHTAGN_GLOBAL_NEW_NOTHROW                                               \
+  {                                                                           \
+    GLOBAL_NEW_T::free_aligned(ptr, static_cast<std::size_t>(alignment));     \
+  }                                                                           \
+  void operator delete(void * ptr, std::size_t, std::align_val_t alignment)   \
+      FHTAGN_GLOBAL_NEW_NOTHROW                                               \
+  {                                                                           \
+    GLOBAL_NEW_T::free_aligned(ptr, static_cast<std::size_t>(alignment));     \
+  }                                                                           \
+  void operator delete[](void * ptr, std::size_t, std::align_val_t alignment) \
+      FHTAGN_GLOBAL_NEW_NOTHROW                                               \
+  {                                                                           \
+    GLOBAL_NEW_T::free_aligned(ptr, static_cast<std::size_t>(alignment));     \
+  }                                                                           \
+  void operator delete(void * ptr, std::align_val_t alignment,                \
+      std::nothrow_t const &) FHTAGN_GLOBAL_NEW_NOTHROW                       \
+  {                                                                           \
+    GLOBAL_NEW_T::free_aligned(ptr, static_cast<std::size_t>(alignment));     \
+  }                                                                           \
+  void operator delete[](void * ptr, std::align_val_t alignment,              \
+      std::nothrow_t const &) FHTAGN_GLOBAL_NEW_NOTHROW                       \
+  {                                                                           \
+    GLOBAL_NEW_T::free_aligned(ptr, static_cast<std::size_t>(alignment));     \
+  }
+#else
+#define FHTAGN_GLOBAL_NEW_DEFINE_ALIGNED(GLOBAL_NEW_T)
+#endif
+
+#define FHTAGN_GLOBAL_NEW_DEFINE(GLOBAL_NEW_T)                                \
+  void * operator new(std::size_t size) FHTAGN_GLOBAL_NEW_THROW               \
+  {                                                                           \
+    return GLOBAL_NEW_T::new_object(size);                                    \
+  }                                                                           \
+  void * operator new[](std::size_t size) FHTAGN_GLOBAL_NEW_THROW             \
+  {                                                                           \
+    return GLOBAL_NEW_T::new_object(size);                                    \
+  }                                                                           \
+  void * operator new(std::size_t size, std::nothrow_t const &)               \
+      FHTAGN_GLOBAL_NEW_NOTHROW                                               \
+  {                                                                           \
+    try {                                                                     \
+      return GLOBAL_NEW_T::new_object(size);                                  \
+    } catch (...) {                                                           \
+      return NULL;                                                            \
+    }                                                                         \
+  }                                                                           \
+  void * operator new[](std::size_t size, std::nothrow_t const &)             \
+      FHTAGN_GLOBAL_NEW_NOTHROW                                               \
+  {                                                                           \
+    try {                                                                     \
+      return GLOBAL_NEW_T::new_object(size);                                  \
+    } catch (...) {                                                           \
+      return NULL;                                                            \
+    }                                                                         \
+  }                                                                           \
+  void operator delete(void * ptr) FHTAGN_GLOBAL_NEW_NOTHROW                  \
+  {                                                                           \
+    GLOBAL_NEW_T::free(ptr);                                                  \
+  }                                                                           \
+  void operator delete[](void * ptr) FHTAGN_GLOBAL_NEW_NOTHROW                \
+  {                                                                           \
+    GLOBAL_NEW_T::free(ptr);                                                  \
+  }                                                                           \
+  void operator delete(void * ptr, std::nothrow_t const &)                    \
+      FHTAGN_GLOBAL_NEW_NOTHROW                                               \
+  {                                                                           \
+    GLOBAL_NEW_T::free(ptr);                                                  \
+  }                                                                           \
+  void operator delete[](void * ptr, std::nothrow_t const &)                  \
+      FHTAGN_GLOBAL_NEW_NOTHROW                                               \
+  {                                                                           \
+    GLOBAL_NEW_T::free(ptr);                                                  \
+  }                                                                           \
+  FHTAGN_GLOBAL_NEW_DEFINE_SIZED(GLOBAL_NEW_T)                                \
+  FHTAGN_GLOBAL_NEW_DEFINE_ALIGNED(GLOBAL_NEW_T)
+
+
+#include <fhtagn/memory/detail/global_new.tcc>
+
+#endif // guard
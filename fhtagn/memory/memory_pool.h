@@ -143,6 +143,36 @@ struct heap_pool
 };
 
 
+
+/**
+ * Bulk allocation and deallocation. Pools may optionally provide member
+ * functions
+ *
+ *   fhtagn::size_t alloc_bulk(fhtagn::size_t size, fhtagn::size_t count,
+ *       void ** ptrs);
+ *   void free_bulk(void ** ptrs, fhtagn::size_t count);
+ *
+ * that allocate or free a whole batch of objects while taking the pool's lock
+ * only once. alloc_bulk() allocates up to count objects of the given size and
+ * stores them in ptrs; it returns the number of objects actually allocated,
+ * which may be less than count if the pool runs out of memory. free_bulk()
+ * frees count pointers from ptrs, skipping NULL pointers.
+ *
+ * The free functions below call those members if the pool provides them, and
+ * otherwise fall back to calling alloc() or free() count times.
+ **/
+template <
+  typename poolT
+>
+inline fhtagn::size_t alloc_bulk(poolT & pool, fhtagn::size_t size,
+    fhtagn::size_t count, void ** ptrs);
+
+template <
+  typename poolT
+>
+inline void free_bulk(poolT & pool, void ** ptrs, fhtagn::size_t count);
+
+
 }} // namespace fhtagn::memory
 
 #include <fhtagn/memory/detail/memory_pool.tcc>
@@ -0,0 +1,508 @@
+/**
+ * $Id$
+ *
+ * This file is part of the Fhtagn! C++ Library.
+ * Copyright (C) 2009 Jens Finkhaeuser <unwesen@users.sourceforge.net>.
+ *
+ * Author: Jens Finkhaeuser <unwesen@users.sourceforge.net>
+ *
+ * This program is licensed as free software for personal, educational or
+ * other non-commerical uses: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation, either version 3 of the License, or (at your
+ * option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Alternatively, licenses for commercial purposes are available as well.
+ * Please send your enquiries to the copyright holder's address above.
+ **/
+#ifndef FHTAGN_MEMORY_MEMORY_SOURCE_H
+#define FHTAGN_MEMORY_MEMORY_SOURCE_H
+
+#ifndef __cplusplus
+#error You are trying to include a C++ only header file
+#endif
+
+#include <fhtagn/fhtagn.h>
+
+#include <fhtagn/memory/utility.h>
+#include <fhtagn/threads/atomic.h>
+
+#if defined(_WIN32)
+#include <windows.h>
+#else
+#include <unistd.h>
+#include <sys/mman.h>
+#endif
+
+#if defined(__linux__)
+#include <sys/syscall.h>
+#endif
+
+namespace fhtagn {
+namespace memory {
+
+/**
+ * Memory sources provide the large blocks of memory pools grow by, e.g. the
+ * chunks of size_based_pool, or - via the retention policies in
+ * retention_policy.h - the memory blocks of dynamic_pool. Choosing a memory
+ * source lets you decide where that memory comes from, independent of how
+ * the pool manages it.
+ *
+ * A memory source must provide:
+ *
+ * - static void * allocate(fhtagn::size_t size, fhtagn::size_t alignment)
+ *   Returns a new block of at least size bytes, aligned at the given
+ *   alignment, or NULL. The alignment must be a power of two.
+ *
+ * - static void release(void * block, fhtagn::size_t size)
+ *   Returns a block obtained from allocate() with the same size.
+ **/
+
+
+/**
+ * Returns the size of a memory page in bytes.
+ **/
+inline fhtagn::size_t page_size()
+{
+#if defined(_WIN32)
+  SYSTEM_INFO info;
+  ::GetSystemInfo(&info);
+  return info.dwPageSize;
+#else
+  static fhtagn::size_t size = ::sysconf(_SC_PAGESIZE);
+  return size;
+#endif
+}
+
+
+
+/**
+ * Allocates blocks from the heap; see allocate_aligned() in utility.h.
+ **/
+struct heap_source
+{
+  static inline void * allocate(fhtagn::size_t size, fhtagn::size_t alignment)
+  {
+    if (alignment < sizeof(void *)) {
+      alignment = sizeof(void *);
+    }
+    return allocate_aligned(size, alignment);
+  }
+
+  static inline void release(void * block, fhtagn::size_t)
+  {
+    free_aligned(block);
+  }
+};
+
+
+
+/**
+ * Maps blocks directly from the OS, and unmaps them on release. Blocks are
+ * always page aligned; larger alignments are achieved by mapping more than
+ * necessary and unmapping the excess.
+ *
+ * Blocks are rounded up to whole pages by the OS, so sizes should be a
+ * multiple of the page size.
+ **/
+struct mmap_source
+{
+  static inline void * allocate(fhtagn::size_t size, fhtagn::size_t alignment)
+  {
+#if defined(_WIN32)
+    if (alignment <= 65536) {
+      // VirtualAlloc aligns at the allocation granularity of 64 KiB.
+      return ::VirtualAlloc(NULL, size, MEM_RESERVE | MEM_COMMIT,
+          PAGE_READWRITE);
+    }
+
+    // Reserve enough address space to find an aligned address, release it
+    // and map at that address. Another thread may grab the address in the
+    // meantime, so try a few times.
+    for (int i = 0 ; i < 8 ; ++i) {
+      void * probe = ::VirtualAlloc(NULL, size + alignment, MEM_RESERVE,
+          PAGE_NOACCESS);
+      if (!probe) {
+        return NULL;
+      }
+      ::VirtualFree(probe, 0, MEM_RELEASE);
+
+      void * aligned = reinterpret_cast<void *>(
+          (reinterpret_cast<fhtagn::size_t>(probe) + alignment - 1)
+          & ~(alignment - 1));
+      void * block = ::VirtualAlloc(aligned, size, MEM_RESERVE | MEM_COMMIT,
+          PAGE_READWRITE);
+      if (block) {
+        return block;
+      }
+    }
+    return NULL;
+#else
+    if (alignment <= page_size()) {
+      return map(size);
+    }
+
+    // Map enough to find an aligned address in the mapping, and unmap the
+    // rest.
+    fhtagn::size_t mapped_size = round_to_pages(size) + alignment;
+    void * mapped = map(mapped_size);
+    if (!mapped) {
+      return NULL;
+    }
+
+    char * start = pointer(mapped).char_ptr;
+    char * aligned = reinterpret_cast<char *>(
+        (reinterpret_cast<fhtagn::size_t>(start) + alignment - 1)
+        & ~(alignment - 1));
+    char * end = aligned + round_to_pages(size);
+
+    if (aligned > start) {
+      ::munmap(start, aligned - start);
+    }
+    if (start + mapped_size > end) {
+      ::munmap(end, start + mapped_size - end);
+    }
+    return aligned;
+#endif
+  }
+
+  static inline void release(void * block, fhtagn::size_t size)
+  {
+#if defined(_WIN32)
+    ::VirtualFree(block, 0, MEM_RELEASE);
+#else
+    ::munmap(block, size);
+#endif
+  }
+
+protected:
+
+#if !defined(_WIN32)
+  static inline void * map(fhtagn::size_t size, int extra_flags = 0)
+  {
+    void * block = ::mmap(NULL, size, PROT_READ | PROT_WRITE,
+        MAP_PRIVATE | MAP_ANONYMOUS | extra_flags, -1, 0);
+    if (MAP_FAILED == block) {
+      return NULL;
+    }
+    return block;
+  }
+#endif
+
+  static inline fhtagn::size_t round_to_pages(fhtagn::size_t size)
+  {
+    fhtagn::size_t page = page_size();
+    return (size + page - 1) & ~(page - 1);
+  }
+};
+
+
+
+/**
+ * Like mmap_source, but backs blocks with huge pages to reduce TLB misses.
+ *
+ * On Linux, blocks whose size is a multiple of HUGE_PAGE_SIZE are first
+ * mapped with MAP_HUGETLB, which only succeeds if huge pages have been
+ * reserved by the administrator. Otherwise, blocks are mapped as usual -
+ * aligned at HUGE_PAGE_SIZE if they are at least that large - and marked
+ * with madvise(MADV_HUGEPAGE), so that transparent huge pages can back them.
+ *
+ * On other systems, hugepage_source behaves like mmap_source.
+ **/
+template <
+  fhtagn::size_t HUGE_PAGE_SIZE = 2 * 1024 * 1024
+>
+struct hugepage_source
+  : public mmap_source
+{
+  static inline void * allocate(fhtagn::size_t size, fhtagn::size_t alignment)
+  {
+#if defined(MAP_HUGETLB)
+    if (!(size % HUGE_PAGE_SIZE) && alignment <= HUGE_PAGE_SIZE) {
+      void * block = map(size, MAP_HUGETLB);
+      if (block) {
+        return block;
+      }
+    }
+#endif
+
+    if (size >= HUGE_PAGE_SIZE && alignment < HUGE_PAGE_SIZE) {
+      alignment = HUGE_PAGE_SIZE;
+    }
+    void * block = mmap_source::allocate(size, alignment);
+
+#if defined(MADV_HUGEPAGE)
+    if (block) {
+      ::madvise(block, size, MADV_HUGEPAGE);
+    }
+#endif
+    return block;
+  }
+};
+
+
+
+/**
+ * Allocates blocks from baseT, and asks the OS to place their pages on the
+ * given NUMA node. The placement is a preference (MPOL_PREFERRED); if the
+ * node runs out of memory, pages are placed on other nodes rather than
+ * failing.
+ *
+ * The policy only applies to pages that have not been touched yet, and
+ * requires page aligned blocks; baseT should therefore be mmap_source or
+ * hugepage_source. On systems other than Linux, blocks are allocated from
+ * baseT without any placement.
+ **/
+template <
+  int NODE,
+  typename baseT = mmap_source
+>
+struct numa_source
+  : public baseT
+{
+  static inline void * allocate(fhtagn::size_t size, fhtagn::size_t alignment)
+  {
+    void * block = baseT::allocate(size, alignment);
+#if defined(__linux__) && defined(SYS_mbind)
+    if (block) {
+      enum {
+        MPOL_PREFERRED_MODE = 1,
+        BITS_PER_WORD = sizeof(unsigned long) * 8,
+      };
+      unsigned long nodemask[NODE / BITS_PER_WORD + 1] = { 0 };
+      nodemask[NODE / BITS_PER_WORD] = 1UL << (NODE % BITS_PER_WORD);
+
+      // Failure leaves the default policy in place, which is good enough.
+      ::syscall(SYS_mbind, block, size, MPOL_PREFERRED_MODE, nodemask,
+          sizeof(nodemask) * 8 + 1, 0);
+    }
+#endif
+    return block;
+  }
+};
+
+
+
+/**
+ * Allocates blocks from baseT, and touches each page from the allocating
+ * thread. Under the OS' default first-touch policy, that places the pages on
+ * the NUMA node the allocating thread runs on, rather than on the node of
+ * whichever thread happens to touch them first later on.
+ *
+ * That also means that the block is fully committed at allocation time.
+ **/
+template <
+  typename baseT = mmap_source
+>
+struct first_touch_source
+  : public baseT
+{
+  static inline void * allocate(fhtagn::size_t size, fhtagn::size_t alignment)
+  {
+    void * block = baseT::allocate(size, alignment);
+    if (block) {
+      fhtagn::size_t page = page_size();
+      volatile char * start = pointer(block).char_ptr;
+      for (fhtagn::size_t offset = 0 ; offset < size ; offset += page) {
+        start[offset] = 0;
+      }
+    }
+    return block;
+  }
+};
+
+
+
+/**
+ * Allocates blocks from baseT, and records which addresses belong to the
+ * blocks it handed out, so that owns() can tell whether an arbitrary pointer
+ * points into one of them - without touching the memory the pointer points
+ * to. That lets e.g. the replacement for the global operator delete in
+ * global_new.h tell pointers allocated from a pool apart from pointers
+ * allocated from the heap.
+ *
+ * Addresses are recorded with one bit per granule of 2^GRANULE_BITS bytes, so
+ * blocks are aligned at and rounded up to the granule size. The bitmap is
+ * split into leaves, which are mapped from the OS when they're first needed
+ * and never released. The table of leaves is zero-initialized static data, so
+ * the source works before static initialization has run.
+ *
+ * allocate() and release() are thread-safe, and owns() is lock-free. Only the
+ * lower 2^48 bytes of the address space are covered on 64 bit systems; should
+ * baseT return a block beyond that, allocate() releases it and fails.
+ **/
+template <
+  typename baseT = mmap_source,
+  fhtagn::size_t GRANULE_BITS = 16
+>
+struct registry_source
+{
+  static inline void * allocate(fhtagn::size_t size, fhtagn::size_t alignment)
+  {
+    fhtagn::size_t granule = fhtagn::size_t(1) << GRANULE_BITS;
+    if (alignment < granule) {
+      alignment = granule;
+    }
+    size = round_to_granules(size);
+
+    void * block = baseT::allocate(size, alignment);
+    if (!block) {
+      return NULL;
+    }
+
+    if (!mark(block, size, true)) {
+      baseT::release(block, size);
+      return NULL;
+    }
+    return block;
+  }
+
+  static inline void release(void * block, fhtagn::size_t size)
+  {
+    size = round_to_granules(size);
+    mark(block, size, false);
+    baseT::release(block, size);
+  }
+
+  /**
+   * Returns true if ptr points into a block allocated from this source, and
+   * not yet released.
+   **/
+  static inline bool owns(void const * ptr)
+  {
+    fhtagn::size_t address = reinterpret_cast<fhtagn::size_t>(ptr);
+    if ((address >> (ADDRESS_BITS - 1)) >> 1) {
+      return false;
+    }
+
+    fhtagn::size_t granule = address >> GRANULE_BITS;
+    fhtagn::size_t volatile * leaf = fhtagn::threads::atomic_load(
+        s_root[granule >> LEAF_BITS]);
+    if (!leaf) {
+      return false;
+    }
+
+    fhtagn::size_t index = granule & (LEAF_GRANULES - 1);
+    return fhtagn::threads::atomic_load(leaf[index / BITS_PER_SIZE_T])
+      & (fhtagn::size_t(1) << (index % BITS_PER_SIZE_T));
+  }
+
+private:
+
+  enum {
+    BITS_PER_SIZE_T = sizeof(fhtagn::size_t) * 8,
+
+    ADDRESS_BITS  = sizeof(void *) > 4 ? 48 : 32,
+    INDEX_BITS    = ADDRESS_BITS - GRANULE_BITS,
+    LEAF_BITS     = INDEX_BITS / 2,
+    ROOT_BITS     = INDEX_BITS - LEAF_BITS,
+
+    LEAF_GRANULES = 1 << LEAF_BITS,
+    LEAF_WORDS    = (LEAF_GRANULES + BITS_PER_SIZE_T - 1) / BITS_PER_SIZE_T,
+    ROOT_SIZE     = 1 << ROOT_BITS,
+  };
+
+  static inline fhtagn::size_t round_to_granules(fhtagn::size_t size)
+  {
+    fhtagn::size_t granule = fhtagn::size_t(1) << GRANULE_BITS;
+    return (size + granule - 1) & ~(granule - 1);
+  }
+
+  /**
+   * Returns the leaf for the given root index, mapping it if necessary.
+   * Returns NULL if the leaf could not be mapped.
+   **/
+  static inline fhtagn::size_t volatile * leaf_for(fhtagn::size_t root)
+  {
+    fhtagn::size_t volatile * leaf = fhtagn::threads::atomic_load(
+        s_root[root]);
+    if (leaf) {
+      return leaf;
+    }
+
+    // Mapped memory is zeroed. If another thread installs a leaf first, ours
+    // is released again.
+    fhtagn::size_t leaf_size = LEAF_WORDS * sizeof(fhtagn::size_t);
+    fhtagn::size_t volatile * fresh = static_cast<fhtagn::size_t volatile *>(
+        mmap_source::allocate(leaf_size, page_size()));
+    if (!fresh) {
+      return NULL;
+    }
+
+    if (!fhtagn::threads::compare_and_swap(s_root[root],
+          static_cast<fhtagn::size_t volatile *>(NULL), fresh))
+    {
+      mmap_source::release(const_cast<fhtagn::size_t *>(fresh), leaf_size);
+    }
+    return fhtagn::threads::atomic_load(s_root[root]);
+  }
+
+  /**
+   * Sets or clears the bits for all granules of the block. Fails if the
+   * block lies beyond the addresses covered, or a leaf could not be mapped.
+   **/
+  static inline bool mark(void * block, fhtagn::size_t size, bool set)
+  {
+    fhtagn::size_t address = reinterpret_cast<fhtagn::size_t>(block);
+    fhtagn::size_t last = address + size - 1;
+    if ((last >> (ADDRESS_BITS - 1)) >> 1) {
+      return false;
+    }
+
+    fhtagn::size_t first_granule = address >> GRANULE_BITS;
+    fhtagn::size_t last_granule = last >> GRANULE_BITS;
+
+    // Map all leaves first, so that we don't have to undo anything if that
+    // fails.
+    if (set) {
+      for (fhtagn::size_t root = first_granule >> LEAF_BITS
+          ; root <= (last_granule >> LEAF_BITS) ; ++root)
+      {
+        if (!leaf_for(root)) {
+          return false;
+        }
+      }
+    }
+
+    for (fhtagn::size_t granule = first_granule ; granule <= last_granule
+        ; ++granule)
+    {
+      fhtagn::size_t volatile * leaf = fhtagn::threads::atomic_load(
+          s_root[granule >> LEAF_BITS]);
+      fhtagn::size_t index = granule & (LEAF_GRANULES - 1);
+      fhtagn::size_t volatile & word = leaf[index / BITS_PER_SIZE_T];
+      fhtagn::size_t bit = fhtagn::size_t(1) << (index % BITS_PER_SIZE_T);
+
+      fhtagn::size_t old_word;
+      do {
+        old_word = word;
+      } while (!fhtagn::threads::compare_and_swap(word, old_word,
+            set ? (old_word | bit) : (old_word & ~bit)));
+    }
+    return true;
+  }
+
+  static fhtagn::size_t volatile * volatile s_root[ROOT_SIZE];
+};
+
+
+template <
+  typename baseT,
+  fhtagn::size_t GRANULE_BITS
+>
+fhtagn::size_t volatile * volatile
+registry_source<baseT, GRANULE_BITS>::s_root[
+  registry_source<baseT, GRANULE_BITS>::ROOT_SIZE];
+
+
+}} // namespace fhtagn::memory
+
+#endif // guard
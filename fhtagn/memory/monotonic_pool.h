@@ -0,0 +1,236 @@
+/**
+ * $Id$
+ *
+ * This file is part of the Fhtagn! C++ Library.
+ * Copyright (C) 2009 Jens Finkhaeuser <unwesen@users.sourceforge.net>.
+ *
+ * Author: Jens Finkhaeuser <unwesen@users.sourceforge.net>
+ *
+ * This program is licensed as free software for personal, educational or
+ * other non-commerical uses: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation, either version 3 of the License, or (at your
+ * option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Alternatively, licenses for commercial purposes are available as well.
+ * Please send your enquiries to the copyright holder's address above.
+ **/
+#ifndef FHTAGN_MEMORY_MONOTONIC_POOL_H
+#define FHTAGN_MEMORY_MONOTONIC_POOL_H
+
+#ifndef __cplusplus
+#error You are trying to include a C++ only header file
+#endif
+
+#include <fhtagn/fhtagn.h>
+
+#include <fhtagn/memory/utility.h>
+#include <fhtagn/memory/memory_pool.h>
+#include <fhtagn/memory/memory_source.h>
+#include <fhtagn/threads/lock_policy.h>
+
+namespace fhtagn {
+namespace memory {
+
+/**
+ * The monotonic_pool class implements a MemoryPool that allocates by bumping
+ * a pointer through a block of memory. free() is a no-op; instead, all memory
+ * allocated from the pool is released at once with reset(), or everything
+ * allocated after a saved marker with rewind().
+ *
+ * That makes allocation very cheap, and is ideal for scratch data that lives
+ * for a well-defined period, e.g. the duration of a request.
+ *
+ * If the current block runs out of space, a new block of MEMORY_BLOCK_SIZE
+ * bytes is obtained from sourceT (see memory_source.h) and chained to the
+ * previous one.
+ * Allocations too large to fit into a block of that size get a block of their
+ * own. Optionally, the first block can be handed to the constructor, e.g. to
+ * start out with stack memory; that block is never released by the pool.
+ *
+ * Each allocation is preceded by a small header recording it's size, so that
+ * alloc_size() and realloc() work as expected. realloc() grows or shrinks the
+ * most recent allocation in place, if possible.
+ *
+ * Like fixed_pool, monotonic_pool aligns all memory it hands out at a
+ * definable block boundary.
+ *
+ * in_use() returns true if anything was allocated since the pool was created
+ * or last reset.
+ **/
+template <
+  fhtagn::size_t MEMORY_BLOCK_SIZE = 4096,
+  typename mutexT = fhtagn::threads::fake_mutex,
+  typename block_alignmentT = block_alignment<>,
+  typename sourceT = heap_source
+>
+class monotonic_pool
+{
+public:
+  /**
+   * Convenience typedefs
+   **/
+  typedef mutexT            mutex_t;
+  typedef block_alignmentT  block_alignment_t;
+  typedef sourceT           source_t;
+
+  /**
+   * Markers record the state of the pool at the time mark() was called. Pass
+   * them to rewind() to release everything allocated since.
+   **/
+  class marker
+  {
+  public:
+    marker()
+      : m_block(NULL)
+      , m_pos(NULL)
+    {
+    }
+
+  private:
+    friend class monotonic_pool;
+
+    marker(void * block, char * pos)
+      : m_block(block)
+      , m_pos(pos)
+    {
+    }
+
+    void *  m_block;
+    char *  m_pos;
+  };
+
+  /**
+   * The default constructor allocates all memory from the heap. The second
+   * constructor uses the given memory block first; the pool does not take
+   * ownership of it, and you must ensure it lives at least as long as the
+   * pool.
+   **/
+  inline monotonic_pool();
+  inline monotonic_pool(void * memblock, fhtagn::size_t size);
+  inline ~monotonic_pool();
+
+  /**
+   * API - see memory_pool.h for details
+   **/
+  inline void * alloc(fhtagn::size_t size);
+  inline void * realloc(void * ptr, fhtagn::size_t new_size);
+  inline void free(void * ptr);
+  inline bool in_use() const;
+  inline fhtagn::size_t alloc_size(void * ptr) const;
+
+  /**
+   * Bulk API - see memory_pool.h for details. free_bulk() is a no-op, just
+   * like free().
+   **/
+  inline fhtagn::size_t alloc_bulk(fhtagn::size_t size, fhtagn::size_t count,
+      void ** ptrs);
+  inline void free_bulk(void ** ptrs, fhtagn::size_t count);
+
+  /**
+   * Releases all memory allocated from the pool. The first block is kept for
+   * re-use, all other blocks are returned to the heap.
+   **/
+  inline void reset();
+
+  /**
+   * mark() returns a marker for the current state of the pool. rewind()
+   * releases everything allocated after the marker was obtained; markers
+   * obtained after that become invalid. A default-constructed marker rewinds
+   * the pool to it's empty state, just like reset().
+   **/
+  inline marker mark() const;
+  inline void rewind(marker const & m);
+
+  /**
+   * Returns the mutex guarding this pool, e.g. to read the lock contention
+   * count of a contention_counting_mutex (see statistics.h).
+   **/
+  inline mutex_t & mutex() const;
+
+private:
+
+  /**
+   * Header at the start of each block. Blocks are chained from the newest to
+   * the oldest. raw and raw_size describe the memory source allocation that
+   * backs the block; raw is NULL for the block passed to the constructor.
+   **/
+  struct block
+  {
+    block *         prev;
+    fhtagn::size_t  size;
+    void *          raw;
+    fhtagn::size_t  raw_size;
+
+    static inline fhtagn::size_t header_size()
+    {
+      return block_alignmentT::adjust_size(sizeof(block));
+    }
+
+    inline char * begin()
+    {
+      return pointer(this).char_ptr + header_size();
+    }
+
+    inline char * end()
+    {
+      return pointer(this).char_ptr + size;
+    }
+  };
+
+  /**
+   * Header preceding each allocation.
+   **/
+  static inline fhtagn::size_t alloc_header_size();
+  static inline fhtagn::size_t & size_of(void * ptr);
+
+  /**
+   * Largest request size for which neither the allocation's size including
+   * it's header, nor the size of a block to hold it computed in grow() can
+   * overflow. Larger requests fail.
+   **/
+  static inline fhtagn::size_t max_request_size();
+
+  /**
+   * Initialize a block in the given memory, aligning it's start.
+   **/
+  static inline block * init_block(void * memblock, fhtagn::size_t size,
+      block * prev, void * raw, fhtagn::size_t raw_size);
+
+  /**
+   * Allocates a new block that can hold at least size bytes of data, and
+   * makes it the current block.
+   **/
+  inline bool grow(fhtagn::size_t size);
+
+  /**
+   * Releases blocks until the given block is the current one.
+   **/
+  inline void release_until(block * keep);
+
+  /**
+   * Same as alloc(), but expects the mutex to be held already.
+   **/
+  inline void * alloc_unlocked(fhtagn::size_t size);
+
+  block *         m_current;
+  char *          m_pos;
+  char *          m_last;   // Most recent allocation, for in-place realloc.
+
+  mutable mutex_t m_mutex;
+};
+
+
+}} // namespace fhtagn::memory
+
+#include <fhtagn/memory/detail/monotonic_pool.tcc>
+
+#endif // guard
@@ -182,6 +182,14 @@ public:
 
   inline void deallocate(pointer p, size_type);
 
+  /**
+   * Bulk allocation of count individual objects, and bulk deallocation of
+   * objects obtained that way. allocate_bulk() returns the number of objects
+   * actually allocated. See alloc_bulk() and free_bulk() in memory_pool.h.
+   **/
+  inline size_type allocate_bulk(size_type count, pointer * ptrs);
+  inline void deallocate_bulk(pointer * ptrs, size_type count);
+
 
   /**
    * Determine size.
@@ -256,6 +264,193 @@ inline bool operator==(
     other_allocatorT const &);
 
 
+
+
+/**
+ * The raw_pool_allocation_policy class behaves like pool_allocation_policy,
+ * except that it refers to it's MemoryPool by a plain pointer rather than a
+ * shared_ptr, and does not own it.
+ *
+ * STL containers copy and rebind their allocators frequently, and containers
+ * such as n_tree hold allocator copies in every node. With
+ * pool_allocation_policy, each of those copies increments and decrements the
+ * shared_ptr's reference count, which are atomic operations. With
+ * raw_pool_allocation_policy, copying an allocator is a plain pointer copy.
+ *
+ * In exchange, you are responsible for keeping the MemoryPool alive for as
+ * long as any allocator refers to it. Typically, that means the pool is a
+ * static or global object, or outlives the containers using it.
+ *
+ * The MemoryPool is determined in the same way as for pool_allocation_policy:
+ * from the per-type pool, the global pool for memory_poolT and tagT, or via
+ * set_memory_pool(). Copies refer to the same pool as the original. Since the
+ * static pool pointers are plain pointers, there's no need to invoke any
+ * initialization macros for them.
+ **/
+template <
+  typename memory_poolT,
+  typename tagT
+>
+class raw_pool_allocation_policy_base
+{
+public:
+  BOOST_CLASS_REQUIRE(memory_poolT, ::fhtagn::memory::concepts,
+      MemoryPoolConcept);
+
+  /**
+   * Convenience typedefs
+   **/
+  typedef memory_poolT    memory_pool_t;
+  typedef memory_poolT *  memory_pool_ptr;
+
+  /**
+   * Global memory pool.
+   **/
+  static memory_pool_ptr  global_memory_pool;
+};
+
+template <typename memory_poolT, typename tagT>
+typename raw_pool_allocation_policy_base<memory_poolT, tagT>::memory_pool_ptr
+raw_pool_allocation_policy_base<memory_poolT, tagT>::global_memory_pool = NULL;
+
+
+
+template <
+  typename T,
+  typename memory_poolT = ::fhtagn::memory::heap_pool,
+  typename tagT = ::fhtagn::memory::default_tag
+>
+class raw_pool_allocation_policy
+  : public raw_pool_allocation_policy_base<memory_poolT, tagT>
+{
+public:
+  /**
+   * Typedefs aliased from base
+   **/
+  typedef typename raw_pool_allocation_policy_base<memory_poolT, tagT>::memory_pool_t   memory_pool_t;
+  typedef typename raw_pool_allocation_policy_base<memory_poolT, tagT>::memory_pool_ptr memory_pool_ptr;
+
+  /**
+   * Typedefs - aliased by the allocator
+   **/
+  typedef T                   value_type;
+  typedef value_type *        pointer;
+  typedef value_type const *  const_pointer;
+  typedef value_type &        reference;
+  typedef value_type const &  const_reference;
+  typedef fhtagn::size_t      size_type;
+  typedef std::ptrdiff_t      difference_type;
+
+
+  /**
+   * Rebind to allocation policy for different type.
+   **/
+  template<typename U>
+  struct rebind
+  {
+    typedef raw_pool_allocation_policy<U, memory_poolT, tagT> other;
+  };
+
+
+  /**
+   * Constructors, destructor. Copies from policies with the same memory_poolT
+   * and tagT share the source's pool; all others are initialized like a
+   * default constructed policy.
+   **/
+  inline explicit raw_pool_allocation_policy();
+  inline ~raw_pool_allocation_policy();
+
+  inline raw_pool_allocation_policy(raw_pool_allocation_policy const &);
+
+  template <typename U>
+  inline explicit raw_pool_allocation_policy(raw_pool_allocation_policy<U, memory_poolT, tagT> const &);
+
+  template <typename U, typename other_poolT, typename other_tagT>
+  inline explicit raw_pool_allocation_policy(raw_pool_allocation_policy<U, other_poolT, other_tagT> const &);
+
+
+  /**
+   * Memory allocation functions.
+   **/
+  inline pointer allocate(size_type count,
+      typename std::allocator<void>::const_pointer = 0);
+
+  inline void deallocate(pointer p, size_type);
+
+  /**
+   * Bulk allocation of count individual objects, and bulk deallocation of
+   * objects obtained that way. allocate_bulk() returns the number of objects
+   * actually allocated. See alloc_bulk() and free_bulk() in memory_pool.h.
+   **/
+  inline size_type allocate_bulk(size_type count, pointer * ptrs);
+  inline void deallocate_bulk(pointer * ptrs, size_type count);
+
+
+  /**
+   * Determine size.
+   **/
+  inline size_type max_size() const;
+
+  /**
+   * Per-T memory pool.
+   **/
+  static memory_pool_ptr  per_type_memory_pool;
+
+  /**
+   * Get the memory pool currently in use for this instance.
+   **/
+  inline memory_pool_ptr get_memory_pool() const;
+
+  /**
+   * Set the memory pool currently in use for this instance. Will return true
+   * on success, else false. If the current memory pool has allocated space to
+   * objects, this operation will fail.
+   **/
+  inline bool set_memory_pool(memory_pool_ptr pool);
+
+
+private:
+  // Sets m_pool to either the type pool or the global pool. If neither is set,
+  // a std::logic_error is thrown.
+  inline void initialize_pool();
+
+  // The memory pool currently used; not owned.
+  memory_pool_ptr         m_pool;
+};
+
+template <typename T, typename memory_poolT, typename tagT>
+typename raw_pool_allocation_policy<T, memory_poolT, tagT>::memory_pool_ptr
+raw_pool_allocation_policy<T, memory_poolT, tagT>::per_type_memory_pool = NULL;
+
+
+
+/**
+ * Equality and inequality comparison operators for raw_pool_allocation_policy,
+ * analogous to those of pool_allocation_policy.
+ **/
+template <
+  typename T1,
+  typename T2,
+  typename memory_poolT,
+  typename tagT
+>
+inline bool operator==(
+    raw_pool_allocation_policy<T1, memory_poolT, tagT> const & rhs,
+    raw_pool_allocation_policy<T2, memory_poolT, tagT> const & lhs);
+
+
+
+template <
+  typename T,
+  typename memory_poolT,
+  typename tagT,
+  typename other_allocatorT
+>
+inline bool operator==(
+    raw_pool_allocation_policy<T, memory_poolT, tagT> const &,
+    other_allocatorT const &);
+
+
 }} // namespace fhtagn::memory
 
 
@@ -0,0 +1,218 @@
+/**
+ * $Id$
+ *
+ * This file is part of the Fhtagn! C++ Library.
+ * Copyright (C) 2009 Jens Finkhaeuser <unwesen@users.sourceforge.net>.
+ *
+ * Author: Jens Finkhaeuser <unwesen@users.sourceforge.net>
+ *
+ * This program is licensed as free software for personal, educational or
+ * other non-commerical uses: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation, either version 3 of the License, or (at your
+ * option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Alternatively, licenses for commercial purposes are available as well.
+ * Please send your enquiries to the copyright holder's address above.
+ **/
+#ifndef FHTAGN_MEMORY_POOL_VECTOR_H
+#define FHTAGN_MEMORY_POOL_VECTOR_H
+
+#ifndef __cplusplus
+#error You are trying to include a C++ only header file
+#endif
+
+#include <cstddef>
+
+#include <fhtagn/fhtagn.h>
+
+#include <boost/type_traits/integral_constant.hpp>
+#include <boost/type_traits/has_trivial_copy.hpp>
+#include <boost/type_traits/has_trivial_destructor.hpp>
+
+#include <fhtagn/memory/memory_pool.h>
+
+namespace fhtagn {
+namespace memory {
+
+/**
+ * Trait determining whether objects of type T can be moved to a different
+ * address by copying their bytes, without invoking their copy constructor
+ * and destructor. That is the case for all types with a trivial copy
+ * constructor and destructor.
+ *
+ * Many other types are trivially relocatable as well, e.g. types that merely
+ * hold pointers to heap memory. Specialize this trait for such types, to let
+ * pool_vector grow them via the pool's realloc().
+ **/
+template <
+  typename T
+>
+struct is_trivially_relocatable
+  : public boost::integral_constant<bool,
+      boost::has_trivial_copy<T>::value
+      && boost::has_trivial_destructor<T>::value>
+{
+};
+
+
+
+/**
+ * The pool_vector class is a growable array, similar to std::vector, that
+ * allocates it's storage from a MemoryPool.
+ *
+ * Unlike std::vector with an allocator, pool_vector grows it's storage with
+ * the pool's realloc() if T is trivially relocatable (see above). Pools that
+ * can grow allocations in place, such as fixed_pool if the following segment
+ * is free, or heap_pool for large allocations on many platforms, can then
+ * avoid copying the vector's contents altogether. For other types, new
+ * storage is allocated, and the elements are copy constructed into it.
+ *
+ * If the pool reports a larger alloc_size() than requested, the extra space
+ * is used as additional capacity.
+ *
+ * Like throw_pool, pool_vector does not own the pool; the pool must outlive
+ * the vector. Copies of a pool_vector allocate from the same pool. If the pool
+ * fails to allocate, std::bad_alloc is thrown and the vector is left
+ * unchanged. Note that block_pool is not a suitable pool, as it cannot
+ * allocate memory of varying sizes.
+ *
+ * Iterators, pointers and references to elements are invalidated whenever
+ * the vector grows.
+ **/
+template <
+  typename T,
+  typename memory_poolT = ::fhtagn::memory::heap_pool
+>
+class pool_vector
+{
+public:
+  BOOST_CLASS_REQUIRE(memory_poolT, ::fhtagn::memory::concepts,
+      MemoryPoolConcept);
+
+  /**
+   * Convenience typedefs
+   **/
+  typedef memory_poolT        memory_pool_t;
+  typedef T                   value_type;
+  typedef value_type *        pointer;
+  typedef value_type const *  const_pointer;
+  typedef value_type &        reference;
+  typedef value_type const &  const_reference;
+  typedef pointer             iterator;
+  typedef const_pointer       const_iterator;
+  typedef fhtagn::size_t      size_type;
+  typedef std::ptrdiff_t      difference_type;
+
+  /**
+   * Constructors, destructor
+   **/
+  inline explicit pool_vector(memory_poolT & pool);
+  inline pool_vector(memory_poolT & pool, size_type count,
+      value_type const & value = value_type());
+  inline pool_vector(pool_vector const & other);
+  inline ~pool_vector();
+
+  inline pool_vector & operator=(pool_vector const & other);
+
+  /**
+   * Iterators
+   **/
+  inline iterator begin();
+  inline const_iterator begin() const;
+  inline iterator end();
+  inline const_iterator end() const;
+
+  /**
+   * Size and capacity
+   **/
+  inline size_type size() const;
+  inline size_type capacity() const;
+  inline bool empty() const;
+  inline size_type max_size() const;
+
+  /**
+   * Element access. at() throws std::out_of_range for invalid indices.
+   **/
+  inline reference operator[](size_type index);
+  inline const_reference operator[](size_type index) const;
+  inline reference at(size_type index);
+  inline const_reference at(size_type index) const;
+  inline reference front();
+  inline const_reference front() const;
+  inline reference back();
+  inline const_reference back() const;
+  inline pointer data();
+  inline const_pointer data() const;
+
+  /**
+   * Modifiers
+   **/
+  inline void reserve(size_type new_capacity);
+  inline void resize(size_type new_size,
+      value_type const & value = value_type());
+  inline void push_back(value_type const & value);
+  inline void pop_back();
+  inline iterator erase(iterator pos);
+  inline iterator erase(iterator first, iterator last);
+  inline void clear();
+  inline void swap(pool_vector & other);
+
+  /**
+   * Returns the pool the vector allocates from.
+   **/
+  inline memory_poolT & get_memory_pool() const;
+
+private:
+  /**
+   * Ensures the capacity is at least min_capacity, growing geometrically.
+   **/
+  inline void grow(size_type min_capacity);
+
+  /**
+   * Changes the capacity to new_capacity - via realloc() for trivially
+   * relocatable types, or by allocating new storage otherwise.
+   **/
+  inline void reallocate(size_type new_capacity, boost::true_type);
+  inline void reallocate(size_type new_capacity, boost::false_type);
+
+  /**
+   * Capacity for the given allocation, taking into account any extra space
+   * the pool hands out.
+   **/
+  inline size_type usable_capacity(void * ptr, size_type requested) const;
+
+  static inline void destroy(pointer first, pointer last);
+
+  memory_poolT *  m_pool;
+  pointer         m_data;
+  size_type       m_size;
+  size_type       m_capacity;
+};
+
+
+
+/**
+ * Swaps the contents of two pool_vectors.
+ **/
+template <
+  typename T,
+  typename memory_poolT
+>
+inline void swap(pool_vector<T, memory_poolT> & first,
+    pool_vector<T, memory_poolT> & second);
+
+
+}} // namespace fhtagn::memory
+
+#include <fhtagn/memory/detail/pool_vector.tcc>
+
+#endif // guard
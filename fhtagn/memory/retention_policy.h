@@ -0,0 +1,157 @@
+/**
+ * $Id$
+ *
+ * This file is part of the Fhtagn! C++ Library.
+ * Copyright (C) 2009 Jens Finkhaeuser <unwesen@users.sourceforge.net>.
+ *
+ * Author: Jens Finkhaeuser <unwesen@users.sourceforge.net>
+ *
+ * This program is licensed as free software for personal, educational or
+ * other non-commerical uses: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation, either version 3 of the License, or (at your
+ * option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Alternatively, licenses for commercial purposes are available as well.
+ * Please send your enquiries to the copyright holder's address above.
+ **/
+#ifndef FHTAGN_MEMORY_RETENTION_POLICY_H
+#define FHTAGN_MEMORY_RETENTION_POLICY_H
+
+#ifndef __cplusplus
+#error You are trying to include a C++ only header file
+#endif
+
+#include <fhtagn/fhtagn.h>
+
+#include <fhtagn/memory/memory_source.h>
+
+namespace fhtagn {
+namespace memory {
+
+/**
+ * Retention policies decide how dynamic_pool (see dynamic_pool.h) obtains the
+ * memory blocks it manages, and what happens to blocks that become empty.
+ *
+ * Each policy keeps up to KEEP_EMPTY empty blocks around, so that bursts of
+ * allocations and deallocations don't result in blocks being allocated and
+ * released over and over again. Empty blocks beyond that number are released.
+ *
+ * A retention policy must provide:
+ *
+ * - An enum value KEEP_EMPTY_BLOCKS, the number of empty blocks to retain.
+ *
+ * - static void * allocate_block(fhtagn::size_t size)
+ *   Returns a new block of the given size, or NULL.
+ *
+ * - static void release_block(void * block, fhtagn::size_t size)
+ *   Returns a block obtained from allocate_block() to where it came from.
+ *
+ * - static void retain_block(void * block, fhtagn::size_t size)
+ *   Called when a block becomes empty and is retained. The block's contents
+ *   need not be preserved.
+ **/
+
+
+/**
+ * Allocates blocks from the heap with new[], and releases them with delete[].
+ **/
+template <
+  fhtagn::size_t KEEP_EMPTY = 0
+>
+struct heap_retention_policy
+{
+  enum {
+    KEEP_EMPTY_BLOCKS = KEEP_EMPTY,
+  };
+
+  static inline void * allocate_block(fhtagn::size_t size)
+  {
+    return new char[size];
+  }
+
+  static inline void release_block(void * block, fhtagn::size_t)
+  {
+    delete [] static_cast<char *>(block);
+  }
+
+  static inline void retain_block(void *, fhtagn::size_t)
+  {
+  }
+};
+
+
+
+/**
+ * Maps blocks directly from the OS, and unmaps them on release. That returns
+ * released memory to the OS immediately, regardless of what the heap
+ * implementation does. Blocks are always rounded up to whole pages by the OS,
+ * so MEMORY_BLOCK_SIZE should be a multiple of the page size.
+ *
+ * Blocks are obtained from sourceT (see memory_source.h), which defaults to
+ * mmap_source; use e.g. hugepage_source or numa_source to control the page
+ * size or NUMA placement of the blocks.
+ **/
+template <
+  fhtagn::size_t KEEP_EMPTY = 0,
+  typename sourceT = mmap_source
+>
+struct mmap_retention_policy
+{
+  enum {
+    KEEP_EMPTY_BLOCKS = KEEP_EMPTY,
+  };
+
+  static inline void * allocate_block(fhtagn::size_t size)
+  {
+    return sourceT::allocate(size, sizeof(void *));
+  }
+
+  static inline void release_block(void * block, fhtagn::size_t size)
+  {
+    sourceT::release(block, size);
+  }
+
+  static inline void retain_block(void *, fhtagn::size_t)
+  {
+  }
+};
+
+
+
+/**
+ * Like mmap_retention_policy, but retained blocks keep only their address
+ * space; their pages are handed back to the OS with madvise(MADV_DONTNEED),
+ * and fault back in (zeroed) when the block is used again. That is cheaper
+ * than unmapping and mapping again, and does not count towards the resident
+ * set size while the block is empty.
+ **/
+template <
+  fhtagn::size_t KEEP_EMPTY = 0,
+  typename sourceT = mmap_source
+>
+struct madvise_retention_policy
+  : public mmap_retention_policy<KEEP_EMPTY, sourceT>
+{
+  static inline void retain_block(void * block, fhtagn::size_t size)
+  {
+#if defined(_WIN32)
+    ::VirtualAlloc(block, size, MEM_RESET, PAGE_READWRITE);
+#else
+    ::madvise(block, size, MADV_DONTNEED);
+#endif
+  }
+};
+
+
+}} // namespace fhtagn::memory
+
+#endif // guard
@@ -0,0 +1,269 @@
+/**
+ * $Id$
+ *
+ * This file is part of the Fhtagn! C++ Library.
+ * Copyright (C) 2009 Jens Finkhaeuser <unwesen@users.sourceforge.net>.
+ *
+ * Author: Jens Finkhaeuser <unwesen@users.sourceforge.net>
+ *
+ * This program is licensed as free software for personal, educational or
+ * other non-commerical uses: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation, either version 3 of the License, or (at your
+ * option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Alternatively, licenses for commercial purposes are available as well.
+ * Please send your enquiries to the copyright holder's address above.
+ **/
+#ifndef FHTAGN_MEMORY_SHARED_POOL_H
+#define FHTAGN_MEMORY_SHARED_POOL_H
+
+#ifndef __cplusplus
+#error You are trying to include a C++ only header file
+#endif
+
+#if defined(_WIN32)
+#error shared_pool requires POSIX process-shared mutexes
+#endif
+
+#include <pthread.h>
+
+#include <fhtagn/fhtagn.h>
+
+#include <fhtagn/memory/utility.h>
+#include <fhtagn/memory/memory_pool.h>
+#include <fhtagn/memory/detail/segment_heap.h>
+
+namespace fhtagn {
+namespace memory {
+
+/**
+ * The shared_pool class implements a MemoryPool in a block of memory that is
+ * shared between processes, e.g. a region created with shm_open() and mapped
+ * into each process with mmap().
+ *
+ * The memory block is managed much like fixed_pool manages it's memory, with
+ * segment headers stored inline and size-binned free lists. Unlike fixed_pool,
+ * all of the pool's state lives at the start of the memory block, and segments
+ * refer to each other by their offset from the start of the block rather than
+ * by pointer, so each process may map the block at a different address. The
+ * state is protected by a process-shared mutex that also lives in the block.
+ *
+ * One process creates the pool in the memory block with the CREATE mode, and
+ * other processes attach to it with the ATTACH mode. Memory allocated in one
+ * process may be freed in any other. Pointers need to be translated when they
+ * are passed between processes: offset_of() returns the offset of a pointer
+ * into the memory block, and pointer_to() translates such an offset back into
+ * a pointer in the receiving process.
+ *
+ * Where available (on Linux), the mutex is robust: if a process dies while
+ * holding it, the next process to lock it rebuilds the free lists from the
+ * segment headers. An allocation the dead process was in the middle of making
+ * or freeing may be lost that way, but the pool stays usable.
+ *
+ * The memory block must be aligned at block_alignmentT's block size, so that
+ * all processes agree on it's layout; memory mapped with mmap() always is for
+ * block sizes up to the page size.
+ *
+ * The pool's state does not depend on the address the memory block is mapped
+ * at, so it also survives in a memory mapped file; see file_pool.h. For that
+ * purpose the pool keeps a dirty flag that's set by any modification and
+ * cleared by sync(), and the REOPEN mode validates the pool when it's opened
+ * again. set_root() and root() store a pointer to the application's entry
+ * point into the data kept in the pool, e.g. the top level lookup table.
+ *
+ * Like fixed_pool, shared_pool neither allocates nor releases the memory
+ * block. Destroying a shared_pool instance merely detaches the process from
+ * the pool; the last process to use the pool should call destroy() before the
+ * memory block is released.
+ **/
+template <
+  typename block_alignmentT = block_alignment<>
+>
+class shared_pool
+{
+public:
+  /**
+   * Convenience typedefs
+   **/
+  typedef block_alignmentT  block_alignment_t;
+
+  /**
+   * Whether to create a new pool in the memory block, or attach to an
+   * existing one.
+   **/
+  enum open_mode
+  {
+    CREATE,
+    ATTACH,
+    REOPEN,
+  };
+
+  /**
+   * With CREATE, initializes a new pool in the memory block of the given size,
+   * overwriting whatever it contained. Throws std::bad_alloc if the block is
+   * too small to hold the pool's state and a single allocation.
+   *
+   * With ATTACH, attaches to the pool another process created in the memory
+   * block. The size must be at least the size the pool was created with.
+   * Throws std::runtime_error if the block does not contain a compatible pool.
+   *
+   * With REOPEN, opens a pool that was created in the memory block earlier,
+   * and that no other process is using, e.g. because the memory block was
+   * read back from a file. The pool's mutex is initialized anew. If the pool
+   * was not synced after it was last modified, the free lists are rebuilt
+   * from the segment headers; otherwise the segment chain and free lists are
+   * only validated. Throws std::runtime_error like ATTACH does, or if the
+   * segment chain is corrupted.
+   *
+   * All modes throw std::logic_error if the memory block is not aligned.
+   **/
+  inline shared_pool(void * memblock, fhtagn::size_t size,
+      open_mode mode = CREATE);
+
+  /**
+   * API - see memory_pool.h for details
+   **/
+  inline void * alloc(fhtagn::size_t size);
+  inline void * realloc(void * ptr, fhtagn::size_t new_size);
+  inline void free(void * ptr);
+  inline bool in_use() const;
+  inline fhtagn::size_t alloc_size(void * ptr) const;
+
+  /**
+   * Returns true if ptr points into the memory block managed by this pool.
+   **/
+  inline bool owns(void * ptr) const;
+
+  /**
+   * Translates between pointers into the memory block and offsets from it's
+   * start. Offsets are the same in all processes sharing the pool. NULL
+   * pointers translate to an offset of zero, and vice versa.
+   **/
+  inline fhtagn::size_t offset_of(void * ptr) const;
+  inline void * pointer_to(fhtagn::size_t offset) const;
+
+  /**
+   * Stores a pointer allocated from this pool (or NULL) in the pool's state,
+   * so that it can be found again by processes attaching to the pool, or after
+   * the pool was reopened.
+   **/
+  inline void set_root(void * ptr);
+  inline void * root() const;
+
+  /**
+   * Flushes the memory block to it's backing file with msync(), and clears
+   * the dirty flag once everything else is on disk. Throws std::runtime_error
+   * if that fails, e.g. because the memory block is not page aligned. dirty()
+   * returns true if the pool was modified after the last sync().
+   **/
+  inline void sync();
+  inline bool dirty() const;
+
+  /**
+   * Destroys the pool's process-shared mutex. Neither this nor any other
+   * process may use the pool afterwards, but the memory block may be used to
+   * create a new pool.
+   **/
+  inline void destroy();
+
+private:
+
+  /**
+   * Segments refer to each other by their offset from the start of the memory
+   * block; zero means no segment, as the pool's state always occupies the
+   * start of the block.
+   **/
+  typedef detail::segment_heap<
+    block_alignmentT,
+    detail::offset_links
+  > heap_t;
+  typedef typename heap_t::segment segment;
+
+  enum {
+    MAGIC           = 0x7368706c,   // "shpl"
+    VERSION         = 1,
+  };
+
+  /**
+   * The pool's state, at the start of the memory block. magic is only set
+   * once the rest of the state is initialized, so attaching processes can
+   * tell a complete pool from one that's still being created.
+   **/
+  struct control
+  {
+    fhtagn::size_t volatile magic;
+    fhtagn::size_t          version;
+    fhtagn::size_t          size;           // Usable size of the memory block.
+    fhtagn::size_t          block_size;     // block_alignmentT's block size.
+    fhtagn::size_t          header_size;    // segment::header_size()
+    typename heap_t::state  heap;           // Free lists and allocation count.
+    fhtagn::size_t          root;           // See set_root().
+    fhtagn::size_t          dirty;          // Modified since the last sync().
+    pthread_mutex_t         mutex;
+
+    static inline fhtagn::size_t control_size()
+    {
+      return block_alignmentT::adjust_size(sizeof(control));
+    }
+  };
+
+  /**
+   * Locks the mutex in the memory block for the lifetime of the scoped_lock.
+   * If the previous owner of a robust mutex died while holding it, the pool's
+   * free lists are rebuilt before the lock is handed out.
+   **/
+  class scoped_lock
+  {
+  public:
+    inline scoped_lock(shared_pool const & pool);
+    inline ~scoped_lock();
+
+  private:
+    shared_pool & m_pool;
+  };
+  friend class scoped_lock;
+
+  /**
+   * Finds the segment in which ptr resides, or throws if the ptr does not
+   * point to an allocated segment's data.
+   **/
+  inline segment * find_segment_for(void * ptr) const;
+
+  /**
+   * Rebuilds the free lists from the segment headers, or validates them; see
+   * segment_heap. Both throw std::runtime_error if the pool is corrupted, and
+   * must be called with the mutex held.
+   **/
+  inline void rebuild();
+  inline void validate() const;
+
+  /**
+   * Initializes the pool's mutex.
+   **/
+  inline void init_mutex();
+
+  /**
+   * Throws std::runtime_error with the given problem description.
+   **/
+  inline void corrupted(char const * problem) const;
+
+  void *    m_memblock;
+  control * m_control;
+  heap_t    m_heap;
+};
+
+
+}} // namespace fhtagn::memory
+
+#include <fhtagn/memory/detail/shared_pool.tcc>
+
+#endif // guard
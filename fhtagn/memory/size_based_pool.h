@@ -31,17 +31,163 @@
 #endif
 
 #include <new>
+#include <vector>
 
 #include <fhtagn/fhtagn.h>
 
+#include <fhtagn/shared_ptr.h>
 #include <fhtagn/memory/memory_pool.h>
-#include <fhtagn/memory/dynamic_pool.h>
 #include <fhtagn/memory/block_pool.h>
+#include <fhtagn/memory/utility.h>
+#include <fhtagn/memory/memory_source.h>
 #include <fhtagn/meta/for.h>
 
 namespace fhtagn {
 namespace memory {
 
+namespace detail {
+namespace size_based_pool_helpers {
+
+/**
+ * Counts the number of values incrementorT produces in [CURRENT, END].
+ **/
+template <
+  int CURRENT,
+  int END,
+  template <int> class incrementorT,
+  bool DONE = (CURRENT > END)
+>
+struct count
+{
+  enum {
+    value = 1 + count<incrementorT<CURRENT>::value, END, incrementorT>::value,
+  };
+};
+
+template <
+  int CURRENT,
+  int END,
+  template <int> class incrementorT
+>
+struct count<CURRENT, END, incrementorT, true>
+{
+  enum {
+    value = 0,
+  };
+};
+
+
+/**
+ * Greatest common divisor of A and B.
+ **/
+template <int A, int B>
+struct gcd
+{
+  enum {
+    value = gcd<B, A % B>::value,
+  };
+};
+
+template <int A>
+struct gcd<A, 0>
+{
+  enum {
+    value = A,
+  };
+};
+
+
+/**
+ * Greatest common divisor of all values incrementorT produces in
+ * [CURRENT, END]; RESULT is the divisor accumulated so far.
+ **/
+template <
+  int CURRENT,
+  int END,
+  template <int> class incrementorT,
+  int RESULT,
+  bool DONE = (CURRENT > END)
+>
+struct common_divisor
+{
+  enum {
+    value = common_divisor<
+      incrementorT<CURRENT>::value,
+      END,
+      incrementorT,
+      gcd<RESULT, CURRENT>::value
+    >::value,
+  };
+};
+
+template <
+  int CURRENT,
+  int END,
+  template <int> class incrementorT,
+  int RESULT
+>
+struct common_divisor<CURRENT, END, incrementorT, RESULT, true>
+{
+  enum {
+    value = RESULT,
+  };
+};
+
+
+/**
+ * Smallest power of two that is larger than or equal to N.
+ **/
+template <
+  fhtagn::size_t N,
+  fhtagn::size_t CURRENT = 1,
+  bool DONE = (CURRENT >= N)
+>
+struct next_power_of_two
+{
+  enum {
+    value = next_power_of_two<N, CURRENT * 2>::value,
+  };
+};
+
+template <
+  fhtagn::size_t N,
+  fhtagn::size_t CURRENT
+>
+struct next_power_of_two<N, CURRENT, true>
+{
+  enum {
+    value = CURRENT,
+  };
+};
+
+
+/**
+ * Base two logarithm of N, rounded down.
+ **/
+template <
+  fhtagn::size_t N,
+  bool DONE = (N <= 1)
+>
+struct log2
+{
+  enum {
+    value = 1 + log2<N / 2>::value,
+  };
+};
+
+template <
+  fhtagn::size_t N
+>
+struct log2<N, true>
+{
+  enum {
+    value = 0,
+  };
+};
+
+}} // namespace detail::size_based_pool_helpers
+
+
 /**
  * The size_based_pool class is inspired by Python's memory allocator. Both
  * create pools for objects of different sizes, with sizes doubling up to a
@@ -51,35 +197,87 @@ namespace memory {
  * for the next larger power-of-two size, e.g. objects of size 5 would be
  * alloced from the pool for objects of size 8.
  *
- * Each pool is a fixed number of items in size, and conceptually identical to
- * block_pool (this implementation in fact uses block_pool). If the pool runs
- * out of space, it's available memory is extended (this implementation uses
- * dynamic_pool wrapped around block_pool).
+ * Each pool is conceptually identical to block_pool (this implementation in
+ * fact uses block_pool). If the pool runs out of space, it's available memory
+ * is extended by another chunk of memory managed by a block_pool.
  *
  * If an object is larger than the largest pool size accommodates, it's
- * allocated directly from the heap (this implementation uses heap_pool).
+ * allocated directly from the memory source.
  *
  * With this implementation, you can specify the minimum object size, the
  * maximum object size, an incrementor (see fhtagn/meta/for.h for details)
  * and the number of objects per each pool grows by if it runs out of space -
  * at compile time.
  *
- * Note that due to implementation details of block_pool, the OBJECTS_PER_POOL
- * number is approximate; there'll usually be a few less objects available per
- * pool than the specified number.
+ * The size classes are determined at compile time; mapping an allocation size
+ * to it's size class is a lookup in a flat table.
+ *
+ * Size class objects are allocated in chunks of CHUNK_SIZE bytes, aligned at a
+ * CHUNK_SIZE boundary, where CHUNK_SIZE is the smallest power of two large
+ * enough to hold OBJECTS_PER_POOL objects of MAX_OBJECT_SIZE. Each chunk
+ * starts with a header describing which size class it belongs to, so the
+ * size class of a pointer can be found by masking the pointer - no per-pointer
+ * bookkeeping is required. Chunks are recorded in a registry_source (see
+ * memory_source.h), which tells whether a pointer lies in a chunk without
+ * touching the memory it points to.
+ *
+ * Objects larger than MAX_OBJECT_SIZE are allocated on their own, with a
+ * header right in front of them instead.
+ *
+ * All memory is obtained from sourceT (see memory_source.h), which defaults to
+ * heap_source. Use e.g. hugepage_source to back chunks with huge pages, or
+ * numa_source to place them on a particular NUMA node.
+ *
+ * Objects within a chunk are laid out according to block_alignmentT. Pass
+ * cache_line_padding (see utility.h) to give each object a cache line of it's
+ * own, so that objects allocated by different threads don't share cache lines;
+ * note that this rounds all size classes up to the cache line size. Objects
+ * larger than MAX_OBJECT_SIZE are aligned at block_alignmentT's block size as
+ * well, so page_alignment yields page aligned large objects.
+ *
+ * Note that due to implementation details of block_pool, and because all size
+ * classes share the same CHUNK_SIZE, the OBJECTS_PER_POOL number is
+ * approximate; there'll usually be a few less objects of MAX_OBJECT_SIZE, and
+ * more objects of smaller sizes available per chunk than the specified number.
+ *
+ * Also note that as a result of the pointer masking, passing pointers to
+ * free(), realloc() or alloc_size() that were not allocated from a
+ * size_based_pool results in undefined behaviour. Pointers allocated from a
+ * different size_based_pool of the same type are detected and ignored.
  **/
 template <
   fhtagn::size_t OBJECTS_PER_POOL = 256,
   fhtagn::size_t MIN_OBJECT_SIZE = 1,
   fhtagn::size_t MAX_OBJECT_SIZE = 256,
   template <int> class incrementorT = ::fhtagn::meta::multi_double,
-  typename mutexT = ::fhtagn::threads::fake_mutex
+  typename mutexT = ::fhtagn::threads::fake_mutex,
+  typename sourceT = ::fhtagn::memory::heap_source,
+  typename block_alignmentT = ::fhtagn::memory::block_alignment<>
 >
 struct size_based_pool
 {
-  typedef mutexT mutex_t;
+  typedef mutexT            mutex_t;
+  typedef sourceT           source_t;
+  typedef block_alignmentT  block_alignment_t;
+
+  enum {
+    /**
+     * Number of size classes.
+     **/
+    SIZE_CLASSES = detail::size_based_pool_helpers::count<
+        MIN_OBJECT_SIZE, MAX_OBJECT_SIZE, incrementorT
+      >::value,
+
+    /**
+     * Size and alignment of the memory chunks allocated by this pool.
+     **/
+    CHUNK_SIZE = detail::size_based_pool_helpers::next_power_of_two<
+        MAX_OBJECT_SIZE * OBJECTS_PER_POOL
+      >::value,
+  };
 
   inline size_based_pool();
+  inline ~size_based_pool();
 
   inline void * alloc(fhtagn::size_t size);
   inline void * realloc(void * ptr, fhtagn::size_t new_size);
@@ -87,76 +285,275 @@ struct size_based_pool
   inline bool in_use() const;
   inline fhtagn::size_t alloc_size(void * ptr) const;
 
+  /**
+   * Bulk versions of alloc() and free(); both acquire the pool's mutex only
+   * once for the whole batch.
+   *
+   * alloc_bulk() allocates up to count objects of the given size, and stores
+   * them in the ptrs array. It returns the number of objects actually
+   * allocated, which may be less than count if the pool runs out of memory.
+   *
+   * free_bulk() frees count pointers from the ptrs array.
+   **/
+  inline fhtagn::size_t alloc_bulk(fhtagn::size_t size, fhtagn::size_t count,
+      void ** ptrs);
+  inline void free_bulk(void ** ptrs, fhtagn::size_t count);
+
+  /**
+   * Size class interface, used by caching layers such as thread_cached_pool
+   * (see thread_cached_pool.h).
+   *
+   * size_classes() returns the number of size classes, i.e. the number of
+   * pools for objects of different sizes this size_based_pool manages.
+   *
+   * size_class() returns the index of the size class objects of the given
+   * size are allocated from, or size_classes() if the size is too large to
+   * be allocated from any of the pools.
+   *
+   * class_size() returns the object size for the size class with the given
+   * index.
+   *
+   * size_class_of() returns the index of the size class the pointer was
+   * allocated from, or size_classes() if the pointer was allocated directly
+   * as a large object or belongs to a different pool. None of these functions
+   * acquire the pool's mutex.
+   **/
+  inline fhtagn::size_t size_classes() const;
+  inline fhtagn::size_t size_class(fhtagn::size_t size) const;
+  inline fhtagn::size_t class_size(fhtagn::size_t index) const;
+  inline fhtagn::size_t size_class_of(void * ptr) const;
+
+  /**
+   * Returns the mutex guarding this pool, e.g. to read the lock contention
+   * count of a contention_counting_mutex (see statistics.h).
+   **/
+  inline mutex_t & mutex() const;
+
 private:
 
+  enum {
+    /**
+     * All size class sizes are multiples of SIZE_GRANULARITY, which means the
+     * size class lookup table needs one entry per SIZE_GRANULARITY bytes.
+     **/
+    SIZE_GRANULARITY = detail::size_based_pool_helpers::common_divisor<
+        MIN_OBJECT_SIZE, MAX_OBJECT_SIZE, incrementorT, MIN_OBJECT_SIZE
+      >::value,
+    LOOKUP_TABLE_SIZE = (MAX_OBJECT_SIZE / SIZE_GRANULARITY) + 1,
+  };
+
+  enum {
+    CHUNK_BITS = detail::size_based_pool_helpers::log2<CHUNK_SIZE>::value,
+  };
+
+  /**
+   * Source of size class chunks; it records them, so that chunk_for() need
+   * not touch memory outside of them.
+   **/
+  typedef ::fhtagn::memory::registry_source<sourceT, CHUNK_BITS> chunk_source_t;
+
+  /**
+   * Header at the start of each chunk. size is the class size, and pool points
+   * to the block_pool that manages the rest of the chunk.
+   **/
+  struct chunk_header
+  {
+    size_based_pool * owner;
+    fhtagn::size_t    size_class;
+    fhtagn::size_t    size;
+    fhtagn::size_t    live;
+    fhtagn::size_t    position;
+    void *            pool;
+
+    static inline fhtagn::size_t header_size()
+    {
+      return block_alignmentT::adjust_size(
+          block_alignment<2 * sizeof(fhtagn::size_t)>::adjust_size(
+            sizeof(chunk_header)));
+    }
+  };
+
+  /**
+   * Header in front of each large object; size is the requested size.
+   **/
+  struct large_header
+  {
+    size_based_pool * owner;
+    fhtagn::size_t    size;
+
+    static inline fhtagn::size_t header_size()
+    {
+      return block_alignmentT::adjust_size(
+          block_alignment<2 * sizeof(fhtagn::size_t)>::adjust_size(
+            sizeof(large_header)));
+    }
+  };
+
+  /**
+   * Returns the header of the chunk ptr lies in, or NULL if ptr does not lie
+   * in a size class chunk, i.e. if it's a large object.
+   **/
+  static inline chunk_header * chunk_for(void * ptr);
+
+  /**
+   * Returns the header of the large object ptr points to.
+   **/
+  static inline large_header * large_for(void * ptr);
+
+  /**
+   * Each size class is managed by a virtual_pool; it hands out objects of the
+   * class size from a list of chunks.
+   **/
   struct virtual_pool_base
   {
     virtual ~virtual_pool_base() {};
 
-    virtual void * alloc(fhtagn::size_t size) = 0;
-    virtual void * realloc(void * ptr, fhtagn::size_t new_size) = 0;
-    virtual void free(void * ptr) = 0;
-    virtual bool in_use() const = 0;
-    virtual fhtagn::size_t alloc_size(void * ptr) const = 0;
+    virtual void * alloc() = 0;
+    virtual void free(chunk_header * chunk, void * ptr) = 0;
   };
 
   template <fhtagn::size_t OBJECT_SIZE>
   struct virtual_pool : virtual_pool_base
   {
-    virtual ~virtual_pool() {};
+    typedef ::fhtagn::memory::block_pool<
+      OBJECT_SIZE,
+      ::fhtagn::threads::fake_mutex,
+      block_alignmentT
+    > chunk_pool_t;
 
-    virtual void * alloc(fhtagn::size_t size)
+    virtual_pool(size_based_pool * owner, fhtagn::size_t size_class)
+      : m_owner(owner)
+      , m_size_class(size_class)
+      , m_current(0)
     {
-      return m_pool.alloc(size);
     }
 
-    virtual void * realloc(void * ptr, fhtagn::size_t new_size)
+    virtual ~virtual_pool()
     {
-      return m_pool.realloc(ptr, new_size);
+      for (typename std::vector<chunk_header *>::iterator iter = m_chunks.begin()
+          ; iter != m_chunks.end() ; ++iter)
+      {
+        release_chunk(*iter);
+      }
+    }
+
+    virtual void * alloc()
+    {
+      // Try the chunk we last allocated from first, then all others.
+      if (m_current < m_chunks.size()) {
+        void * ptr = alloc_from(m_chunks[m_current]);
+        if (ptr) {
+          return ptr;
+        }
+      }
+
+      for (fhtagn::size_t i = 0 ; i < m_chunks.size() ; ++i) {
+        void * ptr = alloc_from(m_chunks[i]);
+        if (ptr) {
+          m_current = i;
+          return ptr;
+        }
+      }
+
+      // All chunks are full, create a new one.
+      void * memblock = chunk_source_t::allocate(CHUNK_SIZE, CHUNK_SIZE);
+      if (!memblock) {
+        return NULL;
+      }
+
+      chunk_header * chunk = new (memblock) chunk_header();
+      chunk->owner = m_owner;
+      chunk->size_class = m_size_class;
+      chunk->size = OBJECT_SIZE;
+      chunk->live = 0;
+      chunk->position = m_chunks.size();
+
+      fhtagn::size_t offset = chunk_header::header_size()
+        + block_alignment<>::adjust_size(sizeof(chunk_pool_t));
+      chunk->pool = new (pointer(memblock).char_ptr
+          + chunk_header::header_size()) chunk_pool_t(
+            pointer(memblock).char_ptr + offset, CHUNK_SIZE - offset);
+
+      m_chunks.push_back(chunk);
+      m_current = chunk->position;
+
+      return alloc_from(chunk);
     }
 
-    virtual void free(void * ptr)
+    virtual void free(chunk_header * chunk, void * ptr)
     {
-      return m_pool.free(ptr);
+      static_cast<chunk_pool_t *>(chunk->pool)->free(ptr);
+      --chunk->live;
+
+      // Release empty chunks, but keep the last one around to avoid creating
+      // and releasing chunks over and over.
+      if (!chunk->live && m_chunks.size() > 1) {
+        // Move the last chunk into the released chunk's position.
+        chunk_header * last = m_chunks.back();
+        m_chunks[chunk->position] = last;
+        last->position = chunk->position;
+        m_chunks.pop_back();
+        m_current = 0;
+
+        release_chunk(chunk);
+      }
     }
 
-    virtual bool in_use() const
+    inline void * alloc_from(chunk_header * chunk)
     {
-      return m_pool.in_use();
+      void * ptr = static_cast<chunk_pool_t *>(chunk->pool)->alloc(OBJECT_SIZE);
+      if (ptr) {
+        ++chunk->live;
+      }
+      return ptr;
     }
 
-    virtual fhtagn::size_t alloc_size(void * ptr) const
+    static inline void release_chunk(chunk_header * chunk)
     {
-      return m_pool.alloc_size(ptr);
+      static_cast<chunk_pool_t *>(chunk->pool)->~chunk_pool_t();
+      chunk->~chunk_header();
+      chunk_source_t::release(chunk, CHUNK_SIZE);
     }
 
-    ::fhtagn::memory::dynamic_pool<
-      ::fhtagn::memory::block_pool<OBJECT_SIZE>,
-      OBJECT_SIZE * OBJECTS_PER_POOL
-    > m_pool;
+    size_based_pool *             m_owner;
+    fhtagn::size_t                m_size_class;
+    std::vector<chunk_header *>   m_chunks;
+    fhtagn::size_t                m_current;
   };
 
 
-  typedef fhtagn::shared_ptr<virtual_pool_base>       virtual_pool_ptr;
-  typedef std::map<fhtagn::size_t, virtual_pool_ptr>  pool_map_t;
-  typedef std::map<void *, fhtagn::size_t>            pointer_size_map_t;
+  typedef fhtagn::shared_ptr<virtual_pool_base> virtual_pool_ptr;
 
   template <int I>
   struct pool_creator
   {
-    void operator()(pool_map_t & map)
+    enum {
+      // The index of the size class I is the number of size classes
+      // preceding it.
+      INDEX = detail::size_based_pool_helpers::count<
+          MIN_OBJECT_SIZE, I - 1, incrementorT
+        >::value,
+    };
+
+    void operator()(size_based_pool & pool)
     {
-      map[I] = virtual_pool_ptr(new virtual_pool<I>());
+      pool.m_class_sizes[INDEX] = I;
+      pool.m_pools[INDEX] = virtual_pool_ptr(new virtual_pool<I>(&pool, INDEX));
     }
   };
 
-  inline fhtagn::size_t pool_size(fhtagn::size_t in_size) const;
+  /**
+   * Lock-free versions of alloc and free, used internally.
+   **/
+  inline void * lockfree_alloc(fhtagn::size_t size);
+  inline void lockfree_free(void * ptr);
 
 
-  pool_map_t          m_pool_map;
-  heap_pool           m_heap;
+  virtual_pool_ptr    m_pools[SIZE_CLASSES];
+  fhtagn::size_t      m_class_sizes[SIZE_CLASSES];
+  boost::uint16_t     m_class_lookup[LOOKUP_TABLE_SIZE];
 
-  pointer_size_map_t  m_pointer_size_map;
+  fhtagn::size_t      m_live;
 
   mutable mutex_t     m_mutex;
 };
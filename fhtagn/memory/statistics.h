@@ -0,0 +1,287 @@
+/**
+ * $Id$
+ *
+ * This file is part of the Fhtagn! C++ Library.
+ * Copyright (C) 2009 Jens Finkhaeuser <unwesen@users.sourceforge.net>.
+ *
+ * Author: Jens Finkhaeuser <unwesen@users.sourceforge.net>
+ *
+ * This program is licensed as free software for personal, educational or
+ * other non-commerical uses: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation, either version 3 of the License, or (at your
+ * option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Alternatively, licenses for commercial purposes are available as well.
+ * Please send your enquiries to the copyright holder's address above.
+ **/
+#ifndef FHTAGN_MEMORY_STATISTICS_H
+#define FHTAGN_MEMORY_STATISTICS_H
+
+#ifndef __cplusplus
+#error You are trying to include a C++ only header file
+#endif
+
+#include <iostream>
+
+#include <fhtagn/fhtagn.h>
+
+#include <boost/noncopyable.hpp>
+#include <boost/thread/locks.hpp>
+#include <boost/mpl/has_xxx.hpp>
+
+#include <fhtagn/memory/memory_pool.h>
+#include <fhtagn/memory/utility.h>
+#include <fhtagn/threads/atomic.h>
+
+namespace fhtagn {
+namespace memory {
+
+/**
+ * Snapshot of the statistics gathered for a MemoryPool, see statistics_pool
+ * below.
+ *
+ * - allocs, frees and reallocs count successful calls to the respective
+ *   functions; failed_allocs counts calls to alloc() and realloc() that
+ *   returned NULL.
+ * - bytes_live is the number of bytes currently allocated, as reported by the
+ *   pool's alloc_size(), and bytes_high_water the largest value bytes_live
+ *   ever reached. Pools that report an alloc_size() of zero do not contribute
+ *   to either.
+ * - contended_locks counts how often a lock on the pool's mutex could not be
+ *   acquired immediately. It is only tracked if the pool uses a
+ *   contention_counting_mutex.
+ * - size_histogram[i] counts allocations and reallocations of a requested
+ *   size in [2^i, 2^(i+1)); the last bucket also includes all larger sizes.
+ *
+ * write_text() dumps the snapshot in a human-readable format, write_json()
+ * as a single JSON object.
+ **/
+struct pool_statistics
+{
+  enum {
+    HISTOGRAM_BUCKETS = 32,
+  };
+
+  inline pool_statistics();
+
+  inline void write_text(std::ostream & os) const;
+  inline void write_json(std::ostream & os) const;
+
+  fhtagn::size_t  allocs;
+  fhtagn::size_t  frees;
+  fhtagn::size_t  reallocs;
+  fhtagn::size_t  failed_allocs;
+  fhtagn::size_t  bytes_live;
+  fhtagn::size_t  bytes_high_water;
+  fhtagn::size_t  contended_locks;
+  fhtagn::size_t  size_histogram[HISTOGRAM_BUCKETS];
+};
+
+
+
+/**
+ * Statistics policies are notified by statistics_pool of each operation on
+ * the pool. Apart from gathering statistics, they're a convenient hook for
+ * tracing pool usage. A statistics policy must provide:
+ *
+ * - An enum value ENABLED. If it's false, statistics_pool skips any work
+ *   that's only required to feed the policy.
+ * - void on_alloc(fhtagn::size_t requested, fhtagn::size_t bytes)
+ * - void on_realloc(fhtagn::size_t requested, fhtagn::size_t old_bytes,
+ *       fhtagn::size_t new_bytes)
+ * - void on_free(fhtagn::size_t bytes)
+ * - void on_failure(fhtagn::size_t requested)
+ * - void snapshot(pool_statistics & stats) const
+ *
+ * Here, requested is the size passed to alloc() or realloc(), and bytes the
+ * alloc_size() of the pointer in question.
+ **/
+
+
+/**
+ * Gathers nothing; statistics_pool<poolT, no_statistics> compiles down to
+ * plain calls to poolT.
+ **/
+struct no_statistics
+{
+  enum {
+    ENABLED = false,
+  };
+
+  inline void on_alloc(fhtagn::size_t, fhtagn::size_t)
+  {
+  }
+
+  inline void on_realloc(fhtagn::size_t, fhtagn::size_t, fhtagn::size_t)
+  {
+  }
+
+  inline void on_free(fhtagn::size_t)
+  {
+  }
+
+  inline void on_failure(fhtagn::size_t)
+  {
+  }
+
+  inline void snapshot(pool_statistics &) const
+  {
+  }
+};
+
+
+
+/**
+ * Gathers all of pool_statistics' counters with atomic operations (see
+ * fhtagn/threads/atomic.h), so it can be used with pools shared between
+ * threads without additional locking.
+ **/
+class atomic_statistics
+  : private boost::noncopyable
+{
+public:
+  enum {
+    ENABLED = true,
+  };
+
+  inline atomic_statistics();
+
+  inline void on_alloc(fhtagn::size_t requested, fhtagn::size_t bytes);
+  inline void on_realloc(fhtagn::size_t requested, fhtagn::size_t old_bytes,
+      fhtagn::size_t new_bytes);
+  inline void on_free(fhtagn::size_t bytes);
+  inline void on_failure(fhtagn::size_t requested);
+  inline void snapshot(pool_statistics & stats) const;
+
+private:
+  inline void add_bytes(fhtagn::size_t bytes);
+  inline void count_size(fhtagn::size_t requested);
+
+  fhtagn::size_t volatile m_allocs;
+  fhtagn::size_t volatile m_frees;
+  fhtagn::size_t volatile m_reallocs;
+  fhtagn::size_t volatile m_failed_allocs;
+  fhtagn::size_t volatile m_bytes_live;
+  fhtagn::size_t volatile m_bytes_high_water;
+  fhtagn::size_t volatile m_size_histogram[pool_statistics::HISTOGRAM_BUCKETS];
+};
+
+
+
+/**
+ * Wraps a mutex of type mutexT, and counts how often lock() finds the mutex
+ * already locked. Pass it as the mutex type to any of the pools to have
+ * statistics_pool report lock contention; statistics_pool reads the count from
+ * the wrapped pool's own mutex, so each pool instance is counted separately.
+ **/
+template <
+  typename mutexT
+>
+class contention_counting_mutex
+  : private boost::noncopyable
+{
+public:
+  typedef boost::unique_lock<contention_counting_mutex> scoped_lock;
+  typedef scoped_lock scoped_try_lock;
+
+  inline contention_counting_mutex()
+    : m_contended(0)
+  {
+  }
+
+  inline void lock()
+  {
+    if (!m_mutex.try_lock()) {
+      fhtagn::threads::atomic_add(m_contended, fhtagn::size_t(1));
+      m_mutex.lock();
+    }
+  }
+
+  inline bool try_lock()
+  {
+    return m_mutex.try_lock();
+  }
+
+  inline void unlock()
+  {
+    m_mutex.unlock();
+  }
+
+  /**
+   * Returns the number of contended lock() calls on this mutex.
+   **/
+  inline fhtagn::size_t contended() const
+  {
+    return fhtagn::threads::atomic_load(m_contended);
+  }
+
+private:
+  mutexT                  m_mutex;
+  fhtagn::size_t volatile m_contended;
+};
+
+
+
+/**
+ * The statistics_pool class wraps a MemoryPool, and reports each call to it
+ * to a statistics policy (see above). Like throw_pool, it does not own the
+ * wrapped pool.
+ *
+ * Wrapping is opt-in per pool instance, and with the no_statistics policy
+ * costs nothing; pools that aren't wrapped are unaffected altogether.
+ *
+ * snapshot() returns the statistics gathered so far.
+ **/
+template <
+  typename memory_poolT,
+  typename statisticsT = atomic_statistics
+>
+class statistics_pool
+{
+public:
+  BOOST_CLASS_REQUIRE(memory_poolT, ::fhtagn::memory::concepts,
+      MemoryPoolConcept);
+
+  typedef statisticsT statistics_t;
+
+  inline statistics_pool(memory_poolT & pool);
+
+  /**
+   * API - see memory_pool.h for details
+   **/
+  inline void * alloc(fhtagn::size_t size);
+  inline void * realloc(void * ptr, fhtagn::size_t new_size);
+  inline void free(void * ptr);
+  inline bool in_use() const;
+  inline fhtagn::size_t alloc_size(void * ptr) const;
+
+  /**
+   * Returns a snapshot of the statistics gathered so far.
+   **/
+  inline pool_statistics snapshot() const;
+
+  /**
+   * Returns the statistics policy object.
+   **/
+  inline statisticsT & statistics();
+
+private:
+  memory_poolT &  m_pool;
+  statisticsT     m_statistics;
+};
+
+
+}} // namespace fhtagn::memory
+
+#include <fhtagn/memory/detail/statistics.tcc>
+
+#endif // guard
@@ -0,0 +1,163 @@
+/**
+ * $Id$
+ *
+ * This file is part of the Fhtagn! C++ Library.
+ * Copyright (C) 2011 Jens Finkhaeuser <unwesen@users.sourceforge.net>.
+ *
+ * Author: Jens Finkhaeuser <unwesen@users.sourceforge.net>
+ *
+ * This program is licensed as free software for personal, educational or
+ * other non-commerical uses: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation, either version 3 of the License, or (at your
+ * option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Alternatively, licenses for commercial purposes are available as well.
+ * Please send your enquiries to the copyright holder's address above.
+ **/
+#ifndef FHTAGN_MEMORY_THREAD_CACHED_POOL_H
+#define FHTAGN_MEMORY_THREAD_CACHED_POOL_H
+
+#ifndef __cplusplus
+#error You are trying to include a C++ only header file
+#endif
+
+#include <fhtagn/fhtagn.h>
+
+#include <vector>
+
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/tss.hpp>
+
+#include <fhtagn/memory/memory_pool.h>
+#include <fhtagn/memory/size_based_pool.h>
+
+namespace fhtagn {
+namespace memory {
+
+/**
+ * The thread_cached_pool class puts a per-thread cache in front of a
+ * size_based_pool, much in the way of thread caching malloc implementations.
+ *
+ * Each thread keeps a small magazine of free objects for each of the
+ * size_based_pool's size classes. Allocations are served from the calling
+ * thread's magazine without acquiring the size_based_pool's mutex. If the
+ * magazine is empty, it is refilled with a batch of objects via a single
+ * alloc_bulk() call.
+ *
+ * Freed pointers are put into the calling thread's magazine for their size
+ * class, which size_based_pool::size_class_of() determines without acquiring
+ * the mutex. If that magazine is full, half of it is returned to the
+ * size_based_pool with a single free_bulk() call first.
+ *
+ * That means most alloc/free pairs never touch the size_based_pool's mutex.
+ * It also means memory freed by one thread may be re-used by another, and
+ * that objects sitting in a thread's magazines count as allocated from the
+ * size_based_pool's point of view - in_use() may return true until each
+ * thread that used the pool has called flush() or exited.
+ *
+ * The poolT parameter must be a size_based_pool with a real mutex type, such
+ * as boost::mutex. Allocations of sizes larger than the size_based_pool's
+ * largest size class are passed through to it directly.
+ *
+ * Note that per-thread caches are released back to the size_based_pool when
+ * the thread they belong to exits. You must therefore ensure that the
+ * thread_cached_pool outlives all threads that allocate from it, with the
+ * exception of the thread destroying the pool.
+ **/
+template <
+  typename poolT = size_based_pool<256, 1, 256,
+      ::fhtagn::meta::multi_double, boost::mutex>,
+  fhtagn::size_t MAGAZINE_SIZE = 32
+>
+class thread_cached_pool
+{
+public:
+  /**
+   * Convenience typedefs
+   **/
+  typedef poolT pool_t;
+
+  inline thread_cached_pool();
+  inline ~thread_cached_pool();
+
+  /**
+   * API - see memory_pool.h for details
+   **/
+  inline void * alloc(fhtagn::size_t size);
+  inline void * realloc(void * ptr, fhtagn::size_t new_size);
+  inline void free(void * ptr);
+  inline bool in_use() const;
+  inline fhtagn::size_t alloc_size(void * ptr) const;
+
+  /**
+   * Returns all memory cached by the calling thread to the underlying
+   * size_based_pool.
+   **/
+  inline void flush();
+
+private:
+
+  /**
+   * A magazine of free objects of the same size class.
+   **/
+  struct magazine
+  {
+    magazine()
+      : count(0)
+    {
+    }
+
+    fhtagn::size_t  count;
+    void *          ptrs[MAGAZINE_SIZE];
+  };
+
+  /**
+   * Per-thread cache: one magazine per size class.
+   **/
+  struct thread_cache
+  {
+    thread_cache(thread_cached_pool * _owner, fhtagn::size_t size_classes)
+      : owner(_owner)
+      , magazines(size_classes)
+    {
+    }
+
+    thread_cached_pool *  owner;
+    std::vector<magazine> magazines;
+  };
+
+  /**
+   * Returns the calling thread's cache, creating it if necessary.
+   **/
+  inline thread_cache & get_cache();
+
+  /**
+   * Returns all memory held by the cache to the underlying pool.
+   **/
+  inline void drain(thread_cache & cache);
+
+  /**
+   * Cleanup function for boost::thread_specific_ptr; drains and deletes a
+   * thread's cache on thread exit.
+   **/
+  static inline void release_cache(thread_cache * cache);
+
+  pool_t                                    m_pool;
+  boost::thread_specific_ptr<thread_cache>  m_cache;
+};
+
+
+}} // namespace fhtagn::memory
+
+#include <fhtagn/memory/detail/thread_cached_pool.tcc>
+
+#endif // guard
@@ -32,6 +32,28 @@
 
 #include <fhtagn/fhtagn.h>
 
+#include <stdlib.h>
+#if defined(_WIN32)
+#include <malloc.h>
+#endif
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+
+/**
+ * Cache line and page size of the target platform. Both are detected at
+ * configure time; if detection failed, the values below are correct for most
+ * current platforms.
+ **/
+#if !defined(FHTAGN_CACHE_LINE_SIZE)
+#define FHTAGN_CACHE_LINE_SIZE 64
+#endif
+
+#if !defined(FHTAGN_PAGE_SIZE)
+#define FHTAGN_PAGE_SIZE 4096
+#endif
+
+
 namespace fhtagn {
 namespace memory {
 
@@ -44,14 +66,22 @@ namespace memory {
  *
  * The adjustment for pointers advances the pointer until it lies on a block
  * boundary.
+ *
+ * If T_PAD_OBJECTS is true, pools that hand out objects of a fixed size, such
+ * as block_pool, additionally pad each object to a multiple of the block size,
+ * so that every object starts on a block boundary and no two objects share a
+ * block. Pools that round up each allocation's size anyway, such as
+ * fixed_pool, behave the same with and without padding.
  **/
 template <
-  fhtagn::size_t T_BLOCK_SIZE = sizeof(fhtagn::size_t)
+  fhtagn::size_t T_BLOCK_SIZE = sizeof(fhtagn::size_t),
+  bool T_PAD_OBJECTS = false
 >
 struct block_alignment
 {
   enum {
     BLOCK_SIZE = T_BLOCK_SIZE,
+    PAD_OBJECTS = T_PAD_OBJECTS,
   };
 
   static inline fhtagn::size_t adjust_size(fhtagn::size_t size)
@@ -73,6 +103,42 @@ struct block_alignment
 
 
 
+/**
+ * Alignment presets:
+ *
+ * - cache_line_alignment aligns allocations at cache line boundaries.
+ * - cache_line_padding additionally pads fixed size objects to whole cache
+ *   lines. Use it for pools from which several threads allocate objects they
+ *   then modify, to avoid false sharing between neighbouring objects.
+ * - page_alignment aligns allocations at page boundaries.
+ **/
+typedef block_alignment<FHTAGN_CACHE_LINE_SIZE>       cache_line_alignment;
+typedef block_alignment<FHTAGN_CACHE_LINE_SIZE, true> cache_line_padding;
+typedef block_alignment<FHTAGN_PAGE_SIZE>             page_alignment;
+
+
+
+/**
+ * Distance between neighbouring objects of size OBJECT_SIZE in a pool using
+ * block_alignmentT: OBJECT_SIZE rounded up to the block size if the alignment
+ * asks for padding, otherwise OBJECT_SIZE itself.
+ **/
+template <
+  fhtagn::size_t OBJECT_SIZE,
+  typename block_alignmentT
+>
+struct object_stride
+{
+  enum {
+    value = block_alignmentT::PAD_OBJECTS
+      ? ((OBJECT_SIZE + block_alignmentT::BLOCK_SIZE - 1)
+          / block_alignmentT::BLOCK_SIZE) * block_alignmentT::BLOCK_SIZE
+      : OBJECT_SIZE,
+  };
+};
+
+
+
 /**
  * Helper struct for conveniently intepreting void * as char * and vice
  * versa.
@@ -91,6 +157,105 @@ struct pointer
 };
 
 
+
+/**
+ * Allocates size bytes from the heap, aligned at the given alignment, which
+ * must be a power of two multiple of sizeof(void *). Returns NULL if
+ * allocation failed.
+ *
+ * Memory allocated with allocate_aligned() must be released with
+ * free_aligned().
+ **/
+inline void * allocate_aligned(fhtagn::size_t size, fhtagn::size_t alignment)
+{
+#if defined(_WIN32)
+  return ::_aligned_malloc(size, alignment);
+#else
+  void * ptr = NULL;
+  if (0 != ::posix_memalign(&ptr, alignment, size)) {
+    return NULL;
+  }
+  return ptr;
+#endif
+}
+
+
+
+inline void free_aligned(void * ptr)
+{
+#if defined(_WIN32)
+  ::_aligned_free(ptr);
+#else
+  ::free(ptr);
+#endif
+}
+
+
+
+
+/**
+ * Returns the index of the lowest set bit in value, i.e. the number of
+ * trailing zero bits. The result is undefined if value is zero.
+ *
+ * Uses the compiler's bit scan intrinsics where available, which translate to
+ * a single instruction on most platforms.
+ **/
+inline fhtagn::size_t count_trailing_zeros(fhtagn::size_t value)
+{
+#if defined(__GNUC__)
+  if (sizeof(fhtagn::size_t) == sizeof(unsigned long long)) {
+    return __builtin_ctzll(value);
+  }
+  return __builtin_ctzl(value);
+#elif defined(_MSC_VER)
+  unsigned long index = 0;
+#  if defined(_WIN64)
+  _BitScanForward64(&index, value);
+#  else
+  _BitScanForward(&index, value);
+#  endif
+  return index;
+#else
+  fhtagn::size_t index = 0;
+  while (!(value & 1)) {
+    value >>= 1;
+    ++index;
+  }
+  return index;
+#endif
+}
+
+
+
+/**
+ * Returns the index of the highest set bit in value, i.e. the integer part of
+ * log2(value). The result is undefined if value is zero.
+ **/
+inline fhtagn::size_t highest_set_bit(fhtagn::size_t value)
+{
+#if defined(__GNUC__)
+  if (sizeof(fhtagn::size_t) == sizeof(unsigned long long)) {
+    return (sizeof(unsigned long long) * 8 - 1) - __builtin_clzll(value);
+  }
+  return (sizeof(unsigned long) * 8 - 1) - __builtin_clzl(value);
+#elif defined(_MSC_VER)
+  unsigned long index = 0;
+#  if defined(_WIN64)
+  _BitScanReverse64(&index, value);
+#  else
+  _BitScanReverse(&index, value);
+#  endif
+  return index;
+#else
+  fhtagn::size_t index = 0;
+  while (value >>= 1) {
+    ++index;
+  }
+  return index;
+#endif
+}
+
+
 }} // namespace fhtagn::memory
 
 #endif // guard
@@ -0,0 +1,182 @@
+/**
+ * $Id$
+ *
+ * This file is part of the Fhtagn! C++ Library.
+ * Copyright (C) 2009 Jens Finkhaeuser <unwesen@users.sourceforge.net>.
+ *
+ * Author: Jens Finkhaeuser <unwesen@users.sourceforge.net>
+ *
+ * This program is licensed as free software for personal, educational or
+ * other non-commerical uses: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation, either version 3 of the License, or (at your
+ * option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Alternatively, licenses for commercial purposes are available as well.
+ * Please send your enquiries to the copyright holder's address above.
+ **/
+#ifndef FHTAGN_THREADS_ATOMIC_H
+#define FHTAGN_THREADS_ATOMIC_H
+
+#ifndef __cplusplus
+#error You are trying to include a C++ only header file
+#endif
+
+#include <fhtagn/fhtagn.h>
+
+#if !defined(__GNUC__) && !defined(_MSC_VER)
+#error Atomic operations are only implemented for GCC and MSVC
+#endif
+
+namespace fhtagn {
+namespace threads {
+
+/**
+ * A small set of atomic operations on word-sized integers and pointers, as
+ * needed for lock-free algorithms. They are implemented in terms of compiler
+ * intrinsics: GCC's __atomic or __sync builtins, and MSVC's Interlocked
+ * functions.
+ *
+ * - atomic_load() reads a value with acquire semantics; atomic_store() writes
+ *   a value with release semantics.
+ * - compare_and_swap() sets target to desired if it's equal to expected, and
+ *   returns true if it did. It implies a full memory barrier.
+ * - atomic_add() adds delta to target, and returns the new value. It implies
+ *   a full memory barrier.
+ *
+ * T must be an integer type or pointer type of 4 or 8 bytes.
+ **/
+namespace detail {
+
+#if defined(_MSC_VER)
+template <int SIZE>
+struct interlocked;
+
+template <>
+struct interlocked<4>
+{
+  typedef LONG value_type;
+
+  static inline value_type compare_exchange(value_type volatile * target,
+      value_type desired, value_type expected)
+  {
+    return ::InterlockedCompareExchange(target, desired, expected);
+  }
+
+  static inline value_type exchange_add(value_type volatile * target,
+      value_type delta)
+  {
+    return ::InterlockedExchangeAdd(target, delta);
+  }
+};
+
+template <>
+struct interlocked<8>
+{
+  typedef LONGLONG value_type;
+
+  static inline value_type compare_exchange(value_type volatile * target,
+      value_type desired, value_type expected)
+  {
+    return ::InterlockedCompareExchange64(target, desired, expected);
+  }
+
+  static inline value_type exchange_add(value_type volatile * target,
+      value_type delta)
+  {
+    return ::InterlockedExchangeAdd64(target, delta);
+  }
+};
+#endif
+
+} // namespace detail
+
+
+
+template <typename T>
+inline T atomic_load(T volatile const & source)
+{
+#if defined(__GNUC__) && defined(__ATOMIC_ACQUIRE)
+  return __atomic_load_n(&source, __ATOMIC_ACQUIRE);
+#elif defined(__GNUC__)
+  T result = source;
+  __sync_synchronize();
+  return result;
+#else
+  T result = source;
+  ::MemoryBarrier();
+  return result;
+#endif
+}
+
+
+
+template <typename T>
+inline void atomic_store(T volatile & target, T value)
+{
+#if defined(__GNUC__) && defined(__ATOMIC_RELEASE)
+  __atomic_store_n(&target, value, __ATOMIC_RELEASE);
+#elif defined(__GNUC__)
+  __sync_synchronize();
+  target = value;
+#else
+  ::MemoryBarrier();
+  target = value;
+#endif
+}
+
+
+
+template <typename T>
+inline bool compare_and_swap(T volatile & target, T expected, T desired)
+{
+#if defined(__GNUC__)
+  return __sync_bool_compare_and_swap(&target, expected, desired);
+#else
+  typedef detail::interlocked<sizeof(T)> impl;
+  typedef typename impl::value_type value_type;
+  value_type result = impl::compare_exchange(
+      reinterpret_cast<value_type volatile *>(&target),
+      (value_type) desired, (value_type) expected);
+  return result == (value_type) expected;
+#endif
+}
+
+
+
+template <typename T>
+inline T atomic_add(T volatile & target, T delta)
+{
+#if defined(__GNUC__)
+  return __sync_add_and_fetch(&target, delta);
+#else
+  typedef detail::interlocked<sizeof(T)> impl;
+  typedef typename impl::value_type value_type;
+  return T(impl::exchange_add(reinterpret_cast<value_type volatile *>(&target),
+        (value_type) delta) + (value_type) delta);
+#endif
+}
+
+
+
+/**
+ * Tag type that can be passed in place of a mutex type to classes that
+ * provide a lock-free implementation, such as block_pool (see
+ * fhtagn/memory/block_pool.h).
+ **/
+struct lock_free
+{
+};
+
+
+}} // namespace fhtagn::threads
+
+#endif // guard
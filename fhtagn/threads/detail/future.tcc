@@ -26,6 +26,9 @@
 #ifndef FHTAGN_THREADS_DETAIL_FUTURE_TCC
 #define FHTAGN_THREADS_DETAIL_FUTURE_TCC
 
+#include <stdexcept>
+
+#include <boost/thread/xtime.hpp>
 
 namespace fhtagn {
 namespace threads {
@@ -44,16 +47,38 @@ exception::exception(std::string const & msg)
 
 
 
+namespace futures {
+namespace detail {
+
+template <
+  typename poolT
+>
+void
+release_to_pool(void * pool, void * ptr)
+{
+  static_cast<poolT *>(pool)->free(ptr);
+}
+
+} // namespace detail
+} // namespace futures
+
+
+
 /*****************************************************************************
- * future::future_impl
+ * future::state
  **/
 template <
   typename return_valueT
 >
-future<return_valueT>::future_impl::future_impl()
-  : m_thread(NULL)
-  , m_value(NULL)
-  , m_exception_message(NULL)
+future<return_valueT>::state::state(executor & exec, void * pool,
+    release_func release)
+  : m_refcount(1)
+  , m_executor(exec)
+  , m_started(false)
+  , m_has_value(false)
+  , m_has_exception(false)
+  , m_pool(pool)
+  , m_release(release)
 {
 }
 
@@ -62,15 +87,22 @@ future<return_valueT>::future_impl::future_impl()
 template <
   typename return_valueT
 >
-future<return_valueT>::future_impl::~future_impl()
+future<return_valueT>::state::~state()
 {
-  if (m_thread) {
-    m_thread->join();
-    delete m_thread;
+  if (m_has_value) {
+    value()->~return_valueT();
   }
+}
+
+
 
-  delete m_value;
-  delete m_exception_message;
+template <
+  typename return_valueT
+>
+void
+future<return_valueT>::state::add_ref()
+{
+  atomic_add(m_refcount, fhtagn::size_t(1));
 }
 
 
@@ -79,10 +111,54 @@ template <
   typename return_valueT
 >
 void
-future<return_valueT>::future_impl::start_thread()
+future<return_valueT>::state::release(state * s)
 {
-  m_thread = new boost::thread(boost::bind(&future_impl::thread_runner,
-        this));
+  if (atomic_add(s->m_refcount, fhtagn::size_t(-1))) {
+    return;
+  }
+
+  // thread_runner() calls the derived class' invoke(), so wait for it to
+  // finish before destruction begins.
+  {
+    boost::mutex::scoped_lock l(s->m_mutex);
+    if (s->m_started) {
+      while (!s->done()) {
+        s->m_finish.wait(l);
+      }
+    }
+  }
+
+  if (!s->m_release) {
+    delete s;
+    return;
+  }
+
+  void * pool = s->m_pool;
+  release_func release = s->m_release;
+  s->~state();
+  release(pool, s);
+}
+
+
+
+template <
+  typename return_valueT
+>
+void
+future<return_valueT>::state::start()
+{
+  if (!m_executor.submit(boost::bind(&state::thread_runner, this))) {
+    std::string exception_message = "Executor did not accept the bound "
+      "function.";
+    std::vector<continuation_type> continuations;
+    finish(false, exception_message, continuations);
+
+    for (typename std::vector<continuation_type>::iterator iter
+        = continuations.begin() ; iter != continuations.end() ; ++iter)
+    {
+      (*iter)();
+    }
+  }
 }
 
 
@@ -91,33 +167,149 @@ template <
   typename return_valueT
 >
 void
-future<return_valueT>::future_impl::thread_runner()
+future<return_valueT>::state::dispatch(state * s, bool use_executor)
 {
-  return_valueT * value = NULL;
-  std::string * exception_message = NULL;
+  if (use_executor) {
+    s->start();
+  }
+  else {
+    s->thread_runner();
+  }
+}
+
+
+
+template <
+  typename return_valueT
+>
+void
+future<return_valueT>::state::thread_runner()
+{
+  bool has_value = false;
+  std::string exception_message;
   try {
-    value = new return_valueT(m_func());
+    invoke();
+    has_value = true;
 
   } catch (std::exception const & ex) {
-    boost::mutex::scoped_lock l(m_mutex);
-    exception_message = new std::string(ex.what());
+    exception_message = ex.what();
 
   } catch (...) {
-    boost::mutex::scoped_lock l(m_mutex);
-    exception_message = new std::string("Unspecified exception occurred in "
-        "bound function.");
+    exception_message = "Unspecified exception occurred in bound function.";
   }
 
-  // Store value and signal that we're done.
+  // Publish value and signal that we're done. From here on, this object may
+  // be destroyed at any time.
+  std::vector<continuation_type> continuations;
+  finish(has_value, exception_message, continuations);
+
+  // Continuations only dispatch other futures' functions, which catch their
+  // own exceptions.
+  for (typename std::vector<continuation_type>::iterator iter
+      = continuations.begin() ; iter != continuations.end() ; ++iter)
+  {
+    (*iter)();
+  }
+}
+
+
+
+template <
+  typename return_valueT
+>
+void
+future<return_valueT>::state::finish(bool has_value,
+    std::string & exception_message,
+    std::vector<continuation_type> & continuations)
+{
   boost::mutex::scoped_lock l(m_mutex);
-  m_value = value;
-  m_exception_message = exception_message;
+  m_has_value = has_value;
+  m_has_exception = !has_value;
+  m_exception_message.swap(exception_message);
+  m_continuations.swap(continuations);
 
   m_finish.notify_all();
 }
 
 
 
+template <
+  typename return_valueT
+>
+void
+future<return_valueT>::state::add_continuation(
+    continuation_type const & continuation)
+{
+  {
+    boost::mutex::scoped_lock l(m_mutex);
+    if (!done()) {
+      m_continuations.push_back(continuation);
+      return;
+    }
+  }
+
+  continuation();
+}
+
+
+
+template <
+  typename return_valueT
+>
+bool
+future<return_valueT>::state::done() const
+{
+  return m_has_value || m_has_exception;
+}
+
+
+
+template <
+  typename return_valueT
+>
+return_valueT *
+future<return_valueT>::state::value()
+{
+  return static_cast<return_valueT *>(m_storage.address());
+}
+
+
+
+
+
+
+/*****************************************************************************
+ * future::bound_state
+ **/
+template <
+  typename return_valueT
+>
+template <
+  typename funcT
+>
+future<return_valueT>::bound_state<funcT>::bound_state(funcT const & func,
+    executor & exec, void * pool, typename state::release_func release)
+  : state(exec, pool, release)
+  , m_func(func)
+{
+}
+
+
+
+template <
+  typename return_valueT
+>
+template <
+  typename funcT
+>
+void
+future<return_valueT>::bound_state<funcT>::invoke()
+{
+  new (this->m_storage.address()) return_valueT(m_func());
+}
+
+
+
 
 
 
@@ -127,12 +319,15 @@ future<return_valueT>::future_impl::thread_runner()
 template <
   typename return_valueT
 >
-future<return_valueT>::future(typename future::func_type::slot_type slot)
-  : property_t(this, &future<return_valueT>::get)
-  , m_impl(new future_impl())
+template <
+  typename funcT
+>
+future<return_valueT>::future(funcT func)
+  : property_t(this, &future::get)
+  , m_state(make_state(func, default_executor()))
 {
-  m_impl->m_func.connect(slot);
-  m_impl->start_thread();
+  m_state->m_started = true;
+  m_state->start();
 }
 
 
@@ -140,12 +335,188 @@ future<return_valueT>::future(typename future::func_type::slot_type slot)
 template <
   typename return_valueT
 >
-future<return_valueT>::future(typename future::func_type::slot_type slot,
+template <
+  typename funcT
+>
+future<return_valueT>::future(funcT func, executor & exec)
+  : property_t(this, &future::get)
+  , m_state(make_state(func, exec))
+{
+  m_state->m_started = true;
+  m_state->start();
+}
+
+
+
+template <
+  typename return_valueT
+>
+template <
+  typename funcT,
+  typename poolT
+>
+future<return_valueT>::future(funcT func, executor & exec,
+    poolT & pool)
+  : property_t(this, &future::get)
+  , m_state(make_state(func, exec, pool))
+{
+  m_state->m_started = true;
+  m_state->start();
+}
+
+
+
+template <
+  typename return_valueT
+>
+template <
+  typename funcT
+>
+future<return_valueT>::future(funcT func,
     futures::lazy_evaluate const &)
   : property_t(this, &future::get)
-  , m_impl(new future_impl())
+  , m_state(make_state(func, default_executor()))
 {
-  m_impl->m_func.connect(slot);
+}
+
+
+
+template <
+  typename return_valueT
+>
+template <
+  typename funcT
+>
+future<return_valueT>::future(funcT func,
+    futures::lazy_evaluate const &, executor & exec)
+  : property_t(this, &future::get)
+  , m_state(make_state(func, exec))
+{
+}
+
+
+
+template <
+  typename return_valueT
+>
+template <
+  typename funcT,
+  typename poolT
+>
+future<return_valueT>::future(funcT func,
+    futures::lazy_evaluate const &, executor & exec, poolT & pool)
+  : property_t(this, &future::get)
+  , m_state(make_state(func, exec, pool))
+{
+}
+
+
+
+template <
+  typename return_valueT
+>
+future<return_valueT>::future(future const & other)
+  : property_t(this, other)
+  , m_state(other.m_state)
+{
+  m_state->add_ref();
+}
+
+
+
+template <
+  typename return_valueT
+>
+future<return_valueT>::future(state * s)
+  : property_t(this, &future::get)
+  , m_state(s)
+{
+}
+
+
+
+template <
+  typename return_valueT
+>
+future<return_valueT> &
+future<return_valueT>::operator=(future const & other)
+{
+  other.m_state->add_ref();
+  state::release(m_state);
+  m_state = other.m_state;
+  return *this;
+}
+
+
+
+template <
+  typename return_valueT
+>
+future<return_valueT>::~future()
+{
+  state::release(m_state);
+}
+
+
+
+template <
+  typename return_valueT
+>
+template <
+  typename funcT
+>
+typename future<return_valueT>::state *
+future<return_valueT>::make_state(funcT const & func, executor & exec)
+{
+  return new bound_state<funcT>(func, exec, NULL, NULL);
+}
+
+
+
+template <
+  typename return_valueT
+>
+template <
+  typename funcT,
+  typename poolT
+>
+typename future<return_valueT>::state *
+future<return_valueT>::make_state(funcT const & func, executor & exec,
+    poolT & pool)
+{
+  void * mem = pool.alloc(sizeof(bound_state<funcT>));
+  if (!mem) {
+    throw std::bad_alloc();
+  }
+
+  try {
+    return new (mem) bound_state<funcT>(func, exec, &pool,
+        &futures::detail::release_to_pool<poolT>);
+  } catch (...) {
+    pool.free(mem);
+    throw;
+  }
+}
+
+
+
+template <
+  typename return_valueT
+>
+void
+future<return_valueT>::ensure_started() const
+{
+  {
+    boost::mutex::scoped_lock l(m_state->m_mutex);
+    if (m_state->m_started) {
+      return;
+    }
+    m_state->m_started = true;
+  }
+
+  // The executor may block or run the function right away, so don't hold
+  // the lock while submitting.
+  m_state->start();
 }
 
 
@@ -156,26 +527,325 @@ template <
 return_valueT
 future<return_valueT>::get() const
 {
-  boost::mutex::scoped_lock l(m_impl->m_mutex);
-  if (!(m_impl->m_value || m_impl->m_exception_message)) {
-    // If there's no thread, start it. That happens with lazy evaluation.
-    if (!m_impl->m_thread) {
-      m_impl->start_thread();
+  wait();
+
+  boost::mutex::scoped_lock l(m_state->m_mutex);
+
+  // May need to throw an exception.
+  if (m_state->m_has_exception) {
+    throw futures::exception(m_state->m_exception_message);
+  }
+
+  // Return value!
+  return *m_state->value();
+}
+
+
+
+template <
+  typename return_valueT
+>
+bool
+future<return_valueT>::ready() const
+{
+  boost::mutex::scoped_lock l(m_state->m_mutex);
+  return m_state->done();
+}
+
+
+
+template <
+  typename return_valueT
+>
+void
+future<return_valueT>::wait() const
+{
+  ensure_started();
+
+  boost::mutex::scoped_lock l(m_state->m_mutex);
+  while (!m_state->done()) {
+    m_state->m_finish.wait(l);
+  }
+}
+
+
+
+template <
+  typename return_valueT
+>
+bool
+future<return_valueT>::timed_wait(boost::uint32_t usecs) const
+{
+  ensure_started();
+
+  // Prepare xtime to wait until
+  boost::xtime t;
+  boost::xtime_get(&t, boost::TIME_UTC);
+  t.sec += usecs / 1000000;
+  t.nsec += (usecs % 1000000) * 1000;
+  if (t.nsec >= 1000000000) {
+    ++t.sec;
+    t.nsec -= 1000000000;
+  }
+
+  boost::mutex::scoped_lock l(m_state->m_mutex);
+  while (!m_state->done()) {
+    if (!m_state->m_finish.timed_wait(l, t)) {
+      break;
     }
+  }
+  return m_state->done();
+}
+
+
+
+template <
+  typename return_valueT
+>
+template <
+  typename funcT
+>
+typename future<return_valueT>::state *
+future<return_valueT>::make_continuation(funcT const & func, executor & exec)
+{
+  state * s = make_state(func, exec);
+  s->m_started = true;
+  return s;
+}
+
+
 
-    // Wait for the thread to finish.
-    while (!(m_impl->m_value || m_impl->m_exception_message)) {
-      m_impl->m_finish.wait(l);
+template <
+  typename return_valueT
+>
+template <
+  typename resultT
+>
+future<resultT>
+future<return_valueT>::then(
+    boost::function<resultT (future const &)> const & func) const
+{
+  return then_impl<resultT>(func, default_executor(), false);
+}
+
+
+
+template <
+  typename return_valueT
+>
+template <
+  typename resultT
+>
+future<resultT>
+future<return_valueT>::then(
+    boost::function<resultT (future const &)> const & func,
+    executor & exec) const
+{
+  return then_impl<resultT>(func, exec, true);
+}
+
+
+
+template <
+  typename return_valueT
+>
+template <
+  typename resultT
+>
+future<resultT>
+future<return_valueT>::then_impl(
+    boost::function<resultT (future const &)> const & func, executor & exec,
+    bool use_executor) const
+{
+  typedef typename future<resultT>::state continuation_state;
+
+  // The continuation's function holds on to a copy of this future, which is
+  // passed to func.
+  future<resultT> result(future<resultT>::make_continuation(
+        boost::bind(func, *this), exec));
+
+  m_state->add_continuation(boost::bind(&continuation_state::dispatch,
+        result.m_state, use_executor));
+  ensure_started();
+
+  return result;
+}
+
+
+
+/*****************************************************************************
+ * when_all, when_any
+ **/
+namespace futures {
+namespace detail {
+
+template <
+  typename return_valueT
+>
+struct compose
+{
+  typedef future<return_valueT>                 future_t;
+  typedef std::vector<future_t>                 futures_t;
+
+  typedef future<std::vector<return_valueT> >   all_future_t;
+  typedef typename all_future_t::state          all_state_t;
+
+  typedef future<fhtagn::size_t>                any_future_t;
+  typedef typename any_future_t::state          any_state_t;
+
+  // Number of futures when_all() still waits for.
+  struct all_state
+  {
+    fhtagn::size_t volatile m_remaining;
+  };
+
+  // Set by the first future to finish for when_any().
+  struct any_state
+  {
+    int volatile    m_fired;
+    fhtagn::size_t  m_index;
+  };
+
+
+  static std::vector<return_valueT> collect(futures_t const & inputs)
+  {
+    std::vector<return_valueT> result;
+    result.reserve(inputs.size());
+    for (typename futures_t::const_iterator iter = inputs.begin()
+        ; iter != inputs.end() ; ++iter)
+    {
+      result.push_back(iter->get());
     }
+    return result;
   }
 
-  // May need to throw an exception.
-  if (m_impl->m_exception_message) {
-    throw futures::exception(*m_impl->m_exception_message);
+
+  static void all_fired(fhtagn::shared_ptr<all_state> state,
+      all_state_t * result, bool use_executor)
+  {
+    if (!atomic_add(state->m_remaining, fhtagn::size_t(-1))) {
+      all_state_t::dispatch(result, use_executor);
+    }
   }
 
-  // Return value!
-  return *m_impl->m_value;
+
+  static all_future_t when_all(futures_t const & inputs, executor & exec,
+      bool use_executor)
+  {
+    all_future_t result(all_future_t::make_continuation(
+          boost::bind(&compose::collect, inputs), exec));
+
+    if (inputs.empty()) {
+      all_state_t::dispatch(result.m_state, use_executor);
+      return result;
+    }
+
+    fhtagn::shared_ptr<all_state> state(new all_state());
+    state->m_remaining = inputs.size();
+
+    for (typename futures_t::const_iterator iter = inputs.begin()
+        ; iter != inputs.end() ; ++iter)
+    {
+      iter->m_state->add_continuation(boost::bind(&compose::all_fired, state,
+            result.m_state, use_executor));
+      iter->ensure_started();
+    }
+
+    return result;
+  }
+
+
+  static fhtagn::size_t index(fhtagn::shared_ptr<any_state> state)
+  {
+    return state->m_index;
+  }
+
+
+  // Only the first call dispatches result; it may be gone by the time later
+  // calls are made.
+  static void any_fired(fhtagn::shared_ptr<any_state> state,
+      fhtagn::size_t index, any_state_t * result, bool use_executor)
+  {
+    if (compare_and_swap(state->m_fired, 0, 1)) {
+      state->m_index = index;
+      any_state_t::dispatch(result, use_executor);
+    }
+  }
+
+
+  static any_future_t when_any(futures_t const & inputs, executor & exec,
+      bool use_executor)
+  {
+    if (inputs.empty()) {
+      throw std::logic_error("when_any() needs at least one future.");
+    }
+
+    fhtagn::shared_ptr<any_state> state(new any_state());
+    state->m_fired = 0;
+    state->m_index = 0;
+
+    any_future_t result(any_future_t::make_continuation(
+          boost::bind(&compose::index, state), exec));
+
+    for (fhtagn::size_t i = 0 ; i < inputs.size() ; ++i) {
+      inputs[i].m_state->add_continuation(boost::bind(&compose::any_fired,
+            state, i, result.m_state, use_executor));
+      inputs[i].ensure_started();
+    }
+
+    return result;
+  }
+};
+
+} // namespace detail
+} // namespace futures
+
+
+
+template <
+  typename return_valueT
+>
+future<std::vector<return_valueT> >
+when_all(std::vector<future<return_valueT> > const & inputs)
+{
+  return futures::detail::compose<return_valueT>::when_all(inputs,
+      default_executor(), false);
+}
+
+
+
+template <
+  typename return_valueT
+>
+future<std::vector<return_valueT> >
+when_all(std::vector<future<return_valueT> > const & inputs, executor & exec)
+{
+  return futures::detail::compose<return_valueT>::when_all(inputs, exec,
+      true);
+}
+
+
+
+template <
+  typename return_valueT
+>
+future<fhtagn::size_t>
+when_any(std::vector<future<return_valueT> > const & inputs)
+{
+  return futures::detail::compose<return_valueT>::when_any(inputs,
+      default_executor(), false);
+}
+
+
+
+template <
+  typename return_valueT
+>
+future<fhtagn::size_t>
+when_any(std::vector<future<return_valueT> > const & inputs, executor & exec)
+{
+  return futures::detail::compose<return_valueT>::when_any(inputs, exec,
+      true);
 }
 
 
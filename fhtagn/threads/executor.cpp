@@ -0,0 +1,258 @@
+/**
+ * $Id$
+ *
+ * This file is part of the Fhtagn! C++ Library.
+ * Copyright (C) 2009,2010,2011 Jens Finkhaeuser <unwesen@users.sourceforge.net>.
+ *
+ * Author: Jens Finkhaeuser <unwesen@users.sourceforge.net>
+ *
+ * This program is licensed as free software for personal, educational or
+ * other non-commerical uses: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation, either version 3 of the License, or (at your
+ * option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Alternatively, licenses for commercial purposes are available as well.
+ * Please send your enquiries to the copyright holder's address above.
+ **/
+#include <boost/bind.hpp>
+
+#include <fhtagn/threads/executor.h>
+
+
+namespace fhtagn {
+namespace threads {
+
+
+executor::~executor()
+{
+}
+
+
+
+thread_per_task_executor::thread_per_task_executor()
+    : m_running(0)
+{
+}
+
+
+thread_per_task_executor::~thread_per_task_executor()
+{
+    boost::mutex::scoped_lock lock(m_mutex);
+    while (m_running) {
+        m_finished.wait(lock);
+    }
+}
+
+
+bool
+thread_per_task_executor::submit(task_type const & task)
+{
+    {
+        boost::mutex::scoped_lock lock(m_mutex);
+        ++m_running;
+    }
+
+    try {
+        // The thread object is destroyed right away, which detaches the
+        // thread; thread_runner() takes care of the bookkeeping.
+        boost::thread t(boost::bind(&thread_per_task_executor::thread_runner,
+                    this, task));
+    } catch (...) {
+        boost::mutex::scoped_lock lock(m_mutex);
+        --m_running;
+        m_finished.notify_all();
+        throw;
+    }
+    return true;
+}
+
+
+bool
+thread_per_task_executor::try_submit(task_type const & task)
+{
+    return submit(task);
+}
+
+
+fhtagn::size_t
+thread_per_task_executor::running() const
+{
+    boost::mutex::scoped_lock lock(m_mutex);
+    return m_running;
+}
+
+
+void
+thread_per_task_executor::thread_runner(task_type task)
+{
+    try {
+        task();
+    } catch (...) {
+        // silently ignore
+    }
+
+    // Destroy the task's bound state before the executor may go away.
+    task = task_type();
+
+    boost::mutex::scoped_lock lock(m_mutex);
+    --m_running;
+    m_finished.notify_all();
+}
+
+
+
+thread_pool_executor::thread_pool_executor(fhtagn::size_t threads,
+        fhtagn::size_t capacity)
+    : m_threads(threads)
+    , m_capacity(capacity)
+    , m_stopping(false)
+    , m_joined(false)
+{
+    if (!threads || !capacity) {
+        throw std::logic_error("thread_pool_executor needs at least one "
+                "thread and a queue capacity of at least one.");
+    }
+
+    try {
+        for (fhtagn::size_t i = 0 ; i < m_threads ; ++i) {
+            m_workers.create_thread(boost::bind(&thread_pool_executor::worker,
+                        this));
+        }
+    } catch (...) {
+        shutdown();
+        throw;
+    }
+}
+
+
+thread_pool_executor::~thread_pool_executor()
+{
+    shutdown();
+}
+
+
+void
+thread_pool_executor::enqueue(task_type const & task)
+{
+    m_queue.push_back(task);
+    m_not_empty.notify_one();
+}
+
+
+bool
+thread_pool_executor::submit(task_type const & task)
+{
+    boost::mutex::scoped_lock lock(m_mutex);
+    while (!m_stopping && m_queue.size() >= m_capacity) {
+        m_not_full.wait(lock);
+    }
+    if (m_stopping) {
+        return false;
+    }
+    enqueue(task);
+    return true;
+}
+
+
+bool
+thread_pool_executor::try_submit(task_type const & task)
+{
+    boost::mutex::scoped_lock lock(m_mutex);
+    if (m_stopping || m_queue.size() >= m_capacity) {
+        return false;
+    }
+    enqueue(task);
+    return true;
+}
+
+
+void
+thread_pool_executor::shutdown()
+{
+    {
+        boost::mutex::scoped_lock lock(m_mutex);
+        m_stopping = true;
+        m_not_empty.notify_all();
+        m_not_full.notify_all();
+
+        if (m_joined) {
+            return;
+        }
+        m_joined = true;
+    }
+
+    m_workers.join_all();
+}
+
+
+fhtagn::size_t
+thread_pool_executor::threads() const
+{
+    return m_threads;
+}
+
+
+fhtagn::size_t
+thread_pool_executor::capacity() const
+{
+    return m_capacity;
+}
+
+
+fhtagn::size_t
+thread_pool_executor::pending() const
+{
+    boost::mutex::scoped_lock lock(m_mutex);
+    return m_queue.size();
+}
+
+
+void
+thread_pool_executor::worker()
+{
+    while (true) {
+        task_type task;
+        {
+            boost::mutex::scoped_lock lock(m_mutex);
+            while (!m_stopping && m_queue.empty()) {
+                m_not_empty.wait(lock);
+            }
+            if (m_queue.empty()) {
+                // m_stopping is set, and there's nothing left to do.
+                return;
+            }
+            task.swap(m_queue.front());
+            m_queue.pop_front();
+            m_not_full.notify_one();
+        }
+
+        try {
+            task();
+        } catch (...) {
+            // silently ignore
+        }
+    }
+}
+
+
+
+executor &
+default_executor()
+{
+    // Never destroyed: objects with static storage duration may still start
+    // tasks on it during their own destruction.
+    static executor * exec = new thread_per_task_executor();
+    return *exec;
+}
+
+
+}} // namespace fhtagn::threads
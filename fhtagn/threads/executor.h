@@ -0,0 +1,219 @@
+/**
+ * $Id$
+ *
+ * This file is part of the Fhtagn! C++ Library.
+ * Copyright (C) 2009,2010,2011 Jens Finkhaeuser <unwesen@users.sourceforge.net>.
+ *
+ * Author: Jens Finkhaeuser <unwesen@users.sourceforge.net>
+ *
+ * This program is licensed as free software for personal, educational or
+ * other non-commerical uses: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation, either version 3 of the License, or (at your
+ * option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Alternatively, licenses for commercial purposes are available as well.
+ * Please send your enquiries to the copyright holder's address above.
+ **/
+#ifndef FHTAGN_THREADS_EXECUTOR_H
+#define FHTAGN_THREADS_EXECUTOR_H
+
+#ifndef __cplusplus
+#error You are trying to include a C++ only header file
+#endif
+
+#include <fhtagn/fhtagn.h>
+
+#include <deque>
+
+#include <boost/function.hpp>
+#include <boost/thread.hpp>
+#include <boost/thread/condition.hpp>
+#include <boost/noncopyable.hpp>
+
+namespace fhtagn {
+namespace threads {
+
+
+/**
+ * An executor runs tasks - nullary function objects - in some thread other
+ * than the submitting one. future and tasklet both hand their bound functions
+ * to an executor, so the choice of executor decides whether each of them gets
+ * a thread of its own, or shares a fixed set of worker threads with others.
+ *
+ * Tasks are expected not to throw; any exception that escapes a task is
+ * silently discarded by the executor implementations below.
+ **/
+class executor
+    : public boost::noncopyable
+{
+public:
+    // Utility typedefs
+    typedef boost::function<void ()> task_type;
+
+    /**
+     * Virtual dtor to allow for derivation.
+     **/
+    virtual ~executor();
+
+
+    /**
+     * Schedule the task for execution. If the executor cannot accept any
+     * more tasks right now, this function blocks until it can.
+     *
+     * @param task Function to execute.
+     * @return false if the executor is shutting down and did not accept the
+     *      task, else true.
+     **/
+    virtual bool submit(task_type const & task) = 0;
+
+    /**
+     * Like submit(), but returns false instead of blocking if the executor
+     * cannot accept any more tasks right now.
+     *
+     * @param task Function to execute.
+     * @return true if the task was accepted, else false.
+     **/
+    virtual bool try_submit(task_type const & task) = 0;
+};
+
+
+
+/**
+ * Executor that runs each task in a thread of its own, which is how futures
+ * and tasklets have always been run. It's the right choice for a handful of
+ * long-running tasks, but thread creation dominates for many small ones.
+ *
+ * Threads are not joined individually; instead, the executor's destructor
+ * waits for all tasks it started to finish.
+ **/
+class thread_per_task_executor
+    : public executor
+{
+public:
+    thread_per_task_executor();
+    ~thread_per_task_executor();
+
+    /**
+     * Starts a new thread for the task. Neither function ever blocks.
+     **/
+    bool submit(task_type const & task);
+    bool try_submit(task_type const & task);
+
+    /**
+     * @return the number of tasks currently running.
+     **/
+    fhtagn::size_t running() const;
+
+private:
+    // Runs the task and keeps track of m_running.
+    void thread_runner(task_type task);
+
+    // Number of tasks currently running.
+    fhtagn::size_t          m_running;
+    // Condition to signal a change in m_running.
+    boost::condition        m_finished;
+    // Mutex to serialize access to m_running.
+    mutable boost::mutex    m_mutex;
+};
+
+
+
+/**
+ * Executor with a fixed number of worker threads, that take tasks from a
+ * bounded FIFO queue. Once the queue has reached its capacity, submit() blocks
+ * until a worker has taken on a task, and try_submit() fails.
+ *
+ * Note #1: Tasks that wait for other tasks submitted to the same executor -
+ *          e.g. a future's bound function reading another future's value - can
+ *          deadlock if all workers end up waiting that way. The same goes for
+ *          long-running tasklets, each of which occupies a worker until it is
+ *          stopped.
+ *
+ * Note #2: The destructor stops accepting new tasks, but runs all tasks that
+ *          were queued before it is invoked.
+ **/
+class thread_pool_executor
+    : public executor
+{
+public:
+    /**
+     * @param threads Number of worker threads to start.
+     * @param capacity Maximum number of tasks waiting in the queue.
+     **/
+    thread_pool_executor(fhtagn::size_t threads, fhtagn::size_t capacity);
+    ~thread_pool_executor();
+
+    bool submit(task_type const & task);
+    bool try_submit(task_type const & task);
+
+    /**
+     * Stops accepting new tasks, and waits for the queued tasks to finish and
+     * the worker threads to exit. Called by the destructor; calling it more
+     * than once is safe, but calling it from within a task is not.
+     **/
+    void shutdown();
+
+    /**
+     * @return the number of worker threads.
+     **/
+    fhtagn::size_t threads() const;
+
+    /**
+     * @return the maximum number of queued tasks.
+     **/
+    fhtagn::size_t capacity() const;
+
+    /**
+     * @return the number of tasks waiting in the queue, i.e. not including the
+     *      ones being run.
+     **/
+    fhtagn::size_t pending() const;
+
+private:
+    // Main loop of each worker thread.
+    void worker();
+
+    // Enqueues the task; must be called with m_mutex held.
+    void enqueue(task_type const & task);
+
+    fhtagn::size_t const    m_threads;
+    fhtagn::size_t const    m_capacity;
+
+    // Queued tasks.
+    std::deque<task_type>   m_queue;
+    // Set by shutdown(); workers exit once it's set and m_queue is empty.
+    bool                    m_stopping;
+    // Set by the first shutdown() to join m_workers.
+    bool                    m_joined;
+
+    // Signalled when a task is added to m_queue, or m_stopping is set.
+    boost::condition        m_not_empty;
+    // Signalled when a task is taken from m_queue.
+    boost::condition        m_not_full;
+    // Mutex to serialize access to the queue and flags.
+    mutable boost::mutex    m_mutex;
+
+    boost::thread_group     m_workers;
+};
+
+
+
+/**
+ * @return the executor futures and tasklets use unless they're given a
+ *      different one, a thread_per_task_executor.
+ **/
+executor & default_executor();
+
+
+}} // namespace fhtagn::threads
+
+#endif // guard
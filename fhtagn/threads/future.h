@@ -32,19 +32,32 @@
 
 #include <fhtagn/fhtagn.h>
 
+#include <new>
 #include <string>
+#include <vector>
 #include <exception>
 
-#include <boost/signal.hpp>
+#include <boost/aligned_storage.hpp>
+#include <boost/bind.hpp>
+#include <boost/function.hpp>
 #include <boost/thread.hpp>
 #include <boost/thread/condition.hpp>
+#include <boost/type_traits/alignment_of.hpp>
 
-#include <fhtagn/shared_ptr.h>
 #include <fhtagn/property.h>
+#include <fhtagn/shared_ptr.h>
+
+#include <fhtagn/threads/executor.h>
+#include <fhtagn/threads/atomic.h>
 
 namespace fhtagn {
 namespace threads {
 
+template <
+  typename return_valueT
+>
+class future;
+
 namespace futures {
 
 /**
@@ -61,6 +74,22 @@ struct exception
   explicit inline exception(std::string const & msg);
 };
 
+namespace detail {
+
+// Implements when_all() and when_any() below.
+template <
+  typename return_valueT
+>
+struct compose;
+
+// Returns memory for a future's shared state to the pool it came from.
+template <
+  typename poolT
+>
+inline void release_to_pool(void * pool, void * ptr);
+
+} // namespace detail
+
 } // namespace futures
 
 
@@ -73,13 +102,29 @@ struct exception
  * for lazy_evaluation can be provided, which launches the thread only when the
  * future's value is about to be read.
  *
+ * By default, each future gets a thread of its own. Pass an executor to the
+ * constructor to run the function on e.g. a thread_pool_executor instead; the
+ * executor must outlive the future. If the executor rejects the function
+ * because it's shutting down, reading the value throws futures::exception.
+ *
+ * All copies of a future share one state, which holds the function object and
+ * the value inline. That state is the only memory a future allocates (other
+ * than what the executor needs to run it); by default it comes from the heap,
+ * but you can pass a MemoryPool (see fhtagn/memory/memory_pool.h) to the
+ * constructor to allocate it from instead. The pool must outlive the future,
+ * and be thread-safe if the future's copies are destroyed in different
+ * threads. Its blocks must be aligned at least as strictly as the value
+ * type. state_size gives the number of Bytes allocated per future, e.g. for
+ * choosing the block size of a block_pool.
+ *
  * Other than that, the future object acts as a read-only version of the
  * wrapped value type, i.e. all attempts to modify it's value will result in
  * compile-time failures.
  *
  * Reading the value will block until the thread used to calculate it finishes.
  * Once the thread is finished, the future's value can be read without further
- * delays.
+ * delays. To avoid blocking, check ready() or use timed_wait(), or chain a
+ * continuation via then(), when_all() or when_any().
  *
  * Note #1: futures are not designed to be thread-safe. That is, some thought
  *          into making them thread-safe had to be invested purely by virtue of
@@ -104,56 +149,338 @@ private:
     fhtagn::read_only_property
   > property_t;
 
+  struct state;
+
+  template <
+    typename funcT
+  >
+  struct bound_state;
+
 public:
   // Utility typedefs
-  typedef boost::signal<return_valueT ()> func_type;
+  typedef return_valueT value_type;
+  typedef boost::function<return_valueT ()> func_type;
+
+
+  /**
+   * Number of Bytes allocated for a future bound to a function object of type
+   * funcT.
+   **/
+  template <
+    typename funcT
+  >
+  struct state_size
+  {
+    enum { value = sizeof(bound_state<funcT>) };
+  };
 
 
   /**
    * Constructor. Either construct with just a function, or with an additional
-   * tag to signify lazy evaluation.
+   * tag to signify lazy evaluation. Either version optionally accepts the
+   * executor to run the function on; the default_executor() is used
+   * otherwise, and a MemoryPool to allocate the future's state from.
+   *
+   * The function can be any function object that can be called without
+   * arguments, and returns something convertible to return_valueT.
    **/
-  inline future(typename func_type::slot_type slot);
-  inline future(typename func_type::slot_type slot, futures::lazy_evaluate const &);
+  template <
+    typename funcT
+  >
+  inline future(funcT func);
+
+  template <
+    typename funcT
+  >
+  inline future(funcT func, executor & exec);
+
+  template <
+    typename funcT,
+    typename poolT
+  >
+  inline future(funcT func, executor & exec, poolT & pool);
+
+  template <
+    typename funcT
+  >
+  inline future(funcT func, futures::lazy_evaluate const &);
+
+  template <
+    typename funcT
+  >
+  inline future(funcT func, futures::lazy_evaluate const &,
+      executor & exec);
+
+  template <
+    typename funcT,
+    typename poolT
+  >
+  inline future(funcT func, futures::lazy_evaluate const &,
+      executor & exec, poolT & pool);
+
+  /**
+   * Copies share the other future's value. The property base needs to refer
+   * to the copy, not the original, so this can't be left to the compiler.
+   **/
+  inline future(future const & other);
+
+  /**
+   * Makes this future share the other future's value.
+   **/
+  inline future & operator=(future const & other);
+
+  /**
+   * Destroying the last copy of a future that's been started waits for its
+   * function to finish.
+   **/
+  inline ~future();
+
+
+  /**
+   * @return true if the value (or an exception) is available, i.e. reading the
+   *      value won't block. Does not start a lazily evaluated future.
+   **/
+  inline bool ready() const;
+
+  /**
+   * Blocks until the value (or an exception) is available, starting lazily
+   * evaluated futures.
+   **/
+  inline void wait() const;
+
+  /**
+   * Like wait(), but waits for at most the specified number of microseconds.
+   *
+   * @param usecs Maximum number of microseconds to wait.
+   * @return true if the value (or an exception) is available, else false.
+   **/
+  inline bool timed_wait(boost::uint32_t usecs) const;
+
+
+  /**
+   * Chains a continuation to this future, and starts it if it's lazily
+   * evaluated. Once this future's value (or exception) is available, the
+   * continuation is invoked with this future as its parameter, and its result
+   * becomes the value of the returned future:
+   *
+   *      int twice(future<int> const & f) { return 2 * f; }
+   *
+   *      future<int> f1(&compute);
+   *      future<int> f2 = f1.then<int>(&twice);
+   *
+   * Without an executor, the continuation runs in the thread that completes
+   * this future, or in the calling thread if this future is ready() already.
+   * With an executor, it's submitted to the executor instead, which must
+   * outlive the returned future.
+   *
+   * @param func Continuation to invoke.
+   * @param exec [optional] Executor to run the continuation on.
+   * @return a future for the continuation's result.
+   **/
+  template <
+    typename resultT
+  >
+  inline future<resultT> then(
+      boost::function<resultT (future const &)> const & func) const;
+
+  template <
+    typename resultT
+  >
+  inline future<resultT> then(
+      boost::function<resultT (future const &)> const & func,
+      executor & exec) const;
 
 private:
+  template <
+    typename otherT
+  >
+  friend class future;
+  template <
+    typename otherT
+  >
+  friend struct futures::detail::compose;
+
   // Getter - see fhtagn/property.h for details
   inline return_valueT get() const;
 
-  struct future_impl
+  // Starts the bound function if it's lazily evaluated and not started yet.
+  inline void ensure_started() const;
+
+  /**
+   * State shared between all copies of a future. bound_state below adds the
+   * function object.
+   **/
+  struct state
   {
-    inline future_impl();
-    inline ~future_impl();
+    typedef boost::function<void ()>  continuation_type;
+    typedef void (*release_func)(void * pool, void * ptr);
+
+    inline state(executor & exec, void * pool, release_func release);
+    virtual inline ~state();
 
-    // Spawns the calculating thread.
-    inline void start_thread();
+    // Calls the bound function, and constructs the value in m_storage.
+    virtual void invoke() = 0;
 
-    // Helper function to call the bound function and set m_value or exception
-    // text.
+    // Adds a reference; release() removes one. Once there are none left, it
+    // waits for a started function to finish, then destroys the state and
+    // returns its memory to where it came from.
+    inline void add_ref();
+    static inline void release(state * s);
+
+    // Submits thread_runner() to the state's executor; m_started must already
+    // be set, and m_mutex must not be held.
+    inline void start();
+
+    // Runs thread_runner() either right away, or via start().
+    static inline void dispatch(state * s, bool use_executor);
+
+    // Helper function to call the bound function and set the value or
+    // exception text, then invoke the continuations.
     inline void thread_runner();
 
-    // Bound function
-    func_type         m_func;
-    // Internal thread in which the bound function is executed.
-    boost::thread *   m_thread;
-    // Condition to signal a change in the m_stopped flag.
+    // Either stores the continuation for thread_runner() to invoke, or invokes
+    // it right away if the value is available already.
+    inline void add_continuation(continuation_type const & continuation);
+
+    // Sets the flags and exception message, and returns the continuations
+    // to invoke.
+    inline void finish(bool has_value, std::string & exception_message,
+        std::vector<continuation_type> & continuations);
+
+    // Must be called with m_mutex held.
+    inline bool done() const;
+    inline return_valueT * value();
+
+    // Number of future copies referring to this state.
+    fhtagn::size_t volatile m_refcount;
+
+    // Executor on which the bound function is run.
+    executor &        m_executor;
+    // Set once the bound function has been submitted to m_executor, or once
+    // a continuation is waiting to be dispatched.
+    bool              m_started;
+    // Condition to signal that the value or exception became available.
     boost::condition  m_finish;
     // Mutex used with the condition variable above
     boost::mutex      m_mutex;
 
-    // Result of the bound function. Pointer, so we can avoid default-
-    // construction and (possible) save expensive setup.
-    return_valueT *   m_value;
-    // Optional exception message.
-    std::string *     m_exception_message;
+    // Set once the value has been constructed in m_storage.
+    bool              m_has_value;
+    // Set if the bound function threw, along with the exception message.
+    bool              m_has_exception;
+    std::string       m_exception_message;
+
+    // Functions to invoke once the value or exception are set.
+    std::vector<continuation_type>  m_continuations;
+
+    // Pool the state was allocated from, and the function to return it to
+    // the pool. Both are NULL for states allocated on the heap.
+    void *            m_pool;
+    release_func      m_release;
+
+    // Storage for the value.
+    typedef boost::aligned_storage<
+      sizeof(return_valueT),
+      boost::alignment_of<return_valueT>::value
+    > storage;
+    storage           m_storage;
   };
 
+  template <
+    typename funcT
+  >
+  struct bound_state
+    : public state
+  {
+    inline bound_state(funcT const & func, executor & exec, void * pool,
+        typename state::release_func release);
+
+    inline void invoke();
+
+    funcT             m_func;
+  };
+
+  // Allocates a state bound to func, either from the heap or from the pool.
+  template <
+    typename funcT
+  >
+  static inline state * make_state(funcT const & func, executor & exec);
+
+  template <
+    typename funcT,
+    typename poolT
+  >
+  static inline state * make_state(funcT const & func, executor & exec,
+      poolT & pool);
+
+  // Creates the state for a continuation future: bound to func, and marked as
+  // started so reading it never starts it, and destroying it waits for it
+  // to be dispatched and finish.
+  template <
+    typename funcT
+  >
+  static inline state * make_continuation(funcT const & func, executor & exec);
+
+  // Constructs a future that takes over the reference to the given state.
+  inline explicit future(state * s);
+
+  template <
+    typename resultT
+  >
+  inline future<resultT> then_impl(
+      boost::function<resultT (future const &)> const & func, executor & exec,
+      bool use_executor) const;
+
   // By pimpl-ing the future, future objects become copyable - they've
-  // got read-only semantics, so sharing an impl doesn't hurt.
-  fhtagn::shared_ptr<future_impl> m_impl;
+  // got read-only semantics, so sharing a state doesn't hurt.
+  state * m_state;
 };
 
 
+
+/**
+ * Returns a future that becomes ready once all of the given futures are; its
+ * value is the vector of their values, in the same order. If any of the
+ * futures fails, reading the returned future throws futures::exception. Lazily
+ * evaluated futures are started.
+ *
+ * As with future::then(), the values are collected in the thread completing
+ * the last of the futures, or on the given executor.
+ **/
+template <
+  typename return_valueT
+>
+inline future<std::vector<return_valueT> >
+when_all(std::vector<future<return_valueT> > const & futures);
+
+template <
+  typename return_valueT
+>
+inline future<std::vector<return_valueT> >
+when_all(std::vector<future<return_valueT> > const & futures, executor & exec);
+
+
+/**
+ * Returns a future that becomes ready once any of the given futures is; its
+ * value is the index of that future. The futures must not be empty. Lazily
+ * evaluated futures are started.
+ *
+ * As with future::then(), the returned future's value is set in the thread
+ * completing the first of the futures, or on the given executor.
+ **/
+template <
+  typename return_valueT
+>
+inline future<fhtagn::size_t>
+when_any(std::vector<future<return_valueT> > const & futures);
+
+template <
+  typename return_valueT
+>
+inline future<fhtagn::size_t>
+when_any(std::vector<future<return_valueT> > const & futures, executor & exec);
+
+
 }} // namespace fhtagn::threads
 
 #include <fhtagn/threads/detail/future.tcc>
@@ -0,0 +1,462 @@
+/**
+ * $Id$
+ *
+ * This file is part of the Fhtagn! C++ Library.
+ * Copyright (C) 2009,2010,2011 Jens Finkhaeuser <unwesen@users.sourceforge.net>.
+ *
+ * Author: Jens Finkhaeuser <unwesen@users.sourceforge.net>
+ *
+ * This program is licensed as free software for personal, educational or
+ * other non-commerical uses: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation, either version 3 of the License, or (at your
+ * option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Alternatively, licenses for commercial purposes are available as well.
+ * Please send your enquiries to the copyright holder's address above.
+ **/
+#include <boost/bind.hpp>
+#include <boost/thread/xtime.hpp>
+
+#include <fhtagn/threads/scheduler.h>
+#include <fhtagn/threads/atomic.h>
+
+
+#define IS_ALIVE \
+    (tasklet::RUNNING == m_state || tasklet::SLEEPING == m_state \
+     || tasklet::STOPPED == m_state)
+
+#define IS_DONE \
+    (tasklet::FINISHED == m_state || tasklet::ABORTED == m_state)
+
+
+namespace fhtagn {
+namespace threads {
+
+namespace {
+
+// Workers are owned by their scheduler, not by the thread specific pointer.
+template <typename T>
+void no_cleanup(T *)
+{
+}
+
+
+// Calculates the absolute time usecs microseconds from now.
+boost::xtime deadline(boost::uint32_t usecs)
+{
+    boost::xtime t;
+    boost::xtime_get(&t, boost::TIME_UTC);
+    t.sec += usecs / 1000000;
+    t.nsec += (usecs % 1000000) * 1000;
+    if (t.nsec >= 1000000000) {
+        ++t.sec;
+        t.nsec -= 1000000000;
+    }
+    return t;
+}
+
+} // anonymous namespace
+
+
+/*****************************************************************************
+ * scheduler::job
+ **/
+scheduler::job::job(scheduler & sched, func_type const & func)
+    : m_scheduler(sched)
+    , m_func(func)
+    , m_state(tasklet::STANDING_BY)
+{
+}
+
+
+scheduler::state
+scheduler::job::get_state() const
+{
+    boost::mutex::scoped_lock lock(m_mutex);
+    return m_state;
+}
+
+
+bool
+scheduler::job::alive() const
+{
+    boost::mutex::scoped_lock lock(m_mutex);
+    return IS_ALIVE;
+}
+
+
+bool
+scheduler::job::done() const
+{
+    boost::mutex::scoped_lock lock(m_mutex);
+    return IS_DONE;
+}
+
+
+bool
+scheduler::job::stop()
+{
+    boost::mutex::scoped_lock lock(m_mutex);
+    if (IS_DONE) {
+        return false;
+    }
+    m_state = tasklet::STOPPED;
+    m_state_change.notify_all();
+    return true;
+}
+
+
+bool
+scheduler::job::wakeup()
+{
+    boost::mutex::scoped_lock lock(m_mutex);
+    if (IS_DONE) {
+        return false;
+    }
+    if (tasklet::SLEEPING == m_state) {
+        m_state = tasklet::RUNNING;
+        m_state_change.notify_all();
+    }
+    return true;
+}
+
+
+scheduler::state
+scheduler::job::sleep(boost::uint32_t usecs /* = 0 */)
+{
+    boost::xtime t;
+    if (usecs) {
+        t = deadline(usecs);
+    }
+
+    boost::mutex::scoped_lock lock(m_mutex);
+    if (tasklet::RUNNING == m_state) {
+        m_state = tasklet::SLEEPING;
+
+        // Sleep until woken, stopped, or the time runs out.
+        while (tasklet::SLEEPING == m_state) {
+            if (usecs) {
+                if (!m_state_change.timed_wait(lock, t)) {
+                    break;
+                }
+            } else {
+                m_state_change.wait(lock);
+            }
+        }
+
+        // If the state's still SLEEPING, the time ran out.
+        if (tasklet::SLEEPING == m_state) {
+            m_state = tasklet::RUNNING;
+        }
+    }
+    return m_state;
+}
+
+
+std::string
+scheduler::job::error() const
+{
+    boost::mutex::scoped_lock lock(m_mutex);
+    return m_error;
+}
+
+
+scheduler &
+scheduler::job::get_scheduler() const
+{
+    return m_scheduler;
+}
+
+
+void
+scheduler::job::run()
+{
+    {
+        boost::mutex::scoped_lock lock(m_mutex);
+        // A job stopped before it ran keeps its STOPPED state.
+        if (tasklet::STANDING_BY == m_state) {
+            m_state = tasklet::RUNNING;
+        }
+    }
+
+    std::string error;
+    bool aborted = false;
+    try {
+        m_func(*this);
+    } catch (std::exception const & ex) {
+        aborted = true;
+        error = ex.what();
+    } catch (...) {
+        aborted = true;
+        error = "Unspecified exception occurred in job's function.";
+    }
+
+    // The function isn't needed any longer, and may hold on to resources.
+    m_func = func_type();
+
+    boost::mutex::scoped_lock lock(m_mutex);
+    if (aborted) {
+        m_state = tasklet::ABORTED;
+        m_error.swap(error);
+    } else {
+        m_state = tasklet::FINISHED;
+    }
+    m_state_change.notify_all();
+}
+
+
+bool
+scheduler::job::wait(boost::uint32_t usecs)
+{
+    boost::xtime t;
+    if (usecs) {
+        t = deadline(usecs);
+    }
+
+    boost::mutex::scoped_lock lock(m_mutex);
+    while (!IS_DONE) {
+        if (usecs) {
+            if (!m_state_change.timed_wait(lock, t)) {
+                break;
+            }
+        } else {
+            m_state_change.wait(lock);
+        }
+    }
+    return IS_DONE;
+}
+
+
+
+/*****************************************************************************
+ * scheduler::worker
+ **/
+scheduler::worker::worker(scheduler & sched, fhtagn::size_t index)
+    : m_scheduler(sched)
+    , m_index(index)
+    , m_victim(index + 1)
+{
+}
+
+
+
+/*****************************************************************************
+ * scheduler
+ **/
+scheduler::scheduler(fhtagn::size_t threads /* = 0 */)
+    : m_pending(0)
+    , m_idle(0)
+    , m_next(0)
+    , m_stopping(0)
+{
+    if (!threads) {
+        threads = boost::thread::hardware_concurrency();
+        if (!threads) {
+            threads = 1;
+        }
+    }
+
+    // Make sure the thread specific pointer exists before any worker runs.
+    current_worker_ptr();
+
+    for (fhtagn::size_t i = 0 ; i < threads ; ++i) {
+        m_workers.push_back(new worker(*this, i));
+    }
+
+    try {
+        for (fhtagn::size_t i = 0 ; i < threads ; ++i) {
+            m_threads.create_thread(boost::bind(&scheduler::worker_loop, this,
+                        m_workers[i]));
+        }
+    } catch (...) {
+        shutdown();
+        throw;
+    }
+}
+
+
+scheduler::~scheduler()
+{
+    shutdown();
+}
+
+
+void
+scheduler::shutdown()
+{
+    {
+        boost::mutex::scoped_lock lock(m_idle_mutex);
+        atomic_store(m_stopping, 1);
+        m_idle_change.notify_all();
+    }
+
+    m_threads.join_all();
+
+    for (fhtagn::size_t i = 0 ; i < m_workers.size() ; ++i) {
+        delete m_workers[i];
+    }
+    m_workers.clear();
+}
+
+
+scheduler::job_ptr
+scheduler::spawn(func_type const & func)
+{
+    job_ptr j(new job(*this, func));
+
+    worker * w = current_worker();
+    if (!w) {
+        fhtagn::size_t next = atomic_add(m_next, fhtagn::size_t(1));
+        w = m_workers[next % m_workers.size()];
+    }
+    push(w, j);
+
+    return j;
+}
+
+
+scheduler::state
+scheduler::join(job_ptr const & j)
+{
+    worker * w = current_worker();
+    if (!w) {
+        j->wait(0);
+        return j->get_state();
+    }
+
+    while (!j->done()) {
+        job_ptr other = find_job(w);
+        if (other) {
+            other->run();
+        } else {
+            // The job we're waiting for is running elsewhere. Check back
+            // every so often for stealable work, in case it spawns more.
+            j->wait(1000);
+        }
+    }
+    return j->get_state();
+}
+
+
+fhtagn::size_t
+scheduler::threads() const
+{
+    return m_workers.size();
+}
+
+
+void
+scheduler::worker_loop(worker * w)
+{
+    current_worker_ptr().reset(w);
+
+    while (true) {
+        job_ptr j = find_job(w);
+        if (j) {
+            j->run();
+            continue;
+        }
+
+        // There's nothing to do. Announce that we're idle before checking
+        // m_pending, so that push() either sees us idle, or we see its job.
+        boost::mutex::scoped_lock lock(m_idle_mutex);
+        atomic_add(m_idle, fhtagn::size_t(1));
+        while (!atomic_load(m_pending) && !atomic_load(m_stopping)) {
+            m_idle_change.wait(lock);
+        }
+        atomic_add(m_idle, fhtagn::size_t(-1));
+
+        if (atomic_load(m_stopping) && !atomic_load(m_pending)) {
+            break;
+        }
+    }
+
+    current_worker_ptr().release();
+}
+
+
+void
+scheduler::push(worker * w, job_ptr const & j)
+{
+    {
+        boost::mutex::scoped_lock lock(w->m_mutex);
+        w->m_jobs.push_back(j);
+    }
+    atomic_add(m_pending, fhtagn::size_t(1));
+
+    if (atomic_load(m_idle)) {
+        boost::mutex::scoped_lock lock(m_idle_mutex);
+        m_idle_change.notify_one();
+    }
+}
+
+
+scheduler::job_ptr
+scheduler::find_job(worker * w)
+{
+    job_ptr j;
+
+    // Newest job from our own deque first; it's most likely to still be in
+    // our cache.
+    {
+        boost::mutex::scoped_lock lock(w->m_mutex);
+        if (!w->m_jobs.empty()) {
+            j.swap(w->m_jobs.back());
+            w->m_jobs.pop_back();
+        }
+    }
+
+    // Then the oldest job from another worker's deque; it's likely to spawn
+    // more jobs than any other.
+    fhtagn::size_t const count = m_workers.size();
+    for (fhtagn::size_t i = 0 ; !j && i < count ; ++i) {
+        worker * victim = m_workers[(w->m_victim + i) % count];
+        if (victim == w) {
+            continue;
+        }
+
+        boost::mutex::scoped_lock lock(victim->m_mutex);
+        if (!victim->m_jobs.empty()) {
+            j.swap(victim->m_jobs.front());
+            victim->m_jobs.pop_front();
+            // Try the same victim first next time.
+            w->m_victim = victim->m_index;
+        }
+    }
+
+    if (j) {
+        atomic_add(m_pending, fhtagn::size_t(-1));
+    }
+    return j;
+}
+
+
+scheduler::worker *
+scheduler::current_worker() const
+{
+    worker * w = current_worker_ptr().get();
+    if (w && &w->m_scheduler == this) {
+        return w;
+    }
+    return NULL;
+}
+
+
+boost::thread_specific_ptr<scheduler::worker> &
+scheduler::current_worker_ptr()
+{
+    static boost::thread_specific_ptr<worker> ptr(&no_cleanup<worker>);
+    return ptr;
+}
+
+
+}} // namespace fhtagn::threads
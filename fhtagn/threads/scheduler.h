@@ -0,0 +1,285 @@
+/**
+ * $Id$
+ *
+ * This file is part of the Fhtagn! C++ Library.
+ * Copyright (C) 2009,2010,2011 Jens Finkhaeuser <unwesen@users.sourceforge.net>.
+ *
+ * Author: Jens Finkhaeuser <unwesen@users.sourceforge.net>
+ *
+ * This program is licensed as free software for personal, educational or
+ * other non-commerical uses: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation, either version 3 of the License, or (at your
+ * option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Alternatively, licenses for commercial purposes are available as well.
+ * Please send your enquiries to the copyright holder's address above.
+ **/
+#ifndef FHTAGN_THREADS_SCHEDULER_H
+#define FHTAGN_THREADS_SCHEDULER_H
+
+#ifndef __cplusplus
+#error You are trying to include a C++ only header file
+#endif
+
+#include <fhtagn/fhtagn.h>
+
+#include <deque>
+#include <string>
+#include <vector>
+
+#include <boost/function.hpp>
+#include <boost/thread.hpp>
+#include <boost/thread/condition.hpp>
+#include <boost/thread/tss.hpp>
+#include <boost/noncopyable.hpp>
+
+#include <fhtagn/shared_ptr.h>
+#include <fhtagn/threads/tasklet.h>
+
+namespace fhtagn {
+namespace threads {
+
+
+/**
+ * The scheduler class runs many short-lived jobs on a fixed set of worker
+ * threads, using work stealing: each worker keeps its own deque of jobs, runs
+ * the most recently spawned one first, and when it runs out of jobs, steals
+ * the oldest job from another worker's deque. That keeps recursive workloads -
+ * jobs that spawn children and join them - mostly on one worker, while still
+ * spreading them across all workers when there's enough work.
+ *
+ * Jobs are closures spawned via spawn(), which returns a handle that can be
+ * passed to join():
+ *
+ *      void child(scheduler::job & j) { ... }
+ *
+ *      void parent(scheduler::job & j)
+ *      {
+ *          scheduler::job_ptr c1 = j.get_scheduler().spawn(&child);
+ *          scheduler::job_ptr c2 = j.get_scheduler().spawn(&child);
+ *          j.get_scheduler().join(c1);
+ *          j.get_scheduler().join(c2);
+ *      }
+ *
+ * join() called from one of the scheduler's workers runs other jobs while it
+ * waits, so that waiting for children never ties up a worker.
+ *
+ * Jobs have the same states as tasklets, and offer the same cooperative
+ * stop(), sleep() and wakeup() functions, so long-running jobs can be written
+ * the same way as a tasklet's bound function. A job that's queued but not yet
+ * running is STANDING_BY.
+ *
+ * Note #1: A sleeping job occupies its worker until it wakes up, same as a job
+ *          that's busy. If you run long-running jobs on a scheduler, make sure
+ *          there are more workers than such jobs.
+ *
+ * Note #2: The destructor runs all jobs spawned until then to completion, so
+ *          stop long-running jobs before destroying the scheduler.
+ **/
+class scheduler
+    : public boost::noncopyable
+{
+public:
+    class job;
+
+    // Utility typedefs
+    typedef fhtagn::shared_ptr<job>           job_ptr;
+    typedef boost::function<void (job &)>     func_type;
+    typedef tasklet::state                    state;
+
+    /**
+     * Handle for a spawned job; also passed to the job's function.
+     **/
+    class job
+        : public boost::noncopyable
+    {
+    public:
+        /**
+         * @return the current state of the job, i.e. one of the values of
+         *      the tasklet::state enum.
+         **/
+        state get_state() const;
+
+        /**
+         * @return true if the current state is one of RUNNING, SLEEPING,
+         *      STOPPED, else false.
+         **/
+        bool alive() const;
+
+        /**
+         * @return true if the job's function has returned, i.e. the state is
+         *      one of FINISHED or ABORTED.
+         **/
+        bool done() const;
+
+        /**
+         * Sets the job's state to STOPPED, which the job's function can check
+         * via get_state() or the return value of sleep(). A job that's stopped
+         * before it runs is still run, in the STOPPED state.
+         *
+         * @return false if the job is done(), else true.
+         **/
+        bool stop();
+
+        /**
+         * Wakes the job if it's sleeping, but does not ask it to stop.
+         *
+         * @return false if the job is done(), else true.
+         **/
+        bool wakeup();
+
+        /**
+         * Waits for the specified number of microseconds, or until the job is
+         * stopped or woken up. Behaves like tasklet::sleep(), and must only
+         * be called from the job's function.
+         *
+         * @param usecs [optional] Number of microseconds to sleep. If no time
+         *      is specified, the sleep can only be broken by stop() or
+         *      wakeup().
+         * @return The current job state.
+         **/
+        state sleep(boost::uint32_t usecs = 0);
+
+        /**
+         * @return the message of the exception that the job's function threw,
+         *      if it is ABORTED, else an empty string.
+         **/
+        std::string error() const;
+
+        /**
+         * @return the scheduler that runs this job, e.g. for spawning child
+         *      jobs.
+         **/
+        scheduler & get_scheduler() const;
+
+    private:
+        friend class scheduler;
+
+        job(scheduler & sched, func_type const & func);
+
+        // Runs m_func and updates the state.
+        void run();
+
+        // Waits until done() or usecs microseconds have elapsed; waits
+        // indefinitely if usecs is 0. Returns done().
+        bool wait(boost::uint32_t usecs);
+
+        scheduler &             m_scheduler;
+        func_type               m_func;
+
+        state                   m_state;
+        std::string             m_error;
+
+        // Condition to signal a change in m_state.
+        boost::condition        m_state_change;
+        // Mutex to serialize access to m_state and m_error.
+        mutable boost::mutex    m_mutex;
+    };
+
+
+    /**
+     * Start the given number of worker threads. If threads is zero, one
+     * worker per hardware thread is started.
+     *
+     * @param threads [optional] Number of workers.
+     **/
+    explicit scheduler(fhtagn::size_t threads = 0);
+
+    /**
+     * Runs all spawned jobs, then stops the workers.
+     **/
+    ~scheduler();
+
+
+    /**
+     * Queue a job running the given function. When called from one of the
+     * scheduler's workers, the job is pushed onto that worker's deque, and
+     * otherwise it's handed to the workers in a round-robin fashion.
+     *
+     * @param func Function to run.
+     * @return handle for the job.
+     **/
+    job_ptr spawn(func_type const & func);
+
+    /**
+     * Wait for the job to finish. If called from one of the scheduler's
+     * workers, runs other jobs in the meantime.
+     *
+     * @param j Job to wait for.
+     * @return the job's final state, FINISHED or ABORTED.
+     **/
+    state join(job_ptr const & j);
+
+
+    /**
+     * @return the number of worker threads.
+     **/
+    fhtagn::size_t threads() const;
+
+private:
+    struct worker
+    {
+        worker(scheduler & sched, fhtagn::size_t index);
+
+        scheduler &             m_scheduler;
+        fhtagn::size_t const    m_index;
+        // Start index for the next attempt at stealing.
+        fhtagn::size_t          m_victim;
+
+        // Jobs spawned on this worker. The worker pushes and pops at the
+        // back, other workers steal from the front.
+        std::deque<job_ptr>     m_jobs;
+        boost::mutex            m_mutex;
+    };
+
+    // Main loop of each worker thread.
+    void worker_loop(worker * w);
+
+    // Stops the workers once all jobs have run, and deletes them.
+    void shutdown();
+
+    // Pushes the job onto the worker's deque, and wakes an idle worker if
+    // there is one.
+    void push(worker * w, job_ptr const & j);
+
+    // Pops a job from the worker's deque, or steals one from another worker.
+    // Returns an empty pointer if there's no job to be found.
+    job_ptr find_job(worker * w);
+
+    // Returns the calling thread's worker, if it's one of this scheduler's
+    // workers, else NULL.
+    worker * current_worker() const;
+
+    // The calling thread's worker, if it's a worker of any scheduler.
+    static boost::thread_specific_ptr<worker> & current_worker_ptr();
+
+    std::vector<worker *>       m_workers;
+    boost::thread_group         m_threads;
+
+    // Number of jobs in all deques.
+    fhtagn::size_t volatile     m_pending;
+    // Number of workers waiting for m_idle_change.
+    fhtagn::size_t volatile     m_idle;
+    // Worker that receives the next job spawned outside of the workers.
+    fhtagn::size_t volatile     m_next;
+    // Set by the destructor; workers exit once it's set and m_pending is zero.
+    int volatile                m_stopping;
+
+    // Condition to wake idle workers, and the mutex used with it.
+    boost::condition            m_idle_change;
+    boost::mutex                m_idle_mutex;
+};
+
+
+}} // namespace fhtagn::threads
+
+#endif // guard
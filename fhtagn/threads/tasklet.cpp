@@ -37,40 +37,55 @@ namespace fhtagn {
 namespace threads {
 
 
-tasklet::tasklet(tasklet::func_type::slot_type slot)
+/*****************************************************************************
+ * tasklet_base
+ **/
+tasklet_base::tasklet_base(executor & exec)
     : m_state(STANDING_BY)
-    , m_thread(0)
+    , m_executor(exec)
+    , m_started(false)
+    , m_running(false)
 {
-    m_func.connect(slot);
 }
 
 
-tasklet::~tasklet()
+tasklet_base::~tasklet_base()
 {
-    stop();
-    wait();
 }
 
 
 bool
-tasklet::start()
+tasklet_base::start()
 {
     boost::mutex::scoped_lock lock(m_mutex);
-    if (m_thread) {
+    if (m_started) {
         return false;
     }
     m_state = RUNNING;
-    m_thread = new boost::thread(boost::bind(&tasklet::thread_runner,
-                this));
-    return true;
+    m_started = true;
+    m_running = true;
+
+    // The executor may block or run the function right away, so don't hold
+    // the lock while submitting.
+    lock.unlock();
+    if (m_executor.submit(boost::bind(&tasklet_base::thread_runner, this))) {
+        return true;
+    }
+
+    lock.lock();
+    m_state = STANDING_BY;
+    m_started = false;
+    m_running = false;
+    m_state_change.notify_all();
+    return false;
 }
 
 
 bool
-tasklet::stop()
+tasklet_base::stop()
 {
     boost::mutex::scoped_lock lock(m_mutex);
-    if (!m_thread) {
+    if (!m_started) {
         return false;
     }
     if (IS_ALIVE) {
@@ -83,32 +98,27 @@ tasklet::stop()
 
 
 bool
-tasklet::wait()
+tasklet_base::wait()
 {
     boost::mutex::scoped_lock lock(m_mutex);
 
-    if (!m_thread) {
+    if (!m_started) {
         return false;
     }
 
-    while (IS_ALIVE) {
+    // Once m_running is cleared, thread_runner() does not touch the tasklet
+    // other than to release m_mutex.
+    while (m_running) {
         m_state_change.wait(lock);
     }
 
-    // Copy m_thread in order to be able to join it without holding m_mutex
-    boost::thread * join_thread = m_thread;
-    m_thread = NULL;
-
-    lock.unlock();
-
-    join_thread->join();
-    delete join_thread;
+    m_started = false;
     return true;
 }
 
 
 bool
-tasklet::reset()
+tasklet_base::reset()
 {
     boost::mutex::scoped_lock lock(m_mutex);
     switch (m_state) {
@@ -135,8 +145,8 @@ tasklet::reset()
 }
 
 
-tasklet::state
-tasklet::get_state() const
+tasklet_base::state
+tasklet_base::get_state() const
 {
     boost::mutex::scoped_lock lock(m_mutex);
     return m_state;
@@ -145,7 +155,7 @@ tasklet::get_state() const
 
 
 bool
-tasklet::alive() const
+tasklet_base::alive() const
 {
     boost::mutex::scoped_lock lock(m_mutex);
     return IS_ALIVE;
@@ -153,8 +163,8 @@ tasklet::alive() const
 
 
 
-tasklet::state
-tasklet::sleep(boost::uint32_t usecs /* = 0 */)
+tasklet_base::state
+tasklet_base::sleep(boost::uint32_t usecs /* = 0 */)
 {
     // Prepare xtime to sleep until
     boost::xtime t;
@@ -207,10 +217,10 @@ tasklet::sleep(boost::uint32_t usecs /* = 0 */)
 
 
 bool
-tasklet::wakeup()
+tasklet_base::wakeup()
 {
     boost::mutex::scoped_lock lock(m_mutex);
-    if (!m_thread) {
+    if (!m_started) {
         return false;
     }
 
@@ -221,20 +231,20 @@ tasklet::wakeup()
 
 
 
-void
-tasklet::add_error_handler(error_func_type::slot_type slot)
+bool
+tasklet_base::started() const
 {
-    boost::mutex::scoped_lock lock(m_error_func_mutex);
-    m_error_func.connect(slot);
+    boost::mutex::scoped_lock lock(m_mutex);
+    return m_started;
 }
 
 
 
 void
-tasklet::thread_runner()
+tasklet_base::thread_runner()
 {
     try {
-        m_func(*this);
+        invoke();
     } catch (std::exception const & ex) {
         {
             boost::mutex::scoped_lock lock(m_mutex);
@@ -242,8 +252,7 @@ tasklet::thread_runner()
         }
         try {
             // Pass any std::exception on to the error handler
-            boost::mutex::scoped_lock lock(m_error_func_mutex);
-            m_error_func(*this, ex);
+            report_error(ex);
         } catch (...) {
             // silently ignore
         }
@@ -256,8 +265,7 @@ tasklet::thread_runner()
             // Pass a new runtime_error on to the error handler.
             std::runtime_error e("Unspecified exception occurred in tasklet's "
                     "bound function.");
-            boost::mutex::scoped_lock lock(m_error_func_mutex);
-            m_error_func(*this, e);
+            report_error(e);
         } catch (...) {
             // silently ignore
         }
@@ -267,9 +275,121 @@ tasklet::thread_runner()
     if (IS_ALIVE) {
         m_state = FINISHED;
     }
+    m_running = false;
 
     m_state_change.notify_all();
 }
 
 
+
+
+/*****************************************************************************
+ * tasklet
+ **/
+tasklet::tasklet(tasklet::func_type::slot_type slot)
+    : tasklet_base(default_executor())
+{
+    m_func.connect(slot);
+}
+
+
+tasklet::tasklet(tasklet::func_type::slot_type slot, executor & exec)
+    : tasklet_base(exec)
+{
+    m_func.connect(slot);
+}
+
+
+tasklet::~tasklet()
+{
+    stop();
+    wait();
+}
+
+
+void
+tasklet::add_error_handler(error_func_type::slot_type slot)
+{
+    boost::mutex::scoped_lock lock(m_error_func_mutex);
+    m_error_func.connect(slot);
+}
+
+
+void
+tasklet::invoke()
+{
+    m_func(*this);
+}
+
+
+void
+tasklet::report_error(std::exception const & ex)
+{
+    boost::mutex::scoped_lock lock(m_error_func_mutex);
+    m_error_func(*this, ex);
+}
+
+
+
+/*****************************************************************************
+ * lean_tasklet
+ **/
+lean_tasklet::lean_tasklet(lean_tasklet::func_type const & func)
+    : tasklet_base(default_executor())
+    , m_func(func)
+    , m_error_func(NULL)
+{
+}
+
+
+lean_tasklet::lean_tasklet(lean_tasklet::func_type const & func,
+        executor & exec)
+    : tasklet_base(exec)
+    , m_func(func)
+    , m_error_func(NULL)
+{
+}
+
+
+lean_tasklet::~lean_tasklet()
+{
+    stop();
+    wait();
+    delete m_error_func;
+}
+
+
+void
+lean_tasklet::add_error_handler(error_func_type::slot_type slot)
+{
+    // thread_runner() reads m_error_func without locking, which is safe only
+    // because start() and wait() order it with this function.
+    if (started()) {
+        throw std::logic_error("Can't add error handlers to a started "
+                "lean_tasklet.");
+    }
+
+    if (!m_error_func) {
+        m_error_func = new error_func_type();
+    }
+    m_error_func->connect(slot);
+}
+
+
+void
+lean_tasklet::invoke()
+{
+    m_func(*this);
+}
+
+
+void
+lean_tasklet::report_error(std::exception const & ex)
+{
+    if (m_error_func) {
+        (*m_error_func)(*this, ex);
+    }
+}
+
+
 }} // namespace fhtagn::threads
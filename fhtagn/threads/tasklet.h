@@ -33,25 +33,30 @@
 #include <fhtagn/fhtagn.h>
 
 #include <exception>
+#include <stdexcept>
 
+#include <boost/function.hpp>
 #include <boost/signal.hpp>
 #include <boost/thread.hpp>
 #include <boost/thread/condition.hpp>
 #include <boost/noncopyable.hpp>
 
+#include <fhtagn/threads/executor.h>
+
 namespace fhtagn {
 namespace threads {
 
 
 /**
- * The tasklet class is a simple wrapper around boost::thread that makes
- * manipulation of a thread a little easier.
+ * Common base for tasklet and lean_tasklet below, which differ only in how they
+ * store the bound function and the error handlers. It implements the
+ * functionality both classes share:
  *
- * In particular, it adds several pieces of functionality over boost::thread:
  * 1) Start/stop/restart the tasklet without a need to bind a function to
  *    a boost::thread yet again. The tasklet is bound to the function to be
- *    run in a separate thread, and internally takes care of creating and
- *    tearing down boost::thread objects.
+ *    run in a separate thread, and internally hands it to an executor each
+ *    time it's started. By default, that's the default_executor(), which
+ *    creates a new thread for each run.
  * 2) Signal the tasklet to stop. The bound function is not interrupted, but
  *    a flag is set that the bound function can check to determine whether it
  *    should end prematurely.
@@ -60,16 +65,15 @@ namespace threads {
  *    to perform some task. This sleeping should be interruptible so the thread
  *    can be torn down when required. The flag & condition required to implement
  *    such functionality is abstracted out.
+ *
+ * Derived classes must call stop() and wait() in their destructor, as the
+ * bound function may still be running when tasklet_base's destructor is
+ * reached.
  **/
-class tasklet
+class tasklet_base
     : public boost::noncopyable
 {
 public:
-    // Utility typedefs
-    typedef boost::signal<void (tasklet &)> func_type;
-    typedef boost::signal<void (tasklet &, std::exception const &)
-        > error_func_type;
-
     /**
      * Enum that defines the states the tasklet can be in.
      **/
@@ -90,43 +94,16 @@ public:
                               ready for resetting. */
     };
 
-    /**
-     * Construct a tasklet instance that, when started, will execute the passed
-     * function. The function prototype must be
-     *
-     *      void foo(tasklet &)
-     *
-     * It's perfectly fine to bind member functions via boost::bind here; in
-     * fact, one type of usage might be to derive from tasklet in the following
-     * manner:
-     *
-     *      struct Foo
-     *          : public tasklet
-     *      {
-     *          Foo()
-     *              : tasklet(boost::bind(&Foo::foo, boost::ref(this), _1))
-     *          {
-     *          }
-     *
-     *          void foo(tasklet & t)
-     *          {
-     *              // The t passed will be *this
-     *          }
-     *      };
-     *
-     * @param slot Function to execute.
-     **/
-    explicit tasklet(func_type::slot_type slot);
-
     /**
      * Virtual dtor to allow for derivation.
      **/
-    virtual ~tasklet();
+    virtual ~tasklet_base();
 
 
     /**
-     * If !started(), will execute the bound function in a new thread and
-     * return true. If started(), returns false.
+     * If !started(), will execute the bound function on the tasklet's executor
+     * and return true. If started(), or if the executor does not accept the
+     * function, returns false.
      *
      * @return see above.
      **/
@@ -141,8 +118,7 @@ public:
     bool stop();
 
     /**
-     * Wait for the bound function to finish, and join the thread started
-     * internally.
+     * Wait for the bound function to finish.
      *
      * @return true if started(), else false.
      **/
@@ -201,6 +177,111 @@ public:
      **/
     bool wakeup();
 
+protected:
+    /**
+     * The bound function is run on the given executor, which must outlive the
+     * tasklet.
+     **/
+    explicit tasklet_base(executor & exec);
+
+    /**
+     * Invokes the bound function.
+     **/
+    virtual void invoke() = 0;
+
+    /**
+     * Invokes the error handlers with the exception the bound function
+     * produced. Exceptions thrown from here are silently ignored.
+     **/
+    virtual void report_error(std::exception const & ex) = 0;
+
+    /**
+     * @return true between start() and wait().
+     **/
+    bool started() const;
+
+private:
+    // Helper function to call the bound function and set m_done at the end.
+    void thread_runner();
+
+    // State of the tasklet, can be queried via the get_state() function.
+    state                   m_state;
+    // Executor on which the bound function is run.
+    executor &              m_executor;
+    // Set between start() and wait().
+    bool                    m_started;
+    // Set between start() and the end of thread_runner().
+    bool                    m_running;
+    // Condition to signal a change in m_state.
+    boost::condition        m_state_change;
+    // Mutex to serialize access to flags.
+    mutable boost::mutex    m_mutex;
+};
+
+
+
+/**
+ * The tasklet class is a simple wrapper around boost::thread that makes
+ * manipulation of a thread a little easier; see tasklet_base above for the
+ * functionality it adds.
+ *
+ * The bound function and error handlers are held in boost::signals, so any
+ * number of error handlers can be added at any time. If you don't need that,
+ * lean_tasklet below is cheaper to construct and start.
+ **/
+class tasklet
+    : public tasklet_base
+{
+public:
+    // Utility typedefs
+    typedef boost::signal<void (tasklet &)> func_type;
+    typedef boost::signal<void (tasklet &, std::exception const &)
+        > error_func_type;
+
+    /**
+     * Construct a tasklet instance that, when started, will execute the passed
+     * function. The function prototype must be
+     *
+     *      void foo(tasklet &)
+     *
+     * It's perfectly fine to bind member functions via boost::bind here; in
+     * fact, one type of usage might be to derive from tasklet in the following
+     * manner:
+     *
+     *      struct Foo
+     *          : public tasklet
+     *      {
+     *          Foo()
+     *              : tasklet(boost::bind(&Foo::foo, boost::ref(this), _1))
+     *          {
+     *          }
+     *
+     *          void foo(tasklet & t)
+     *          {
+     *              // The t passed will be *this
+     *          }
+     *      };
+     *
+     * @param slot Function to execute.
+     **/
+    explicit tasklet(func_type::slot_type slot);
+
+    /**
+     * Same as above, but the bound function is run on the given executor
+     * rather than the default_executor(). The executor must outlive the
+     * tasklet. Note that the tasklet occupies one of a thread_pool_executor's
+     * workers until the bound function returns.
+     *
+     * @param slot Function to execute.
+     * @param exec Executor to run the function on.
+     **/
+    tasklet(func_type::slot_type slot, executor & exec);
+
+    /**
+     * Stops the tasklet and waits for the bound function to finish.
+     **/
+    virtual ~tasklet();
+
 
     /**
      * Allows to set an error handler function for the tasklet that's invoked
@@ -226,24 +307,18 @@ public:
      **/
     void add_error_handler(error_func_type::slot_type slot);
 
-private:
-    // Helper function to call the bound function and set m_done at the end.
-    void thread_runner();
+protected:
+    // See tasklet_base
+    void invoke();
+    void report_error(std::exception const & ex);
 
+private:
     // Bound function
     func_type               m_func;
 
     // Optional error handling function
     error_func_type         m_error_func;
 
-    // State of the tasklet, can be queried via the get_state() function.
-    state                   m_state;
-    // Internal thread in which the bound function is executed.
-    boost::thread *         m_thread;
-    // Condition to signal a change in m_state.
-    boost::condition        m_state_change;
-    // Mutex to serialize access to flags and m_thread.
-    mutable boost::mutex    m_mutex;
     // Mutex to serialize access to the error handler callback. It's a separate
     // mutex, unfortunately, because we don't want to block access to tasklet's
     // functions from the error handler.
@@ -251,6 +326,69 @@ private:
 };
 
 
+
+/**
+ * The lean_tasklet class behaves like tasklet above, but holds its bound
+ * function in a boost::function, which stores small function objects such as
+ * the result of binding a member function to an object without allocating
+ * memory. Running it calls that function directly rather than iterating over
+ * a signal's slots, and reporting errors takes no additional mutex.
+ *
+ * Error handlers are optional. The boost::signal for them is only created when
+ * the first one is added, which must happen while the tasklet is not started.
+ **/
+class lean_tasklet
+    : public tasklet_base
+{
+public:
+    // Utility typedefs
+    typedef boost::function<void (lean_tasklet &)> func_type;
+    typedef boost::signal<void (lean_tasklet &, std::exception const &)
+        > error_func_type;
+
+    /**
+     * Construct a lean_tasklet instance that, when started, will execute the
+     * passed function on the default_executor(), or the given executor. The
+     * function prototype must be
+     *
+     *      void foo(lean_tasklet &)
+     *
+     * @param func Function to execute.
+     * @param exec [optional] Executor to run the function on; it must outlive
+     *      the tasklet.
+     **/
+    explicit lean_tasklet(func_type const & func);
+    lean_tasklet(func_type const & func, executor & exec);
+
+    /**
+     * Stops the tasklet and waits for the bound function to finish.
+     **/
+    virtual ~lean_tasklet();
+
+
+    /**
+     * Adds an error handler as with tasklet::add_error_handler(), except that
+     * it must not be called between start() and wait().
+     *
+     * @param slot The error handler function to invoke on errors.
+     * @throw std::logic_error if called between start() and wait().
+     **/
+    void add_error_handler(error_func_type::slot_type slot);
+
+protected:
+    // See tasklet_base
+    void invoke();
+    void report_error(std::exception const & ex);
+
+private:
+    // Bound function
+    func_type               m_func;
+
+    // Error handling functions; NULL until the first is added.
+    error_func_type *       m_error_func;
+};
+
+
 }} // namespace fhtagn::threads
 
 #endif // guard
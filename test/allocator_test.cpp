@@ -25,16 +25,37 @@
  **/
 
 #include <vector>
+#include <set>
+#include <sstream>
+#include <stdexcept>
+
+#if !defined(_WIN32)
+#include <fcntl.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#endif
 
 #include <cppunit/extensions/HelperMacros.h>
 
 #include <fhtagn/memory/allocator.h>
 #include <fhtagn/memory/memory_pool.h>
 #include <fhtagn/memory/fixed_pool.h>
+#if !defined(_WIN32)
+#include <fhtagn/memory/shared_pool.h>
+#include <fhtagn/memory/file_pool.h>
+#endif
 #include <fhtagn/memory/pool_allocator.h>
+#include <fhtagn/memory/pool_vector.h>
 #include <fhtagn/memory/throw_pool.h>
+#include <fhtagn/memory/fallback_pool.h>
+#include <fhtagn/memory/debug_pool.h>
+#include <fhtagn/memory/statistics.h>
 #include <fhtagn/memory/block_pool.h>
 #include <fhtagn/memory/dynamic_pool.h>
+#include <fhtagn/memory/memory_source.h>
+#include <fhtagn/memory/monotonic_pool.h>
 #include <fhtagn/memory/size_based_pool.h>
 
 
@@ -45,17 +66,24 @@ typedef fhtagn::memory::dynamic_pool<
   1024
 > dynamic_pool_t;
 
+template <int CURRENT>
+struct inc_by_twelve : public fhtagn::meta::increment<CURRENT, 12>
+{
+};
+
 
 
 FHTAGN_POOL_ALLOCATION_INITIALIZE_BASE(fhtagn::memory::heap_pool);
 FHTAGN_POOL_ALLOCATION_INITIALIZE_BASE(fhtagn::memory::fixed_pool<>);
 FHTAGN_POOL_ALLOCATION_INITIALIZE_BASE(dynamic_pool_t);
 FHTAGN_POOL_ALLOCATION_INITIALIZE_BASE(fhtagn::memory::size_based_pool<>);
+FHTAGN_POOL_ALLOCATION_INITIALIZE_BASE(fhtagn::memory::monotonic_pool<>);
 
 FHTAGN_POOL_ALLOCATION_INITIALIZE(test_int_t, fhtagn::memory::heap_pool);
 FHTAGN_POOL_ALLOCATION_INITIALIZE(test_int_t, fhtagn::memory::fixed_pool<>);
 FHTAGN_POOL_ALLOCATION_INITIALIZE(test_int_t, dynamic_pool_t);
 FHTAGN_POOL_ALLOCATION_INITIALIZE(test_int_t, fhtagn::memory::size_based_pool<>);
+FHTAGN_POOL_ALLOCATION_INITIALIZE(test_int_t, fhtagn::memory::monotonic_pool<>);
 
 
 class AllocatorTest
@@ -69,16 +97,37 @@ public:
       CPPUNIT_TEST(testHeapMemoryPool);
       CPPUNIT_TEST(testFixedMemoryPool);
       CPPUNIT_TEST(testFixedPoolFragmentation);
+      CPPUNIT_TEST(testFixedPoolCoalescing);
+#if !defined(_WIN32)
+      CPPUNIT_TEST(testSharedMemoryPool);
+#if defined(__linux__)
+      CPPUNIT_TEST(testSharedPoolOwnerDeath);
+#endif
+      CPPUNIT_TEST(testFilePool);
+#endif
       CPPUNIT_TEST(testBlockMemoryPool);
+      CPPUNIT_TEST(testLockFreeBlockPool);
+      CPPUNIT_TEST(testCacheLineAlignment);
       CPPUNIT_TEST(testDynamicMemoryPool);
+      CPPUNIT_TEST(testDynamicPoolRetention);
+      CPPUNIT_TEST(testMemorySources);
+      CPPUNIT_TEST(testMonotonicMemoryPool);
       CPPUNIT_TEST(testThrowPool);
+      CPPUNIT_TEST(testFallbackPool);
+      CPPUNIT_TEST(testDebugPool);
+      CPPUNIT_TEST(testStatisticsPool);
+      CPPUNIT_TEST(testPoolVector);
+      CPPUNIT_TEST(testBulkAllocation);
       CPPUNIT_TEST(testSizeBasedMemoryPool);
+      CPPUNIT_TEST(testSizeBasedPoolSizeClasses);
 
       CPPUNIT_TEST(testDefaultAllocator);
       CPPUNIT_TEST(testHeapPoolAllocator);
       CPPUNIT_TEST(testFixedPoolAllocator);
       CPPUNIT_TEST(testDynamicPoolAllocator);
       CPPUNIT_TEST(testSizeBasedPoolAllocator);
+      CPPUNIT_TEST(testMonotonicPoolAllocator);
+      CPPUNIT_TEST(testRawPoolAllocator);
 
     CPPUNIT_TEST_SUITE_END();
 private:
@@ -241,6 +290,406 @@ private:
     }
 
 
+    void testFixedPoolCoalescing()
+    {
+      namespace mem = fhtagn::memory;
+
+      std::vector<char> memory(1024 * 1024);
+      mem::fixed_pool<fhtagn::threads::fake_mutex, mem::block_alignment<16> > p(
+          &memory[0], memory.size());
+
+      // Allocate objects of varying sizes, and free them in a different order.
+      // Each object is filled with a pattern that must survive all other
+      // allocations and frees.
+      srand(42);
+      std::vector<std::pair<char *, fhtagn::size_t> > ptrs;
+      for (int round = 0 ; round < 10000 ; ++round) {
+        if (ptrs.empty() || rand() % 3) {
+          fhtagn::size_t size = 1 + rand() % 1000;
+          char * ptr = static_cast<char *>(p.alloc(size));
+          if (!ptr) {
+            continue;
+          }
+          CPPUNIT_ASSERT_EQUAL(fhtagn::size_t(0),
+              reinterpret_cast<fhtagn::size_t>(ptr) % 16);
+          CPPUNIT_ASSERT(p.alloc_size(ptr) >= size);
+          ::memset(ptr, size % 256, size);
+          ptrs.push_back(std::make_pair(ptr, size));
+        }
+        else {
+          fhtagn::size_t index = rand() % ptrs.size();
+          char * ptr = ptrs[index].first;
+          fhtagn::size_t size = ptrs[index].second;
+          CPPUNIT_ASSERT_EQUAL(char(size % 256), ptr[0]);
+          CPPUNIT_ASSERT_EQUAL(char(size % 256), ptr[size - 1]);
+          p.free(ptr);
+          ptrs[index] = ptrs.back();
+          ptrs.pop_back();
+        }
+      }
+
+      // Pointers not returned by alloc() are rejected.
+      CPPUNIT_ASSERT(!ptrs.empty());
+      CPPUNIT_ASSERT_THROW(p.free(ptrs[0].first + 16), std::logic_error);
+
+      for (std::vector<std::pair<char *, fhtagn::size_t> >::iterator iter
+          = ptrs.begin() ; iter != ptrs.end() ; ++iter)
+      {
+        p.free(iter->first);
+      }
+      CPPUNIT_ASSERT_EQUAL(false, p.in_use());
+
+      // With all segments merged again, almost the entire block can be
+      // allocated at once.
+      void * ptr = p.alloc(memory.size() - 64);
+      CPPUNIT_ASSERT(ptr);
+
+      // Freeing it twice is an error.
+      p.free(ptr);
+      CPPUNIT_ASSERT_EQUAL(false, p.in_use());
+      CPPUNIT_ASSERT_THROW(p.free(ptr), std::logic_error);
+    }
+
+
+#if !defined(_WIN32)
+    void testSharedMemoryPool()
+    {
+      namespace mem = fhtagn::memory;
+      typedef mem::shared_pool<> pool_t;
+
+      fhtagn::size_t const size = 64 * 1024;
+      void * region = ::mmap(NULL, size, PROT_READ | PROT_WRITE,
+          MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+      CPPUNIT_ASSERT(MAP_FAILED != region);
+
+      // There's no pool to attach to yet, and the pool needs aligned memory.
+      CPPUNIT_ASSERT_THROW(pool_t(region, size, pool_t::ATTACH),
+          std::runtime_error);
+      CPPUNIT_ASSERT_THROW(pool_t(static_cast<char *>(region) + 1, size - 1),
+          std::logic_error);
+
+      pool_t p(region, size);
+      CPPUNIT_ASSERT_EQUAL(false, p.in_use());
+      testMemoryPoolGeneric(p);
+      CPPUNIT_ASSERT_EQUAL(false, p.in_use());
+
+      // Offsets translate to and from pointers.
+      CPPUNIT_ASSERT_EQUAL(fhtagn::size_t(0), p.offset_of(NULL));
+      CPPUNIT_ASSERT_EQUAL(static_cast<void *>(NULL), p.pointer_to(0));
+
+      // Allocate a few blocks, and pass their offsets to a child process via
+      // the pool itself. The child attaches, frees the blocks, and allocates
+      // one of it's own.
+      fhtagn::size_t * offsets = static_cast<fhtagn::size_t *>(
+          p.alloc(3 * sizeof(fhtagn::size_t)));
+      CPPUNIT_ASSERT(offsets);
+      offsets[0] = p.offset_of(p.alloc(100));
+      offsets[1] = p.offset_of(p.alloc(200));
+      offsets[2] = 0;
+      CPPUNIT_ASSERT_EQUAL(offsets[0], p.offset_of(p.pointer_to(offsets[0])));
+
+      pid_t pid = ::fork();
+      CPPUNIT_ASSERT(pid >= 0);
+      if (!pid) {
+        int result = 1;
+        try {
+          pool_t child(region, size, pool_t::ATTACH);
+          child.free(child.pointer_to(offsets[0]));
+          child.free(child.pointer_to(offsets[1]));
+          void * ptr = child.alloc(50);
+          if (ptr) {
+            ::memset(ptr, 42, 50);
+            offsets[2] = child.offset_of(ptr);
+            result = 0;
+          }
+        } catch (...) {
+        }
+        ::_exit(result);
+      }
+
+      int status = 0;
+      CPPUNIT_ASSERT_EQUAL(pid, ::waitpid(pid, &status, 0));
+      CPPUNIT_ASSERT(WIFEXITED(status));
+      CPPUNIT_ASSERT_EQUAL(0, WEXITSTATUS(status));
+
+      char * child_ptr = static_cast<char *>(p.pointer_to(offsets[2]));
+      CPPUNIT_ASSERT(child_ptr);
+      CPPUNIT_ASSERT_EQUAL(char(42), child_ptr[49]);
+      CPPUNIT_ASSERT(p.alloc_size(child_ptr) >= 50);
+
+      p.free(child_ptr);
+      p.free(offsets);
+      CPPUNIT_ASSERT_EQUAL(false, p.in_use());
+
+      p.destroy();
+      ::munmap(region, size);
+    }
+
+
+
+#if defined(__linux__)
+    void testSharedPoolOwnerDeath()
+    {
+      namespace mem = fhtagn::memory;
+      typedef mem::shared_pool<> pool_t;
+
+      fhtagn::size_t const page_size = ::sysconf(_SC_PAGESIZE);
+      fhtagn::size_t const size = 16 * page_size;
+      void * region = ::mmap(NULL, size, PROT_READ | PROT_WRITE,
+          MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+      CPPUNIT_ASSERT(MAP_FAILED != region);
+
+      // The filler keeps the victim's segment header off the page with the
+      // pool's state.
+      pool_t p(region, size);
+      void * filler = p.alloc(2 * page_size);
+      char * victim = static_cast<char *>(p.alloc(2 * page_size));
+      CPPUNIT_ASSERT(filler);
+      CPPUNIT_ASSERT(victim);
+
+      // The child makes the pages around the victim's segment header
+      // inaccessible in it's own mapping, so freeing the victim crashes while
+      // the child holds the pool's mutex.
+      pid_t pid = ::fork();
+      CPPUNIT_ASSERT(pid >= 0);
+      if (!pid) {
+        try {
+          pool_t child(region, size, pool_t::ATTACH);
+          fhtagn::size_t const mask = ~(page_size - 1);
+          char * first = reinterpret_cast<char *>(
+              reinterpret_cast<fhtagn::size_t>(victim - 64) & mask);
+          ::mprotect(first, victim - first + page_size, PROT_NONE);
+          child.free(victim);
+        } catch (...) {
+        }
+        ::_exit(0);
+      }
+
+      int status = 0;
+      CPPUNIT_ASSERT_EQUAL(pid, ::waitpid(pid, &status, 0));
+      CPPUNIT_ASSERT(WIFSIGNALED(status));
+      CPPUNIT_ASSERT_EQUAL(SIGSEGV, WTERMSIG(status));
+
+      // The mutex is recovered and the pool rebuilt; the free never happened.
+      void * ptr = p.alloc(100);
+      CPPUNIT_ASSERT(ptr);
+      CPPUNIT_ASSERT(p.alloc_size(victim) >= 2 * page_size);
+
+      p.free(ptr);
+      p.free(victim);
+      p.free(filler);
+      CPPUNIT_ASSERT_EQUAL(false, p.in_use());
+
+      p.destroy();
+      ::munmap(region, size);
+    }
+#endif
+
+
+
+    void testFilePool()
+    {
+      namespace mem = fhtagn::memory;
+      typedef mem::file_pool<> pool_t;
+
+      char path[] = "/tmp/fhtagn_file_pool_XXXXXX";
+      int fd = ::mkstemp(path);
+      CPPUNIT_ASSERT(-1 != fd);
+      ::close(fd);
+
+      fhtagn::size_t const size = 64 * 1024;
+      fhtagn::size_t table_offset = 0;
+      {
+        pool_t p(path, size);
+        CPPUNIT_ASSERT_EQUAL(true, p.created());
+        CPPUNIT_ASSERT_EQUAL(size, p.file_size());
+        CPPUNIT_ASSERT_EQUAL(false, p.in_use());
+        testMemoryPoolGeneric(p);
+
+        // The file can only be opened once at a time.
+        CPPUNIT_ASSERT_THROW(pool_t(path, size), std::runtime_error);
+
+        int * table = static_cast<int *>(p.alloc(100 * sizeof(int)));
+        CPPUNIT_ASSERT(table);
+        for (int i = 0 ; i < 100 ; ++i) {
+          table[i] = i * i;
+        }
+        p.set_root(table);
+        table_offset = p.offset_of(table);
+
+        CPPUNIT_ASSERT_EQUAL(true, p.dirty());
+        p.sync();
+        CPPUNIT_ASSERT_EQUAL(false, p.dirty());
+      }
+
+      // Reopening finds the table via the root, with the size of the file.
+      {
+        pool_t p(path, 2 * size);
+        CPPUNIT_ASSERT_EQUAL(false, p.created());
+        CPPUNIT_ASSERT_EQUAL(size, p.file_size());
+        CPPUNIT_ASSERT_EQUAL(false, p.dirty());
+        CPPUNIT_ASSERT_EQUAL(true, p.in_use());
+
+        int * table = static_cast<int *>(p.root());
+        CPPUNIT_ASSERT(table);
+        CPPUNIT_ASSERT_EQUAL(81 * 81, table[81]);
+        CPPUNIT_ASSERT(p.alloc_size(table) >= 100 * sizeof(int));
+      }
+
+      // A process that terminates without syncing leaves the pool dirty; it's
+      // rebuilt on the next open, and remains usable.
+      pid_t pid = ::fork();
+      CPPUNIT_ASSERT(pid >= 0);
+      if (!pid) {
+        try {
+          // Exit while the pool is still open, so it's not synced.
+          pool_t child(path, size);
+          child.free(child.root());
+          child.set_root(child.alloc(10));
+          ::_exit(child.dirty() ? 0 : 1);
+        } catch (...) {
+        }
+        ::_exit(1);
+      }
+
+      int status = 0;
+      CPPUNIT_ASSERT_EQUAL(pid, ::waitpid(pid, &status, 0));
+      CPPUNIT_ASSERT(WIFEXITED(status));
+      CPPUNIT_ASSERT_EQUAL(0, WEXITSTATUS(status));
+
+      {
+        pool_t p(path, size);
+        CPPUNIT_ASSERT_EQUAL(true, p.dirty());
+        void * root = p.root();
+        CPPUNIT_ASSERT(root);
+        CPPUNIT_ASSERT(p.alloc_size(root) >= 10);
+        p.free(root);
+        p.set_root(NULL);
+        CPPUNIT_ASSERT_EQUAL(false, p.in_use());
+        table_offset = p.offset_of(p.alloc(200));
+      }
+
+      // Data structures that link objects via offsets survive the file being
+      // mapped at a different address, which pointers would not.
+      {
+        char list_path[] = "/tmp/fhtagn_file_pool_XXXXXX";
+        int list_fd = ::mkstemp(list_path);
+        CPPUNIT_ASSERT(-1 != list_fd);
+        ::close(list_fd);
+
+        struct node
+        {
+          fhtagn::size_t  next;
+          int             value;
+        };
+
+        void * old_base = NULL;
+        {
+          pool_t p(list_path, size);
+          fhtagn::size_t head = 0;
+          for (int i = 0 ; i < 10 ; ++i) {
+            node * n = static_cast<node *>(p.alloc(sizeof(node)));
+            CPPUNIT_ASSERT(n);
+            n->value = i;
+            n->next = head;
+            head = p.offset_of(n);
+          }
+          p.set_root(p.pointer_to(head));
+          old_base = static_cast<char *>(p.pointer_to(head)) - head;
+        }
+
+        // Occupy the address the file was mapped at, so that it's mapped
+        // elsewhere when it's reopened.
+        void * blocker = ::mmap(old_base, size, PROT_NONE,
+            MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        CPPUNIT_ASSERT(MAP_FAILED != blocker);
+        {
+          pool_t p(list_path, size);
+          node * n = static_cast<node *>(p.root());
+          CPPUNIT_ASSERT(n);
+          if (blocker == old_base) {
+            CPPUNIT_ASSERT(static_cast<void *>(
+                  reinterpret_cast<char *>(n) - p.offset_of(n)) != old_base);
+          }
+
+          int expected = 9;
+          for ( ; n ; n = static_cast<node *>(p.pointer_to(n->next))) {
+            CPPUNIT_ASSERT_EQUAL(expected, n->value);
+            --expected;
+          }
+          CPPUNIT_ASSERT_EQUAL(-1, expected);
+        }
+        ::munmap(blocker, size);
+        ::unlink(list_path);
+      }
+
+      // Overwriting a segment header is detected when the file is reopened.
+      {
+        fd = ::open(path, O_RDWR);
+        CPPUNIT_ASSERT(-1 != fd);
+        void * map = ::mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED,
+            fd, 0);
+        CPPUNIT_ASSERT(MAP_FAILED != map);
+        fhtagn::size_t const header = 3 * sizeof(fhtagn::size_t);
+        ::memset(static_cast<char *>(map) + table_offset - header, 0xff,
+            header);
+        ::munmap(map, size);
+        ::close(fd);
+
+        CPPUNIT_ASSERT_THROW(pool_t(path, size), std::runtime_error);
+      }
+
+      ::unlink(path);
+    }
+#endif
+
+
+
+    void testLockFreeBlockPool()
+    {
+      namespace mem = fhtagn::memory;
+
+      typedef mem::block_pool<sizeof(boost::uint64_t),
+              fhtagn::threads::lock_free> pool_t;
+
+      // Basic single-threaded behaviour is the same as for other block_pools;
+      // the throw_pool also ensures the MemoryPoolConcept is met.
+      char memory[300] = { 0 };
+      pool_t p(memory, sizeof(memory));
+      mem::throw_pool<pool_t> tp(p);
+
+      CPPUNIT_ASSERT_EQUAL(false, p.in_use());
+      CPPUNIT_ASSERT_EQUAL(static_cast<void *>(NULL), p.alloc(3));
+
+      std::set<void *> ptrs;
+      void * ptr = NULL;
+      while ((ptr = p.alloc(sizeof(boost::uint64_t)))) {
+        CPPUNIT_ASSERT(ptrs.insert(ptr).second);
+      }
+      CPPUNIT_ASSERT(ptrs.size() > 30);
+      CPPUNIT_ASSERT_EQUAL(true, p.in_use());
+      CPPUNIT_ASSERT_THROW(tp.alloc(sizeof(boost::uint64_t)), std::bad_alloc);
+
+      ptr = *ptrs.begin();
+      CPPUNIT_ASSERT_EQUAL(fhtagn::size_t(sizeof(boost::uint64_t)),
+          p.alloc_size(ptr));
+      CPPUNIT_ASSERT_EQUAL(ptr, p.realloc(ptr, sizeof(boost::uint64_t)));
+      p.free(ptr);
+      p.free(ptr);
+      CPPUNIT_ASSERT_EQUAL(ptr, p.alloc(sizeof(boost::uint64_t)));
+      CPPUNIT_ASSERT_EQUAL(static_cast<void *>(NULL),
+          p.alloc(sizeof(boost::uint64_t)));
+
+      for (std::set<void *>::iterator iter = ptrs.begin() ; iter != ptrs.end()
+          ; ++iter)
+      {
+        p.free(*iter);
+      }
+      CPPUNIT_ASSERT_EQUAL(false, p.in_use());
+    }
+
+
+
     void testDynamicMemoryPool()
     {
       namespace mem = fhtagn::memory;
@@ -275,6 +724,163 @@ private:
       p.free(p4);
       p.free(p5);
       CPPUNIT_ASSERT_EQUAL(false, p.in_use());
+
+      // Grow the pool to many blocks, then free every other pointer; the
+      // freed space must be found again before new blocks are created, and
+      // each pointer must still be attributed to the right block.
+      std::vector<void *> ptrs;
+      for (int i = 0 ; i < 1000 ; ++i) {
+        void * ptr = p.alloc(200);
+        CPPUNIT_ASSERT(ptr);
+        ::memset(ptr, i % 256, 200);
+        ptrs.push_back(ptr);
+      }
+      for (int i = 0 ; i < 1000 ; i += 2) {
+        CPPUNIT_ASSERT(p.alloc_size(ptrs[i]) >= 200);
+        p.free(ptrs[i]);
+      }
+      std::set<void *> freed(ptrs.begin(), ptrs.end());
+      for (int i = 0 ; i < 1000 ; i += 2) {
+        void * ptr = p.alloc(200);
+        CPPUNIT_ASSERT(freed.end() != freed.find(ptr));
+        ptrs[i] = ptr;
+        ::memset(ptr, i % 256, 200);
+      }
+      for (int i = 0 ; i < 1000 ; ++i) {
+        CPPUNIT_ASSERT_EQUAL(char(i % 256), static_cast<char *>(ptrs[i])[199]);
+        p.free(ptrs[i]);
+      }
+      CPPUNIT_ASSERT_EQUAL(false, p.in_use());
+
+      // A block that failed a large request must still serve small ones: each
+      // of the three blocks holding a large object has room for a small one.
+      ptrs.clear();
+      for (int i = 0 ; i < 3 ; ++i) {
+        void * ptr = p.alloc(600);
+        CPPUNIT_ASSERT(ptr);
+        ptrs.push_back(ptr);
+      }
+      fhtagn::size_t held = p.blocks_held();
+      for (int i = 0 ; i < 3 ; ++i) {
+        void * ptr = p.alloc(300);
+        CPPUNIT_ASSERT(ptr);
+        ptrs.push_back(ptr);
+      }
+      CPPUNIT_ASSERT_EQUAL(held, p.blocks_held());
+      for (std::vector<void *>::iterator iter = ptrs.begin()
+          ; iter != ptrs.end() ; ++iter)
+      {
+        p.free(*iter);
+      }
+      CPPUNIT_ASSERT_EQUAL(false, p.in_use());
+
+      // Blocks that filled up leave the list of pools with free space, so
+      // allocations don't have to walk them, no matter how many there are.
+      // They still serve smaller requests, and return to the list once
+      // memory is freed.
+      {
+        mem::dynamic_pool<mem::fixed_pool<>, 4096> dp;
+        ptrs.clear();
+        for (int i = 0 ; i < 2000 ; ++i) {
+          void * ptr = dp.alloc(1300);
+          CPPUNIT_ASSERT(ptr);
+          ptrs.push_back(ptr);
+          CPPUNIT_ASSERT(dp.blocks_with_space() <= 1);
+        }
+        held = dp.blocks_held();
+        CPPUNIT_ASSERT(held >= 600);
+
+        void * small = dp.alloc(16);
+        CPPUNIT_ASSERT(small);
+        CPPUNIT_ASSERT_EQUAL(held, dp.blocks_held());
+        dp.free(small);
+
+        dp.free(ptrs[0]);
+        CPPUNIT_ASSERT(dp.blocks_with_space() <= 2);
+        void * ptr = dp.alloc(1300);
+        CPPUNIT_ASSERT_EQUAL(ptrs[0], ptr);
+        CPPUNIT_ASSERT_EQUAL(held, dp.blocks_held());
+
+        for (std::vector<void *>::iterator iter = ptrs.begin()
+            ; iter != ptrs.end() ; ++iter)
+        {
+          dp.free(*iter);
+        }
+        CPPUNIT_ASSERT_EQUAL(false, dp.in_use());
+      }
+    }
+
+
+
+    template <
+      typename poolT
+    >
+    void testDynamicPoolRetentionGeneric(poolT & p, fhtagn::size_t size)
+    {
+      // Fill five blocks
+      std::vector<void *> ptrs;
+      for (int i = 0 ; i < 5 ; ++i) {
+        void * ptr = p.alloc(size);
+        CPPUNIT_ASSERT(ptr);
+        ::memset(ptr, 0xab, size);
+        ptrs.push_back(ptr);
+      }
+      CPPUNIT_ASSERT_EQUAL(fhtagn::size_t(5), p.blocks_held());
+      CPPUNIT_ASSERT_EQUAL(fhtagn::size_t(5), p.blocks_in_use());
+
+      // Freeing everything should keep two empty blocks around.
+      for (int i = 0 ; i < 5 ; ++i) {
+        p.free(ptrs[i]);
+      }
+      CPPUNIT_ASSERT_EQUAL(false, p.in_use());
+      CPPUNIT_ASSERT_EQUAL(fhtagn::size_t(2), p.blocks_held());
+      CPPUNIT_ASSERT_EQUAL(fhtagn::size_t(0), p.blocks_in_use());
+
+      // Retained blocks get re-used before new blocks are created.
+      void * ptr = p.alloc(size);
+      CPPUNIT_ASSERT(ptr);
+      ::memset(ptr, 0xab, size);
+      CPPUNIT_ASSERT_EQUAL(true, p.in_use());
+      CPPUNIT_ASSERT_EQUAL(fhtagn::size_t(2), p.blocks_held());
+      CPPUNIT_ASSERT_EQUAL(fhtagn::size_t(1), p.blocks_in_use());
+
+      // Trimming releases the remaining empty block only.
+      CPPUNIT_ASSERT_EQUAL(fhtagn::size_t(1), p.trim());
+      CPPUNIT_ASSERT_EQUAL(fhtagn::size_t(1), p.blocks_held());
+      CPPUNIT_ASSERT_EQUAL(fhtagn::size_t(1), p.blocks_in_use());
+
+      p.free(ptr);
+      CPPUNIT_ASSERT_EQUAL(false, p.in_use());
+      CPPUNIT_ASSERT_EQUAL(fhtagn::size_t(1), p.trim());
+      CPPUNIT_ASSERT_EQUAL(fhtagn::size_t(0), p.blocks_held());
+    }
+
+
+
+    void testDynamicPoolRetention()
+    {
+      namespace mem = fhtagn::memory;
+
+      // Without retention, empty blocks are released immediately.
+      mem::dynamic_pool<mem::fixed_pool<>, 1024> p;
+      void * ptr = p.alloc(900);
+      CPPUNIT_ASSERT_EQUAL(fhtagn::size_t(1), p.blocks_held());
+      p.free(ptr);
+      CPPUNIT_ASSERT_EQUAL(fhtagn::size_t(0), p.blocks_held());
+
+      // Retain two empty blocks with each of the policies. Allocations are
+      // sized so that each needs a block of it's own.
+      mem::dynamic_pool<mem::fixed_pool<>, 1024, fhtagn::threads::fake_mutex,
+        mem::heap_retention_policy<2> > heap;
+      testDynamicPoolRetentionGeneric(heap, 900);
+
+      mem::dynamic_pool<mem::fixed_pool<>, 4096, fhtagn::threads::fake_mutex,
+        mem::mmap_retention_policy<2> > mapped;
+      testDynamicPoolRetentionGeneric(mapped, 4000);
+
+      mem::dynamic_pool<mem::block_pool<2048>, 4096, fhtagn::threads::fake_mutex,
+        mem::madvise_retention_policy<2> > advised;
+      testDynamicPoolRetentionGeneric(advised, 2048);
     }
 
 
@@ -329,6 +935,314 @@ private:
       // Now free q - that should make room for one more allocation.
       p.free(q);
       CPPUNIT_ASSERT(p.alloc(sizeof(test_int_t)));
+
+      // Freeing q twice must not make room for two allocations.
+      p.free(q);
+      p.free(q);
+      CPPUNIT_ASSERT(p.alloc(sizeof(test_int_t)));
+      CPPUNIT_ASSERT_EQUAL(static_cast<void *>(NULL), p.alloc(sizeof(test_int_t)));
+
+      // Fill a larger pool, which needs a summary spanning several words, then
+      // free every third block and allocate them again.
+      std::vector<char> large_memory(1024 * 1024);
+      mem::block_pool<16> large(&large_memory[0], large_memory.size());
+
+      std::vector<void *> ptrs;
+      void * ptr = NULL;
+      while ((ptr = large.alloc(16))) {
+        ptrs.push_back(ptr);
+      }
+      CPPUNIT_ASSERT(ptrs.size() > 65000);
+      CPPUNIT_ASSERT_EQUAL(ptrs.size(),
+          std::set<void *>(ptrs.begin(), ptrs.end()).size());
+
+      std::set<void *> freed;
+      for (std::vector<void *>::size_type i = 0 ; i < ptrs.size() ; i += 3) {
+        large.free(ptrs[i]);
+        freed.insert(ptrs[i]);
+      }
+      for (std::set<void *>::size_type i = 0 ; i < freed.size() ; ++i) {
+        ptr = large.alloc(16);
+        CPPUNIT_ASSERT(freed.end() != freed.find(ptr));
+      }
+      CPPUNIT_ASSERT_EQUAL(static_cast<void *>(NULL), large.alloc(16));
+
+      for (std::vector<void *>::size_type i = 0 ; i < ptrs.size() ; ++i) {
+        large.free(ptrs[i]);
+      }
+      CPPUNIT_ASSERT_EQUAL(false, large.in_use());
+    }
+
+
+
+    template <
+      typename poolT
+    >
+    void testAlignedObjects(poolT & pool, fhtagn::size_t size,
+        fhtagn::size_t alignment, fhtagn::size_t count)
+    {
+      // Each object must be aligned, and no two objects may share an aligned
+      // block of memory.
+      std::set<fhtagn::size_t> blocks;
+      std::vector<void *> ptrs;
+      for (fhtagn::size_t i = 0 ; i < count ; ++i) {
+        void * ptr = pool.alloc(size);
+        CPPUNIT_ASSERT(ptr);
+        ptrs.push_back(ptr);
+
+        fhtagn::size_t addr = reinterpret_cast<fhtagn::size_t>(ptr);
+        CPPUNIT_ASSERT_EQUAL(fhtagn::size_t(0), addr % alignment);
+        for (fhtagn::size_t block = addr / alignment
+            ; block <= (addr + size - 1) / alignment ; ++block)
+        {
+          CPPUNIT_ASSERT(blocks.insert(block).second);
+        }
+      }
+
+      for (std::vector<void *>::iterator iter = ptrs.begin()
+          ; iter != ptrs.end() ; ++iter)
+      {
+        pool.free(*iter);
+      }
+      CPPUNIT_ASSERT_EQUAL(false, pool.in_use());
+    }
+
+
+
+    void testCacheLineAlignment()
+    {
+      namespace mem = fhtagn::memory;
+
+      fhtagn::size_t const line = FHTAGN_CACHE_LINE_SIZE;
+      CPPUNIT_ASSERT_EQUAL(line,
+          fhtagn::size_t(mem::cache_line_alignment::BLOCK_SIZE));
+      CPPUNIT_ASSERT_EQUAL(fhtagn::size_t(FHTAGN_PAGE_SIZE),
+          fhtagn::size_t(mem::page_alignment::BLOCK_SIZE));
+
+      // Object strides are only padded if the alignment asks for it.
+      CPPUNIT_ASSERT_EQUAL(fhtagn::size_t(24), fhtagn::size_t(
+            mem::object_stride<24, mem::cache_line_alignment>::value));
+      CPPUNIT_ASSERT_EQUAL(line, fhtagn::size_t(
+            mem::object_stride<24, mem::cache_line_padding>::value));
+      CPPUNIT_ASSERT_EQUAL(2 * line, fhtagn::size_t(
+            mem::object_stride<FHTAGN_CACHE_LINE_SIZE + 1,
+              mem::cache_line_padding>::value));
+
+      std::vector<char> memory(64 * 1024);
+
+      // Padded block_pools, both locking and lock-free, place every block on
+      // it's own cache line, even from an unaligned memory block.
+      {
+        mem::block_pool<24, fhtagn::threads::fake_mutex,
+          mem::cache_line_padding> p(&memory[1], memory.size() - 1);
+        testAlignedObjects(p, 24, line, 500);
+      }
+      {
+        mem::block_pool<24, fhtagn::threads::lock_free,
+          mem::cache_line_padding> p(&memory[1], memory.size() - 1);
+        testAlignedObjects(p, 24, line, 500);
+      }
+
+      // fixed_pool rounds allocations up to the block size anyway, so cache
+      // line or page alignment keeps allocations apart without padding.
+      {
+        mem::fixed_pool<fhtagn::threads::fake_mutex,
+          mem::cache_line_alignment> p(&memory[1], memory.size() - 1);
+        testAlignedObjects(p, 10, line, 200);
+      }
+      {
+        mem::fixed_pool<fhtagn::threads::fake_mutex,
+          mem::page_alignment> p(&memory[1], memory.size() - 1);
+        testAlignedObjects(p, 10, FHTAGN_PAGE_SIZE, 5);
+      }
+
+      // size_based_pool pads all size classes, and aligns large objects.
+      {
+        mem::size_based_pool<256, 1, 256, fhtagn::meta::multi_double,
+          fhtagn::threads::fake_mutex, mem::heap_source,
+          mem::cache_line_padding> p;
+        testMemoryPoolGeneric(p);
+        testAlignedObjects(p, 1, line, 1000);
+        testAlignedObjects(p, 100, line, 1000);
+        testAlignedObjects(p, 1000, line, 10);
+      }
+    }
+
+
+
+    template <
+      typename sourceT
+    >
+    void testMemorySourceGeneric()
+    {
+      // Alignments up to and beyond the page size must be honoured.
+      fhtagn::size_t const alignments[] = { 16, 4096, 64 * 1024 };
+      for (int i = 0 ; i < 3 ; ++i) {
+        fhtagn::size_t size = 3 * 4096;
+        void * block = sourceT::allocate(size, alignments[i]);
+        CPPUNIT_ASSERT(block);
+        CPPUNIT_ASSERT_EQUAL(fhtagn::size_t(0),
+            reinterpret_cast<fhtagn::size_t>(block) % alignments[i]);
+        ::memset(block, 0xab, size);
+        sourceT::release(block, size);
+      }
+    }
+
+
+
+    void testMemorySources()
+    {
+      namespace mem = fhtagn::memory;
+
+      testMemorySourceGeneric<mem::heap_source>();
+      testMemorySourceGeneric<mem::mmap_source>();
+      testMemorySourceGeneric<mem::hugepage_source<> >();
+      testMemorySourceGeneric<mem::numa_source<0> >();
+      testMemorySourceGeneric<mem::first_touch_source<> >();
+      testMemorySourceGeneric<mem::registry_source<> >();
+
+      // registry_source knows which pointers lie in it's blocks.
+      typedef mem::registry_source<mem::heap_source> registry_t;
+      int on_stack = 0;
+      CPPUNIT_ASSERT_EQUAL(false, registry_t::owns(&on_stack));
+      CPPUNIT_ASSERT_EQUAL(false, registry_t::owns(NULL));
+
+      fhtagn::size_t registered = 100 * 1024;
+      char * reg = static_cast<char *>(registry_t::allocate(registered, 16));
+      CPPUNIT_ASSERT(reg);
+      CPPUNIT_ASSERT(registry_t::owns(reg));
+      CPPUNIT_ASSERT(registry_t::owns(reg + registered / 2));
+      CPPUNIT_ASSERT(registry_t::owns(reg + registered - 1));
+      registry_t::release(reg, registered);
+      CPPUNIT_ASSERT_EQUAL(false, registry_t::owns(reg));
+      CPPUNIT_ASSERT_EQUAL(false, registry_t::owns(reg + registered - 1));
+
+      // Huge page sized blocks come back huge page aligned, whether or not
+      // huge pages are actually available.
+      fhtagn::size_t huge = 2 * 1024 * 1024;
+      void * block = mem::hugepage_source<>::allocate(huge, 4096);
+      CPPUNIT_ASSERT(block);
+      CPPUNIT_ASSERT_EQUAL(fhtagn::size_t(0),
+          reinterpret_cast<fhtagn::size_t>(block) % huge);
+      ::memset(block, 0xab, huge);
+      mem::hugepage_source<>::release(block, huge);
+
+      // Pools growing from the different sources.
+      mem::size_based_pool<256, 1, 256, fhtagn::meta::multi_double,
+        fhtagn::threads::fake_mutex, mem::mmap_source> sp;
+      testMemoryPoolGeneric(sp);
+      CPPUNIT_ASSERT_EQUAL(false, sp.in_use());
+
+      mem::size_based_pool<256, 1, 256, fhtagn::meta::multi_double,
+        fhtagn::threads::fake_mutex, mem::numa_source<0> > np;
+      testMemoryPoolGeneric(np);
+      CPPUNIT_ASSERT_EQUAL(false, np.in_use());
+
+      mem::dynamic_pool<mem::fixed_pool<>, 4096, fhtagn::threads::fake_mutex,
+        mem::mmap_retention_policy<2, mem::first_touch_source<> > > dp;
+      testDynamicPoolRetentionGeneric(dp, 4000);
+
+      mem::dynamic_pool<mem::block_pool<2048>, 4096, fhtagn::threads::fake_mutex,
+        mem::madvise_retention_policy<2, mem::hugepage_source<> > > hp;
+      testDynamicPoolRetentionGeneric(hp, 2048);
+
+      mem::monotonic_pool<4096, fhtagn::threads::fake_mutex,
+        mem::block_alignment<>, mem::mmap_source> mp;
+      testMemoryPoolGeneric(mp);
+      CPPUNIT_ASSERT(mp.alloc(10000));
+      mp.reset();
+      CPPUNIT_ASSERT_EQUAL(false, mp.in_use());
+    }
+
+
+
+    void testMonotonicMemoryPool()
+    {
+      namespace mem = fhtagn::memory;
+
+      {
+        mem::monotonic_pool<> p;
+
+        CPPUNIT_ASSERT_EQUAL(false, p.in_use());
+        testMemoryPoolGeneric(p);
+        CPPUNIT_ASSERT_EQUAL(true, p.in_use());
+        p.reset();
+        CPPUNIT_ASSERT_EQUAL(false, p.in_use());
+      }
+
+      // Allocations are handed out back to back; the most recent one can grow
+      // and shrink in place.
+      mem::monotonic_pool<1024> p;
+      char * a = static_cast<char *>(p.alloc(16));
+      char * b = static_cast<char *>(p.alloc(16));
+      CPPUNIT_ASSERT(a);
+      CPPUNIT_ASSERT(b > a);
+      CPPUNIT_ASSERT(p.alloc_size(b) >= 16);
+      CPPUNIT_ASSERT_EQUAL(static_cast<void *>(b), p.realloc(b, 100));
+      CPPUNIT_ASSERT(p.alloc_size(b) >= 100);
+      CPPUNIT_ASSERT_EQUAL(static_cast<void *>(b), p.realloc(b, 8));
+
+      // Reallocating anything else moves the data.
+      ::memset(a, 0x5a, 16);
+      char * c = static_cast<char *>(p.realloc(a, 32));
+      CPPUNIT_ASSERT(c > b);
+      for (int i = 0 ; i < 16 ; ++i) {
+        CPPUNIT_ASSERT_EQUAL(char(0x5a), c[i]);
+      }
+
+      // Rewinding to a marker makes the memory after it available again, even
+      // if new blocks had to be chained in the meantime.
+      mem::monotonic_pool<1024>::marker m = p.mark();
+      char * d = static_cast<char *>(p.alloc(16));
+      for (int i = 0 ; i < 1000 ; ++i) {
+        CPPUNIT_ASSERT(p.alloc(24));
+      }
+      // Larger than a block.
+      char * large = static_cast<char *>(p.alloc(5000));
+      CPPUNIT_ASSERT(large);
+      ::memset(large, 0xa5, 5000);
+      CPPUNIT_ASSERT(p.alloc_size(large) >= 5000);
+
+      p.rewind(m);
+      CPPUNIT_ASSERT_EQUAL(true, p.in_use());
+      CPPUNIT_ASSERT_EQUAL(static_cast<void *>(d), p.alloc(16));
+
+      // Rewinding to an empty marker is the same as resetting the pool.
+      p.rewind(mem::monotonic_pool<1024>::marker());
+      CPPUNIT_ASSERT_EQUAL(false, p.in_use());
+      CPPUNIT_ASSERT_EQUAL(static_cast<void *>(a), p.alloc(16));
+
+      // Start out with stack memory, then continue on the heap.
+      char memory[256] = { 0 };
+      mem::monotonic_pool<1024> sp(memory + 1, sizeof(memory) - 1);
+      char * s = static_cast<char *>(sp.alloc(16));
+      CPPUNIT_ASSERT(s > memory && s < memory + sizeof(memory));
+      CPPUNIT_ASSERT(sp.alloc(512));
+      sp.reset();
+      CPPUNIT_ASSERT_EQUAL(static_cast<void *>(s), sp.alloc(16));
+
+      CPPUNIT_ASSERT_EQUAL(static_cast<void *>(NULL), sp.alloc(0));
+      CPPUNIT_ASSERT_EQUAL(static_cast<void *>(NULL), sp.realloc(s, 0));
+
+      // Requests too large for the size arithmetic to hold fail, rather than
+      // wrapping around to small allocations. The most recent allocation
+      // keeps it's size.
+      {
+        mem::monotonic_pool<> hp;
+        fhtagn::size_t const huge = ~fhtagn::size_t(0);
+        CPPUNIT_ASSERT_EQUAL(static_cast<void *>(NULL), hp.alloc(huge));
+        CPPUNIT_ASSERT_EQUAL(static_cast<void *>(NULL), hp.alloc(huge - 8));
+
+        void * ptr = hp.alloc(16);
+        CPPUNIT_ASSERT(ptr);
+        fhtagn::size_t size = hp.alloc_size(ptr);
+        CPPUNIT_ASSERT(size >= 16);
+        CPPUNIT_ASSERT_EQUAL(static_cast<void *>(NULL), hp.realloc(ptr, huge));
+        CPPUNIT_ASSERT_EQUAL(static_cast<void *>(NULL),
+            hp.realloc(ptr, huge - 8));
+        CPPUNIT_ASSERT_EQUAL(size, hp.alloc_size(ptr));
+        CPPUNIT_ASSERT_EQUAL(static_cast<void *>(NULL), hp.realloc(NULL, huge));
+      }
     }
 
 
@@ -357,6 +1271,583 @@ private:
 
 
 
+    void testFallbackPool()
+    {
+      namespace mem = fhtagn::memory;
+
+      // Generic tests first; they fit into the primary pool.
+      {
+        char memory[1500] = { 0 };
+        mem::fixed_pool<> primary(memory, sizeof(memory));
+        mem::heap_pool secondary;
+        mem::fallback_pool<mem::fixed_pool<>, mem::heap_pool> p(primary,
+            secondary);
+        testMemoryPoolGeneric(p);
+        CPPUNIT_ASSERT_EQUAL(fhtagn::size_t(0), p.spills());
+        CPPUNIT_ASSERT_EQUAL(false, primary.in_use());
+      }
+
+      // A full primary pool spills to the secondary, and pointers are freed
+      // to the pool that allocated them.
+      {
+        char memory[300] = { 0 };
+        mem::fixed_pool<> primary(memory, sizeof(memory));
+        mem::dynamic_pool<mem::fixed_pool<>, 1024> secondary;
+        mem::fallback_pool<mem::fixed_pool<>,
+          mem::dynamic_pool<mem::fixed_pool<>, 1024> > p(primary, secondary);
+
+        std::vector<void *> ptrs;
+        for (int i = 0 ; i < 20 ; ++i) {
+          void * ptr = p.alloc(40);
+          CPPUNIT_ASSERT(ptr);
+          ::memset(ptr, i, 40);
+          ptrs.push_back(ptr);
+        }
+        CPPUNIT_ASSERT(p.spills() > 0);
+        CPPUNIT_ASSERT(p.spills() < 20);
+        CPPUNIT_ASSERT_EQUAL(true, primary.in_use());
+        CPPUNIT_ASSERT_EQUAL(true, secondary.in_use());
+
+        fhtagn::size_t in_primary = 0;
+        for (int i = 0 ; i < 20 ; ++i) {
+          CPPUNIT_ASSERT_EQUAL(i, int(static_cast<char *>(ptrs[i])[39]));
+          CPPUNIT_ASSERT(p.alloc_size(ptrs[i]) >= 40);
+          if (primary.owns(ptrs[i])) {
+            ++in_primary;
+          }
+        }
+        CPPUNIT_ASSERT_EQUAL(fhtagn::size_t(20) - p.spills(), in_primary);
+
+        // Growing a primary pointer beyond what the primary pool can hold
+        // moves it to the secondary pool, contents intact.
+        fhtagn::size_t spills = p.spills();
+        void * moved = p.realloc(ptrs[0], 500);
+        CPPUNIT_ASSERT(moved);
+        CPPUNIT_ASSERT(!primary.owns(moved));
+        CPPUNIT_ASSERT_EQUAL(0, int(static_cast<char *>(moved)[39]));
+        CPPUNIT_ASSERT_EQUAL(spills + 1, p.spills());
+        ptrs[0] = moved;
+
+        // Freed space in the primary pool is used again first.
+        p.free(ptrs[1]);
+        ptrs[1] = p.alloc(40);
+        CPPUNIT_ASSERT(primary.owns(ptrs[1]));
+        CPPUNIT_ASSERT_EQUAL(spills + 1, p.spills());
+
+        for (int i = 0 ; i < 20 ; ++i) {
+          p.free(ptrs[i]);
+        }
+        CPPUNIT_ASSERT_EQUAL(false, primary.in_use());
+        CPPUNIT_ASSERT_EQUAL(false, secondary.in_use());
+        CPPUNIT_ASSERT_EQUAL(false, p.in_use());
+      }
+
+      // Bulk allocations are completed from the secondary pool.
+      {
+        typedef mem::block_pool<16> primary_t;
+        typedef mem::dynamic_pool<mem::block_pool<16>, 1024> secondary_t;
+
+        std::vector<char> memory(32 * 16);
+        primary_t primary(&memory[0], memory.size());
+        secondary_t secondary;
+        mem::fallback_pool<primary_t, secondary_t> p(primary, secondary);
+
+        std::vector<void *> ptrs(100);
+        CPPUNIT_ASSERT_EQUAL(fhtagn::size_t(100),
+            mem::alloc_bulk(p, 16, 100, &ptrs[0]));
+        CPPUNIT_ASSERT(p.spills() > 60);
+        CPPUNIT_ASSERT_EQUAL(static_cast<void *>(NULL), primary.alloc(16));
+
+        mem::free_bulk(p, &ptrs[0], 100);
+        CPPUNIT_ASSERT_EQUAL(false, primary.in_use());
+        CPPUNIT_ASSERT_EQUAL(false, secondary.in_use());
+      }
+    }
+
+
+
+    void testDebugPool()
+    {
+      namespace mem = fhtagn::memory;
+
+      typedef mem::debug_pool<mem::heap_pool, 4> heap_debug_t;
+
+      {
+        mem::heap_pool hp;
+        heap_debug_t p(hp);
+        testMemoryPoolGeneric(p);
+        CPPUNIT_ASSERT_EQUAL(false, p.in_use());
+        CPPUNIT_ASSERT_EQUAL(fhtagn::size_t(4), p.quarantined());
+        p.verify();
+      }
+
+      {
+        char memory[2000] = { 0 };
+        mem::fixed_pool<> fp(memory, sizeof(memory));
+        mem::debug_pool<mem::fixed_pool<> > p(fp);
+        testMemoryPoolGeneric(p);
+        p.flush();
+        CPPUNIT_ASSERT_EQUAL(false, fp.in_use());
+      }
+
+      mem::heap_pool hp;
+      heap_debug_t p(hp);
+
+      // New memory is filled with a pattern, and alloc_size() reports the
+      // requested size exactly.
+      unsigned char * ptr = static_cast<unsigned char *>(p.alloc(13));
+      CPPUNIT_ASSERT(ptr);
+      CPPUNIT_ASSERT_EQUAL(fhtagn::size_t(13), p.alloc_size(ptr));
+      CPPUNIT_ASSERT_EQUAL(int(heap_debug_t::ALLOC_PATTERN), int(ptr[12]));
+      CPPUNIT_ASSERT_EQUAL(fhtagn::size_t(1), p.live());
+
+      // realloc() moves the data, and quarantines the old pointer.
+      ::memset(ptr, 42, 13);
+      unsigned char * moved = static_cast<unsigned char *>(p.realloc(ptr, 100));
+      CPPUNIT_ASSERT(moved && moved != ptr);
+      CPPUNIT_ASSERT_EQUAL(42, int(moved[12]));
+      CPPUNIT_ASSERT_EQUAL(fhtagn::size_t(1), p.quarantined());
+      CPPUNIT_ASSERT_THROW(p.free(ptr), std::logic_error);
+      p.free(moved);
+
+      // Single byte over- and underruns are caught on free() and verify().
+      ptr = static_cast<unsigned char *>(p.alloc(13));
+      ptr[13] = 0;
+      CPPUNIT_ASSERT_THROW(p.verify(), std::logic_error);
+      CPPUNIT_ASSERT_THROW(p.free(ptr), std::logic_error);
+      ptr[13] = heap_debug_t::GUARD_PATTERN;
+      ptr[-1] = 0;
+      CPPUNIT_ASSERT_THROW(p.free(ptr), std::logic_error);
+      ptr[-1] = heap_debug_t::GUARD_PATTERN;
+      p.verify();
+      p.free(ptr);
+
+      // Writes to quarantined memory are caught by verify(), and when the
+      // allocation leaves the quarantine.
+      p.flush();
+      ptr = static_cast<unsigned char *>(p.alloc(20));
+      p.free(ptr);
+      ptr[5] = 0;
+      CPPUNIT_ASSERT_THROW(p.verify(), std::logic_error);
+      for (int i = 0 ; i < 3 ; ++i) {
+        p.free(p.alloc(8));
+      }
+      CPPUNIT_ASSERT_THROW(p.free(p.alloc(8)), std::logic_error);
+      p.verify();
+      CPPUNIT_ASSERT_EQUAL(fhtagn::size_t(4), p.quarantined());
+      CPPUNIT_ASSERT_EQUAL(false, p.in_use());
+    }
+
+
+
+    void testStatisticsPool()
+    {
+      namespace mem = fhtagn::memory;
+
+      // Without statistics, the wrapper holds nothing but the reference to the
+      // wrapped pool.
+      CPPUNIT_ASSERT(sizeof(mem::statistics_pool<mem::fixed_pool<>,
+            mem::no_statistics>) <= sizeof(void *) + sizeof(void *));
+
+      {
+        char memory[1024] = { 0 };
+        mem::fixed_pool<> p(memory, sizeof(memory));
+        mem::statistics_pool<mem::fixed_pool<> > sp(p);
+
+        testMemoryPoolGeneric(sp);
+
+        mem::pool_statistics stats = sp.snapshot();
+        CPPUNIT_ASSERT_EQUAL(fhtagn::size_t(2), stats.allocs);
+        CPPUNIT_ASSERT_EQUAL(fhtagn::size_t(2), stats.reallocs);
+        CPPUNIT_ASSERT_EQUAL(fhtagn::size_t(2), stats.frees);
+        CPPUNIT_ASSERT_EQUAL(fhtagn::size_t(0), stats.failed_allocs);
+        CPPUNIT_ASSERT_EQUAL(fhtagn::size_t(0), stats.bytes_live);
+        CPPUNIT_ASSERT(stats.bytes_high_water >= 666);
+        CPPUNIT_ASSERT_EQUAL(fhtagn::size_t(0), stats.contended_locks);
+
+        // 42, 123, 200 and 666 bytes fall into different buckets.
+        CPPUNIT_ASSERT_EQUAL(fhtagn::size_t(1), stats.size_histogram[5]);
+        CPPUNIT_ASSERT_EQUAL(fhtagn::size_t(1), stats.size_histogram[6]);
+        CPPUNIT_ASSERT_EQUAL(fhtagn::size_t(1), stats.size_histogram[7]);
+        CPPUNIT_ASSERT_EQUAL(fhtagn::size_t(1), stats.size_histogram[9]);
+
+        CPPUNIT_ASSERT_EQUAL(static_cast<void *>(NULL), sp.alloc(sizeof(memory)));
+        stats = sp.snapshot();
+        CPPUNIT_ASSERT_EQUAL(fhtagn::size_t(1), stats.failed_allocs);
+
+        std::ostringstream text;
+        stats.write_text(text);
+        CPPUNIT_ASSERT(std::string::npos != text.str().find("failed allocs:    1"));
+
+        std::ostringstream json;
+        stats.write_json(json);
+        CPPUNIT_ASSERT(std::string::npos != json.str().find("\"allocs\":2,"));
+        CPPUNIT_ASSERT(std::string::npos != json.str().find("\"failed_allocs\":1,"));
+      }
+
+      {
+        mem::heap_pool p;
+        mem::statistics_pool<mem::heap_pool> sp(p);
+        void * ptr = sp.alloc(100);
+        CPPUNIT_ASSERT_EQUAL(p.alloc_size(ptr), sp.snapshot().bytes_live);
+        sp.free(ptr);
+        CPPUNIT_ASSERT_EQUAL(fhtagn::size_t(0), sp.snapshot().bytes_live);
+      }
+
+      {
+        char memory[300] = { 0 };
+        mem::block_pool<sizeof(test_int_t)> p(memory, sizeof(memory));
+        mem::statistics_pool<mem::block_pool<sizeof(test_int_t)> > sp(p);
+        void * ptr = sp.alloc(sizeof(test_int_t));
+        CPPUNIT_ASSERT_EQUAL(fhtagn::size_t(sizeof(test_int_t)),
+            sp.snapshot().bytes_live);
+        sp.free(ptr);
+        CPPUNIT_ASSERT_EQUAL(fhtagn::size_t(0), sp.snapshot().bytes_live);
+      }
+
+      {
+        dynamic_pool_t p;
+        mem::statistics_pool<dynamic_pool_t> sp(p);
+        testMemoryPoolGeneric(sp);
+        CPPUNIT_ASSERT_EQUAL(fhtagn::size_t(0), sp.snapshot().bytes_live);
+      }
+    }
+
+
+
+    struct counted
+    {
+      static int live;
+      static int copies_left;   // Copying throws once this drops to zero;
+                                // negative means copying never throws.
+
+      counted(int v = 0)
+        : value(v)
+      {
+        ++live;
+      }
+
+      counted(counted const & other)
+        : value(other.value)
+      {
+        if (!copies_left) {
+          throw std::runtime_error("counted: copy failed");
+        }
+        --copies_left;
+        ++live;
+      }
+
+      ~counted()
+      {
+        --live;
+      }
+
+      int value;
+    };
+
+
+
+    void testPoolVector()
+    {
+      namespace mem = fhtagn::memory;
+
+      CPPUNIT_ASSERT_EQUAL(true, mem::is_trivially_relocatable<int>::value);
+      CPPUNIT_ASSERT_EQUAL(false, mem::is_trivially_relocatable<counted>::value);
+
+      mem::heap_pool hp;
+      {
+        mem::pool_vector<int> v(hp);
+        CPPUNIT_ASSERT(v.empty());
+        for (int i = 0 ; i < 10000 ; ++i) {
+          v.push_back(i);
+        }
+        CPPUNIT_ASSERT_EQUAL(fhtagn::size_t(10000), v.size());
+        CPPUNIT_ASSERT(v.capacity() >= v.size());
+        for (int i = 0 ; i < 10000 ; ++i) {
+          CPPUNIT_ASSERT_EQUAL(i, v[i]);
+        }
+
+        // Pushing back an element of the vector itself must work, even if the
+        // vector grows.
+        v.resize(v.capacity());
+        v.push_back(v[1]);
+        CPPUNIT_ASSERT_EQUAL(1, v.back());
+
+        v.erase(v.begin(), v.begin() + 5);
+        CPPUNIT_ASSERT_EQUAL(5, v.front());
+        v.resize(3);
+        CPPUNIT_ASSERT_EQUAL(fhtagn::size_t(3), v.size());
+        CPPUNIT_ASSERT_EQUAL(7, v.at(2));
+        CPPUNIT_ASSERT_THROW(v.at(3), std::out_of_range);
+
+        mem::pool_vector<int> w(v);
+        CPPUNIT_ASSERT_EQUAL(fhtagn::size_t(3), w.size());
+        CPPUNIT_ASSERT_EQUAL(6, w[1]);
+
+        mem::pool_vector<int> x(hp, 10, 42);
+        x = w;
+        CPPUNIT_ASSERT_EQUAL(fhtagn::size_t(3), x.size());
+        x.clear();
+        swap(x, w);
+        CPPUNIT_ASSERT(w.empty());
+        CPPUNIT_ASSERT_EQUAL(fhtagn::size_t(3), x.size());
+      }
+
+      // With nothing following it in a fixed_pool, the vector's storage grows in
+      // place.
+      {
+        char memory[4096] = { 0 };
+        mem::fixed_pool<> fp(memory, sizeof(memory));
+        mem::pool_vector<int, mem::fixed_pool<> > v(fp);
+        v.reserve(16);
+        for (int i = 0 ; i < 16 ; ++i) {
+          v.push_back(i);
+        }
+        int * data = v.data();
+        v.push_back(16);
+        CPPUNIT_ASSERT_EQUAL(data, v.data());
+        v.reserve(512);
+        CPPUNIT_ASSERT_EQUAL(data, v.data());
+        for (int i = 0 ; i < 17 ; ++i) {
+          CPPUNIT_ASSERT_EQUAL(i, v[i]);
+        }
+
+        // Allocation failure leaves the vector intact.
+        CPPUNIT_ASSERT_THROW(v.reserve(sizeof(memory)), std::bad_alloc);
+        CPPUNIT_ASSERT_EQUAL(fhtagn::size_t(17), v.size());
+        CPPUNIT_ASSERT_EQUAL(16, v.back());
+      }
+
+      // Types that aren't trivially relocatable get copied and destroyed
+      // properly.
+      {
+        mem::pool_vector<counted> v(hp);
+        for (int i = 0 ; i < 1000 ; ++i) {
+          v.push_back(counted(i));
+          CPPUNIT_ASSERT_EQUAL(int(v.size()), counted::live);
+        }
+        for (int i = 0 ; i < 1000 ; ++i) {
+          CPPUNIT_ASSERT_EQUAL(i, v[i].value);
+        }
+        v.erase(v.begin());
+        CPPUNIT_ASSERT_EQUAL(999, counted::live);
+        CPPUNIT_ASSERT_EQUAL(1, v.front().value);
+      }
+      CPPUNIT_ASSERT_EQUAL(0, counted::live);
+
+      // Constructors that fail to copy an element destroy the elements already
+      // copied, and release their memory.
+      {
+        mem::heap_pool backing;
+        mem::debug_pool<mem::heap_pool> dp(backing);
+        mem::pool_vector<counted, mem::debug_pool<mem::heap_pool> > v(dp, 10);
+        CPPUNIT_ASSERT_EQUAL(10, counted::live);
+
+        typedef mem::pool_vector<counted, mem::debug_pool<mem::heap_pool> >
+          vector_t;
+        counted::copies_left = 5;
+        CPPUNIT_ASSERT_THROW(vector_t copy(v), std::runtime_error);
+        CPPUNIT_ASSERT_EQUAL(10, counted::live);
+
+        counted::copies_left = 5;
+        CPPUNIT_ASSERT_THROW(vector_t filled(dp, 10, counted(1)),
+            std::runtime_error);
+        CPPUNIT_ASSERT_EQUAL(10, counted::live);
+
+        counted::copies_left = -1;
+        v.clear();
+        CPPUNIT_ASSERT_EQUAL(0, counted::live);
+        CPPUNIT_ASSERT_EQUAL(fhtagn::size_t(1), dp.live());
+      }
+    }
+
+
+
+    template <
+      typename poolT
+    >
+    void testBulkGeneric(poolT & pool, fhtagn::size_t size,
+        fhtagn::size_t count)
+    {
+      namespace mem = fhtagn::memory;
+
+      std::vector<void *> ptrs(count, static_cast<void *>(NULL));
+      CPPUNIT_ASSERT_EQUAL(fhtagn::size_t(0),
+          mem::alloc_bulk(pool, 0, count, &ptrs[0]));
+      CPPUNIT_ASSERT_EQUAL(count, mem::alloc_bulk(pool, size, count, &ptrs[0]));
+
+      // All pointers are distinct and usable; stamp each and check the stamps
+      // afterwards, so overlapping allocations are detected.
+      std::set<void *> unique;
+      for (fhtagn::size_t i = 0 ; i < count ; ++i) {
+        CPPUNIT_ASSERT(ptrs[i]);
+        CPPUNIT_ASSERT(unique.insert(ptrs[i]).second);
+        CPPUNIT_ASSERT(pool.alloc_size(ptrs[i]) >= size);
+        ::memset(ptrs[i], int(i & 0xff), size);
+      }
+      for (fhtagn::size_t i = 0 ; i < count ; ++i) {
+        unsigned char * bytes = static_cast<unsigned char *>(ptrs[i]);
+        CPPUNIT_ASSERT_EQUAL(int(i & 0xff), int(bytes[0]));
+        CPPUNIT_ASSERT_EQUAL(int(i & 0xff), int(bytes[size - 1]));
+      }
+      CPPUNIT_ASSERT_EQUAL(true, pool.in_use());
+
+      // Pointers from the bulk API can be freed individually, and pointers
+      // from alloc() in bulk.
+      pool.free(ptrs[0]);
+      ptrs[0] = pool.alloc(size);
+      CPPUNIT_ASSERT(ptrs[0]);
+      mem::free_bulk(pool, &ptrs[0], count);
+    }
+
+
+
+    struct bulk_tag {};
+
+    void testBulkAllocation()
+    {
+      namespace mem = fhtagn::memory;
+
+      // Pools with a native bulk path, and the generic fallback.
+      CPPUNIT_ASSERT_EQUAL(true, bool(mem::detail::has_bulk_api<
+            mem::block_pool<8> >::value));
+      CPPUNIT_ASSERT_EQUAL(true, bool(mem::detail::has_bulk_api<
+            mem::fixed_pool<> >::value));
+      CPPUNIT_ASSERT_EQUAL(false, bool(mem::detail::has_bulk_api<
+            mem::heap_pool>::value));
+
+      {
+        mem::heap_pool p;
+        testBulkGeneric(p, 24, 100);
+      }
+
+      {
+        // More blocks than fit into one bitmap word, so alloc_bulk() has to
+        // move on to further words.
+        std::vector<char> memory(200 * 8);
+        mem::block_pool<8> p(&memory[0], memory.size());
+        testBulkGeneric(p, 8, 150);
+        CPPUNIT_ASSERT_EQUAL(false, p.in_use());
+
+        // Requests of the wrong size fail, and a batch larger than the pool
+        // is satisfied partially.
+        std::vector<void *> ptrs(300);
+        CPPUNIT_ASSERT_EQUAL(fhtagn::size_t(0),
+            mem::alloc_bulk(p, 4, 10, &ptrs[0]));
+        fhtagn::size_t got = mem::alloc_bulk(p, 8, 300, &ptrs[0]);
+        CPPUNIT_ASSERT(got > 150 && got < 200);
+        CPPUNIT_ASSERT_EQUAL(static_cast<void *>(NULL), p.alloc(8));
+        mem::free_bulk(p, &ptrs[0], got);
+        CPPUNIT_ASSERT_EQUAL(false, p.in_use());
+      }
+
+      {
+        typedef mem::block_pool<8, fhtagn::threads::lock_free> pool_t;
+        std::vector<char> memory(200 * 8);
+        pool_t p(&memory[0], memory.size());
+        testBulkGeneric(p, 8, 150);
+        CPPUNIT_ASSERT_EQUAL(false, p.in_use());
+
+        std::vector<void *> ptrs(300);
+        fhtagn::size_t got = mem::alloc_bulk(p, 8, 300, &ptrs[0]);
+        CPPUNIT_ASSERT(got > 150 && got < 200);
+        CPPUNIT_ASSERT_EQUAL(static_cast<void *>(NULL), p.alloc(8));
+        mem::free_bulk(p, &ptrs[0], got);
+        CPPUNIT_ASSERT_EQUAL(false, p.in_use());
+      }
+
+      {
+        // With an empty fixed_pool, the batch is carved from a single free
+        // segment, so the objects are adjacent.
+        char memory[4096] = { 0 };
+        mem::fixed_pool<> p(memory, sizeof(memory));
+        testBulkGeneric(p, 20, 50);
+        CPPUNIT_ASSERT_EQUAL(false, p.in_use());
+
+        void * ptrs[4];
+        CPPUNIT_ASSERT_EQUAL(fhtagn::size_t(4), mem::alloc_bulk(p, 24, 4, ptrs));
+        for (int i = 1 ; i < 4 ; ++i) {
+          CPPUNIT_ASSERT(ptrs[i] > ptrs[i - 1]);
+          CPPUNIT_ASSERT(static_cast<char *>(ptrs[i])
+              - static_cast<char *>(ptrs[i - 1]) < 64);
+        }
+
+        // The carved segments are ordinary segments: freeing them in any
+        // order coalesces the pool back into a single free segment.
+        p.free(ptrs[2]);
+        p.free(ptrs[0]);
+        mem::free_bulk(p, ptrs + 1, 1);
+        p.free(ptrs[3]);
+        CPPUNIT_ASSERT_EQUAL(false, p.in_use());
+        CPPUNIT_ASSERT(p.alloc(3000));
+
+        // A fragmented pool falls back to allocating object by object.
+        mem::fixed_pool<> fragmented(memory, sizeof(memory));
+        std::vector<void *> holes;
+        void * ptr = NULL;
+        while ((ptr = fragmented.alloc(40))) {
+          holes.push_back(ptr);
+        }
+        for (fhtagn::size_t i = 0 ; i < holes.size() ; i += 2) {
+          fragmented.free(holes[i]);
+        }
+        std::vector<void *> ptrs2(holes.size());
+        fhtagn::size_t got = mem::alloc_bulk(fragmented, 40, holes.size(),
+            &ptrs2[0]);
+        CPPUNIT_ASSERT_EQUAL((holes.size() + 1) / 2, got);
+        mem::free_bulk(fragmented, &ptrs2[0], got);
+      }
+
+      {
+        mem::dynamic_pool<mem::fixed_pool<>, 1024> p;
+        testBulkGeneric(p, 20, 200);
+        CPPUNIT_ASSERT_EQUAL(false, p.in_use());
+      }
+
+      {
+        mem::dynamic_pool<mem::block_pool<16>, 1024> p;
+        testBulkGeneric(p, 16, 300);
+        CPPUNIT_ASSERT_EQUAL(false, p.in_use());
+      }
+
+      {
+        mem::monotonic_pool<> p;
+        testBulkGeneric(p, 24, 500);
+        p.reset();
+        CPPUNIT_ASSERT_EQUAL(false, p.in_use());
+      }
+
+      {
+        mem::size_based_pool<> p;
+        testBulkGeneric(p, 24, 500);
+        CPPUNIT_ASSERT_EQUAL(false, p.in_use());
+      }
+
+      // Allocation policies pass batches on to the pool.
+      {
+        typedef mem::raw_pool_allocation_policy<test_int_t,
+                mem::block_pool<sizeof(test_int_t)>, bulk_tag> policy_t;
+
+        std::vector<char> memory(1000 * sizeof(test_int_t));
+        mem::block_pool<sizeof(test_int_t)> p(&memory[0], memory.size());
+        policy_t::global_memory_pool = &p;
+
+        policy_t policy;
+        std::vector<test_int_t *> ptrs(600);
+        CPPUNIT_ASSERT_EQUAL(fhtagn::size_t(600),
+            policy.allocate_bulk(600, &ptrs[0]));
+        std::set<test_int_t *> unique(ptrs.begin(), ptrs.end());
+        CPPUNIT_ASSERT_EQUAL(fhtagn::size_t(600), unique.size());
+        CPPUNIT_ASSERT_EQUAL(true, p.in_use());
+        policy.deallocate_bulk(&ptrs[0], 600);
+        CPPUNIT_ASSERT_EQUAL(false, p.in_use());
+
+        policy_t::global_memory_pool = NULL;
+      }
+    }
+
+
+
     void testSizeBasedMemoryPool()
     {
       namespace mem = fhtagn::memory;
@@ -370,6 +1861,83 @@ private:
 
 
 
+    void testSizeBasedPoolSizeClasses()
+    {
+      namespace mem = fhtagn::memory;
+
+      // Default pool: size classes 1, 2, 4, ..., 256
+      mem::size_based_pool<> p;
+      CPPUNIT_ASSERT_EQUAL(fhtagn::size_t(9), p.size_classes());
+      CPPUNIT_ASSERT_EQUAL(fhtagn::size_t(0), p.size_class(1));
+      CPPUNIT_ASSERT_EQUAL(fhtagn::size_t(2), p.size_class(3));
+      CPPUNIT_ASSERT_EQUAL(fhtagn::size_t(2), p.size_class(4));
+      CPPUNIT_ASSERT_EQUAL(fhtagn::size_t(3), p.size_class(5));
+      CPPUNIT_ASSERT_EQUAL(fhtagn::size_t(8), p.size_class(256));
+      CPPUNIT_ASSERT_EQUAL(p.size_classes(), p.size_class(257));
+      CPPUNIT_ASSERT_EQUAL(fhtagn::size_t(128), p.class_size(7));
+
+      // Pointers know their size class, and sizes are reported per class.
+      void * small = p.alloc(100);
+      CPPUNIT_ASSERT(small);
+      CPPUNIT_ASSERT_EQUAL(fhtagn::size_t(7), p.size_class_of(small));
+      CPPUNIT_ASSERT_EQUAL(fhtagn::size_t(128), p.alloc_size(small));
+
+      // Large objects report the requested size.
+      void * large = p.alloc(1000);
+      CPPUNIT_ASSERT(large);
+      CPPUNIT_ASSERT_EQUAL(p.size_classes(), p.size_class_of(large));
+      CPPUNIT_ASSERT_EQUAL(fhtagn::size_t(1000), p.alloc_size(large));
+
+      // Large objects don't get a chunk of their own, so they're not all at the
+      // same offset into a chunk.
+      std::vector<void *> larges;
+      std::set<fhtagn::size_t> offsets;
+      for (int i = 0 ; i < 8 ; ++i) {
+        void * ptr = p.alloc(1000);
+        CPPUNIT_ASSERT(ptr);
+        CPPUNIT_ASSERT_EQUAL(p.size_classes(), p.size_class_of(ptr));
+        larges.push_back(ptr);
+        offsets.insert(reinterpret_cast<fhtagn::size_t>(ptr)
+            % mem::size_based_pool<>::CHUNK_SIZE);
+      }
+      CPPUNIT_ASSERT(offsets.size() > 1);
+      p.free_bulk(&larges[0], larges.size());
+
+      // Pointers from a different pool are not ours.
+      mem::size_based_pool<> other;
+      CPPUNIT_ASSERT_EQUAL(other.size_classes(), other.size_class_of(small));
+      CPPUNIT_ASSERT_EQUAL(fhtagn::size_t(0), other.alloc_size(large));
+      other.free(small);
+      CPPUNIT_ASSERT_EQUAL(true, p.in_use());
+
+      // Growing a pooled object into a large one keeps the contents.
+      ::memset(small, 0xab, 100);
+      void * grown = p.realloc(small, 500);
+      CPPUNIT_ASSERT(grown);
+      CPPUNIT_ASSERT_EQUAL(fhtagn::size_t(500), p.alloc_size(grown));
+      CPPUNIT_ASSERT_EQUAL(char(0xab), static_cast<char *>(grown)[99]);
+
+      p.free(grown);
+      p.free(large);
+      CPPUNIT_ASSERT_EQUAL(false, p.in_use());
+
+      // Size classes 6, 18, 30, ..., 102 with a lookup granularity of 6
+      mem::size_based_pool<32, 6, 102, inc_by_twelve> q;
+      CPPUNIT_ASSERT_EQUAL(fhtagn::size_t(9), q.size_classes());
+      CPPUNIT_ASSERT_EQUAL(fhtagn::size_t(0), q.size_class(1));
+      CPPUNIT_ASSERT_EQUAL(fhtagn::size_t(0), q.size_class(6));
+      CPPUNIT_ASSERT_EQUAL(fhtagn::size_t(1), q.size_class(7));
+      CPPUNIT_ASSERT_EQUAL(fhtagn::size_t(1), q.size_class(18));
+      CPPUNIT_ASSERT_EQUAL(fhtagn::size_t(2), q.size_class(19));
+      CPPUNIT_ASSERT_EQUAL(fhtagn::size_t(8), q.size_class(102));
+      CPPUNIT_ASSERT_EQUAL(q.size_classes(), q.size_class(103));
+
+      testMemoryPoolGeneric(q);
+      CPPUNIT_ASSERT_EQUAL(false, q.in_use());
+    }
+
+
+
     template <
       typename allocatorT
     >
@@ -498,7 +2066,83 @@ private:
     }
 
 
+    void testMonotonicPoolAllocator()
+    {
+      namespace mem = fhtagn::memory;
+
+      typedef mem::allocator<
+        test_int_t,
+        mem::pool_allocation_policy<
+          test_int_t,
+          mem::monotonic_pool<>
+        >
+      > allocator_t;
+
+      // Nothing is ever freed, so the pool stays in use until it's reset.
+      mem::monotonic_pool<> * p = new mem::monotonic_pool<>();
+      allocator_t::global_memory_pool = allocator_t::memory_pool_ptr(p);
+
+      CPPUNIT_ASSERT_EQUAL(false, p->in_use());
+      allocatorTests<allocator_t>();
+      CPPUNIT_ASSERT_EQUAL(true, p->in_use());
+      p->reset();
+      CPPUNIT_ASSERT_EQUAL(false, p->in_use());
+    }
+
+
+    void testRawPoolAllocator()
+    {
+      namespace mem = fhtagn::memory;
+
+      // Same as the fixed_pool test, but the allocator doesn't own the pool.
+      typedef mem::raw_pool_allocation_policy<test_int_t, mem::fixed_pool<> > policy_t;
+      typedef mem::allocator<test_int_t, policy_t> allocator_t;
+
+      char memory[200] = { 0 };
+      mem::fixed_pool<> fp(memory, sizeof(memory));
+
+      // Without a pool set, construction fails.
+      CPPUNIT_ASSERT_THROW(allocator_t(), std::logic_error);
+
+      allocator_t::global_memory_pool = &fp;
+
+      CPPUNIT_ASSERT_EQUAL(false, fp.in_use());
+      allocatorTests<allocator_t>();
+      CPPUNIT_ASSERT_EQUAL(false, fp.in_use());
+
+      // Copies and rebound copies share the pool, even if it's changed per
+      // instance.
+      char other_memory[200] = { 0 };
+      mem::fixed_pool<> other(other_memory, sizeof(other_memory));
+
+      allocator_t a;
+      CPPUNIT_ASSERT(a.set_memory_pool(&other));
+      allocator_t b(a);
+      CPPUNIT_ASSERT_EQUAL(&other, b.get_memory_pool());
+      CPPUNIT_ASSERT(a == b);
+
+      allocator_t::rebind<char>::other c(a);
+      CPPUNIT_ASSERT_EQUAL(&other, c.get_memory_pool());
+
+      allocator_t d;
+      CPPUNIT_ASSERT_EQUAL(&fp, d.get_memory_pool());
+      CPPUNIT_ASSERT(!(a == d));
+
+      // The per-type pool takes precedence over the global pool.
+      policy_t::per_type_memory_pool = &other;
+      allocator_t e;
+      CPPUNIT_ASSERT_EQUAL(&other, e.get_memory_pool());
+      policy_t::per_type_memory_pool = NULL;
+
+      allocator_t::global_memory_pool = NULL;
+    }
+
+
 };
 
 
+int AllocatorTest::counted::live = 0;
+int AllocatorTest::counted::copies_left = -1;
+
+
 CPPUNIT_TEST_SUITE_REGISTRATION(AllocatorTest);
@@ -0,0 +1,387 @@
+/**
+ * $Id$
+ *
+ * This file is part of the Fhtagn! C++ Library.
+ * Copyright (C) 2009 Jens Finkhaeuser <unwesen@users.sourceforge.net>.
+ *
+ * Author: Jens Finkhaeuser <unwesen@users.sourceforge.net>
+ *
+ * This program is licensed as free software for personal, educational or
+ * other non-commerical uses: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation, either version 3 of the License, or (at your
+ * option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Alternatively, licenses for commercial purposes are available as well.
+ * Please send your enquiries to the copyright holder's address above.
+ **/
+
+
+#include <string.h>
+
+#include <vector>
+#include <set>
+
+#include <boost/bind.hpp>
+#include <boost/thread.hpp>
+
+#include <cppunit/extensions/HelperMacros.h>
+
+#include <fhtagn/memory/memory_pool.h>
+#include <fhtagn/memory/statistics.h>
+#include <fhtagn/memory/block_pool.h>
+#include <fhtagn/memory/memory_source.h>
+#include <fhtagn/memory/global_new.h>
+#include <fhtagn/memory/size_based_pool.h>
+#include <fhtagn/memory/thread_cached_pool.h>
+
+
+/**
+ * Allocator tests that need boost::thread; see allocator_test.cpp for all
+ * others.
+ **/
+class AllocatorThreadsTest
+    : public CppUnit::TestFixture
+{
+public:
+    CPPUNIT_TEST_SUITE(AllocatorThreadsTest);
+
+      CPPUNIT_TEST(testLockFreeBlockPool);
+      CPPUNIT_TEST(testLockFreeBulkAllocation);
+      CPPUNIT_TEST(testStatisticsContention);
+      CPPUNIT_TEST(testThreadCachedMemoryPool);
+      CPPUNIT_TEST(testGlobalNew);
+
+    CPPUNIT_TEST_SUITE_END();
+private:
+
+    template <
+      typename poolT
+    >
+    static void lockFreeWorker(poolT * pool, boost::uint32_t id,
+        fhtagn::size_t * errors)
+    {
+      // Allocate a varying number of blocks, stamp each with a value unique
+      // to this thread and iteration, and check the stamps before freeing. If
+      // a block were ever handed out twice, another thread would overwrite
+      // the stamp.
+      std::vector<boost::uint64_t *> ptrs;
+      for (boost::uint32_t round = 0 ; round < 20000 ; ++round) {
+        fhtagn::size_t count = 1 + ((round + id) % 16);
+        for (fhtagn::size_t i = 0 ; i < count ; ++i) {
+          void * ptr = pool->alloc(sizeof(boost::uint64_t));
+          if (!ptr) {
+            // The pool may legitimately be exhausted by other threads.
+            break;
+          }
+          boost::uint64_t * value = static_cast<boost::uint64_t *>(ptr);
+          *value = (boost::uint64_t(id) << 32) | round;
+          ptrs.push_back(value);
+        }
+
+        for (std::vector<boost::uint64_t *>::iterator iter = ptrs.begin()
+            ; iter != ptrs.end() ; ++iter)
+        {
+          if (**iter != ((boost::uint64_t(id) << 32) | round)) {
+            ++*errors;
+          }
+          pool->free(*iter);
+        }
+        ptrs.clear();
+      }
+    }
+
+
+
+    void testLockFreeBlockPool()
+    {
+      namespace mem = fhtagn::memory;
+
+      typedef mem::block_pool<sizeof(boost::uint64_t),
+              fhtagn::threads::lock_free> pool_t;
+
+      // Stress test: a pool too small for all threads' allocations, so that
+      // threads compete for blocks and for bitmap words.
+      std::vector<char> stress_memory(100 * sizeof(boost::uint64_t));
+      pool_t stress(&stress_memory[0], stress_memory.size());
+
+      int const num_threads = 8;
+      std::vector<fhtagn::size_t> errors(num_threads, 0);
+      boost::thread_group threads;
+      for (int i = 0 ; i < num_threads ; ++i) {
+        threads.create_thread(boost::bind(&lockFreeWorker<pool_t>, &stress,
+              boost::uint32_t(i), &errors[i]));
+      }
+      threads.join_all();
+
+      for (int i = 0 ; i < num_threads ; ++i) {
+        CPPUNIT_ASSERT_EQUAL(fhtagn::size_t(0), errors[i]);
+      }
+      CPPUNIT_ASSERT_EQUAL(false, stress.in_use());
+    }
+
+
+
+    template <
+      typename poolT
+    >
+    static void bulkWorker(poolT * pool, boost::uint32_t id,
+        fhtagn::size_t * errors)
+    {
+      namespace mem = fhtagn::memory;
+
+      // Like lockFreeWorker, but allocating and freeing in batches.
+      void * ptrs[16];
+      for (boost::uint32_t round = 0 ; round < 20000 ; ++round) {
+        boost::uint64_t stamp = (boost::uint64_t(id) << 32) | round;
+        fhtagn::size_t count = mem::alloc_bulk(*pool, sizeof(boost::uint64_t),
+            1 + ((round + id) % 16), ptrs);
+        for (fhtagn::size_t i = 0 ; i < count ; ++i) {
+          *static_cast<boost::uint64_t *>(ptrs[i]) = stamp;
+        }
+        for (fhtagn::size_t i = 0 ; i < count ; ++i) {
+          if (*static_cast<boost::uint64_t *>(ptrs[i]) != stamp) {
+            ++*errors;
+          }
+        }
+        mem::free_bulk(*pool, ptrs, count);
+      }
+    }
+
+
+
+    void testLockFreeBulkAllocation()
+    {
+      namespace mem = fhtagn::memory;
+
+      typedef mem::block_pool<8, fhtagn::threads::lock_free> pool_t;
+
+      // Concurrent batches compete for reservations and bitmap words.
+      std::vector<char> stress_memory(100 * sizeof(boost::uint64_t));
+      pool_t stress(&stress_memory[0], stress_memory.size());
+
+      int const num_threads = 8;
+      std::vector<fhtagn::size_t> errors(num_threads, 0);
+      boost::thread_group threads;
+      for (int i = 0 ; i < num_threads ; ++i) {
+        threads.create_thread(boost::bind(&bulkWorker<pool_t>, &stress,
+              boost::uint32_t(i), &errors[i]));
+      }
+      threads.join_all();
+
+      for (int i = 0 ; i < num_threads ; ++i) {
+        CPPUNIT_ASSERT_EQUAL(fhtagn::size_t(0), errors[i]);
+      }
+      CPPUNIT_ASSERT_EQUAL(false, stress.in_use());
+    }
+
+
+
+    template <
+      typename poolT
+    >
+    static void statisticsWorker(poolT * pool, int iterations)
+    {
+      for (int i = 0 ; i < iterations ; ++i) {
+        void * ptr = pool->alloc(1 + (i % 64));
+        pool->free(ptr);
+      }
+    }
+
+
+
+    void testStatisticsContention()
+    {
+      namespace mem = fhtagn::memory;
+
+      // Lock contention is reported for pools using a
+      // contention_counting_mutex.
+      typedef mem::size_based_pool<256, 1, 256, fhtagn::meta::multi_double,
+              mem::contention_counting_mutex<boost::mutex> > pool_t;
+      typedef mem::statistics_pool<pool_t> stats_pool_t;
+
+      pool_t p;
+      stats_pool_t sp(p);
+
+      int const threads = 4;
+      int const iterations = 10000;
+      boost::thread_group group;
+      for (int i = 0 ; i < threads ; ++i) {
+        group.create_thread(boost::bind(&statisticsWorker<stats_pool_t>,
+              &sp, iterations));
+      }
+      group.join_all();
+
+      mem::pool_statistics stats = sp.snapshot();
+      CPPUNIT_ASSERT_EQUAL(fhtagn::size_t(threads * iterations), stats.allocs);
+      CPPUNIT_ASSERT_EQUAL(fhtagn::size_t(threads * iterations), stats.frees);
+      CPPUNIT_ASSERT_EQUAL(fhtagn::size_t(0), stats.bytes_live);
+      CPPUNIT_ASSERT(stats.bytes_high_water > 0);
+      CPPUNIT_ASSERT_EQUAL(p.mutex().contended(), stats.contended_locks);
+
+      // Contention is counted per pool instance, so another pool of the
+      // same type that nobody used reports none.
+      pool_t other;
+      stats_pool_t other_sp(other);
+      CPPUNIT_ASSERT_EQUAL(fhtagn::size_t(0),
+          other_sp.snapshot().contended_locks);
+    }
+
+
+
+    template <
+      typename poolT
+    >
+    static void threadCachedWorker(poolT * pool, fhtagn::size_t * errors)
+    {
+      // Allocate and free objects of different sizes in a pattern that
+      // exercises refilling and flushing of the thread's magazines.
+      std::vector<void *> ptrs;
+      for (int round = 0 ; round < 100 ; ++round) {
+        for (int i = 0 ; i < 100 ; ++i) {
+          fhtagn::size_t size = 1 + ((round + i) % 256);
+          void * p = pool->alloc(size);
+          if (!p) {
+            ++*errors;
+            continue;
+          }
+          ::memset(p, 0xab, size);
+          ptrs.push_back(p);
+        }
+        for (std::vector<void *>::iterator iter = ptrs.begin()
+            ; iter != ptrs.end() ; ++iter)
+        {
+          pool->free(*iter);
+        }
+        ptrs.clear();
+      }
+    }
+
+
+
+    void testThreadCachedMemoryPool()
+    {
+      namespace mem = fhtagn::memory;
+
+      typedef mem::thread_cached_pool<> pool_t;
+      pool_t p;
+
+      CPPUNIT_ASSERT_EQUAL(false, p.in_use());
+
+      char * ptr = static_cast<char *>(p.alloc(42));
+      CPPUNIT_ASSERT(ptr);
+      CPPUNIT_ASSERT_EQUAL(true, p.in_use());
+      ::memset(ptr, 0x0f, 42);
+
+      ptr = static_cast<char *>(p.realloc(ptr, 666));
+      CPPUNIT_ASSERT(ptr);
+      for (int i = 0 ; i < 42 ; ++i) {
+        CPPUNIT_ASSERT_EQUAL(char(0x0f), *(ptr + i));
+      }
+      CPPUNIT_ASSERT(p.alloc_size(ptr) >= 666);
+      p.free(ptr);
+
+      // Freed memory is cached by this thread, so the pool is still in use
+      // until the cache is flushed.
+      p.flush();
+      CPPUNIT_ASSERT_EQUAL(false, p.in_use());
+
+      // Memory freed to the cache must be handed out again, so repeatedly
+      // allocating and freeing must only ever use a handful of pointers.
+      std::set<void *> seen;
+      for (int i = 0 ; i < 1000 ; ++i) {
+        void * q = p.alloc(16);
+        CPPUNIT_ASSERT(q);
+        seen.insert(q);
+        p.free(q);
+      }
+      CPPUNIT_ASSERT(seen.size() < 100);
+
+      // Run a few threads concurrently; once they've exited, their caches
+      // must have been returned to the pool.
+      p.flush();
+      int const num_threads = 4;
+      std::vector<fhtagn::size_t> errors(num_threads, 0);
+      boost::thread_group threads;
+      for (int i = 0 ; i < num_threads ; ++i) {
+        threads.create_thread(boost::bind(&threadCachedWorker<pool_t>, &p,
+              &errors[i]));
+      }
+      threads.join_all();
+
+      for (int i = 0 ; i < num_threads ; ++i) {
+        CPPUNIT_ASSERT_EQUAL(fhtagn::size_t(0), errors[i]);
+      }
+      CPPUNIT_ASSERT_EQUAL(false, p.in_use());
+    }
+
+
+
+    void testGlobalNew()
+    {
+      namespace mem = fhtagn::memory;
+
+      // Use global_new directly, rather than replacing the global operators
+      // for the whole test suite.
+      typedef mem::registry_source<> source_t;
+      typedef mem::size_based_pool<256, 8, 256, fhtagn::meta::multi_double,
+        boost::mutex, source_t, mem::block_alignment<2 * sizeof(void *)>
+      > pool_t;
+      typedef mem::global_new<pool_t, source_t, 256> global_new_t;
+
+      // The pool is constructed on first use.
+      CPPUNIT_ASSERT(!global_new_t::pool());
+
+      // Small objects come from the pool, aligned as operator new requires;
+      // large objects do not.
+      std::vector<void *> ptrs;
+      for (fhtagn::size_t size = 0 ; size <= 256 ; ++size) {
+        void * ptr = global_new_t::new_object(size);
+        CPPUNIT_ASSERT(ptr);
+        CPPUNIT_ASSERT(source_t::owns(ptr));
+        if (size > global_new_t::POOL_ALIGNMENT) {
+          CPPUNIT_ASSERT_EQUAL(fhtagn::size_t(0),
+              reinterpret_cast<fhtagn::size_t>(ptr)
+              % global_new_t::POOL_ALIGNMENT);
+        }
+        ptrs.push_back(ptr);
+      }
+      CPPUNIT_ASSERT(global_new_t::pool());
+      CPPUNIT_ASSERT(global_new_t::pool()->in_use());
+
+      void * large = global_new_t::new_object(257);
+      CPPUNIT_ASSERT(large);
+      CPPUNIT_ASSERT_EQUAL(false, source_t::owns(large));
+      global_new_t::free(large, 257);
+
+      // Over-aligned objects are honoured, even if small.
+      void * aligned = global_new_t::new_aligned_object(32, 128);
+      CPPUNIT_ASSERT(aligned);
+      CPPUNIT_ASSERT_EQUAL(fhtagn::size_t(0),
+          reinterpret_cast<fhtagn::size_t>(aligned) % 128);
+      global_new_t::free_aligned(aligned, 128);
+
+      // Freeing with and without size must both route to the pool.
+      for (fhtagn::size_t i = 0 ; i < ptrs.size() ; ++i) {
+        if (i % 2) {
+          global_new_t::free(ptrs[i], i);
+        }
+        else {
+          global_new_t::free(ptrs[i]);
+        }
+      }
+      global_new_t::free(NULL);
+      CPPUNIT_ASSERT_EQUAL(false, global_new_t::pool()->in_use());
+    }
+};
+
+
+CPPUNIT_TEST_SUITE_REGISTRATION(AllocatorThreadsTest);
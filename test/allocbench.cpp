@@ -0,0 +1,1183 @@
+/**
+ * $Id$
+ *
+ * This file is part of the Fhtagn! C++ Library.
+ * Copyright (C) 2009 Jens Finkhaeuser <unwesen@users.sourceforge.net>.
+ *
+ * Author: Jens Finkhaeuser <unwesen@users.sourceforge.net>
+ *
+ * This program is licensed as free software for personal, educational or
+ * other non-commerical uses: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation, either version 3 of the License, or (at your
+ * option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Alternatively, licenses for commercial purposes are available as well.
+ * Please send your enquiries to the copyright holder's address above.
+ **/
+
+#include <stdlib.h>
+
+#if defined(_WIN32)
+#include <windows.h>
+#else
+#include <time.h>
+#endif
+
+#include <algorithm>
+#include <iostream>
+#include <memory>
+#include <new>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include <fhtagn/version.h>
+
+#include <fhtagn/memory/allocator.h>
+#include <fhtagn/memory/pool_allocator.h>
+#include <fhtagn/memory/memory_pool.h>
+#include <fhtagn/memory/fixed_pool.h>
+#include <fhtagn/memory/block_pool.h>
+#include <fhtagn/memory/dynamic_pool.h>
+#include <fhtagn/memory/size_based_pool.h>
+#include <fhtagn/memory/thread_cached_pool.h>
+#include <fhtagn/memory/monotonic_pool.h>
+#include <fhtagn/memory/shared_pool.h>
+#include <fhtagn/memory/debug_pool.h>
+#include <fhtagn/memory/fallback_pool.h>
+#include <fhtagn/memory/statistics.h>
+
+#include <fhtagn/threads/atomic.h>
+
+#include <fhtagn/util/stopwatch.h>
+
+#include <boost/program_options.hpp>
+#include <boost/thread.hpp>
+
+namespace mem = fhtagn::memory;
+
+
+// The benchmark runs a number of scenarios against each pool, for each object
+// size. Each run creates a fresh pool, so that no run inherits the
+// fragmentation of the previous one. Every alloc() and free() call is timed
+// individually, and the latency distribution is reported per run and
+// operation, one line per result, as CSV or as JSON objects.
+//
+// Scenarios:
+//  - lifo:     allocate a batch of objects, and free them in reverse order.
+//  - fifo:     allocate a batch of objects, and free them in the same order.
+//  - fragment: randomly interleave allocations and frees of objects with
+//              random sizes between half the object size and the object size.
+//              Every 8th object is kept until the end of the run, which leaves
+//              holes between the long-lived objects that later allocations
+//              must be fitted into. Pools that only support a single object
+//              size allocate objects of exactly the object size.
+//  - xthread:  producer/consumer pairs; the producer allocates objects and
+//              passes them to the consumer, which frees them. Only run for
+//              thread-safe pools.
+//
+// With more than one thread, each thread runs the scenario concurrently on the
+// same pool; for the xthread scenario, the number of threads is the number of
+// producer/consumer pairs. Non thread-safe pools are skipped then.
+
+
+typedef boost::uint64_t nsec_t;
+
+// Object sizes run by default: powers of two from 8 Bytes to 64 KiB.
+enum {
+  MIN_SIZE = 8,
+  MAX_SIZE = 64 * 1024,
+};
+
+
+// Monotonic clock with nanosecond resolution. Every sample includes the
+// overhead of reading the clock once, and of a virtual function call into the
+// pool adapter; both are the same for all pools. The overhead of reading the
+// clock is reported in the results as well, as the "timer" operation.
+inline nsec_t now()
+{
+#if defined(_WIN32)
+  static LARGE_INTEGER frequency = { 0 };
+  if (!frequency.QuadPart) {
+    ::QueryPerformanceFrequency(&frequency);
+  }
+  LARGE_INTEGER counter;
+  ::QueryPerformanceCounter(&counter);
+  return nsec_t(counter.QuadPart) * 1000000000 / frequency.QuadPart;
+#else
+  ::timespec ts;
+  ::clock_gettime(CLOCK_MONOTONIC, &ts);
+  return nsec_t(ts.tv_sec) * 1000000000 + ts.tv_nsec;
+#endif
+}
+
+
+
+// Small xorshift RNG. Each thread gets it's own, seeded with a compiled-in
+// value and the thread's index, so runs are reproducible.
+struct rng
+{
+  explicit rng(boost::uint32_t seed)
+    : m_state(0xdeadbeef ^ (seed * 0x9e3779b9))
+  {
+    if (!m_state) {
+      m_state = 0xdeadbeef;
+    }
+  }
+
+  boost::uint32_t operator()()
+  {
+    m_state ^= m_state << 13;
+    m_state ^= m_state >> 17;
+    m_state ^= m_state << 5;
+    return m_state;
+  }
+
+  boost::uint32_t m_state;
+};
+
+
+
+/*****************************************************************************
+ * Pool adapters
+ **/
+
+typedef mem::fixed_pool<>                                 fixed_pool_t;
+typedef mem::dynamic_pool<fixed_pool_t, 4 * 1024 * 1024>  dynamic_pool_t;
+typedef mem::size_based_pool<16, MIN_SIZE, MAX_SIZE>      size_based_pool_t;
+typedef mem::size_based_pool<16, MIN_SIZE, MAX_SIZE,
+        fhtagn::meta::multi_double, boost::mutex>         locked_size_based_pool_t;
+typedef mem::thread_cached_pool<locked_size_based_pool_t> cached_pool_t;
+typedef mem::monotonic_pool<1024 * 1024>                  monotonic_pool_t;
+typedef mem::shared_pool<>                                shared_pool_t;
+typedef mem::fallback_pool<fixed_pool_t, mem::heap_pool>  fallback_pool_t;
+
+typedef mem::pool_allocation_policy<char, locked_size_based_pool_t>
+                                                          policy_t;
+typedef mem::raw_pool_allocation_policy<char, locked_size_based_pool_t>
+                                                          raw_policy_t;
+
+FHTAGN_POOL_ALLOCATION_INITIALIZE_BASE(locked_size_based_pool_t);
+FHTAGN_POOL_ALLOCATION_INITIALIZE(char, locked_size_based_pool_t);
+
+
+// Common interface to all benchmarked pools, so scenarios need not be
+// instantiated for each pool type.
+struct bench_pool
+{
+  virtual ~bench_pool() {}
+  virtual void * alloc(fhtagn::size_t size) = 0;
+  virtual void free(void * ptr) = 0;
+
+  // Called after all objects of a batch were freed, outside of the timed
+  // operations.
+  virtual void drained() {}
+};
+
+
+// Adapter for pools that are default constructible.
+template <
+  typename poolT
+>
+struct pool_adapter : public bench_pool
+{
+  pool_adapter()
+    : m_pool()
+  {
+  }
+
+  virtual void * alloc(fhtagn::size_t size)
+  {
+    return m_pool.alloc(size);
+  }
+
+  virtual void free(void * ptr)
+  {
+    m_pool.free(ptr);
+  }
+
+  poolT m_pool;
+};
+
+
+// monotonic_pool does not reuse freed memory, so it's reset after each batch
+// to keep it from growing without bounds.
+struct monotonic_adapter : public pool_adapter<monotonic_pool_t>
+{
+  virtual void drained()
+  {
+    m_pool.reset();
+  }
+};
+
+
+// Owns a heap block for pools that subdivide memory handed to them. This is a
+// base class of region_adapter, so the block exists before the pool is
+// constructed.
+struct region
+{
+  explicit region(fhtagn::size_t size)
+    : m_memblock(::malloc(size))
+    , m_size(size)
+  {
+    if (!m_memblock) {
+      throw std::bad_alloc();
+    }
+  }
+
+  ~region()
+  {
+    ::free(m_memblock);
+  }
+
+  void *          m_memblock;
+  fhtagn::size_t  m_size;
+};
+
+
+// Adapter for pools that are constructed from a memory block and it's size.
+template <
+  typename poolT
+>
+struct region_adapter
+  : private region
+  , public bench_pool
+{
+  explicit region_adapter(fhtagn::size_t size)
+    : region(size)
+    , m_pool(m_memblock, m_size)
+  {
+  }
+
+  virtual void * alloc(fhtagn::size_t size)
+  {
+    return m_pool.alloc(size);
+  }
+
+  virtual void free(void * ptr)
+  {
+    m_pool.free(ptr);
+  }
+
+  poolT m_pool;
+};
+
+
+// The pool used by allocator_adapter. It's installed as the allocation policy's
+// global pool on construction, before the adapter's allocator is constructed.
+// The adapter owns the pool, so the shared_ptr installed for
+// pool_allocation_policy must not delete it.
+struct null_deleter
+{
+  void operator()(void *) const
+  {
+  }
+};
+
+
+template <
+  typename policyT
+>
+struct allocator_pool
+{
+  allocator_pool()
+    : m_pool()
+  {
+    install(policyT::global_memory_pool);
+  }
+
+  ~allocator_pool()
+  {
+    policyT::global_memory_pool = typename policyT::memory_pool_ptr();
+  }
+
+  void install(locked_size_based_pool_t * & global)
+  {
+    global = &m_pool;
+  }
+
+  template <
+    typename pool_ptrT
+  >
+  void install(pool_ptrT & global)
+  {
+    global = pool_ptrT(&m_pool, null_deleter());
+  }
+
+  locked_size_based_pool_t m_pool;
+};
+
+
+// Adapter that allocates through fhtagn's allocator with the given allocation
+// policy. Each alloc and free goes through a copy of the allocator, as is
+// common for node-based containers, so the cost of copying the allocator is
+// included in the samples.
+template <
+  typename policyT
+>
+struct allocator_adapter
+  : private allocator_pool<policyT>
+  , public bench_pool
+{
+  typedef mem::allocator<char, policyT> allocator_t;
+
+  allocator_adapter()
+    : allocator_pool<policyT>()
+    , m_allocator()
+  {
+  }
+
+  virtual void * alloc(fhtagn::size_t size)
+  {
+    allocator_t alloc(m_allocator);
+    return alloc.allocate(size);
+  }
+
+  virtual void free(void * ptr)
+  {
+    allocator_t alloc(m_allocator);
+    alloc.deallocate(static_cast<char *>(ptr), 0);
+  }
+
+  allocator_t m_allocator;
+};
+
+
+// Adapter for pools such as debug_pool or statistics_pool, which wrap a pool
+// that must outlive them.
+template <
+  typename poolT,
+  typename wrapperT
+>
+struct wrapper_adapter : public bench_pool
+{
+  wrapper_adapter()
+    : m_wrapped()
+    , m_pool(m_wrapped)
+  {
+  }
+
+  virtual void * alloc(fhtagn::size_t size)
+  {
+    return m_pool.alloc(size);
+  }
+
+  virtual void free(void * ptr)
+  {
+    m_pool.free(ptr);
+  }
+
+  poolT     m_wrapped;
+  wrapperT  m_pool;
+};
+
+
+// Adapter for fallback_pool; a fixed_pool in a memory block of the given size
+// spills to the heap once it's exhausted. Every free has to find out which of
+// the two pools owns the pointer.
+struct fallback_adapter
+  : private region
+  , public bench_pool
+{
+  explicit fallback_adapter(fhtagn::size_t size)
+    : region(size)
+    , m_primary(m_memblock, m_size)
+    , m_secondary()
+    , m_pool(m_primary, m_secondary)
+  {
+  }
+
+  virtual void * alloc(fhtagn::size_t size)
+  {
+    return m_pool.alloc(size);
+  }
+
+  virtual void free(void * ptr)
+  {
+    m_pool.free(ptr);
+  }
+
+  fixed_pool_t    m_primary;
+  mem::heap_pool  m_secondary;
+  fallback_pool_t m_pool;
+};
+
+
+
+// Properties of a benchmarked pool.
+struct pool_info
+{
+  char const *  name;
+  bool          thread_safe;
+  bool          single_size;  // Only allocates objects of one size.
+  bool          reuses;       // Reuses freed memory before the pool is reset.
+  char const *  description;
+};
+
+pool_info const g_pools[] = {
+  { "heap",      true,  false, true,  "heap_pool" },
+  { "fixed",     false, false, true,  "fixed_pool" },
+  { "block",     false, true,  true,  "block_pool for objects of the object "
+                                      "size" },
+  { "lockfree",  true,  true,  true,  "lock-free block_pool for objects of "
+                                      "the object size" },
+  { "dynamic",   false, false, true,  "dynamic_pool of 4 MiB fixed_pools" },
+  { "size",      false, false, true,  "size_based_pool for objects of 8 "
+                                      "Bytes to 64 KiB" },
+  { "locked",    true,  false, true,  "the same size_based_pool, protected "
+                                      "by a mutex" },
+  { "cached",    true,  false, true,  "thread_cached_pool in front of the "
+                                      "locked size_based_pool" },
+  { "monotonic", false, false, false, "monotonic_pool of 1 MiB blocks, reset "
+                                      "after each batch" },
+  { "shared",    true,  false, true,  "shared_pool" },
+  { "debug",     false, false, true,  "debug_pool wrapping a heap_pool" },
+  { "fallback",  false, false, true,  "fixed_pool spilling to a heap_pool "
+                                      "once it's exhausted" },
+  { "statistics", true, false, true,  "statistics_pool wrapping the locked "
+                                      "size_based_pool" },
+  { "policy",    true,  false, true,  "the locked size_based_pool, through "
+                                      "pool_allocation_policy" },
+  { "raw_policy", true, false, true,  "the locked size_based_pool, through "
+                                      "raw_pool_allocation_policy" },
+};
+
+fhtagn::size_t const g_num_pools = sizeof(g_pools) / sizeof(pool_info);
+
+
+// Creates block_pools for the given object size, which must be a power of two
+// between MIN_SIZE and MAX_SIZE.
+template <
+  typename mutexT
+>
+bench_pool * create_block_pool(fhtagn::size_t object_size,
+    fhtagn::size_t memory)
+{
+#define FHTAGN_ALLOCBENCH_BLOCK_POOL(size)                                  \
+  case size:                                                                \
+    return new region_adapter<mem::block_pool<size, mutexT> >(memory);
+
+  switch (object_size) {
+    FHTAGN_ALLOCBENCH_BLOCK_POOL(8)
+    FHTAGN_ALLOCBENCH_BLOCK_POOL(16)
+    FHTAGN_ALLOCBENCH_BLOCK_POOL(32)
+    FHTAGN_ALLOCBENCH_BLOCK_POOL(64)
+    FHTAGN_ALLOCBENCH_BLOCK_POOL(128)
+    FHTAGN_ALLOCBENCH_BLOCK_POOL(256)
+    FHTAGN_ALLOCBENCH_BLOCK_POOL(512)
+    FHTAGN_ALLOCBENCH_BLOCK_POOL(1024)
+    FHTAGN_ALLOCBENCH_BLOCK_POOL(2048)
+    FHTAGN_ALLOCBENCH_BLOCK_POOL(4096)
+    FHTAGN_ALLOCBENCH_BLOCK_POOL(8192)
+    FHTAGN_ALLOCBENCH_BLOCK_POOL(16384)
+    FHTAGN_ALLOCBENCH_BLOCK_POOL(32768)
+    FHTAGN_ALLOCBENCH_BLOCK_POOL(65536)
+
+    default:
+      return NULL;
+  }
+
+#undef FHTAGN_ALLOCBENCH_BLOCK_POOL
+}
+
+
+// Returns a new pool of the given name, or NULL if the pool does not support
+// the object size. Pools that subdivide a memory block get one of the given
+// size.
+bench_pool * create_pool(std::string const & name, fhtagn::size_t object_size,
+    fhtagn::size_t memory)
+{
+  if (name == "heap") {
+    return new pool_adapter<mem::heap_pool>();
+  }
+  else if (name == "fixed") {
+    return new region_adapter<fixed_pool_t>(memory);
+  }
+  else if (name == "block") {
+    return create_block_pool<fhtagn::threads::fake_mutex>(object_size, memory);
+  }
+  else if (name == "lockfree") {
+    return create_block_pool<fhtagn::threads::lock_free>(object_size, memory);
+  }
+  else if (name == "dynamic") {
+    return new pool_adapter<dynamic_pool_t>();
+  }
+  else if (name == "size") {
+    return new pool_adapter<size_based_pool_t>();
+  }
+  else if (name == "locked") {
+    return new pool_adapter<locked_size_based_pool_t>();
+  }
+  else if (name == "cached") {
+    return new pool_adapter<cached_pool_t>();
+  }
+  else if (name == "monotonic") {
+    return new monotonic_adapter();
+  }
+  else if (name == "shared") {
+    return new region_adapter<shared_pool_t>(memory);
+  }
+  else if (name == "debug") {
+    return new wrapper_adapter<mem::heap_pool,
+           mem::debug_pool<mem::heap_pool> >();
+  }
+  else if (name == "fallback") {
+    return new fallback_adapter(memory);
+  }
+  else if (name == "statistics") {
+    return new wrapper_adapter<locked_size_based_pool_t,
+           mem::statistics_pool<locked_size_based_pool_t> >();
+  }
+  else if (name == "policy") {
+    return new allocator_adapter<policy_t>();
+  }
+  else if (name == "raw_policy") {
+    return new allocator_adapter<raw_policy_t>();
+  }
+  return NULL;
+}
+
+
+
+/*****************************************************************************
+ * Results
+ **/
+
+// Latency samples of one operation, in nanoseconds.
+typedef std::vector<nsec_t> samples_t;
+
+// The samples and failures each thread of a run records.
+struct thread_result
+{
+  samples_t       alloc;
+  samples_t       free;
+  fhtagn::size_t  failed;
+};
+
+
+// Returns the sample at the given percentile; samples must be sorted.
+nsec_t percentile(samples_t const & samples, double pct)
+{
+  if (samples.empty()) {
+    return 0;
+  }
+  fhtagn::size_t index = fhtagn::size_t(pct / 100.0 * samples.size());
+  if (index >= samples.size()) {
+    index = samples.size() - 1;
+  }
+  return samples[index];
+}
+
+
+
+// Writes results, one line per operation.
+class reporter
+{
+public:
+  explicit reporter(std::string const & format)
+    : m_json(format == "json")
+  {
+    std::pair<boost::uint16_t, boost::uint16_t> v = fhtagn::version();
+    std::stringstream s;
+    s << v.first << "." << v.second;
+    m_version = s.str();
+
+    if (!m_json) {
+      std::cout << "version,pool,scenario,size,threads,op,count,failed,"
+        "mean_ns,p50_ns,p90_ns,p99_ns,p999_ns,max_ns,"
+        "wall_usec,sys_usec,user_usec" << std::endl;
+    }
+  }
+
+  void report(std::string const & pool, std::string const & scenario,
+      fhtagn::size_t size, fhtagn::size_t threads, std::string const & op,
+      samples_t & samples, fhtagn::size_t failed,
+      fhtagn::util::stopwatch::times_t const & times)
+  {
+    std::sort(samples.begin(), samples.end());
+
+    nsec_t total = 0;
+    for (samples_t::const_iterator iter = samples.begin()
+        ; iter != samples.end() ; ++iter)
+    {
+      total += *iter;
+    }
+    nsec_t mean = samples.empty() ? 0 : total / samples.size();
+    nsec_t max = samples.empty() ? 0 : samples.back();
+
+    if (m_json) {
+      std::cout << "{\"version\":\"" << m_version << "\""
+        << ",\"pool\":\"" << pool << "\""
+        << ",\"scenario\":\"" << scenario << "\""
+        << ",\"size\":" << size
+        << ",\"threads\":" << threads
+        << ",\"op\":\"" << op << "\""
+        << ",\"count\":" << samples.size()
+        << ",\"failed\":" << failed
+        << ",\"mean_ns\":" << mean
+        << ",\"p50_ns\":" << percentile(samples, 50)
+        << ",\"p90_ns\":" << percentile(samples, 90)
+        << ",\"p99_ns\":" << percentile(samples, 99)
+        << ",\"p999_ns\":" << percentile(samples, 99.9)
+        << ",\"max_ns\":" << max
+        << ",\"wall_usec\":" << times.get<0>()
+        << ",\"sys_usec\":" << times.get<1>()
+        << ",\"user_usec\":" << times.get<2>()
+        << "}" << std::endl;
+    }
+    else {
+      std::cout << m_version << "," << pool << "," << scenario << ","
+        << size << "," << threads << "," << op << ","
+        << samples.size() << "," << failed << ","
+        << mean << ","
+        << percentile(samples, 50) << ","
+        << percentile(samples, 90) << ","
+        << percentile(samples, 99) << ","
+        << percentile(samples, 99.9) << ","
+        << max << ","
+        << times.get<0>() << "," << times.get<1>() << "," << times.get<2>()
+        << std::endl;
+    }
+  }
+
+private:
+  bool        m_json;
+  std::string m_version;
+};
+
+
+
+/*****************************************************************************
+ * Scenarios
+ **/
+
+// Parameters shared by all threads of a run.
+struct run_params
+{
+  bench_pool *    pool;
+  std::string     scenario;
+  fhtagn::size_t  size;
+  bool            single_size;
+  fhtagn::size_t  objects;    // Objects per batch, per thread.
+  fhtagn::size_t  rounds;
+};
+
+
+// Timed alloc and free. Failed allocations are counted, not timed.
+inline void * timed_alloc(bench_pool * pool, fhtagn::size_t size,
+    thread_result & result)
+{
+  nsec_t start = now();
+  void * ptr = pool->alloc(size);
+  nsec_t end = now();
+
+  if (!ptr) {
+    ++result.failed;
+    return NULL;
+  }
+
+  result.alloc.push_back(end - start);
+  return ptr;
+}
+
+
+inline void timed_free(bench_pool * pool, void * ptr, thread_result & result)
+{
+  nsec_t start = now();
+  pool->free(ptr);
+  nsec_t end = now();
+
+  result.free.push_back(end - start);
+}
+
+
+
+void run_batch(run_params const & params, thread_result & result, bool lifo)
+{
+  std::vector<void *> ptrs;
+  ptrs.reserve(params.objects);
+
+  for (fhtagn::size_t round = 0 ; round < params.rounds ; ++round) {
+    for (fhtagn::size_t i = 0 ; i < params.objects ; ++i) {
+      void * ptr = timed_alloc(params.pool, params.size, result);
+      if (ptr) {
+        ptrs.push_back(ptr);
+      }
+    }
+
+    if (lifo) {
+      for (std::vector<void *>::reverse_iterator iter = ptrs.rbegin()
+          ; iter != ptrs.rend() ; ++iter)
+      {
+        timed_free(params.pool, *iter, result);
+      }
+    }
+    else {
+      for (std::vector<void *>::iterator iter = ptrs.begin()
+          ; iter != ptrs.end() ; ++iter)
+      {
+        timed_free(params.pool, *iter, result);
+      }
+    }
+    ptrs.clear();
+    params.pool->drained();
+  }
+}
+
+
+
+void run_fragment(run_params const & params, thread_result & result,
+    boost::uint32_t seed)
+{
+  rng random(seed);
+
+  std::vector<void *> live;
+  std::vector<void *> pinned;
+  live.reserve(params.objects);
+
+  fhtagn::size_t min_size = params.single_size ? params.size
+                                               : params.size / 2 + 1;
+  fhtagn::size_t size_range = params.size - min_size + 1;
+
+  fhtagn::size_t steps = params.objects * params.rounds;
+  fhtagn::size_t allocs = 0;
+  for (fhtagn::size_t i = 0 ; i < steps ; ++i) {
+    // Allocate on 5/8 of the steps while there's room, so the pool slowly
+    // fills up with a mix of long- and short-lived objects.
+    bool full = live.size() + pinned.size() >= params.objects;
+    if (!full && (live.empty() || random() % 8 < 5)) {
+      fhtagn::size_t size = min_size + random() % size_range;
+      void * ptr = timed_alloc(params.pool, size, result);
+      if (!ptr) {
+        continue;
+      }
+
+      if (++allocs % 8 == 0 && pinned.size() < params.objects / 4) {
+        pinned.push_back(ptr);
+      }
+      else {
+        live.push_back(ptr);
+      }
+    }
+    else if (!live.empty()) {
+      fhtagn::size_t index = random() % live.size();
+      timed_free(params.pool, live[index], result);
+      live[index] = live.back();
+      live.pop_back();
+    }
+  }
+
+  for (std::vector<void *>::iterator iter = live.begin()
+      ; iter != live.end() ; ++iter)
+  {
+    timed_free(params.pool, *iter, result);
+  }
+  for (std::vector<void *>::iterator iter = pinned.begin()
+      ; iter != pinned.end() ; ++iter)
+  {
+    timed_free(params.pool, *iter, result);
+  }
+}
+
+
+
+// Single producer, single consumer ring buffer for the xthread scenario. Spins
+// while full or empty, so that the consumer frees objects as soon as possible
+// after they've been allocated.
+class handoff
+{
+public:
+  enum {
+    CAPACITY = 1024,
+  };
+
+  handoff()
+    : m_head(0)
+    , m_tail(0)
+  {
+  }
+
+  void push(void * ptr)
+  {
+    fhtagn::size_t tail = m_tail;
+    while (tail - fhtagn::threads::atomic_load(m_head) >= CAPACITY) {
+      boost::this_thread::yield();
+    }
+    m_ring[tail % CAPACITY] = ptr;
+    fhtagn::threads::atomic_store(m_tail, tail + 1);
+  }
+
+  void * pop()
+  {
+    fhtagn::size_t head = m_head;
+    while (fhtagn::threads::atomic_load(m_tail) == head) {
+      boost::this_thread::yield();
+    }
+    void * ptr = m_ring[head % CAPACITY];
+    fhtagn::threads::atomic_store(m_head, head + 1);
+    return ptr;
+  }
+
+private:
+  void *                  m_ring[CAPACITY];
+  fhtagn::size_t volatile m_head;
+  fhtagn::size_t volatile m_tail;
+};
+
+
+
+void run_producer(run_params const & params, thread_result & result,
+    handoff & queue)
+{
+  fhtagn::size_t count = params.objects * params.rounds;
+  for (fhtagn::size_t i = 0 ; i < count ; ++i) {
+    // Failed allocations are handed off as NULL, so the consumer knows
+    // when to stop.
+    queue.push(timed_alloc(params.pool, params.size, result));
+  }
+}
+
+
+void run_consumer(run_params const & params, thread_result & result,
+    handoff & queue)
+{
+  fhtagn::size_t count = params.objects * params.rounds;
+  for (fhtagn::size_t i = 0 ; i < count ; ++i) {
+    void * ptr = queue.pop();
+    if (ptr) {
+      timed_free(params.pool, ptr, result);
+    }
+  }
+}
+
+
+
+// Thread function running one thread's part of a scenario.
+struct worker
+{
+  worker(run_params const & params, thread_result & result,
+      boost::uint32_t index, handoff * queue = NULL, bool consumer = false)
+    : m_params(params)
+    , m_result(result)
+    , m_index(index)
+    , m_queue(queue)
+    , m_consumer(consumer)
+  {
+  }
+
+  void operator()()
+  {
+    if (m_params.scenario == "lifo") {
+      run_batch(m_params, m_result, true);
+    }
+    else if (m_params.scenario == "fifo") {
+      run_batch(m_params, m_result, false);
+    }
+    else if (m_params.scenario == "fragment") {
+      run_fragment(m_params, m_result, m_index);
+    }
+    else if (m_consumer) {
+      run_consumer(m_params, m_result, *m_queue);
+    }
+    else {
+      run_producer(m_params, m_result, *m_queue);
+    }
+  }
+
+  run_params const &  m_params;
+  thread_result &     m_result;
+  boost::uint32_t     m_index;
+  handoff *           m_queue;
+  bool                m_consumer;
+};
+
+
+
+// Runs a scenario with the given number of threads, and reports the merged
+// results of all threads.
+void run(reporter & out, pool_info const & info, std::string const & scenario,
+    fhtagn::size_t size, fhtagn::size_t num_threads, fhtagn::size_t objects,
+    fhtagn::size_t rounds, fhtagn::size_t memory)
+{
+  std::auto_ptr<bench_pool> pool(create_pool(info.name, size, memory));
+  if (!pool.get()) {
+    return;
+  }
+
+  run_params params;
+  params.pool = pool.get();
+  params.scenario = scenario;
+  params.size = size;
+  params.single_size = info.single_size;
+  params.objects = objects;
+  params.rounds = rounds;
+
+  bool xthread = (scenario == "xthread");
+  fhtagn::size_t num_results = xthread ? 2 * num_threads : num_threads;
+
+  // Reserve all sample memory up front, so it's not allocated while timing.
+  std::vector<thread_result> results(num_results);
+  for (std::vector<thread_result>::iterator iter = results.begin()
+      ; iter != results.end() ; ++iter)
+  {
+    iter->alloc.reserve(2 * objects * rounds);
+    iter->free.reserve(2 * objects * rounds);
+    iter->failed = 0;
+  }
+  std::vector<handoff> queues(xthread ? num_threads : 0);
+
+  fhtagn::util::stopwatch sw;
+
+  boost::thread_group threads;
+  for (fhtagn::size_t i = 0 ; i < num_threads ; ++i) {
+    if (xthread) {
+      threads.create_thread(worker(params, results[2 * i], i, &queues[i]));
+      threads.create_thread(worker(params, results[2 * i + 1], i, &queues[i],
+            true));
+    }
+    else {
+      threads.create_thread(worker(params, results[i], i));
+    }
+  }
+  threads.join_all();
+
+  fhtagn::util::stopwatch::times_t times = sw.get_times();
+
+  samples_t alloc_samples;
+  samples_t free_samples;
+  fhtagn::size_t failed = 0;
+  for (std::vector<thread_result>::const_iterator iter = results.begin()
+      ; iter != results.end() ; ++iter)
+  {
+    alloc_samples.insert(alloc_samples.end(), iter->alloc.begin(),
+        iter->alloc.end());
+    free_samples.insert(free_samples.end(), iter->free.begin(),
+        iter->free.end());
+    failed += iter->failed;
+  }
+
+  out.report(info.name, scenario, size, num_threads, "alloc", alloc_samples,
+      failed, times);
+  out.report(info.name, scenario, size, num_threads, "free", free_samples,
+      0, times);
+}
+
+
+
+// Measures the overhead of reading the clock, which is included in every
+// sample.
+void run_timer(reporter & out, fhtagn::size_t count)
+{
+  samples_t samples;
+  samples.reserve(count);
+
+  fhtagn::util::stopwatch sw;
+  for (fhtagn::size_t i = 0 ; i < count ; ++i) {
+    nsec_t start = now();
+    nsec_t end = now();
+    samples.push_back(end - start);
+  }
+  fhtagn::util::stopwatch::times_t times = sw.get_times();
+
+  out.report("none", "none", 0, 1, "timer", samples, 0, times);
+}
+
+
+
+// Splits a comma separated list.
+std::vector<std::string> split(std::string const & list)
+{
+  std::vector<std::string> result;
+  std::string::size_type start = 0;
+  while (start <= list.size()) {
+    std::string::size_type end = list.find(',', start);
+    if (end == std::string::npos) {
+      end = list.size();
+    }
+    if (end > start) {
+      result.push_back(list.substr(start, end - start));
+    }
+    start = end + 1;
+  }
+  return result;
+}
+
+
+
+int main(int argc, char **argv)
+{
+  namespace po = boost::program_options;
+
+  std::stringstream pools_help;
+  for (fhtagn::size_t i = 0 ; i < g_num_pools ; ++i) {
+    pools_help << "   - " << g_pools[i].name << ": " << g_pools[i].description
+      << (g_pools[i].thread_safe ? "" : " (not thread-safe)") << "\n";
+  }
+
+  po::options_description desc(
+    "Allocator benchmark.\n\n"
+    "This benchmark times each individual allocation and deallocation from\n"
+    "Fhtagn's memory pools, and reports the mean, 50th, 90th, 99th and 99.9th\n"
+    "percentile and maximum latency per pool, scenario, object size and\n"
+    "operation, along with the wall, system and user time of the whole run.\n"
+    "Results are printed one per line, either as CSV with a header line, or\n"
+    "as JSON objects. Each result carries the library version, so results of\n"
+    "different releases can be compared.\n\n"
+    "The overhead of reading the clock is included in each sample; it is\n"
+    "reported as the 'timer' operation at the start of the results.\n\n"
+    "You can influence the following parameters:\n"
+    " - The pools to benchmark:\n" + pools_help.str() +
+    " - The scenarios to run:\n"
+    "   - lifo: allocate a batch of objects and free them in reverse order.\n"
+    "   - fifo: allocate a batch of objects and free them in order.\n"
+    "   - fragment: randomly interleave allocations and frees of objects of\n"
+    "     random sizes, keeping some objects until the end of the run.\n"
+    "   - xthread: producer threads allocate objects that are freed by\n"
+    "     consumer threads. Only run for thread-safe pools.\n"
+    "   The fragment scenario is not run for the monotonic pool, which only\n"
+    "   releases memory when it's reset.\n"
+    " - The object sizes, from 8 Bytes to 64 KiB.\n"
+    " - The number of objects per batch, and the number of batches.\n"
+    " - The number of threads running each scenario concurrently on the\n"
+    "   same pool, or the number of producer/consumer pairs for xthread.\n"
+    "   Pools that are not thread-safe are skipped for more than one thread.\n"
+    " - The size of the memory block handed to pools that subdivide one.\n\n"
+    "Command line arguments"
+  );
+
+  std::string pools;
+  std::string scenarios;
+  std::string sizes;
+  std::string format;
+  fhtagn::size_t objects = 0;
+  fhtagn::size_t rounds = 0;
+  fhtagn::size_t num_threads = 0;
+  fhtagn::size_t memory = 0;
+
+  desc.add_options()
+    ("help", "Prints this help text and exits.")
+    ("pools", po::value<std::string>(&pools)->default_value("all"),
+        "Comma separated list of pools to benchmark, or 'all'.")
+    ("scenarios", po::value<std::string>(&scenarios)->default_value("all"),
+        "Comma separated list of scenarios to run, or 'all'. Possible values "
+        "are 'lifo', 'fifo', 'fragment' and 'xthread'.")
+    ("sizes", po::value<std::string>(&sizes)->default_value("all"),
+        "Comma separated list of object sizes in Bytes, or 'all' for all "
+        "powers of two from 8 to 65536. block_pools only support powers of "
+        "two.")
+    ("objects", po::value<fhtagn::size_t>(&objects)->default_value(1000),
+        "Number of objects per batch and thread.")
+    ("rounds", po::value<fhtagn::size_t>(&rounds)->default_value(50),
+        "Number of batches per run.")
+    ("threads", po::value<fhtagn::size_t>(&num_threads)->default_value(1),
+        "Number of threads, or producer/consumer pairs.")
+    ("memory", po::value<fhtagn::size_t>(&memory)->default_value(256),
+        "Size of the memory block in MiB for pools that subdivide one.")
+    ("format", po::value<std::string>(&format)->default_value("csv"),
+        "Output format, 'csv' or 'json'.")
+  ;
+
+  po::variables_map vm;
+  po::store(po::parse_command_line(argc, argv, desc), vm);
+  po::notify(vm);
+
+  if (vm.count("help")) {
+    std::cout << desc << "\n";
+    return 1;
+  }
+
+  std::vector<std::string> pool_names;
+  if (pools == "all") {
+    for (fhtagn::size_t i = 0 ; i < g_num_pools ; ++i) {
+      pool_names.push_back(g_pools[i].name);
+    }
+  }
+  else {
+    pool_names = split(pools);
+  }
+
+  std::vector<std::string> scenario_names;
+  if (scenarios == "all") {
+    scenario_names.push_back("lifo");
+    scenario_names.push_back("fifo");
+    scenario_names.push_back("fragment");
+    scenario_names.push_back("xthread");
+  }
+  else {
+    scenario_names = split(scenarios);
+  }
+
+  std::vector<fhtagn::size_t> object_sizes;
+  if (sizes == "all") {
+    for (fhtagn::size_t size = MIN_SIZE ; size <= MAX_SIZE ; size *= 2) {
+      object_sizes.push_back(size);
+    }
+  }
+  else {
+    std::vector<std::string> size_names = split(sizes);
+    for (std::vector<std::string>::const_iterator iter = size_names.begin()
+        ; iter != size_names.end() ; ++iter)
+    {
+      fhtagn::size_t size = ::strtoul(iter->c_str(), NULL, 10);
+      if (size < MIN_SIZE || size > MAX_SIZE) {
+        std::cerr << "Invalid object size: " << *iter << std::endl;
+        return 1;
+      }
+      object_sizes.push_back(size);
+    }
+  }
+
+  reporter out(format);
+  run_timer(out, objects * rounds);
+
+  for (std::vector<std::string>::const_iterator name = pool_names.begin()
+      ; name != pool_names.end() ; ++name)
+  {
+    pool_info const * info = NULL;
+    for (fhtagn::size_t i = 0 ; i < g_num_pools ; ++i) {
+      if (*name == g_pools[i].name) {
+        info = &g_pools[i];
+      }
+    }
+    if (!info) {
+      std::cerr << "Invalid pool: " << *name << std::endl;
+      return 1;
+    }
+
+    for (std::vector<std::string>::const_iterator scenario
+          = scenario_names.begin()
+        ; scenario != scenario_names.end() ; ++scenario)
+    {
+      if (*scenario != "lifo" && *scenario != "fifo"
+          && *scenario != "fragment" && *scenario != "xthread")
+      {
+        std::cerr << "Invalid scenario: " << *scenario << std::endl;
+        return 1;
+      }
+
+      if (!info->thread_safe && (num_threads > 1 || *scenario == "xthread")) {
+        continue;
+      }
+      if (!info->reuses && *scenario == "fragment") {
+        continue;
+      }
+
+      for (std::vector<fhtagn::size_t>::const_iterator size
+            = object_sizes.begin()
+          ; size != object_sizes.end() ; ++size)
+      {
+        run(out, *info, *scenario, *size, num_threads, objects, rounds,
+            memory * 1024 * 1024);
+      }
+    }
+  }
+}
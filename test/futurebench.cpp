@@ -0,0 +1,574 @@
+/**
+ * $Id$
+ *
+ * This file is part of the Fhtagn! C++ Library.
+ * Copyright (C) 2009 Jens Finkhaeuser <unwesen@users.sourceforge.net>.
+ *
+ * Author: Jens Finkhaeuser <unwesen@users.sourceforge.net>
+ *
+ * This program is licensed as free software for personal, educational or
+ * other non-commerical uses: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation, either version 3 of the License, or (at your
+ * option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Alternatively, licenses for commercial purposes are available as well.
+ * Please send your enquiries to the copyright holder's address above.
+ **/
+
+#include <stdlib.h>
+
+#if defined(_WIN32)
+#include <windows.h>
+#else
+#include <time.h>
+#endif
+
+#include <algorithm>
+#include <iostream>
+#include <new>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include <fhtagn/version.h>
+#include <fhtagn/shared_ptr.h>
+
+#include <fhtagn/threads/executor.h>
+#include <fhtagn/threads/future.h>
+#include <fhtagn/threads/atomic.h>
+
+#include <fhtagn/memory/block_pool.h>
+
+#include <boost/bind.hpp>
+#include <boost/program_options.hpp>
+#include <boost/signal.hpp>
+#include <boost/thread.hpp>
+#include <boost/thread/condition.hpp>
+
+namespace th = fhtagn::threads;
+namespace mem = fhtagn::memory;
+
+
+// The benchmark measures the overhead of creating a future, reading its value
+// and destroying it again, for a function that does no work. Futures are
+// created in batches, and each batch is read after all of its futures have
+// been created.
+//
+// Modes:
+//  - legacy: a copy of the future implementation that bound its function via
+//            a boost::signal, and allocated the value and any exception
+//            message on the heap, behind a shared_ptr to the shared state.
+//  - heap:   th::future, with its state allocated on the heap.
+//  - pool:   th::future, with its state allocated from a lock-free
+//            block_pool.
+//
+// The futures run either on an executor that runs the function right away in
+// the calling thread, which isolates the cost of the future itself, or on a
+// thread_pool_executor.
+//
+// Each round creates and reads the given number of futures; the minimum, mean
+// and maximum time per future are reported, along with the number of calls to
+// operator new per future, one line per mode, as CSV.
+
+
+typedef boost::uint64_t nsec_t;
+
+
+// Monotonic clock with nanosecond resolution.
+inline nsec_t now()
+{
+#if defined(_WIN32)
+  static LARGE_INTEGER frequency = { 0 };
+  if (!frequency.QuadPart) {
+    ::QueryPerformanceFrequency(&frequency);
+  }
+  LARGE_INTEGER counter;
+  ::QueryPerformanceCounter(&counter);
+  return nsec_t(counter.QuadPart) * 1000000000 / frequency.QuadPart;
+#else
+  ::timespec ts;
+  ::clock_gettime(CLOCK_MONOTONIC, &ts);
+  return nsec_t(ts.tv_sec) * 1000000000 + ts.tv_nsec;
+#endif
+}
+
+
+
+/*****************************************************************************
+ * Allocation counting
+ **/
+fhtagn::size_t volatile allocations = 0;
+
+
+void * operator new(std::size_t size)
+{
+  th::atomic_add(allocations, fhtagn::size_t(1));
+  void * ptr = ::malloc(size ? size : 1);
+  if (!ptr) {
+    throw std::bad_alloc();
+  }
+  return ptr;
+}
+
+
+void operator delete(void * ptr) throw()
+{
+  ::free(ptr);
+}
+
+
+void * operator new[](std::size_t size)
+{
+  return operator new(size);
+}
+
+
+void operator delete[](void * ptr) throw()
+{
+  operator delete(ptr);
+}
+
+
+
+/*****************************************************************************
+ * Executors
+ **/
+// Runs tasks right away, in the thread submitting them.
+struct inline_executor
+  : public th::executor
+{
+  bool submit(task_type const & task)
+  {
+    task();
+    return true;
+  }
+
+  bool try_submit(task_type const & task)
+  {
+    return submit(task);
+  }
+};
+
+
+
+/*****************************************************************************
+ * legacy
+ **/
+// Reduced copy of the future implementation this benchmark compares against;
+// lazy evaluation, timed waits and continuations are left out, as they don't
+// affect the cost measured here.
+template <
+  typename return_valueT
+>
+class legacy_future
+{
+public:
+  typedef boost::signal<return_valueT ()> func_type;
+
+  legacy_future(typename func_type::slot_type slot, th::executor & exec)
+    : m_impl(new impl(exec))
+  {
+    m_impl->m_func.connect(slot);
+    m_impl->m_started = true;
+    if (!exec.submit(boost::bind(&impl::thread_runner, m_impl.get()))) {
+      m_impl->finish(NULL, new std::string("Executor did not accept the "
+            "bound function."));
+    }
+  }
+
+  return_valueT get() const
+  {
+    boost::mutex::scoped_lock l(m_impl->m_mutex);
+    while (!(m_impl->m_value || m_impl->m_exception_message)) {
+      m_impl->m_finish.wait(l);
+    }
+    if (m_impl->m_exception_message) {
+      throw th::futures::exception(*m_impl->m_exception_message);
+    }
+    return *m_impl->m_value;
+  }
+
+private:
+  struct impl
+  {
+    explicit impl(th::executor & exec)
+      : m_executor(exec)
+      , m_started(false)
+      , m_value(NULL)
+      , m_exception_message(NULL)
+    {
+    }
+
+    ~impl()
+    {
+      {
+        boost::mutex::scoped_lock l(m_mutex);
+        if (m_started) {
+          while (!(m_value || m_exception_message)) {
+            m_finish.wait(l);
+          }
+        }
+      }
+
+      delete m_value;
+      delete m_exception_message;
+    }
+
+    void thread_runner()
+    {
+      return_valueT * value = NULL;
+      std::string * exception_message = NULL;
+      try {
+        value = new return_valueT(m_func());
+      } catch (std::exception const & ex) {
+        exception_message = new std::string(ex.what());
+      } catch (...) {
+        exception_message = new std::string("Unspecified exception occurred "
+            "in bound function.");
+      }
+      finish(value, exception_message);
+    }
+
+    void finish(return_valueT * value, std::string * exception_message)
+    {
+      boost::mutex::scoped_lock l(m_mutex);
+      m_value = value;
+      m_exception_message = exception_message;
+      m_finish.notify_all();
+    }
+
+    func_type                               m_func;
+    th::executor &                          m_executor;
+    bool                                    m_started;
+    boost::condition                        m_finish;
+    boost::mutex                            m_mutex;
+    return_valueT *                         m_value;
+    std::string *                           m_exception_message;
+    std::vector<boost::function<void ()> >  m_continuations;
+  };
+
+  fhtagn::shared_ptr<impl> m_impl;
+};
+
+
+
+/*****************************************************************************
+ * Modes
+ **/
+typedef fhtagn::size_t (*func_t)();
+
+fhtagn::size_t identity()
+{
+  return 42;
+}
+
+
+typedef th::future<fhtagn::size_t> future_t;
+
+typedef mem::block_pool<
+  future_t::state_size<func_t>::value,
+  th::lock_free
+> pool_t;
+
+
+struct context
+{
+  th::executor &  exec;
+  fhtagn::size_t  batch;
+  pool_t *        pool;
+};
+
+
+fhtagn::size_t run_legacy(fhtagn::size_t count, context & ctx)
+{
+  typedef legacy_future<fhtagn::size_t> legacy_t;
+
+  fhtagn::size_t sum = 0;
+  std::vector<legacy_t> futures;
+  futures.reserve(ctx.batch);
+  for (fhtagn::size_t done = 0 ; done < count ; done += ctx.batch) {
+    fhtagn::size_t const size = std::min(ctx.batch, count - done);
+    for (fhtagn::size_t i = 0 ; i < size ; ++i) {
+      futures.push_back(legacy_t(&identity, ctx.exec));
+    }
+    for (fhtagn::size_t i = 0 ; i < size ; ++i) {
+      sum += futures[i].get();
+    }
+    futures.clear();
+  }
+  return sum;
+}
+
+
+fhtagn::size_t run_heap(fhtagn::size_t count, context & ctx)
+{
+  fhtagn::size_t sum = 0;
+  std::vector<future_t> futures;
+  futures.reserve(ctx.batch);
+  for (fhtagn::size_t done = 0 ; done < count ; done += ctx.batch) {
+    fhtagn::size_t const size = std::min(ctx.batch, count - done);
+    for (fhtagn::size_t i = 0 ; i < size ; ++i) {
+      futures.push_back(future_t(&identity, ctx.exec));
+    }
+    for (fhtagn::size_t i = 0 ; i < size ; ++i) {
+      fhtagn::size_t value = futures[i];
+      sum += value;
+    }
+    futures.clear();
+  }
+  return sum;
+}
+
+
+fhtagn::size_t run_pool(fhtagn::size_t count, context & ctx)
+{
+  fhtagn::size_t sum = 0;
+  std::vector<future_t> futures;
+  futures.reserve(ctx.batch);
+  for (fhtagn::size_t done = 0 ; done < count ; done += ctx.batch) {
+    fhtagn::size_t const size = std::min(ctx.batch, count - done);
+    for (fhtagn::size_t i = 0 ; i < size ; ++i) {
+      futures.push_back(future_t(func_t(&identity), ctx.exec, *ctx.pool));
+    }
+    for (fhtagn::size_t i = 0 ; i < size ; ++i) {
+      fhtagn::size_t value = futures[i];
+      sum += value;
+    }
+    futures.clear();
+  }
+  return sum;
+}
+
+
+
+/*****************************************************************************
+ * Driver
+ **/
+struct result
+{
+  nsec_t          min;
+  nsec_t          max;
+  nsec_t          total;
+  fhtagn::size_t  allocations;
+  bool            valid;
+};
+
+
+result run(fhtagn::size_t count, fhtagn::size_t rounds,
+    fhtagn::size_t (*func)(fhtagn::size_t, context &), context & ctx)
+{
+  result r;
+  r.min = ~nsec_t(0);
+  r.max = 0;
+  r.total = 0;
+  r.allocations = 0;
+  r.valid = true;
+
+  for (fhtagn::size_t i = 0 ; i < rounds ; ++i) {
+    fhtagn::size_t before = th::atomic_load(allocations);
+    nsec_t start = now();
+    fhtagn::size_t value = func(count, ctx);
+    nsec_t elapsed = now() - start;
+    r.allocations += th::atomic_load(allocations) - before;
+
+    r.min = std::min(r.min, elapsed);
+    r.max = std::max(r.max, elapsed);
+    r.total += elapsed;
+    if (value != count * identity()) {
+      r.valid = false;
+    }
+  }
+  return r;
+}
+
+
+void report(std::string const & version, std::string const & mode,
+    std::string const & executor, fhtagn::size_t count,
+    fhtagn::size_t batch, fhtagn::size_t rounds, result const & r)
+{
+  std::cout << version << "," << mode << "," << executor << ","
+    << count << "," << batch << "," << rounds << ","
+    << (double(r.min) / count) << ","
+    << (double(r.total) / rounds / count) << ","
+    << (double(r.max) / count) << ","
+    << (double(r.allocations) / rounds / count) << ","
+    << (r.valid ? "ok" : "mismatch") << std::endl;
+}
+
+
+std::vector<std::string> split(std::string const & list)
+{
+  std::vector<std::string> result;
+  std::string::size_type start = 0;
+  while (start <= list.size()) {
+    std::string::size_type end = list.find(',', start);
+    if (end == std::string::npos) {
+      end = list.size();
+    }
+    if (end > start) {
+      result.push_back(list.substr(start, end - start));
+    }
+    start = end + 1;
+  }
+  return result;
+}
+
+
+
+int main(int argc, char **argv)
+{
+  namespace po = boost::program_options;
+
+  po::options_description desc(
+    "Future benchmark.\n\n"
+    "This benchmark creates futures for a function that does no work in\n"
+    "batches, and reads each batch's values once all of its futures are\n"
+    "created. The futures are implemented in one of the following modes:\n"
+    " - legacy: a copy of the former future implementation, which bound its\n"
+    "   function via boost::signal and allocated its value on the heap.\n"
+    " - heap: fhtagn::threads::future, allocating its state on the heap.\n"
+    " - pool: fhtagn::threads::future, allocating its state from a\n"
+    "   lock-free block_pool.\n\n"
+    "The futures either run on an executor that calls their functions right\n"
+    "away ('inline'), or on a thread_pool_executor ('pool').\n\n"
+    "The minimum, mean and maximum time per future in nanoseconds, and the\n"
+    "mean number of calls to operator new per future, are printed as CSV\n"
+    "with a header line, along with whether the sum of the values read\n"
+    "matched the expected sum.\n\n"
+    "Command line arguments"
+  );
+
+  std::string modes;
+  std::string executors;
+  fhtagn::size_t count = 0;
+  fhtagn::size_t batch = 0;
+  fhtagn::size_t rounds = 0;
+  fhtagn::size_t num_threads = 0;
+
+  desc.add_options()
+    ("help", "Prints this help text and exits.")
+    ("modes", po::value<std::string>(&modes)->default_value("all"),
+        "Comma separated list of modes to run, or 'all'. Possible values are "
+        "'legacy', 'heap' and 'pool'.")
+    ("executors", po::value<std::string>(&executors)->default_value("all"),
+        "Comma separated list of executors to run the modes on, or 'all'. "
+        "Possible values are 'inline' and 'pool'.")
+    ("futures", po::value<fhtagn::size_t>(&count)->default_value(100000),
+        "Number of futures per round.")
+    ("batch", po::value<fhtagn::size_t>(&batch)->default_value(64),
+        "Number of futures created before their values are read.")
+    ("rounds", po::value<fhtagn::size_t>(&rounds)->default_value(10),
+        "Number of rounds per mode.")
+    ("threads", po::value<fhtagn::size_t>(&num_threads)->default_value(0),
+        "Number of worker threads for the thread_pool_executor, or 0 for one "
+        "per hardware thread.")
+  ;
+
+  po::variables_map vm;
+  po::store(po::parse_command_line(argc, argv, desc), vm);
+  po::notify(vm);
+
+  if (vm.count("help")) {
+    std::cout << desc << "\n";
+    return 1;
+  }
+
+  if (!count || !batch || !rounds) {
+    std::cerr << "Futures, batch and rounds must be at least one."
+      << std::endl;
+    return 1;
+  }
+
+  if (!num_threads) {
+    num_threads = boost::thread::hardware_concurrency();
+    if (!num_threads) {
+      num_threads = 1;
+    }
+  }
+
+  std::vector<std::string> mode_names;
+  if (modes == "all") {
+    mode_names.push_back("legacy");
+    mode_names.push_back("heap");
+    mode_names.push_back("pool");
+  }
+  else {
+    mode_names = split(modes);
+  }
+
+  std::vector<std::string> executor_names;
+  if (executors == "all") {
+    executor_names.push_back("inline");
+    executor_names.push_back("pool");
+  }
+  else {
+    executor_names = split(executors);
+  }
+
+  std::pair<boost::uint16_t, boost::uint16_t> v = fhtagn::version();
+  std::stringstream version;
+  version << v.first << "." << v.second;
+
+  // Room for a full batch of future states, plus alignment and the pool's
+  // metadata.
+  std::vector<char> memory((batch + 1) * 2
+      * future_t::state_size<func_t>::value);
+  pool_t pool(&memory[0], memory.size());
+
+  std::cout << "version,mode,executor,futures,batch,rounds,min_nsec,"
+    "mean_nsec,max_nsec,allocations,result" << std::endl;
+
+  for (std::vector<std::string>::const_iterator exec_name
+      = executor_names.begin() ; exec_name != executor_names.end()
+      ; ++exec_name)
+  {
+    inline_executor inline_exec;
+    th::thread_pool_executor pool_exec(num_threads, batch);
+
+    th::executor * exec = NULL;
+    if (*exec_name == "inline") {
+      exec = &inline_exec;
+    }
+    else if (*exec_name == "pool") {
+      exec = &pool_exec;
+    }
+    else {
+      std::cerr << "Unknown executor: " << *exec_name << std::endl;
+      return 1;
+    }
+
+    context ctx = { *exec, batch, &pool };
+
+    for (std::vector<std::string>::const_iterator mode = mode_names.begin()
+        ; mode != mode_names.end() ; ++mode)
+    {
+      if (*mode == "legacy") {
+        report(version.str(), *mode, *exec_name, count, batch, rounds,
+            run(count, rounds, &run_legacy, ctx));
+      }
+      else if (*mode == "heap") {
+        report(version.str(), *mode, *exec_name, count, batch, rounds,
+            run(count, rounds, &run_heap, ctx));
+      }
+      else if (*mode == "pool") {
+        report(version.str(), *mode, *exec_name, count, batch, rounds,
+            run(count, rounds, &run_pool, ctx));
+      }
+      else {
+        std::cerr << "Unknown mode: " << *mode << std::endl;
+        return 1;
+      }
+    }
+  }
+
+  return 0;
+}
@@ -0,0 +1,504 @@
+/**
+ * $Id$
+ *
+ * This file is part of the Fhtagn! C++ Library.
+ * Copyright (C) 2009,2010,2011 Jens Finkhaeuser <unwesen@users.sourceforge.net>.
+ *
+ * Author: Jens Finkhaeuser <unwesen@users.sourceforge.net>
+ *
+ * This program is licensed as free software for personal, educational or
+ * other non-commerical uses: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation, either version 3 of the License, or (at your
+ * option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Alternatively, licenses for commercial purposes are available as well.
+ * Please send your enquiries to the copyright holder's address above.
+ **/
+
+#include <stdlib.h>
+
+#if defined(_WIN32)
+#include <windows.h>
+#else
+#include <time.h>
+#endif
+
+#include <algorithm>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include <fhtagn/version.h>
+
+#include <fhtagn/threads/scheduler.h>
+#include <fhtagn/threads/executor.h>
+#include <fhtagn/threads/future.h>
+
+#include <boost/bind.hpp>
+#include <boost/program_options.hpp>
+#include <boost/thread.hpp>
+#include <boost/thread/condition.hpp>
+
+namespace th = fhtagn::threads;
+
+
+// The benchmark runs a recursive fan-out workload: a tree of the given depth,
+// in which each inner node has the given number of children, and each leaf
+// performs a fixed amount of busy work. Each inner node sums up its
+// children's results, and the result of the root node is checked against the
+// result of the serial run.
+//
+// Modes:
+//  - serial:    the tree is evaluated recursively in the calling thread.
+//  - scheduler: each node is a job on a work-stealing scheduler, which spawns
+//               and joins its children.
+//  - pool:      a thread_pool_executor can't run the recursion without tying
+//               up workers waiting for their children, so only the leaves are
+//               submitted to it, all from the calling thread.
+//  - thread:    each node is a future on the default executor, i.e. one thread
+//               per node, which reads its children's futures. Skipped for
+//               trees with more nodes than --max-threads.
+//
+// Each round evaluates the whole tree; the minimum, mean and maximum time per
+// round are reported, one line per mode, as CSV.
+
+
+typedef boost::uint64_t nsec_t;
+
+
+// Monotonic clock with nanosecond resolution.
+inline nsec_t now()
+{
+#if defined(_WIN32)
+  static LARGE_INTEGER frequency = { 0 };
+  if (!frequency.QuadPart) {
+    ::QueryPerformanceFrequency(&frequency);
+  }
+  LARGE_INTEGER counter;
+  ::QueryPerformanceCounter(&counter);
+  return nsec_t(counter.QuadPart) * 1000000000 / frequency.QuadPart;
+#else
+  ::timespec ts;
+  ::clock_gettime(CLOCK_MONOTONIC, &ts);
+  return nsec_t(ts.tv_sec) * 1000000000 + ts.tv_nsec;
+#endif
+}
+
+
+
+// Shape of the tree, and the amount of work per leaf.
+struct workload
+{
+  fhtagn::size_t depth;
+  fhtagn::size_t width;
+  fhtagn::size_t work;
+
+  fhtagn::size_t leaves() const
+  {
+    fhtagn::size_t result = 1;
+    for (fhtagn::size_t i = 0 ; i < depth ; ++i) {
+      result *= width;
+    }
+    return result;
+  }
+
+  fhtagn::size_t nodes() const
+  {
+    fhtagn::size_t result = 0;
+    fhtagn::size_t level = 1;
+    for (fhtagn::size_t i = 0 ; i <= depth ; ++i) {
+      result += level;
+      level *= width;
+    }
+    return result;
+  }
+};
+
+
+
+// Busy work for a leaf: iterate a xorshift RNG seeded with the leaf's index.
+fhtagn::size_t leaf(workload const & w, fhtagn::size_t index)
+{
+  boost::uint32_t state = 0xdeadbeef ^ (boost::uint32_t(index) * 0x9e3779b9);
+  for (fhtagn::size_t i = 0 ; i < w.work ; ++i) {
+    state ^= state << 13;
+    state ^= state >> 17;
+    state ^= state << 5;
+  }
+  return state & 0xffff;
+}
+
+
+
+/*****************************************************************************
+ * serial
+ **/
+fhtagn::size_t serial_node(workload const & w, fhtagn::size_t depth,
+    fhtagn::size_t index)
+{
+  if (!depth) {
+    return leaf(w, index);
+  }
+
+  fhtagn::size_t sum = 0;
+  for (fhtagn::size_t i = 0 ; i < w.width ; ++i) {
+    sum += serial_node(w, depth - 1, index * w.width + i);
+  }
+  return sum;
+}
+
+
+fhtagn::size_t run_serial(workload const & w, fhtagn::size_t &)
+{
+  return serial_node(w, w.depth, 0);
+}
+
+
+
+/*****************************************************************************
+ * scheduler
+ **/
+void scheduler_node(workload const & w, fhtagn::size_t depth,
+    fhtagn::size_t index, fhtagn::size_t * result, th::scheduler::job & j)
+{
+  if (!depth) {
+    *result = leaf(w, index);
+    return;
+  }
+
+  th::scheduler & sched = j.get_scheduler();
+
+  std::vector<fhtagn::size_t> results(w.width, 0);
+  std::vector<th::scheduler::job_ptr> children;
+  children.reserve(w.width);
+  for (fhtagn::size_t i = 0 ; i < w.width ; ++i) {
+    children.push_back(sched.spawn(boost::bind(&scheduler_node,
+            boost::cref(w), depth - 1, index * w.width + i, &results[i], _1)));
+  }
+
+  fhtagn::size_t sum = 0;
+  for (fhtagn::size_t i = 0 ; i < w.width ; ++i) {
+    sched.join(children[i]);
+    sum += results[i];
+  }
+  *result = sum;
+}
+
+
+fhtagn::size_t run_scheduler(workload const & w, th::scheduler & sched)
+{
+  fhtagn::size_t result = 0;
+  sched.join(sched.spawn(boost::bind(&scheduler_node, boost::cref(w),
+          w.depth, 0, &result, _1)));
+  return result;
+}
+
+
+
+/*****************************************************************************
+ * pool
+ **/
+struct latch
+{
+  explicit latch(fhtagn::size_t count)
+    : m_count(count)
+  {
+  }
+
+  void count_down()
+  {
+    boost::mutex::scoped_lock l(m_mutex);
+    if (!--m_count) {
+      m_condition.notify_all();
+    }
+  }
+
+  void wait()
+  {
+    boost::mutex::scoped_lock l(m_mutex);
+    while (m_count) {
+      m_condition.wait(l);
+    }
+  }
+
+  fhtagn::size_t    m_count;
+  boost::mutex      m_mutex;
+  boost::condition  m_condition;
+};
+
+
+void pool_leaf(workload const & w, fhtagn::size_t index,
+    fhtagn::size_t * result, latch * done)
+{
+  *result = leaf(w, index);
+  done->count_down();
+}
+
+
+fhtagn::size_t run_pool(workload const & w, th::thread_pool_executor & exec)
+{
+  fhtagn::size_t const leaves = w.leaves();
+  std::vector<fhtagn::size_t> results(leaves, 0);
+  latch done(leaves);
+
+  for (fhtagn::size_t i = 0 ; i < leaves ; ++i) {
+    exec.submit(boost::bind(&pool_leaf, boost::cref(w), i, &results[i],
+          &done));
+  }
+  done.wait();
+
+  // Sum up in the same order as the tree would.
+  fhtagn::size_t sum = 0;
+  for (fhtagn::size_t i = 0 ; i < leaves ; ++i) {
+    sum += results[i];
+  }
+  return sum;
+}
+
+
+
+/*****************************************************************************
+ * thread
+ **/
+fhtagn::size_t thread_node(workload const & w, fhtagn::size_t depth,
+    fhtagn::size_t index)
+{
+  if (!depth) {
+    return leaf(w, index);
+  }
+
+  // futures aren't assignable, so they can't be kept in a vector directly.
+  typedef fhtagn::shared_ptr<th::future<fhtagn::size_t> > future_ptr;
+  std::vector<future_ptr> children;
+  children.reserve(w.width);
+  for (fhtagn::size_t i = 0 ; i < w.width ; ++i) {
+    children.push_back(future_ptr(new th::future<fhtagn::size_t>(boost::bind(
+            &thread_node, boost::cref(w), depth - 1, index * w.width + i))));
+  }
+
+  fhtagn::size_t sum = 0;
+  for (fhtagn::size_t i = 0 ; i < w.width ; ++i) {
+    fhtagn::size_t value = *children[i];
+    sum += value;
+  }
+  return sum;
+}
+
+
+fhtagn::size_t run_thread(workload const & w, fhtagn::size_t &)
+{
+  th::future<fhtagn::size_t> root(boost::bind(&thread_node, boost::cref(w),
+        w.depth, 0));
+  fhtagn::size_t value = root;
+  return value;
+}
+
+
+
+/*****************************************************************************
+ * Driver
+ **/
+struct result
+{
+  nsec_t min;
+  nsec_t max;
+  nsec_t total;
+  bool   valid;
+};
+
+
+template <
+  typename contextT
+>
+result run(workload const & w, fhtagn::size_t rounds, fhtagn::size_t expected,
+    fhtagn::size_t (*func)(workload const &, contextT &), contextT & context)
+{
+  result r;
+  r.min = ~nsec_t(0);
+  r.max = 0;
+  r.total = 0;
+  r.valid = true;
+
+  for (fhtagn::size_t i = 0 ; i < rounds ; ++i) {
+    nsec_t start = now();
+    fhtagn::size_t value = func(w, context);
+    nsec_t elapsed = now() - start;
+
+    r.min = std::min(r.min, elapsed);
+    r.max = std::max(r.max, elapsed);
+    r.total += elapsed;
+    if (value != expected) {
+      r.valid = false;
+    }
+  }
+  return r;
+}
+
+
+void report(std::string const & version, std::string const & mode,
+    fhtagn::size_t threads, workload const & w, fhtagn::size_t rounds,
+    result const & r)
+{
+  std::cout << version << "," << mode << "," << threads << ","
+    << w.depth << "," << w.width << "," << w.work << ","
+    << w.nodes() << "," << w.leaves() << "," << rounds << ","
+    << (r.min / 1000) << "," << (r.total / rounds / 1000) << ","
+    << (r.max / 1000) << "," << (r.valid ? "ok" : "mismatch") << std::endl;
+}
+
+
+std::vector<std::string> split(std::string const & list)
+{
+  std::vector<std::string> result;
+  std::string::size_type start = 0;
+  while (start <= list.size()) {
+    std::string::size_type end = list.find(',', start);
+    if (end == std::string::npos) {
+      end = list.size();
+    }
+    if (end > start) {
+      result.push_back(list.substr(start, end - start));
+    }
+    start = end + 1;
+  }
+  return result;
+}
+
+
+
+int main(int argc, char **argv)
+{
+  namespace po = boost::program_options;
+
+  po::options_description desc(
+    "Scheduler benchmark.\n\n"
+    "This benchmark evaluates a tree of jobs, in which each inner node spawns\n"
+    "a number of children and sums up their results, and each leaf performs\n"
+    "a fixed amount of busy work. The tree is evaluated in the following\n"
+    "modes:\n"
+    " - serial: recursively in the calling thread.\n"
+    " - scheduler: one job per node on the work-stealing scheduler.\n"
+    " - pool: only the leaves, submitted to a thread_pool_executor from the\n"
+    "   calling thread.\n"
+    " - thread: one future per node, each running in its own thread. Skipped\n"
+    "   for trees with more than --max-threads nodes.\n\n"
+    "The minimum, mean and maximum time per evaluation of the whole tree are\n"
+    "printed as CSV with a header line, along with whether the result matched\n"
+    "the serial evaluation's.\n\n"
+    "Command line arguments"
+  );
+
+  std::string modes;
+  fhtagn::size_t num_threads = 0;
+  fhtagn::size_t rounds = 0;
+  fhtagn::size_t max_threads = 0;
+  workload w;
+
+  desc.add_options()
+    ("help", "Prints this help text and exits.")
+    ("modes", po::value<std::string>(&modes)->default_value("all"),
+        "Comma separated list of modes to run, or 'all'. Possible values are "
+        "'serial', 'scheduler', 'pool' and 'thread'.")
+    ("depth", po::value<fhtagn::size_t>(&w.depth)->default_value(4),
+        "Depth of the tree.")
+    ("width", po::value<fhtagn::size_t>(&w.width)->default_value(6),
+        "Number of children per inner node.")
+    ("work", po::value<fhtagn::size_t>(&w.work)->default_value(2000),
+        "Number of RNG iterations per leaf.")
+    ("threads", po::value<fhtagn::size_t>(&num_threads)->default_value(0),
+        "Number of worker threads for the scheduler and pool modes, or 0 for "
+        "one per hardware thread.")
+    ("rounds", po::value<fhtagn::size_t>(&rounds)->default_value(20),
+        "Number of evaluations of the tree per mode.")
+    ("max-threads", po::value<fhtagn::size_t>(&max_threads)
+        ->default_value(2000),
+        "Maximum number of nodes for which the thread mode is run.")
+  ;
+
+  po::variables_map vm;
+  po::store(po::parse_command_line(argc, argv, desc), vm);
+  po::notify(vm);
+
+  if (vm.count("help")) {
+    std::cout << desc << "\n";
+    return 1;
+  }
+
+  if (!w.width || !rounds) {
+    std::cerr << "Width and rounds must be at least one." << std::endl;
+    return 1;
+  }
+
+  if (!num_threads) {
+    num_threads = boost::thread::hardware_concurrency();
+    if (!num_threads) {
+      num_threads = 1;
+    }
+  }
+
+  std::vector<std::string> mode_names;
+  if (modes == "all") {
+    mode_names.push_back("serial");
+    mode_names.push_back("scheduler");
+    mode_names.push_back("pool");
+    mode_names.push_back("thread");
+  }
+  else {
+    mode_names = split(modes);
+  }
+
+  std::pair<boost::uint16_t, boost::uint16_t> v = fhtagn::version();
+  std::stringstream version;
+  version << v.first << "." << v.second;
+
+  std::cout << "version,mode,threads,depth,width,work,nodes,leaves,rounds,"
+    "min_usec,mean_usec,max_usec,result" << std::endl;
+
+  fhtagn::size_t const expected = serial_node(w, w.depth, 0);
+
+  for (std::vector<std::string>::const_iterator mode = mode_names.begin()
+      ; mode != mode_names.end() ; ++mode)
+  {
+    if (*mode == "serial") {
+      fhtagn::size_t dummy = 0;
+      report(version.str(), *mode, 1, w, rounds,
+          run(w, rounds, expected, &run_serial, dummy));
+    }
+    else if (*mode == "scheduler") {
+      th::scheduler sched(num_threads);
+      report(version.str(), *mode, num_threads, w, rounds,
+          run(w, rounds, expected, &run_scheduler, sched));
+    }
+    else if (*mode == "pool") {
+      th::thread_pool_executor exec(num_threads, 1024);
+      report(version.str(), *mode, num_threads, w, rounds,
+          run(w, rounds, expected, &run_pool, exec));
+    }
+    else if (*mode == "thread") {
+      if (w.nodes() > max_threads) {
+        std::cerr << "Skipping thread mode for " << w.nodes() << " nodes."
+          << std::endl;
+        continue;
+      }
+      fhtagn::size_t dummy = 0;
+      report(version.str(), *mode, w.nodes(), w, rounds,
+          run(w, rounds, expected, &run_thread, dummy));
+    }
+    else {
+      std::cerr << "Unknown mode: " << *mode << std::endl;
+      return 1;
+    }
+  }
+
+  return 0;
+}
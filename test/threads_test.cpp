@@ -25,6 +25,7 @@
  **/
 
 #include <cmath>
+#include <vector>
 
 #include <boost/bind.hpp>
 #include <boost/thread/xtime.hpp>
@@ -35,6 +36,11 @@
 #include <fhtagn/threads/tasklet.h>
 #include <fhtagn/threads/lock_policy.h>
 #include <fhtagn/threads/future.h>
+#include <fhtagn/threads/executor.h>
+#include <fhtagn/threads/scheduler.h>
+#include <fhtagn/threads/atomic.h>
+
+#include <fhtagn/memory/block_pool.h>
 
 namespace {
 
@@ -59,10 +65,26 @@ void error_handler(fhtagn::threads::tasklet & t, std::exception const & ex)
 }
 
 
+void throwing_lean_func(fhtagn::threads::lean_tasklet & t)
+{
+    throw std::runtime_error("test_error");
+}
+
+
+int lean_errors_handled = 0;
+void lean_error_handler(fhtagn::threads::lean_tasklet & t,
+        std::exception const & ex)
+{
+    CPPUNIT_ASSERT_EQUAL(std::string("test_error"), std::string(ex.what()));
+    ++lean_errors_handled;
+}
+
+
 struct bind_test
 {
     bind_test()
         : done(false)
+        , sleep_state(fhtagn::threads::tasklet::STANDING_BY)
         , wake_count(0)
     {
     }
@@ -81,10 +103,11 @@ struct bind_test
     }
 
 
-    void sleep_halfsec(fhtagn::threads::tasklet & t)
+    template <typename taskT>
+    void sleep_halfsec(taskT & t)
     {
         namespace th = fhtagn::threads;
-        t.sleep(500000);
+        sleep_state = t.sleep(500000);
         done = true;
     }
 
@@ -117,7 +140,8 @@ struct bind_test
     }
 
 
-    void counting_member(fhtagn::threads::tasklet & t)
+    template <typename taskT>
+    void counting_member(taskT & t)
     {
         namespace th = fhtagn::threads;
         th::tasklet::state s = th::tasklet::STANDING_BY;
@@ -137,6 +161,7 @@ struct bind_test
 
 
     bool     done;
+    fhtagn::threads::tasklet::state sleep_state;
 
     boost::mutex      wake_mutex;
     boost::condition  wake_condition;
@@ -336,6 +361,159 @@ fhtagn::size_t throwing_future_func()
 }
 
 
+struct executor_test
+{
+    executor_test()
+        : count(0)
+        , open(false)
+    {
+    }
+
+
+    void increment()
+    {
+        boost::mutex::scoped_lock l(mutex);
+        ++count;
+    }
+
+
+    // Blocks until open_gate() is called.
+    void gate()
+    {
+        boost::mutex::scoped_lock l(mutex);
+        while (!open) {
+            condition.wait(l);
+        }
+        ++count;
+    }
+
+
+    void open_gate()
+    {
+        boost::mutex::scoped_lock l(mutex);
+        open = true;
+        condition.notify_all();
+    }
+
+
+    int get_count()
+    {
+        boost::mutex::scoped_lock l(mutex);
+        return count;
+    }
+
+
+    int               count;
+    bool              open;
+    boost::mutex      mutex;
+    boost::condition  condition;
+};
+
+
+struct fan_out_test
+{
+    fan_out_test(int _width)
+        : width(_width)
+        , leaves(0)
+    {
+    }
+
+
+    void node(int depth, fhtagn::threads::scheduler::job & j)
+    {
+        namespace th = fhtagn::threads;
+
+        if (!depth) {
+            th::atomic_add(leaves, fhtagn::size_t(1));
+            return;
+        }
+
+        std::vector<th::scheduler::job_ptr> children;
+        for (int i = 0 ; i < width ; ++i) {
+            children.push_back(j.get_scheduler().spawn(boost::bind(
+                            &fan_out_test::node, this, depth - 1, _1)));
+        }
+        for (int i = 0 ; i < width ; ++i) {
+            CPPUNIT_ASSERT_EQUAL((int) th::tasklet::FINISHED,
+                    (int) j.get_scheduler().join(children[i]));
+        }
+    }
+
+
+    int                       width;
+    fhtagn::size_t volatile   leaves;
+};
+
+
+fhtagn::size_t gated_future_func(executor_test * et)
+{
+    et->gate();
+    return 7;
+}
+
+
+// Opens the gate after a short delay, by which time the future waiting for it
+// is usually being destroyed.
+void open_gate_later(executor_test * et)
+{
+    boost::xtime t;
+    boost::xtime_get(&t, boost::TIME_UTC);
+    t.nsec += 50000000;
+    if (t.nsec >= 1000000000) {
+        ++t.sec;
+        t.nsec -= 1000000000;
+    }
+    boost::thread::sleep(t);
+
+    et->open_gate();
+}
+
+
+// Function object with state that's used after the gate opens.
+struct gated_string_func
+{
+    gated_string_func(executor_test * _et, std::string const & _text)
+        : et(_et)
+        , text(_text)
+    {
+    }
+
+    fhtagn::size_t operator()() const
+    {
+        et->gate();
+        return text.size();
+    }
+
+    executor_test *   et;
+    std::string       text;
+};
+
+
+fhtagn::size_t add_one(fhtagn::threads::future<fhtagn::size_t> const & f)
+{
+    fhtagn::size_t x = f;
+    return x + 1;
+}
+
+
+fhtagn::size_t sum(
+        fhtagn::threads::future<std::vector<fhtagn::size_t> > const & f)
+{
+    std::vector<fhtagn::size_t> values = f;
+    fhtagn::size_t result = 0;
+    for (fhtagn::size_t i = 0 ; i < values.size() ; ++i) {
+        result += values[i];
+    }
+    return result;
+}
+
+
+void throwing_job(fhtagn::threads::scheduler::job & j)
+{
+    throw std::runtime_error("test_error");
+}
+
+
 } // anonymous namespace
 
 class ThreadsTest
@@ -349,12 +527,24 @@ public:
         CPPUNIT_TEST(testTaskletFreeFun);
         CPPUNIT_TEST(testTaskletError);
         CPPUNIT_TEST(testTaskletScope);
+        CPPUNIT_TEST(testLeanTasklet);
 
         CPPUNIT_TEST(testMutexConcepts);
         CPPUNIT_TEST(testMutexes);
 
         CPPUNIT_TEST(testFutures);
 
+        CPPUNIT_TEST(testExecutors);
+        CPPUNIT_TEST(testExecutorFutures);
+        CPPUNIT_TEST(testFutureWait);
+        CPPUNIT_TEST(testFutureContinuations);
+        CPPUNIT_TEST(testFutureComposition);
+        CPPUNIT_TEST(testFuturePool);
+        CPPUNIT_TEST(testFutureScope);
+
+        CPPUNIT_TEST(testScheduler);
+        CPPUNIT_TEST(testSchedulerSleep);
+
     CPPUNIT_TEST_SUITE_END();
 private:
 
@@ -394,7 +584,8 @@ private:
         // be larger than half a second.
         {
             bind_test bt;
-            th::tasklet task(boost::bind(&bind_test::sleep_halfsec,
+            th::tasklet task(boost::bind(
+                        &bind_test::sleep_halfsec<th::tasklet>,
                         boost::ref(bt), _1));
 
             boost::xtime t1;
@@ -411,6 +602,8 @@ private:
             // The time difference must be very close to the sleep time of
             // 500msec. We'll want no less than 0.1 msec difference.
             CPPUNIT_ASSERT(std::labs((st2 - st1) - 500000000) < 1000000);
+            CPPUNIT_ASSERT_EQUAL((int) th::tasklet::RUNNING,
+                    (int) bt.sleep_state);
         }
 
         // Count how often the thread got woken. Since it sleeps indefinitely,
@@ -419,7 +612,8 @@ private:
         // incremented, though.
         {
             bind_test bt;
-            th::tasklet task(boost::bind(&bind_test::counting_member,
+            th::tasklet task(boost::bind(
+                        &bind_test::counting_member<th::tasklet>,
                         boost::ref(bt), _1));
 
             CPPUNIT_ASSERT(task.start());
@@ -587,6 +781,89 @@ private:
     }
 
 
+    void testLeanTasklet()
+    {
+        namespace th = fhtagn::threads;
+
+        th::thread_pool_executor exec(1, 4);
+
+        // Wake and stop a sleeping lean_tasklet, as in testTaskletSleep().
+        {
+            bind_test bt;
+            th::lean_tasklet task(boost::bind(
+                        &bind_test::counting_member<th::lean_tasklet>,
+                        boost::ref(bt), _1), exec);
+
+            CPPUNIT_ASSERT(task.start());
+            CPPUNIT_ASSERT(!task.start());
+            while (th::tasklet::SLEEPING != task.get_state());
+
+            CPPUNIT_ASSERT(task.wakeup());
+            {
+                boost::mutex::scoped_lock l(bt.wake_mutex);
+                while (0 == bt.wake_count) {
+                    bt.wake_condition.wait(l);
+                }
+            }
+
+            CPPUNIT_ASSERT(task.stop());
+            CPPUNIT_ASSERT(task.wait());
+            CPPUNIT_ASSERT_EQUAL((int) th::tasklet::FINISHED,
+                    (int) task.get_state());
+            CPPUNIT_ASSERT(bt.done);
+        }
+
+        // Errors abort the tasklet, with or without error handlers...
+        {
+            lean_errors_handled = 0;
+            th::lean_tasklet task(&throwing_lean_func, exec);
+
+            CPPUNIT_ASSERT(task.start());
+            CPPUNIT_ASSERT(task.wait());
+            CPPUNIT_ASSERT_EQUAL((int) th::tasklet::ABORTED,
+                    (int) task.get_state());
+            CPPUNIT_ASSERT(task.reset());
+
+            // ... and all error handlers get invoked.
+            task.add_error_handler(boost::bind(&lean_error_handler, _1, _2));
+            task.add_error_handler(boost::bind(&lean_error_handler, _1, _2));
+
+            CPPUNIT_ASSERT(task.start());
+            CPPUNIT_ASSERT(task.wait());
+            CPPUNIT_ASSERT_EQUAL((int) th::tasklet::ABORTED,
+                    (int) task.get_state());
+            CPPUNIT_ASSERT_EQUAL(int(2), lean_errors_handled);
+        }
+
+        // Error handlers can't be added while the tasklet is started.
+        {
+            bind_test bt;
+            th::lean_tasklet task(boost::bind(
+                        &bind_test::counting_member<th::lean_tasklet>,
+                        boost::ref(bt), _1));
+
+            CPPUNIT_ASSERT(task.start());
+            CPPUNIT_ASSERT_THROW(task.add_error_handler(boost::bind(
+                            &lean_error_handler, _1, _2)), std::logic_error);
+        }
+
+        // Destroying started and unstarted tasklets is fine.
+        {
+            bind_test bt;
+            th::lean_tasklet task(boost::bind(
+                        &bind_test::counting_member<th::lean_tasklet>,
+                        boost::ref(bt), _1), exec);
+        }
+        {
+            bind_test bt;
+            th::lean_tasklet task(boost::bind(
+                        &bind_test::counting_member<th::lean_tasklet>,
+                        boost::ref(bt), _1), exec);
+            task.start();
+        }
+    }
+
+
     void testMutexConcepts()
     {
         namespace th = fhtagn::threads;
@@ -734,6 +1011,500 @@ private:
         CPPUNIT_ASSERT_EQUAL(f1, f2);
       }
     }
+
+
+    void testExecutors()
+    {
+        namespace th = fhtagn::threads;
+
+        // The thread_per_task_executor's destructor waits for all tasks.
+        {
+            executor_test et;
+            {
+                th::thread_per_task_executor exec;
+                for (int i = 0 ; i < 10 ; ++i) {
+                    CPPUNIT_ASSERT(exec.submit(boost::bind(
+                                &executor_test::increment, boost::ref(et))));
+                }
+            }
+            CPPUNIT_ASSERT_EQUAL(int(10), et.get_count());
+        }
+
+        // Same for the thread_pool_executor, which runs all queued tasks
+        // before shutting down.
+        {
+            executor_test et;
+            {
+                th::thread_pool_executor exec(4, 16);
+                CPPUNIT_ASSERT_EQUAL(fhtagn::size_t(4), exec.threads());
+                CPPUNIT_ASSERT_EQUAL(fhtagn::size_t(16), exec.capacity());
+                for (int i = 0 ; i < 1000 ; ++i) {
+                    CPPUNIT_ASSERT(exec.submit(boost::bind(
+                                &executor_test::increment, boost::ref(et))));
+                }
+            }
+            CPPUNIT_ASSERT_EQUAL(int(1000), et.get_count());
+        }
+
+        // The queue is bounded. Block the only worker, then fill the queue.
+        {
+            executor_test et;
+            th::thread_pool_executor exec(1, 2);
+
+            CPPUNIT_ASSERT(exec.submit(boost::bind(&executor_test::gate,
+                            boost::ref(et))));
+            // Wait for the worker to pick up the blocking task.
+            while (exec.pending()) {
+                boost::this_thread::yield();
+            }
+
+            CPPUNIT_ASSERT(exec.try_submit(boost::bind(
+                            &executor_test::increment, boost::ref(et))));
+            CPPUNIT_ASSERT(exec.try_submit(boost::bind(
+                            &executor_test::increment, boost::ref(et))));
+            CPPUNIT_ASSERT_EQUAL(fhtagn::size_t(2), exec.pending());
+            CPPUNIT_ASSERT_EQUAL(false, exec.try_submit(boost::bind(
+                            &executor_test::increment, boost::ref(et))));
+
+            et.open_gate();
+            exec.shutdown();
+            CPPUNIT_ASSERT_EQUAL(int(3), et.get_count());
+
+            // Once shut down, no more tasks are accepted.
+            CPPUNIT_ASSERT_EQUAL(false, exec.submit(boost::bind(
+                            &executor_test::increment, boost::ref(et))));
+            CPPUNIT_ASSERT_EQUAL(false, exec.try_submit(boost::bind(
+                            &executor_test::increment, boost::ref(et))));
+        }
+
+        CPPUNIT_ASSERT_THROW(th::thread_pool_executor(0, 1), std::logic_error);
+        CPPUNIT_ASSERT_THROW(th::thread_pool_executor(1, 0), std::logic_error);
+    }
+
+
+    void testExecutorFutures()
+    {
+        namespace th = fhtagn::threads;
+
+        th::thread_pool_executor exec(2, 64);
+
+        // immediate evaluation
+        {
+            th::future<fhtagn::size_t> f(&future_func, exec);
+            fhtagn::size_t x = f;
+            CPPUNIT_ASSERT_EQUAL(fhtagn::size_t(42), x);
+        }
+
+        // lazy evaluation
+        {
+            th::future<fhtagn::size_t> f(&future_func,
+                    th::futures::lazy_evaluate(), exec);
+            fhtagn::size_t x = f;
+            CPPUNIT_ASSERT_EQUAL(fhtagn::size_t(42), x);
+        }
+
+        // future and exception
+        {
+            th::future<fhtagn::size_t> f(&throwing_future_func, exec);
+            fhtagn::size_t x = 0;
+            CPPUNIT_ASSERT_THROW(x = f, th::futures::exception);
+        }
+
+        // Many more futures than workers or queue slots.
+        {
+            typedef fhtagn::shared_ptr<th::future<fhtagn::size_t> > future_ptr;
+            std::vector<future_ptr> futures;
+            for (int i = 0 ; i < 500 ; ++i) {
+                futures.push_back(future_ptr(new th::future<fhtagn::size_t>(
+                                &future_func, exec)));
+            }
+            for (int i = 0 ; i < 500 ; ++i) {
+                fhtagn::size_t x = *futures[i];
+                CPPUNIT_ASSERT_EQUAL(fhtagn::size_t(42), x);
+            }
+        }
+
+        // Tasklets can run on a pool as well, and be restarted there.
+        {
+            bind_test bt;
+            th::tasklet task(boost::bind(&bind_test::sleeping_member,
+                        boost::ref(bt), _1), exec);
+
+            for (int i = 0 ; i < 3 ; ++i) {
+                bt.done = false;
+                CPPUNIT_ASSERT(task.start());
+                CPPUNIT_ASSERT(task.stop());
+                CPPUNIT_ASSERT(task.wait());
+                CPPUNIT_ASSERT(bt.done);
+                CPPUNIT_ASSERT(task.reset());
+            }
+        }
+
+        // A future whose executor has shut down reports an error rather than
+        // blocking forever.
+        {
+            th::thread_pool_executor closed(1, 1);
+            closed.shutdown();
+
+            th::future<fhtagn::size_t> f(&future_func, closed);
+            fhtagn::size_t x = 0;
+            CPPUNIT_ASSERT_THROW(x = f, th::futures::exception);
+        }
+    }
+
+
+    void testFutureWait()
+    {
+        namespace th = fhtagn::threads;
+
+        executor_test et;
+        th::future<fhtagn::size_t> f(boost::bind(&gated_future_func, &et));
+
+        CPPUNIT_ASSERT(!f.ready());
+        CPPUNIT_ASSERT(!f.timed_wait(1000));
+
+        et.open_gate();
+        CPPUNIT_ASSERT(f.timed_wait(10000000));
+        CPPUNIT_ASSERT(f.ready());
+        fhtagn::size_t x = f;
+        CPPUNIT_ASSERT_EQUAL(fhtagn::size_t(7), x);
+
+        // Lazily evaluated futures are started by waiting, but not by
+        // checking whether they're ready.
+        th::future<fhtagn::size_t> lazy(&future_func,
+                th::futures::lazy_evaluate());
+        CPPUNIT_ASSERT(!lazy.ready());
+        lazy.wait();
+        CPPUNIT_ASSERT(lazy.ready());
+    }
+
+
+    void testFutureContinuations()
+    {
+        namespace th = fhtagn::threads;
+
+        // Run on the completing thread.
+        {
+            th::future<fhtagn::size_t> f(&future_func);
+            th::future<fhtagn::size_t> g = f.then<fhtagn::size_t>(&add_one);
+            fhtagn::size_t x = g;
+            CPPUNIT_ASSERT_EQUAL(fhtagn::size_t(43), x);
+        }
+
+        // Chained while the first future is still blocked.
+        {
+            executor_test et;
+            th::future<fhtagn::size_t> f(boost::bind(&gated_future_func, &et));
+            th::future<fhtagn::size_t> g = f.then<fhtagn::size_t>(&add_one)
+                .then<fhtagn::size_t>(&add_one);
+            CPPUNIT_ASSERT(!g.ready());
+
+            et.open_gate();
+            fhtagn::size_t x = g;
+            CPPUNIT_ASSERT_EQUAL(fhtagn::size_t(9), x);
+        }
+
+        // Run on an executor, and chained to a future that's ready already.
+        {
+            th::thread_pool_executor exec(2, 16);
+            th::future<fhtagn::size_t> f(&future_func, exec);
+            f.wait();
+            th::future<fhtagn::size_t> g = f.then<fhtagn::size_t>(&add_one,
+                    exec);
+            fhtagn::size_t x = g;
+            CPPUNIT_ASSERT_EQUAL(fhtagn::size_t(43), x);
+        }
+
+        // Continuations start lazily evaluated futures.
+        {
+            th::future<fhtagn::size_t> f(&future_func,
+                    th::futures::lazy_evaluate());
+            th::future<fhtagn::size_t> g = f.then<fhtagn::size_t>(&add_one);
+            CPPUNIT_ASSERT(g.timed_wait(10000000));
+            fhtagn::size_t x = g;
+            CPPUNIT_ASSERT_EQUAL(fhtagn::size_t(43), x);
+        }
+
+        // Exceptions propagate through continuations that read the value.
+        {
+            th::future<fhtagn::size_t> f(&throwing_future_func);
+            th::future<fhtagn::size_t> g = f.then<fhtagn::size_t>(&add_one);
+            fhtagn::size_t x = 0;
+            CPPUNIT_ASSERT_THROW(x = g, th::futures::exception);
+        }
+    }
+
+
+    void testFutureComposition()
+    {
+        namespace th = fhtagn::threads;
+
+        th::thread_pool_executor exec(2, 64);
+
+        // when_all collects all values in order.
+        {
+            std::vector<th::future<fhtagn::size_t> > inputs;
+            for (int i = 0 ; i < 10 ; ++i) {
+                inputs.push_back(th::future<fhtagn::size_t>(&future_func,
+                            exec));
+            }
+
+            th::future<fhtagn::size_t> total = th::when_all(inputs)
+                .then<fhtagn::size_t>(&sum);
+            fhtagn::size_t x = total;
+            CPPUNIT_ASSERT_EQUAL(fhtagn::size_t(420), x);
+
+            std::vector<fhtagn::size_t> values = th::when_all(inputs, exec);
+            CPPUNIT_ASSERT_EQUAL(std::size_t(10), values.size());
+        }
+
+        // ... fails if any of the futures fails ...
+        {
+            std::vector<th::future<fhtagn::size_t> > inputs;
+            inputs.push_back(th::future<fhtagn::size_t>(&future_func, exec));
+            inputs.push_back(th::future<fhtagn::size_t>(&throwing_future_func,
+                        exec));
+
+            th::future<std::vector<fhtagn::size_t> > all = th::when_all(inputs);
+            CPPUNIT_ASSERT(all.timed_wait(10000000));
+            std::vector<fhtagn::size_t> values;
+            CPPUNIT_ASSERT_THROW(values = all, th::futures::exception);
+        }
+
+        // ... and is ready right away for no futures.
+        {
+            std::vector<th::future<fhtagn::size_t> > inputs;
+            th::future<std::vector<fhtagn::size_t> > all = th::when_all(inputs);
+            CPPUNIT_ASSERT(all.ready());
+        }
+
+        // when_any reports the first future to finish.
+        {
+            executor_test et;
+            std::vector<th::future<fhtagn::size_t> > inputs;
+            inputs.push_back(th::future<fhtagn::size_t>(boost::bind(
+                            &gated_future_func, &et)));
+            inputs.push_back(th::future<fhtagn::size_t>(&future_func,
+                        th::futures::lazy_evaluate()));
+
+            th::future<fhtagn::size_t> any = th::when_any(inputs, exec);
+            fhtagn::size_t index = any;
+            CPPUNIT_ASSERT_EQUAL(fhtagn::size_t(1), index);
+
+            et.open_gate();
+        }
+
+        std::vector<th::future<fhtagn::size_t> > none;
+        CPPUNIT_ASSERT_THROW(th::when_any(none), std::logic_error);
+    }
+
+
+    void testFuturePool()
+    {
+        namespace th = fhtagn::threads;
+        namespace mem = fhtagn::memory;
+
+        typedef th::future<fhtagn::size_t> future_t;
+        typedef fhtagn::size_t (*func_t)();
+        typedef mem::block_pool<
+            future_t::state_size<func_t>::value,
+            boost::mutex
+        > pool_t;
+
+        th::thread_pool_executor exec(2, 64);
+
+        char memory[4096];
+        pool_t pool(memory, sizeof(memory));
+
+        // The future's state comes from the pool, and is returned to it once
+        // the last copy of the future is gone.
+        {
+            future_t f(&future_func, exec, pool);
+            CPPUNIT_ASSERT_EQUAL(true, pool.in_use());
+
+            future_t g = f;
+            fhtagn::size_t x = g;
+            CPPUNIT_ASSERT_EQUAL(fhtagn::size_t(42), x);
+
+            f = future_t(&throwing_future_func, exec, pool);
+            CPPUNIT_ASSERT_THROW(x = f, th::futures::exception);
+            x = g;
+            CPPUNIT_ASSERT_EQUAL(fhtagn::size_t(42), x);
+        }
+        CPPUNIT_ASSERT_EQUAL(false, pool.in_use());
+
+        // Same for lazily evaluated futures...
+        {
+            future_t f(&future_func, th::futures::lazy_evaluate(), exec, pool);
+            CPPUNIT_ASSERT_EQUAL(false, f.ready());
+            fhtagn::size_t x = f;
+            CPPUNIT_ASSERT_EQUAL(fhtagn::size_t(42), x);
+        }
+        CPPUNIT_ASSERT_EQUAL(false, pool.in_use());
+
+        // ... and unstarted ones.
+        {
+            future_t f(&future_func, th::futures::lazy_evaluate(), exec, pool);
+        }
+        CPPUNIT_ASSERT_EQUAL(false, pool.in_use());
+
+        // Construction fails if the pool is exhausted.
+        std::vector<void *> blocks;
+        while (void * block = pool.alloc(future_t::state_size<func_t>::value)) {
+            blocks.push_back(block);
+        }
+        CPPUNIT_ASSERT_THROW(future_t(&future_func, exec, pool),
+                std::bad_alloc);
+        for (std::vector<void *>::iterator iter = blocks.begin()
+                ; iter != blocks.end() ; ++iter)
+        {
+            pool.free(*iter);
+        }
+        CPPUNIT_ASSERT_EQUAL(false, pool.in_use());
+    }
+
+
+    void testFutureScope()
+    {
+        namespace th = fhtagn::threads;
+
+        // Futures that are destroyed while their function is still running,
+        // or before it even started, must wait for it. These tests basically
+        // only have to not crash...
+
+        // Function running
+        {
+            executor_test et;
+            boost::thread opener(boost::bind(&open_gate_later, &et));
+            {
+                th::future<fhtagn::size_t> f(gated_string_func(&et,
+                            "a string long enough to live on the heap"));
+            }
+            opener.join();
+        }
+
+        // Function not yet run by the executor
+        {
+            executor_test et;
+            th::thread_pool_executor exec(1, 4);
+            CPPUNIT_ASSERT(exec.submit(boost::bind(&executor_test::gate,
+                            &et)));
+
+            boost::thread opener(boost::bind(&open_gate_later, &et));
+            {
+                th::future<fhtagn::size_t> f(&future_func, exec);
+            }
+            opener.join();
+        }
+
+        // Discarded continuation
+        {
+            executor_test et;
+            boost::thread opener(boost::bind(&open_gate_later, &et));
+            {
+                th::future<fhtagn::size_t> f(boost::bind(&gated_future_func,
+                            &et));
+                f.then<fhtagn::size_t>(&add_one);
+            }
+            opener.join();
+        }
+    }
+
+
+    void testScheduler()
+    {
+        namespace th = fhtagn::threads;
+
+        th::scheduler sched(4);
+        CPPUNIT_ASSERT_EQUAL(fhtagn::size_t(4), sched.threads());
+
+        // Recursive fan-out; children are spawned and joined on the workers.
+        {
+            fan_out_test ft(4);
+            th::scheduler::job_ptr j = sched.spawn(boost::bind(
+                        &fan_out_test::node, &ft, 5, _1));
+            CPPUNIT_ASSERT_EQUAL((int) th::tasklet::FINISHED,
+                    (int) sched.join(j));
+            CPPUNIT_ASSERT_EQUAL(fhtagn::size_t(1024),
+                    th::atomic_load(ft.leaves));
+            CPPUNIT_ASSERT(j->done());
+            CPPUNIT_ASSERT(!j->alive());
+        }
+
+        // Many jobs spawned from outside the workers.
+        {
+            fan_out_test ft(0);
+            std::vector<th::scheduler::job_ptr> jobs;
+            for (int i = 0 ; i < 1000 ; ++i) {
+                jobs.push_back(sched.spawn(boost::bind(&fan_out_test::node,
+                                &ft, 0, _1)));
+            }
+            for (int i = 0 ; i < 1000 ; ++i) {
+                sched.join(jobs[i]);
+            }
+            CPPUNIT_ASSERT_EQUAL(fhtagn::size_t(1000),
+                    th::atomic_load(ft.leaves));
+        }
+
+        // Exceptions abort the job.
+        {
+            th::scheduler::job_ptr j = sched.spawn(&throwing_job);
+            CPPUNIT_ASSERT_EQUAL((int) th::tasklet::ABORTED,
+                    (int) sched.join(j));
+            CPPUNIT_ASSERT_EQUAL(std::string("test_error"), j->error());
+            CPPUNIT_ASSERT(!j->stop());
+        }
+
+        // The destructor runs all outstanding jobs.
+        {
+            fan_out_test ft(8);
+            {
+                th::scheduler s(2);
+                s.spawn(boost::bind(&fan_out_test::node, &ft, 3, _1));
+            }
+            CPPUNIT_ASSERT_EQUAL(fhtagn::size_t(512),
+                    th::atomic_load(ft.leaves));
+        }
+    }
+
+
+    void testSchedulerSleep()
+    {
+        namespace th = fhtagn::threads;
+
+        th::scheduler sched(2);
+
+        // Long-running jobs sleep, wake up and stop just like tasklets.
+        bind_test bt;
+        th::scheduler::job_ptr j = sched.spawn(boost::bind(
+                    &bind_test::counting_member<th::scheduler::job>,
+                    boost::ref(bt), _1));
+
+        while (th::tasklet::SLEEPING != j->get_state());
+
+        CPPUNIT_ASSERT(j->wakeup());
+
+        {
+            boost::mutex::scoped_lock l(bt.wake_mutex);
+            while (0 == bt.wake_count) {
+                bt.wake_condition.wait(l);
+            }
+            CPPUNIT_ASSERT_EQUAL(int(1), bt.wake_count);
+        }
+
+        CPPUNIT_ASSERT(j->stop());
+        CPPUNIT_ASSERT_EQUAL((int) th::tasklet::FINISHED, (int) sched.join(j));
+        CPPUNIT_ASSERT(bt.done);
+        CPPUNIT_ASSERT(!j->wakeup());
+
+        // Timed sleep returns the RUNNING state once the time's up.
+        bt.done = false;
+        j = sched.spawn(boost::bind(&bind_test::sleep_halfsec<
+                    th::scheduler::job>, boost::ref(bt), _1));
+        CPPUNIT_ASSERT_EQUAL((int) th::tasklet::FINISHED, (int) sched.join(j));
+        CPPUNIT_ASSERT(bt.done);
+        CPPUNIT_ASSERT_EQUAL((int) th::tasklet::RUNNING, (int) bt.sleep_state);
+    }
 };
 
 